@@ -477,9 +477,17 @@ CUSTOM_COMMAND_SIG(quick_calc)
 }
 
 // Leader key type thing. Add any other <leader><_> type commands to the switch statement.
+CUSTOM_COMMAND_SIG(system_clipboard_paste)
+{
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    int pos = view.cursor.pos;
+    paste_from_register(app, &buffer, pos, vim_register(reg_system_clipboard));
+}
+
 CUSTOM_COMMAND_SIG(leader_key_query)
 {
-    switch(get_user_input(app, EventOnAnyKey, EventOnEsc).key.keycode)
+    switch(vim_get_user_input(app, EventOnAnyKey, EventOnEsc).key.keycode)
     {
         case ' ':
         {
@@ -497,7 +505,7 @@ CUSTOM_COMMAND_SIG(leader_key_query)
             
             if(original == next)
             {
-                View_Summary new_view = open_view(app, &view, ViewSplit_Right);
+                View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
                 new_view_settings(app, &new_view);
                 view_set_buffer(app, &new_view, view.buffer_id, 0);
             }
@@ -514,6 +522,13 @@ CUSTOM_COMMAND_SIG(leader_key_query)
             reopen(app);
         }
         break;
+        
+        // q is taken by macro recording, so the clipboard paste lives here
+        case 'p':
+        {
+            system_clipboard_paste(app);
+        }
+        break;
     }
 }
 
@@ -527,7 +542,7 @@ CUSTOM_COMMAND_SIG(compile_project)
     
     if(original == next)
     {
-        View_Summary new_view = open_view(app, &view, ViewSplit_Right);
+        View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
         new_view_settings(app, &new_view);
         view_set_buffer(app, &new_view, view.buffer_id, 0);
     }
@@ -541,7 +556,7 @@ CUSTOM_COMMAND_SIG(compile_project)
 // Auto completes an open curly brace in different ways depending on the next key pressed.
 CUSTOM_COMMAND_SIG(curly_command_query)
 {
-    switch(get_user_input(app, EventOnAnyKey, EventOnEsc).key.keycode)
+    switch(vim_get_user_input(app, EventOnAnyKey, EventOnEsc).key.keycode)
     {
         case '\n':
         {
@@ -582,14 +597,6 @@ CUSTOM_COMMAND_SIG(close_open_quote)
     vim_move_left(app);
 }
 
-CUSTOM_COMMAND_SIG(system_clipboard_paste)
-{
-    View_Summary view = get_active_view(app, AccessOpen);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
-    int pos = view.cursor.pos;
-    paste_from_register(app, &buffer, pos, &state.registers[reg_system_clipboard]);
-}
-
 CUSTOM_COMMAND_SIG(auto_todo)
 {
     write_string(app, make_lit_string("// TODO(Luke): "));
@@ -625,17 +632,10 @@ CUSTOM_COMMAND_SIG(seek_next_closing)
     View_Summary view = get_active_view(app, AccessOpen);
     Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
     
-    char cur;
-    int pos = view.cursor.pos;
-    while(pos < buffer.size && 0 < buffer.size)
+    int pos = vim_find_next_closing(app, &buffer, view.cursor.pos);
+    if(pos >= 0)
     {
-        buffer_read_range(app, &buffer, pos, pos + 1, &cur);
-        if(cur == ')' || cur == '}' || cur == '"' || cur == ']' || cur == '"')
-        {
-            view_set_cursor(app, &view, seek_pos(pos + 1), 1);
-            break;
-        }
-        ++pos;
+        view_set_cursor(app, &view, seek_pos(pos + 1), 1);
     }
 }
 
@@ -664,8 +664,8 @@ CUSTOM_COMMAND_SIG(jump_under_cursor)
 CUSTOM_COMMAND_SIG(visual_upper_case)
 {
     View_Summary view = get_active_view(app, AccessOpen);
-    view_set_cursor(app, &view, seek_pos(state.selection_range.end), 1);
-    view_set_mark(app, &view, seek_pos(state.selection_range.start));
+    view_set_cursor(app, &view, seek_pos(modal->selection_range.end), 1);
+    view_set_mark(app, &view, seek_pos(modal->selection_range.start));
     to_uppercase(app);
     enter_normal_mode(app, view.buffer_id);
 }
@@ -673,8 +673,8 @@ CUSTOM_COMMAND_SIG(visual_upper_case)
 CUSTOM_COMMAND_SIG(visual_place_in_scope)
 {
     View_Summary view = get_active_view(app, AccessOpen);
-    view_set_cursor(app, &view, seek_pos(state.selection_range.end), 1);
-    view_set_mark(app, &view, seek_pos(state.selection_range.start));
+    view_set_cursor(app, &view, seek_pos(modal->selection_range.end), 1);
+    view_set_mark(app, &view, seek_pos(modal->selection_range.start));
     place_in_scope(app);
     enter_normal_mode(app, view.buffer_id);
 }
@@ -682,8 +682,8 @@ CUSTOM_COMMAND_SIG(visual_place_in_scope)
 CUSTOM_COMMAND_SIG(visual_surround_brackets)
 {
     View_Summary view = get_active_view(app, AccessOpen);
-    view_set_cursor(app, &view, seek_pos(state.selection_range.end), 1);
-    view_set_mark(app, &view, seek_pos(state.selection_range.start));
+    view_set_cursor(app, &view, seek_pos(modal->selection_range.end), 1);
+    view_set_mark(app, &view, seek_pos(modal->selection_range.start));
     write_string(app, make_lit_string(")"));
     cursor_mark_swap(app);
     write_string(app, make_lit_string("("));
@@ -693,8 +693,8 @@ CUSTOM_COMMAND_SIG(visual_surround_brackets)
 CUSTOM_COMMAND_SIG(visual_replace_in_range)
 {
     View_Summary view = get_active_view(app, AccessOpen);
-    view_set_cursor(app, &view, seek_pos(state.selection_range.end), 1);
-    view_set_mark(app, &view, seek_pos(state.selection_range.start));
+    view_set_cursor(app, &view, seek_pos(modal->selection_range.end), 1);
+    view_set_mark(app, &view, seek_pos(modal->selection_range.start));
     replace_in_range(app);
     enter_normal_mode(app, view.buffer_id);
 }
@@ -705,7 +705,10 @@ void luke_get_bindings(Bind_Helper *context)
     set_start_hook(context, luke_init);
     set_open_file_hook(context, vim_hook_open_file_func);
     set_new_file_hook(context, vim_hook_new_file_func);
+    set_end_file_hook(context, vim_hook_end_file_func);
+    set_file_edit_range_hook(context, vim_hook_file_edit_range_func);
     set_render_caller(context, vim_render_caller);
+    set_command_caller(context, vim_hook_command_caller_func);
     
     // Call to set the vim bindings
     vim_get_bindings(context);
@@ -714,9 +717,9 @@ void luke_get_bindings(Bind_Helper *context)
     // here that will apply in the appropriate map:
     
     begin_map(context, mapid_movements);
-    // For example, I forget to hit shift a lot when typing commands. Since
-    // semicolon doesn't do much useful in vim by default, I bind it to the
-    // same command that colon itself does.
+    // For example, I forget to hit shift a lot when typing commands, so I
+    // give up semicolon's repeat of the last f/t/F/T and bind it to the same
+    // command that colon itself does. Comma still repeats the other way.
     bind(context, ';', MDFR_NONE, status_command);
     bind(context, 'j', MDFR_CTRL, vim_move_whitespace_down);
     bind(context, 'k', MDFR_CTRL, vim_move_whitespace_up);
@@ -740,9 +743,8 @@ void luke_get_bindings(Bind_Helper *context)
     
     begin_map(context, mapid_normal);
     bind(context, ' ', MDFR_NONE, leader_key_query);
-    bind(context, 'q', MDFR_NONE, system_clipboard_paste);
     bind(context, 's', MDFR_NONE, quick_calc);
-    bind(context, '1', MDFR_NONE, compile_project);
+    bind(context, key_f5, MDFR_NONE, compile_project);
     end_map(context);
     
     begin_map(context, mapid_visual);
@@ -765,6 +767,12 @@ void luke_get_bindings(Bind_Helper *context)
     
     // TODO(chr): Make the statusbar commands more intelligent
     //  so that this isn't an issue.
+    
+    // Extra words to highlight next to TODO and NOTE:
+    vim_define_highlight_keyword(make_lit_string("HACK"), SymbolicColorFromPalette(Stag_Text_Cycle_3));
+    vim_define_highlight_keyword(make_lit_string("FIXME"), SymbolicColorFromPalette(Stag_Text_Cycle_1));
+    vim_define_highlight_keyword(make_lit_string("BUG"), SymbolicColorFromPalette(Stag_Text_Cycle_1));
+    vim_define_highlight_keyword(make_lit_string("PERF"), SymbolicColorFromPalette(Stag_Text_Cycle_4));
 }
 
 extern "C" int
@@ -14,6 +14,11 @@
 //     - In your start hook, call vim_hook_init_func(app)
 //     - In your open file hook, call vim_hook_open_file_func(app, buffer_id)
 //     - In your new file hook, call vim_hook_new_file_func(app, buffer_id)
+//     - In your end file hook, call vim_hook_end_file_func(app, buffer_id)
+//     - In your file edit range hook, call
+//       vim_hook_file_edit_range_func(app, buffer_id, range, text)
+//     - In your render caller, call vim_render_caller(...)
+//     - In your command caller, call vim_hook_command_caller_func(app, cmd)
 //     - In your get bindings hook, call vim_get_bindings(context)
 //
 // 2. Define the following functions:
@@ -44,16 +49,17 @@ void on_enter_visual_mode(struct Application_Links* app);
 //  - Range reformatting gq
 //    - v1: comment wrapping
 //  - Autocomment on new line
-//  - Support some basic vim variables via set
-//  - Visual block mode
 //  - Code folding?
 //
 //=============================================================================
 
 #include <assert.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 //=============================================================================
 // > Types <
@@ -73,12 +79,15 @@ enum Vim_Maps {
     // different behaviors. 
 
     mapid_chord_replace_single,
+    mapid_chord_visual_replace,
     mapid_chord_yank,
     mapid_chord_delete,
     mapid_chord_indent_left,
     mapid_chord_indent_right,
     mapid_chord_format,
     mapid_chord_mark,
+    mapid_chord_mark_jump_line,
+    mapid_chord_mark_jump,
     mapid_chord_g,
     mapid_chord_window,
     mapid_chord_choose_register,
@@ -87,6 +96,9 @@ enum Vim_Maps {
     mapid_chord_move_rfind,
     mapid_chord_move_rtil,
     mapid_chord_move_in,
+    mapid_chord_move_around,
+    mapid_chord_macro_record,
+    mapid_chord_macro_replay,
 };
 
 enum Vim_Mode {
@@ -95,6 +107,7 @@ enum Vim_Mode {
     mode_replace,
     mode_visual,
     mode_visual_line,
+    mode_visual_block,
 };
 
 enum Pending_Action {
@@ -108,9 +121,26 @@ enum Pending_Action {
     vimaction_indent_right_range,
 };
 
+// A block of register text from the register store (see Registers).
+#define VIM_REGISTER_CHUNK_SIZE (4 << 10)
+
+struct Vim_Register_Chunk {
+    Vim_Register_Chunk* next;
+    int size;
+    char text[VIM_REGISTER_CHUNK_SIZE - 16];
+};
+
 struct Vim_Register {
-    String text;
+    // The text, as a list of chunks that are full but for the last one.
+    Vim_Register_Chunk* first;
+    Vim_Register_Chunk* last;
+    int size;
+    int chunk_count;
     bool is_line;
+    // Holds a visual block, one line of it per line of text.
+    bool is_block;
+    // Holds macro events (see Macros) rather than text.
+    bool is_macro;
 };
 
 enum Register_Id {
@@ -119,7 +149,10 @@ enum Register_Id {
     reg_a, reg_b, reg_c, reg_d, reg_e, reg_f, reg_g, reg_h, reg_i, 
     reg_j, reg_k, reg_l, reg_m, reg_n, reg_o, reg_p, reg_q, reg_r, 
     reg_s, reg_t, reg_u, reg_v, reg_w, reg_x, reg_y, reg_z,
-    reg_1, reg_2, reg_3, reg_4, reg_5, reg_6, reg_7, reg_8, reg_9, reg_0 
+    reg_1, reg_2, reg_3, reg_4, reg_5, reg_6, reg_7, reg_8, reg_9, reg_0,
+    // Deletes within a line, as "- in vim.
+    reg_small_delete,
+    reg_count
 };
 
 Register_Id regid_from_char(Key_Code C) {
@@ -137,6 +170,7 @@ Register_Id regid_from_char(Key_Code C) {
     if (C == '0') { return reg_0; }
 
     if (C == '*') { return reg_system_clipboard; }
+    if (C == '-') { return reg_small_delete; }
 
     return reg_unnamed;
 }
@@ -159,25 +193,86 @@ struct Vim_Query_Bar {
     int contents_len;
 };
 
-struct Vim_State {
-    // 37 clipboard registers:
-    //  - 1 unnamed
-    //  - 1 sysclipboard
-    //  - 26 letters
-    //  - 10 numbers
-    Vim_Register registers[38];
+// The last change, for '.' to repeat. It keeps what the change did (operator,
+// motion, count, register, typed text) rather than the keys that did it, so
+// repeating it never goes back through the keymaps.
+enum Vim_Change_Kind {
+    change_none,
+    // An operator over a motion, as in d3w or cc.
+    change_operator,
+    // A command that edits by itself, as in x or p.
+    change_command,
+    // Text typed after i, a, A, o or O.
+    change_insert,
+};
 
-    // 36 Mark offsets:
-    //  - 26 letters
-    //  - 10 numbers
-    int marks[36];
+enum Vim_Insert_Entry {
+    insert_entry_at_cursor,
+    insert_entry_after_cursor,
+    insert_entry_end_of_line,
+    insert_entry_line_below,
+    insert_entry_line_above,
+};
+
+struct Vim_Change {
+    Vim_Change_Kind kind;
+    Pending_Action action;
+    // The motion for change_operator, the command itself for change_command.
+    Custom_Command_Function* command;
+    // The character a motion read, as in dtx.
+    Key_Code character;
+    // 0 if no count was typed.
+    int count;
+    Register_Id reg;
+    Vim_Insert_Entry entry;
+    // What was typed in insert mode afterwards, for change_insert and the c
+    // operator.
+    char* text;
+    int text_size;
+    int text_capacity;
+};
 
+// Follows the text typed into the buffer during an insert that '.' can repeat.
+struct Vim_Insert_Capture {
+    bool active;
+    Buffer_ID buffer_id;
+    // Where the typed text starts, or -1 before anything has been typed.
+    int start;
+};
+
+// I, A or c in visual block mode: what is typed on the block's first line goes
+// onto the others when insert mode ends.
+struct Vim_Block_Insert {
+    bool active;
+    Buffer_ID buffer_id;
+    int first_line;
+    int last_line;
+    int column;
+    // Lines shorter than column get spaces up to it, rather than being skipped.
+    bool pad;
+    // Per line after the first, whether it gets the text. Malloc'd.
+    uint8_t* fill;
+};
+
+// What each view keeps to itself: its mode, the command being typed in it, its
+// selection and its chord bar. A view keeps these while it is inactive and
+// picks up where it left off when it is active again.
+struct Vim_Modal_State {
 	// The *current* vim mode. If a chord or action is pending, this will dictate
     // what mode you return to once the action is completed.
     Vim_Mode mode;
+    // The keymap the view's buffer had when the view was last active.
+    int keymap;
 	// A pending action. Used to keep track of intended edits while in the middle
 	// of chords.
     Pending_Action action;
+    // The count typed in front of a command, as in 5j. Zero if none was typed.
+    // Once an operator starts, the count typed before it moves to action_count
+    // and multiplies whatever is typed after it (2d3w deletes six words).
+    int count;
+    int action_count;
+    // The count the last motion ran with (0 if none was typed), for '.'.
+    int count_taken;
     // The current register. Union for convenience (and to make it clear that
 	// only one of these things can be happening at once).
     union {
@@ -185,6 +280,11 @@ struct Vim_State {
         Register_Id yank_register;
         Register_Id paste_register;
     };
+    // Set by "A to "Z, which append to their lowercase register.
+    bool register_append;
+    // The buffer the three ranges below are in: the view's buffer when the
+    // view was last active. Edits to it move them along.
+    Buffer_ID buffer_id;
     // The state of the selection:
     //  - start is where the selection was started
     //  - end is where the cursor is during the selection
@@ -193,12 +293,45 @@ struct Vim_State {
     //  - normalized range which should be used for cut/copy
     //    operations
     Range selection_range;
+    // The last visual selection, for the '< and '> ex addresses.
+    Range last_visual_range;
 
-    // TODO(chr): Actually there needs to be one of these per file!
-    // Until I can use the GUI customization to make my own, anyway.
     Vim_Query_Bar chord_bar;
+};
+
+// What every view shares. Registers, marks, the last search and the last
+// change follow you from view to view, as in vim.
+struct Vim_State {
+    // 39 clipboard registers:
+    //  - 1 unnamed
+    //  - 1 sysclipboard
+    //  - 26 letters
+    //  - 10 numbers
+    //  - 1 small delete
+    // Read them through vim_register, which resolves the unnamed register
+    // and the rotation of "1 to "9.
+    Vim_Register registers[reg_count];
+    // The register "" reads: whichever one was written last.
+    Register_Id unnamed_target;
+    // Slot of "1 among the nine numbered ones; a delete rotates it.
+    int numbered_first;
 
     Search_Context last_search;
+    // Set by :nohlsearch and cleared by the next search, as in vim.
+    bool search_highlight_hidden;
+
+    Vim_Change last_change;
+    Vim_Insert_Capture insert_capture;
+    Vim_Block_Insert block_insert;
+    // Set while '.' replays last_change. Nothing is recorded meanwhile and the
+    // c operator puts back the recorded text instead of entering insert mode.
+    bool replaying;
+    // The character the last f/t/F/T read.
+    Key_Code motion_character;
+    // The last f/t/F/T, for ; and ,. find_character is 0 until one has run.
+    char find_character;
+    Search_Direction find_direction;
+    bool find_til;
 };
 
 #define VIM_COMMAND_FUNC_SIG(n) void n(struct Application_Links *app,         \
@@ -212,16 +345,73 @@ struct Vim_Command_Defn {
     Vim_Command_Func* func;
 };
 
+// A line range typed in front of a status command, as in :%s or :10,20s.
+struct Vim_Ex_Range {
+    bool given;
+    // 1-based and inclusive.
+    int first_line;
+    int last_line;
+};
+
 //=============================================================================
 // > Global Variables <
 // I hope I can use 4coder's API to avoid having these eventually.
 //=============================================================================
 
 static Vim_State state = {};
+// The active view's modal state, kept in its Vim_View_State and found again by
+// vim_sync_active_view when another view becomes active. Until the first view
+// has one, it is initial_modal.
+static Vim_Modal_State vim_make_modal_state() {
+    // A new view starts out in normal mode with nothing pending.
+    Vim_Modal_State result = {};
+    result.mode = mode_normal;
+    result.keymap = mapid_normal;
+    result.yank_register = reg_unnamed;
+    result.selection_cursor = make_range(-1, -1);
+    result.selection_range = make_range(-1, -1);
+    result.last_visual_range = make_range(-1, -1);
+    return result;
+}
+static Vim_Modal_State initial_modal = vim_make_modal_state();
+static Vim_Modal_State* modal = &initial_modal;
+static View_ID modal_view_id = 0;
 
 // TODO(chr): Make these be dynamic and be a hashtable
 static Vim_Command_Defn defined_commands[512];
 static int defined_command_count = 0;
+// The range the running status command was given. Commands that take a range
+// read it; when none was typed it covers the cursor line.
+static Vim_Ex_Range command_range;
+
+// Move to the nearest match while a / or ? pattern is still being typed.
+static bool vim_incsearch = true;
+// Highlight every visible match of the last search.
+static bool vim_hlsearch = true;
+// f, t, F and T stop at the end of the cursor line.
+static bool vim_find_in_line = true;
+// Columns that one > or < moves a line's indentation by.
+static int vim_shiftwidth = 4;
+// Columns between tab stops, for measuring and writing indentation.
+static int vim_tabstop = 4;
+// > and < write indentation as spaces rather than tabs.
+static bool vim_expandtab = true;
+
+// What :set can change. An option has either a flag or a number.
+struct Vim_Option {
+    const char* name;
+    const char* short_name;
+    bool* flag;
+    int* number;
+};
+
+static Vim_Option vim_options[] = {
+    { "incsearch",  "is",  &vim_incsearch, nullptr },
+    { "hlsearch",   "hls", &vim_hlsearch,  nullptr },
+    { "expandtab",  "et",  &vim_expandtab, nullptr },
+    { "shiftwidth", "sw",  nullptr,        &vim_shiftwidth },
+    { "tabstop",    "ts",  nullptr,        &vim_tabstop },
+};
 
 //=============================================================================
 // > Helpers <                                                         @helpers
@@ -241,471 +431,2503 @@ struct _Defer {
 };
 #define defer(s) _Defer defer##__LINE__([&] { s; })
 
-// Iterate over views:                                               @for_views
-#define for_views(view, app)                                                  \
-    for (View_Summary view = get_view_first(app, AccessAll);                  \
-         view.exists;                                                         \
-         get_view_next(app, &view, AccessAll))
+// Growable arrays:                                                    @array
+// Plain malloc-backed arrays for the per-buffer and per-view indices.
+template <typename T>
+struct Vim_Array {
+    T* items;
+    int count;
+    int capacity;
+};
 
-// Linux specific magic to deal with ~ expansion
-#if defined(IS_LINUX)
-#include <pwd.h>
-#include <unistd.h>
-#endif
+template <typename T>
+static bool vim_array_reserve(Vim_Array<T>* array, int capacity) {
+    if (capacity <= array->capacity) { return true; }
+    int new_capacity = array->capacity ? array->capacity : 16;
+    while (new_capacity < capacity) { new_capacity *= 2; }
+    T* items = (T*)realloc(array->items, sizeof(T)*new_capacity);
+    if (items == nullptr) { return false; }
+    array->items = items;
+    array->capacity = new_capacity;
+    return true;
+}
 
-static int32_t get_user_home_dir(char* out, int32_t out_mem_size) {
-#if defined(IS_LINUX)
-    uid_t uid = getuid();
-    struct passwd *pw = getpwuid(uid);
-    int32_t homedir_len = strlen(pw->pw_dir);
-    if (homedir_len <= out_mem_size && out != nullptr) {
-        strncpy(out, pw->pw_dir, homedir_len);
+// Opens a gap of count uninitialized items at index and returns it.
+template <typename T>
+static T* vim_array_insert(Vim_Array<T>* array, int index, int count) {
+    if (!vim_array_reserve(array, array->count + count)) { return nullptr; }
+    if (index < array->count) {
+        memmove(array->items + index + count, array->items + index,
+                sizeof(T)*(array->count - index));
     }
-    return homedir_len;
-#else
-    return -1;
-#endif
+    array->count += count;
+    return array->items + index;
 }
 
-namespace {
+template <typename T>
+static T* vim_array_push(Vim_Array<T>* array, T item) {
+    T* slot = vim_array_insert(array, array->count, 1);
+    if (slot) { *slot = item; }
+    return slot;
+}
 
-// Forward declare these for ease of use since they call between each other
-static void enter_normal_mode(struct Application_Links *app, int buffer_id);
-static void enter_insert_mode(struct Application_Links *app, int buffer_id);
-static void update_visual_range(struct Application_Links* app, int end_new);
-static void update_visual_line_range(struct Application_Links* app,
-                                     int end_new);
-static void end_visual_selection(struct Application_Links* app);
-static void copy_into_register(struct Application_Links* app,
-                               Buffer_Summary* buffer, Range range,
-                               Vim_Register* target_register);
-static bool active_view_to_line(struct Application_Links* app, int line);
-static int get_line_start(struct Application_Links* app, int cursor = -1);
-static int get_cursor_pos(struct Application_Links* app);
-static char get_cursor_char(struct Application_Links* app, int offset = 0);
-static void push_to_chord_bar(struct Application_Links* app, const String str);
-static void end_chord_bar(struct Application_Links* app);
-static void clear_register_selection();
-static void vim_exec_action(struct Application_Links* app, Range range,
-                            bool is_line = false);
+template <typename T>
+static void vim_array_remove(Vim_Array<T>* array, int index, int count) {
+    if (count <= 0) { return; }
+    memmove(array->items + index, array->items + index + count,
+            sizeof(T)*(array->count - index - count));
+    array->count -= count;
+}
 
-static bool directory_cd_expand_user(
-    struct Application_Links* app,
-    char* dir_str,
-    int32_t* dir_len,
-    int32_t dir_capacity,
-    char* rel_path,
-    int32_t rel_len) {
-    if (rel_len > 0 && rel_path[0] == '~') {
-        int32_t home_dir_len = get_user_home_dir(nullptr, 0);
-        int32_t expanded_len = home_dir_len + (rel_len - 1);
-        if (expanded_len > dir_capacity) { return false; }
-        get_user_home_dir(dir_str, dir_capacity);
-        String dir = make_string_cap(dir_str, home_dir_len, dir_capacity);
-        append_ss(&dir, make_string(rel_path + 1, rel_len - 1));
-        *dir_len = dir.size;
-        return true;
-    } else {
-        return directory_cd(app, dir_str, dir_len, dir_capacity, rel_path, rel_len);
-    }
+template <typename T>
+static void vim_array_free(Vim_Array<T>* array) {
+    free(array->items);
+    array->items = nullptr;
+    array->count = array->capacity = 0;
 }
 
-static void enter_insert_mode(struct Application_Links *app, int buffer_id) {
-    unsigned int access = AccessAll;
-    Buffer_Summary buffer;
-    
-    if (state.mode == mode_visual ||
-        state.mode == mode_visual_line) {
-        end_visual_selection(app);
+// Index of the first item >= value in a sorted int array.
+static int vim_lower_bound(const int* items, int count, int value) {
+    int first = 0;
+    while (count > 0) {
+        int half = count/2;
+        if (items[first + half] < value) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
     }
+    return first;
+}
 
-    state.action = vimaction_none;
-    state.mode = mode_insert;
-    end_chord_bar(app);
+// Id tables:                                                          @table
+// Open-addressed map from a 4coder id (buffer or view, never 0) to a
+// zero-initialized record owned by the table.
+template <typename T>
+struct Vim_Id_Table {
+    int32_t* keys;
+    T** values;
+    int capacity;
+    int count;
+};
 
-    buffer = get_buffer(app, buffer_id, access);
-    buffer_set_setting(app, &buffer, BufferSetting_MapID, mapid_insert);
+template <typename T>
+static int vim_table_slot(Vim_Id_Table<T>* table, int32_t id) {
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t slot = ((uint32_t)id*2654435761u) & mask;
+    while (table->keys[slot] != 0 && table->keys[slot] != id) {
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
 
-    on_enter_insert_mode(app);
+template <typename T>
+static T* vim_table_get(Vim_Id_Table<T>* table, int32_t id) {
+    if (table->capacity == 0 || id == 0) { return nullptr; }
+    int slot = vim_table_slot(table, id);
+    return table->keys[slot] == id ? table->values[slot] : nullptr;
 }
 
-static void copy_into_register(struct Application_Links* app,
-                               Buffer_Summary* buffer, Range range,
-                               Vim_Register* target_register) {
-    free(target_register->text.str);
-    target_register->text = make_string((char*)malloc(range.end - range.start), range.end - range.start);
-    buffer_read_range(app, buffer, range.start, range.end, target_register->text.str);
-    if (target_register == &state.registers[reg_system_clipboard]) {
-        clipboard_post(app, 0, target_register->text.str, target_register->text.size);
+template <typename T>
+static T* vim_table_get_or_create(Vim_Id_Table<T>* table, int32_t id) {
+    if (id == 0) { return nullptr; }
+    T* existing = vim_table_get(table, id);
+    if (existing) { return existing; }
+
+    if ((table->count + 1)*4 > table->capacity*3) {
+        Vim_Id_Table<T> old = *table;
+        table->capacity = old.capacity ? old.capacity*2 : 32;
+        table->keys = (int32_t*)calloc(table->capacity, sizeof(int32_t));
+        table->values = (T**)calloc(table->capacity, sizeof(T*));
+        for (int i = 0; i < old.capacity; ++i) {
+            if (old.keys[i] == 0) { continue; }
+            int slot = vim_table_slot(table, old.keys[i]);
+            table->keys[slot] = old.keys[i];
+            table->values[slot] = old.values[i];
+        }
+        free(old.keys);
+        free(old.values);
     }
+
+    int slot = vim_table_slot(table, id);
+    table->keys[slot] = id;
+    table->values[slot] = (T*)calloc(1, sizeof(T));
+    table->count += 1;
+    return table->values[slot];
 }
 
-static void paste_from_register(struct Application_Links* app,
-							    Buffer_Summary* buffer, int paste_pos,
-								Vim_Register* reg) {
-	if (reg == &state.registers[reg_system_clipboard]) {
-		free(reg->text.str);
-		int clipboard_text_size = clipboard_index(app, 0, 0, NULL, 0);
-		reg->text = make_string((char*)malloc(clipboard_text_size), clipboard_text_size);
-		clipboard_index(app, 0, 0, reg->text.str, reg->text.size);
-	}
-    buffer_replace_range(app, buffer, paste_pos, paste_pos,
-                         reg->text.str, reg->text.size);
+// Unlinks the record for id and hands it back for the caller to release.
+template <typename T>
+static T* vim_table_remove(Vim_Id_Table<T>* table, int32_t id) {
+    if (table->capacity == 0 || id == 0) { return nullptr; }
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t slot = (uint32_t)vim_table_slot(table, id);
+    if (table->keys[slot] != id) { return nullptr; }
+    T* value = table->values[slot];
+    table->keys[slot] = 0;
+    table->values[slot] = nullptr;
+    table->count -= 1;
+    // Backward-shift the rest of the probe run so lookups never stop early.
+    uint32_t next = (slot + 1) & mask;
+    while (table->keys[next] != 0) {
+        int32_t key = table->keys[next];
+        T* moved = table->values[next];
+        table->keys[next] = 0;
+        table->values[next] = nullptr;
+        int home = vim_table_slot(table, key);
+        table->keys[home] = key;
+        table->values[home] = moved;
+        next = (next + 1) & mask;
+    }
+    return value;
 }
 
-static void buffer_search(struct Application_Links* app, String word,
-                          View_Summary view, Search_Direction direction) {
-    const auto& buffer_seek_func =
-        (direction == search_forward ? buffer_seek_string_forward :
-         buffer_seek_string_backward);
+// Position rings:                                                     @ring
+// Fixed-capacity histories of buffer positions, oldest first, for the jump
+// and change lists. A full ring drops its oldest entry to take a new one. The
+// owner moves the positions along with edits, as it does its other caches.
+#define VIM_RING_CAPACITY 100
 
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
-    int start_pos = view.cursor.pos;
-    int new_pos = start_pos;
+struct Vim_Position {
+    Buffer_ID buffer_id;
+    int pos;
+};
 
-    buffer_seek_func(app, &buffer, view.cursor.pos + direction, 0, word.str,
-                     word.size, &new_pos);
-    if (new_pos < buffer.size && new_pos >= 0) {
-        view_set_cursor(app, &view, seek_pos(new_pos), true);
-    } else {
-        int wrap = (direction == search_forward ? 0 : buffer.size - 1);
-        buffer_seek_func(app, &buffer, wrap, 0, word.str, word.size, &new_pos);
-        if (new_pos < buffer.size && new_pos >= 0) {
-            view_set_cursor(app, &view, seek_pos(new_pos), true);
-        }
-    }
-    refresh_view(app, &view);
-    int actual_new_cursor_pos = view.cursor.pos;
-    // Update last_search
-    state.last_search.direction = direction;
-    state.last_search.text = make_fixed_width_string(
-        state.last_search.text_buffer);
-    append_checked_ss(&state.last_search.text, word);
-    // Do the motion
-    vim_exec_action(app, make_range(start_pos, actual_new_cursor_pos), false);
+struct Vim_Position_Ring {
+    Vim_Position items[VIM_RING_CAPACITY];
+    // items[first] is the oldest entry.
+    int first;
+    int count;
+    // How far back ^O or g; has walked; count when at the newest end.
+    int at;
+};
+
+static Vim_Position* vim_ring_get(Vim_Position_Ring* ring, int i) {
+    return ring->items + (ring->first + i) % VIM_RING_CAPACITY;
 }
 
-static bool active_view_to_line(struct Application_Links* app, int line) {
-    View_Summary view = get_active_view(app, AccessProtected);
-    if (!view.exists) return false;
-    if (!view_set_cursor(app, &view, seek_line_char(line, 0), false)) {
-        return false;
+static void vim_ring_push(Vim_Position_Ring* ring, Vim_Position position) {
+    if (ring->count == VIM_RING_CAPACITY) {
+        ring->first = (ring->first + 1) % VIM_RING_CAPACITY;
+        ring->count -= 1;
     }
-    return true;
+    *vim_ring_get(ring, ring->count++) = position;
+    ring->at = ring->count;
 }
 
-static int get_current_view_buffer_id(struct Application_Links* app,
-                                      int access) {
-    View_Summary view = get_active_view(app, access);
-    return view.buffer_id;
+// Drops the entries in buffer_id that lie in [min, max]. Walking starts over.
+static void vim_ring_remove_range(Vim_Position_Ring* ring, Buffer_ID buffer_id,
+                                  int min, int max) {
+    int kept = 0;
+    for (int i = 0; i < ring->count; ++i) {
+        Vim_Position entry = *vim_ring_get(ring, i);
+        if (entry.buffer_id == buffer_id && min <= entry.pos && entry.pos <= max) {
+            continue;
+        }
+        *vim_ring_get(ring, kept++) = entry;
+    }
+    ring->count = kept;
+    ring->at = kept;
 }
 
-static void set_current_keymap(struct Application_Links* app, int map) {
-    View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
-    if (!buffer.exists) { return; }
-    buffer_set_setting(app, &buffer, BufferSetting_MapID, map);
+static void vim_ring_on_edit(Vim_Position_Ring* ring, Buffer_ID buffer_id,
+                             int start, int end, int text_size) {
+    int delta = text_size - (end - start);
+    for (int i = 0; i < ring->count; ++i) {
+        Vim_Position* entry = vim_ring_get(ring, i);
+        if (entry->buffer_id != buffer_id) { continue; }
+        if (entry->pos >= end) { entry->pos += delta; }
+        else if (entry->pos > start) { entry->pos = start; }
+    }
 }
 
-static char get_cursor_char(struct Application_Links* app, int offset) {
-    View_Summary view = get_active_view(app, AccessOpen);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
-    char read; 
-    int res = buffer_read_range(app, &buffer, view.cursor.pos + offset,
-								view.cursor.pos + offset + 1, &read);
-    if (res) { return read; }
-    else { return 0; }
+// Register store:                                                 @registers
+// Register text lives in fixed-size chunks shared through one free list, so a
+// yank or delete reuses the chunks a register gave up rather than going back
+// to malloc, and "Ayy adds to the last chunk without copying what is there.
+// "1 to "9 are a ring of slots: a delete moves numbered_first back by one, so
+// the old "9 becomes the new "1 and nothing is copied along. The one exception
+// to fixed-size chunks is a whole chunk, which holds more than a chunk's worth
+// of text in one piece for "*, since 4coder takes and hands out clipboard text
+// in one piece. It is malloc'd to fit, is only ever a register's first chunk
+// and never goes to the free list.
+#define VIM_REGISTER_CHUNK_TEXT ((int)sizeof(((Vim_Register_Chunk*)0)->text))
+// Free chunks kept for reuse, 1MB worth. Past that they go back to malloc.
+#define VIM_REGISTER_POOL_MAX 256
+
+struct Vim_Register_Stats {
+    uint64_t chunk_allocations;
+    uint64_t chunk_frees;
+    uint64_t writes;
+    uint64_t appends;
+    uint64_t rotations;
+};
+
+static Vim_Register_Chunk* register_free_chunks = nullptr;
+static int register_free_count = 0;
+static Vim_Register_Stats register_stats = {};
+
+// The register id names, after "" and the numbered ring are resolved.
+static Vim_Register* vim_register(Register_Id id) {
+    if (id == reg_unnamed) { id = state.unnamed_target; }
+    if (reg_1 <= id && id <= reg_9) {
+        id = (Register_Id)(reg_1 + (id - reg_1 + state.numbered_first) % 9);
+    }
+    return state.registers + id;
 }
 
-static int get_cursor_pos(struct Application_Links* app) {
-    View_Summary view = get_active_view(app, AccessAll);
-    return view.cursor.pos;
+static bool vim_register_chunk_is_whole(Vim_Register_Chunk* chunk) {
+    return chunk->size > VIM_REGISTER_CHUNK_TEXT;
 }
 
-static int get_line_start(struct Application_Links* app, int cursor) {
-    unsigned int access = AccessAll;
-    View_Summary view = get_active_view(app, access);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, access);
-    if (cursor == -1) {
-        cursor = view.cursor.pos;
+static void vim_register_clear(Vim_Register* reg) {
+    if (reg->first && !vim_register_chunk_is_whole(reg->first) &&
+        register_free_count + reg->chunk_count <= VIM_REGISTER_POOL_MAX) {
+        reg->last->next = register_free_chunks;
+        register_free_chunks = reg->first;
+        register_free_count += reg->chunk_count;
+    } else {
+        Vim_Register_Chunk* chunk = reg->first;
+        while (chunk) {
+            Vim_Register_Chunk* next = chunk->next;
+            if (register_free_count < VIM_REGISTER_POOL_MAX &&
+                !vim_register_chunk_is_whole(chunk)) {
+                chunk->next = register_free_chunks;
+                register_free_chunks = chunk;
+                register_free_count += 1;
+            } else {
+                free(chunk);
+                register_stats.chunk_frees += 1;
+            }
+            chunk = next;
+        }
     }
-    
-    int new_pos = seek_line_beginning(app, &buffer, cursor);
-    return new_pos;
+    reg->first = reg->last = nullptr;
+    reg->size = 0;
+    reg->chunk_count = 0;
 }
 
-static int get_line_end(struct Application_Links* app, int cursor = -1) {
-    unsigned int access = AccessAll;
-    View_Summary view = get_active_view(app, access);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, access);
-    if (cursor == -1) {
-        cursor = view.cursor.pos;
+// Claims up to *size bytes at the end of reg, taking a chunk if the last one
+// is full. Sets *size to what was claimed; returns nullptr when out of memory.
+static char* vim_register_extend(Vim_Register* reg, int* size) {
+    if (reg->last == nullptr || reg->last->size >= VIM_REGISTER_CHUNK_TEXT) {
+        Vim_Register_Chunk* chunk = register_free_chunks;
+        if (chunk) {
+            register_free_chunks = chunk->next;
+            register_free_count -= 1;
+        } else {
+            chunk = (Vim_Register_Chunk*)malloc(sizeof(Vim_Register_Chunk));
+            if (chunk == nullptr) { return nullptr; }
+            register_stats.chunk_allocations += 1;
+        }
+        chunk->next = nullptr;
+        chunk->size = 0;
+        if (reg->last) { reg->last->next = chunk; }
+        else { reg->first = chunk; }
+        reg->last = chunk;
+        reg->chunk_count += 1;
     }
-    
-    int new_pos = seek_line_end(app, &buffer, cursor);
-    return new_pos;
+    Vim_Register_Chunk* last = reg->last;
+    if (*size > VIM_REGISTER_CHUNK_TEXT - last->size) {
+        *size = VIM_REGISTER_CHUNK_TEXT - last->size;
+    }
+    char* dest = last->text + last->size;
+    last->size += *size;
+    reg->size += *size;
+    return dest;
 }
 
-static void update_visual_range(struct Application_Links* app, int end_new) {
-    View_Summary view;
-    
-    unsigned int access = AccessOpen;
-    view = get_active_view(app, access);
-
-    state.selection_cursor.end = end_new;
-    Range normalized = make_range(state.selection_cursor.start, state.selection_cursor.end);
-    state.selection_range = make_range(normalized.start, normalized.end + 1);
+// A chunk with room for size bytes in one piece, size set, for the caller to
+// fill and give to vim_register_set_whole. nullptr when out of memory.
+static Vim_Register_Chunk* vim_register_alloc_whole(int size) {
+    size_t bytes = sizeof(Vim_Register_Chunk);
+    if (size > VIM_REGISTER_CHUNK_TEXT) {
+        bytes = offsetof(Vim_Register_Chunk, text) + (size_t)size;
+    }
+    Vim_Register_Chunk* chunk = (Vim_Register_Chunk*)malloc(bytes);
+    if (chunk == nullptr) { return nullptr; }
+    register_stats.chunk_allocations += 1;
+    chunk->next = nullptr;
+    chunk->size = size;
+    return chunk;
 }
 
-static void update_visual_line_range(struct Application_Links* app, int end_new) {
-    View_Summary view;
-    
-    unsigned int access = AccessOpen;
-    view = get_active_view(app, access);
-
-    state.selection_cursor.end = end_new;
-    Range normalized = make_range(state.selection_cursor.start, state.selection_cursor.end);
-    state.selection_range = make_range(get_line_start(app, normalized.start), 
-                                       get_line_end(app, normalized.end) + 1);
+// Makes chunk, from vim_register_alloc_whole, all of reg's text.
+static void vim_register_set_whole(Vim_Register* reg, Vim_Register_Chunk* chunk) {
+    vim_register_clear(reg);
+    reg->first = reg->last = chunk;
+    reg->size = chunk->size;
+    reg->chunk_count = 1;
 }
 
-static void end_visual_selection(struct Application_Links* app) {
-    View_Summary view;
-    
-    unsigned int access = AccessOpen;
-    view = get_active_view(app, access);
-
-    state.selection_range.start = state.selection_range.end = -1;
-    state.selection_cursor.start = state.selection_cursor.end = -1;
+static bool vim_register_append_text(Vim_Register* reg, const char* text, int size) {
+    while (size > 0) {
+        int claimed = size;
+        char* dest = vim_register_extend(reg, &claimed);
+        if (dest == nullptr) { return false; }
+        memcpy(dest, text, claimed);
+        text += claimed;
+        size -= claimed;
+    }
+    return true;
 }
 
-static int push_to_string(char* str, size_t str_len, size_t str_max,
-                          char* dest, size_t dest_len) {
-    int i = 0;
-    for (i; i < dest_len && i < (str_max - str_len); ++i)
-    {
-        str[str_len + i] = dest[i];
+// Reads [start, end) of buffer straight into the register's chunks.
+static bool vim_register_append_range(struct Application_Links* app,
+                                      Buffer_Summary* buffer, Vim_Register* reg,
+                                      int start, int end) {
+    while (start < end) {
+        int claimed = end - start;
+        char* dest = vim_register_extend(reg, &claimed);
+        if (dest == nullptr) { return false; }
+        buffer_read_range(app, buffer, start, start + claimed, dest);
+        start += claimed;
     }
-    return i + (int)str_len;
+    return true;
 }
 
-static void push_to_chord_bar(struct Application_Links* app, const String str) {
-    if (!state.chord_bar.exists) {
-        if (start_query_bar(app, &state.chord_bar.bar, 0) == 0) return;
-        state.chord_bar.contents_len = 0;
-        memset(state.chord_bar.contents, '\0',
-               ArrayCount(state.chord_bar.contents));
-        state.chord_bar.exists = true;
+// Copies the whole text of reg to dest, which has room for reg->size bytes.
+static void vim_register_copy_out(Vim_Register* reg, char* dest) {
+    for (Vim_Register_Chunk* chunk = reg->first; chunk; chunk = chunk->next) {
+        memcpy(dest, chunk->text, chunk->size);
+        dest += chunk->size;
     }
-    state.chord_bar.contents_len = push_to_string(
-        state.chord_bar.contents, state.chord_bar.contents_len,
-        ArrayCount(state.chord_bar.contents), str.str, str.size);
-    state.chord_bar.bar.string = make_string(
-        state.chord_bar.contents, state.chord_bar.contents_len,
-        ArrayCount(state.chord_bar.contents));
 }
 
-static void end_chord_bar(struct Application_Links* app) {
-    if (state.chord_bar.exists) {
-        end_query_bar(app, &state.chord_bar.bar, 0);
-        state.chord_bar.contents_len = 0;
-        memset(state.chord_bar.contents, '\0',
-               ArrayCount(state.chord_bar.contents));
-        state.chord_bar.exists = false;
+static char vim_register_last_char(Vim_Register* reg) {
+    return reg->size > 0 ? reg->last->text[reg->last->size - 1] : 0;
+}
+
+static bool vim_register_has_newline(Vim_Register* reg) {
+    for (Vim_Register_Chunk* chunk = reg->first; chunk; chunk = chunk->next) {
+        if (memchr(chunk->text, '\n', chunk->size)) { return true; }
     }
+    return false;
 }
 
-static void clear_register_selection() {
-    state.yank_register = state.paste_register = reg_unnamed;
+static int vim_register_memory() {
+    int chunks = register_free_count;
+    int whole_extra = 0;
+    for (int i = 0; i < reg_count; ++i) {
+        Vim_Register* reg = state.registers + i;
+        chunks += reg->chunk_count;
+        if (reg->first && vim_register_chunk_is_whole(reg->first)) {
+            whole_extra += reg->first->size - VIM_REGISTER_CHUNK_TEXT;
+        }
+    }
+    return chunks*(int)sizeof(Vim_Register_Chunk) + whole_extra;
 }
 
-static void vim_exec_action(struct Application_Links* app, Range range,
-                            bool is_line) {
-    View_Summary view = get_active_view(app, AccessAll);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+// System clipboard:                                               @clipboard
+// "* follows the system clipboard lazily. A paste from it first takes a
+// fingerprint of 4coder's clipboard history: the entry count, and the size
+// and first VIM_CLIPBOARD_SAMPLE bytes of every entry. "* is only read again
+// when the fingerprint has changed since "* last matched. 4coder hands out an
+// entry only from its start, so the fingerprint cannot cover all of a long
+// entry; what it relies on is that a new entry pushes every older one down a
+// place. Once the history is full, a new entry still goes unseen if it and
+// every entry in the history have the same size and the same first
+// VIM_CLIPBOARD_SAMPLE bytes.
+// "* keeps its text in one whole chunk, so a paste goes from it to the buffer
+// without a copy, and so does a post. A write to "* is posted once the frame
+// is drawn, so a macro that yanks into it a thousand times posts once.
+#define VIM_CLIPBOARD_SAMPLE 4096
+
+struct Vim_Clipboard_Sync {
+    // The clipboard as it was when "* last matched it.
+    bool valid;
+    int32_t count;
+    // Of the newest entry.
+    int32_t size;
+    uint64_t hash;
+    // "* holds text the system clipboard has not been given yet.
+    bool post_pending;
+};
 
-    switch (state.action) {
-        case vimaction_delete_range: 
-        case vimaction_change_range: {
-            Vim_Register* target_register = state.registers + state.yank_register;
-            target_register->is_line = is_line;
- 
-            copy_into_register(app, &buffer, range, state.registers + state.yank_register);
-            
-            buffer_replace_range(app, &buffer, range.start, range.end, "", 0);
+struct Vim_Clipboard_Stats {
+    uint64_t fetches;
+    uint64_t fetches_skipped;
+    uint64_t posts;
+    // Writes to "* that a later write replaced before they were posted.
+    uint64_t posts_coalesced;
+};
 
-            if (state.action == vimaction_change_range) {
-                enter_insert_mode(app, buffer.buffer_id);
-            }
-        } break;
+static Vim_Clipboard_Sync clipboard_sync = {};
+static Vim_Clipboard_Stats clipboard_stats = {};
 
-        case vimaction_yank_range: {
-            Vim_Register* target_register = state.registers + state.yank_register;
-            target_register->is_line = is_line;
+// FNV-1a. Pass the hash so far to carry on over text in pieces.
+static uint64_t vim_hash_bytes(const char* text, int size,
+                               uint64_t hash = 14695981039346656037ull) {
+    for (int i = 0; i < size; ++i) {
+        hash = (hash ^ (uint8_t)text[i])*1099511628211ull;
+    }
+    return hash;
+}
 
-            copy_into_register(app, &buffer, range, target_register);
-        } break;
+// The fingerprint of the clipboard history. Reads at most
+// VIM_CLIPBOARD_SAMPLE bytes of each entry, however long the entries are.
+static Vim_Clipboard_Sync vim_clipboard_probe(struct Application_Links* app) {
+    Vim_Clipboard_Sync probe = {};
+    char sample[VIM_CLIPBOARD_SAMPLE];
+    probe.valid = true;
+    probe.count = clipboard_count(app, 0);
+    probe.hash = vim_hash_bytes(nullptr, 0);
+    for (int32_t i = 0; i < probe.count; ++i) {
+        int32_t size = clipboard_index(app, 0, i, sample, sizeof(sample));
+        if (i == 0) { probe.size = size; }
+        int sampled = (size < (int32_t)sizeof(sample)) ? size : (int)sizeof(sample);
+        probe.hash = vim_hash_bytes((const char*)&size, sizeof(size), probe.hash);
+        probe.hash = vim_hash_bytes(sample, sampled, probe.hash);
+    }
+    return probe;
+}
 
-        case vimaction_indent_left_range:  // TODO(chr)
-        case vimaction_indent_right_range:
-        case vimaction_format_range: {
-            // TODO(chr) tab width as a user variable
-            buffer_auto_indent(app, &buffer, range.start, range.end - 1, 4, 0);
-        } break;
+// Brings "* up to date with the system clipboard.
+static void vim_clipboard_fetch(struct Application_Links* app) {
+    // Until it is posted, "* is newer than anything the system has.
+    if (clipboard_sync.post_pending) { return; }
+    Vim_Clipboard_Sync probe = vim_clipboard_probe(app);
+    if (clipboard_sync.valid && probe.count == clipboard_sync.count &&
+        probe.size == clipboard_sync.size && probe.hash == clipboard_sync.hash) {
+        clipboard_stats.fetches_skipped += 1;
+        return;
+    }
+    Vim_Register* reg = &state.registers[reg_system_clipboard];
+    if (probe.count == 0 || probe.size == 0) {
+        vim_register_clear(reg);
+    } else {
+        Vim_Register_Chunk* chunk = vim_register_alloc_whole(probe.size);
+        if (chunk == nullptr) { return; }
+        clipboard_index(app, 0, 0, chunk->text, probe.size);
+        vim_register_set_whole(reg, chunk);
     }
+    reg->is_macro = false;
+    reg->is_line = false;
+    reg->is_block = false;
+    clipboard_sync = probe;
+    clipboard_stats.fetches += 1;
+}
 
-    switch (state.mode) {
-        case mode_normal: {
-            enter_normal_mode(app, buffer.buffer_id);
-        } break;
+// Marks "* as changed, for vim_clipboard_flush to post.
+static void vim_clipboard_changed() {
+    if (clipboard_sync.post_pending) { clipboard_stats.posts_coalesced += 1; }
+    clipboard_sync.post_pending = true;
+}
 
-        case mode_visual: {
-            update_visual_range(app, view.cursor.pos);
-            set_current_keymap(app, mapid_visual);
-        } break;
+// Gives the system clipboard what was last written to "*, if it does not
+// have it yet. The render caller runs this every frame.
+static void vim_clipboard_flush(struct Application_Links* app) {
+    if (!clipboard_sync.post_pending) { return; }
+    clipboard_sync.post_pending = false;
+    Vim_Register* reg = &state.registers[reg_system_clipboard];
+    if (reg->size == 0) { return; }
+    if (reg->chunk_count > 1) {
+        // The one copy the write costs; pastes and later posts use it as is.
+        Vim_Register_Chunk* chunk = vim_register_alloc_whole(reg->size);
+        if (chunk == nullptr) { return; }
+        vim_register_copy_out(reg, chunk->text);
+        vim_register_set_whole(reg, chunk);
+    }
+    clipboard_post(app, 0, reg->first->text, reg->size);
+    // The entry just posted is what "* holds, so pastes need not fetch it.
+    clipboard_sync = vim_clipboard_probe(app);
+    clipboard_stats.posts += 1;
+}
 
-        case mode_visual_line: {
-            update_visual_line_range(app, view.cursor.pos);
-            set_current_keymap(app, mapid_visual);
-        } break;
+// Iterate over views:                                               @for_views
+#define for_views(view, app)                                                  \
+    for (View_Summary view = get_view_first(app, AccessAll);                  \
+         view.exists;                                                         \
+         get_view_next(app, &view, AccessAll))
+
+// Timing:                                                             @timing
+// Wall clocks for benchmarks (microseconds) and instrumentation (nanoseconds).
+#include <chrono>
+
+static int64_t vim_time_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t vim_time_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+// Scratch buffers:                                                   @scratch
+// Get a cleared, unimportant buffer to print reports into.
+static Buffer_Summary vim_get_scratch_buffer(struct Application_Links* app,
+                                             String name) {
+    Buffer_Summary buffer = get_buffer_by_name(app, expand_str(name), AccessAll);
+    if (!buffer.exists) {
+        buffer = create_buffer(app, expand_str(name), BufferCreate_AlwaysNew);
+        buffer_set_setting(app, &buffer, BufferSetting_Unimportant, true);
+    } else {
+        buffer_replace_range(app, &buffer, 0, buffer.size, 0, 0);
     }
+    return buffer;
 }
 
-static int buffer_seek_next_word(Application_Links* app, Buffer_Summary* buffer,
-                                 int pos) {
-    char chunk[1024];
-    int chunk_size = sizeof(chunk);
-    Stream_Chunk stream = {};
-    
-    if (init_stream_chunk(&stream, app, buffer, pos, chunk, chunk_size)) {
-        char cursorch = stream.data[pos];
-        char nextch = cursorch; 
-        int still_looping = true;
-        bool inter_whitespace = false;
-        do {
-            for (; pos < stream.end; ++pos) {
-                // Three kinds of characters:
-                //  - word characters, first of a row results in a stop
-                //  - symbol characters, first of a row results in a stop
-                //  - whitespace characters, always skip
-                //  The distinction between the first two is only needed
-                //   because word and symbol characters do not form a "row"
-                //   when intermixed.
-                nextch = stream.data[pos];
-                int is_whitespace = char_is_whitespace(nextch);
-                int is_alphanum = char_is_alpha_numeric(nextch);
-                int is_symbol = !is_whitespace && !is_alphanum;
+static void vim_scratch_printf(struct Application_Links* app,
+                               Buffer_Summary* buffer, const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (size < 0) { return; }
+    if (size >= (int)sizeof(line)) { size = sizeof(line) - 1; }
+    *buffer = get_buffer(app, buffer->buffer_id, AccessAll);
+    buffer_replace_range(app, buffer, buffer->size, buffer->size, line, size);
+}
 
-                if (char_is_whitespace(cursorch)) {
-                    if (!is_whitespace) {
-                        return pos;
-                    }
-                }
-                else if (char_is_alpha_numeric(cursorch)) {
-                    if (is_whitespace) {
-                        inter_whitespace = true;
-                    }
-                    else if (is_symbol ||
-                             (is_alphanum && inter_whitespace)) {
-                        return pos;
-                    }
-                }
-                else {
-                    if (is_whitespace) {
-                        inter_whitespace = true;
-                    }
-                    if (is_alphanum ||
-                        (is_symbol && inter_whitespace)) {
-                        return pos;
-                    }
-                }
+// Linux specific magic to deal with ~ expansion
+#if defined(IS_LINUX)
+#include <pwd.h>
+#include <unistd.h>
+#endif
+
+static int32_t get_user_home_dir(char* out, int32_t out_mem_size) {
+#if defined(IS_LINUX)
+    uid_t uid = getuid();
+    struct passwd *pw = getpwuid(uid);
+    int32_t homedir_len = strlen(pw->pw_dir);
+    if (homedir_len <= out_mem_size && out != nullptr) {
+        strncpy(out, pw->pw_dir, homedir_len);
+    }
+    return homedir_len;
+#else
+    return -1;
+#endif
+}
+
+#include "4coder_vim_search.cpp"
+#include "4coder_vim_regex.cpp"
+#include "4coder_vim_motion.cpp"
+
+//=============================================================================
+// > Buffer tracking <                                                 @buffers
+// Per-buffer data that 4vim keeps in sync with edits through
+// vim_hook_file_edit_range_func.
+//=============================================================================
+
+// Save indent:                                                  @save_indent
+// With virtual whitespace on, :w auto-indents before it saves. The first save
+// of a buffer indents all of it. From then on the edit hook keeps the byte
+// ranges changed since the last save, and the next save only indents those,
+// carried on to the end of the brace pair around them, since a changed line
+// can only move the indentation of the lines after it in its scope.
+
+// Past this many ranges the two closest ones merge.
+#define VIM_INDENT_DIRTY_MAX 64
+
+struct Vim_Indent_Dirty {
+    // Set by a save that indented the whole buffer. Until then there is
+    // nothing for the ranges to be changes from.
+    bool tracking;
+    // Changed since the last save. Sorted and disjoint.
+    Vim_Array<Range> ranges;
+    // Buffer size as of the last edit seen, as in the match cache. A save
+    // that finds another size missed an edit and indents everything.
+    int buffer_size;
+};
+
+static void vim_indent_dirty_reset(Vim_Indent_Dirty* dirty, int buffer_size) {
+    dirty->tracking = true;
+    dirty->ranges.count = 0;
+    dirty->buffer_size = buffer_size;
+}
+
+static void vim_indent_dirty_on_edit(Vim_Indent_Dirty* dirty, int start,
+                                     int end, int text_size) {
+    if (!dirty->tracking) { return; }
+    int shift = text_size - (end - start);
+    dirty->buffer_size += shift;
+
+    // The ranges the edit touches fold into the one it leaves behind.
+    Range changed = make_range(start, start + text_size);
+    Vim_Array<Range>* ranges = &dirty->ranges;
+    int insert_at = 0;
+    int kept = 0;
+    for (int i = 0; i < ranges->count; ++i) {
+        Range range = ranges->items[i];
+        if (range.end < start) {
+            ranges->items[kept++] = range;
+            insert_at = kept;
+        } else if (range.start > end) {
+            range.start += shift;
+            range.end += shift;
+            ranges->items[kept++] = range;
+        } else {
+            if (range.start < changed.start) { changed.start = range.start; }
+            int range_end = (range.end >= end) ? range.end + shift : changed.end;
+            if (range_end > changed.end) { changed.end = range_end; }
+        }
+    }
+    ranges->count = kept;
+    Range* slot = vim_array_insert(ranges, insert_at, 1);
+    if (slot == nullptr) {
+        dirty->tracking = false;
+        return;
+    }
+    *slot = changed;
+
+    if (ranges->count > VIM_INDENT_DIRTY_MAX) {
+        int closest = 0;
+        for (int i = 1; i + 1 < ranges->count; ++i) {
+            if (ranges->items[i + 1].start - ranges->items[i].end <
+                ranges->items[closest + 1].start - ranges->items[closest].end) {
+                closest = i;
             }
-            still_looping = forward_stream_chunk(&stream);
-        } while (still_looping);
+        }
+        ranges->items[closest].end = ranges->items[closest + 1].end;
+        vim_array_remove(ranges, closest + 1, 1);
+    }
+}
 
-        if (pos > buffer->size) {
-            pos = buffer->size;
+struct Vim_Buffer_State {
+    Buffer_ID buffer_id;
+    // Bumped by every edit the edit hook sees.
+    uint32_t edit_version;
+    Vim_Match_Cache matches;
+    Vim_Bracket_Index brackets;
+    Vim_Line_Index lines;
+    // Markers for the marks in this buffer, a-z and then A-Z, which 4coder
+    // moves along with every edit. 0 until the first mark is set.
+    Managed_Object marks;
+    // Which of a-z are set. The uppercase ones are in global_marks.
+    uint32_t marks_set;
+    // Where edits happened, one entry per line, for g; and g,.
+    Vim_Position_Ring changes;
+    // What the next :w has to indent.
+    Vim_Indent_Dirty indent_dirty;
+};
+
+static Vim_Id_Table<Vim_Buffer_State> buffer_states = {};
+
+// The per-view caches that hold buffer positions live in View tracking.
+static void vim_track_view_edit(Buffer_ID buffer_id, int start, int end,
+                                int text_size);
+static void vim_release_view_buffer(Buffer_ID buffer_id);
+
+static Vim_Buffer_State* vim_get_buffer_state(Buffer_ID buffer_id) {
+    Vim_Buffer_State* buffer_state =
+        vim_table_get_or_create(&buffer_states, buffer_id);
+    if (buffer_state) { buffer_state->buffer_id = buffer_id; }
+    return buffer_state;
+}
+
+// Marks:                                                               @marks
+// m{a-zA-Z} stores the cursor in a marker on the buffer, so 4coder keeps it in
+// place through edits and a jump just reads it back. An uppercase mark is in
+// one buffer at a time, the one global_marks names; when that buffer closes
+// the mark keeps the file name and offset, and the next jump opens the file
+// again.
+
+#define VIM_MARK_SLOTS 52
+
+struct Vim_Global_Mark {
+    // 0 when the mark is unset or its buffer has closed.
+    Buffer_ID buffer_id;
+    // Where the mark was when its buffer closed, if the buffer had a file.
+    char* file_name;
+    int file_name_size;
+    int pos;
+};
+
+static Vim_Global_Mark global_marks[26] = {};
+
+// Slot of mark c in a buffer's marker object, or -1.
+static int vim_mark_slot(char c) {
+    if ('a' <= c && c <= 'z') { return c - 'a'; }
+    if ('A' <= c && c <= 'Z') { return 26 + (c - 'A'); }
+    return -1;
+}
+
+static bool vim_buffer_mark_store(struct Application_Links* app,
+                                  Vim_Buffer_State* buffer_state, int slot,
+                                  int pos) {
+    if (buffer_state->marks == 0) {
+        buffer_state->marks = alloc_buffer_markers_on_buffer(
+            app, buffer_state->buffer_id, VIM_MARK_SLOTS, nullptr);
+        if (buffer_state->marks == 0) { return false; }
+    }
+    Marker marker = {};
+    marker.pos = pos;
+    return managed_object_store_data(app, buffer_state->marks, slot, 1, &marker);
+}
+
+static int vim_buffer_mark_load(struct Application_Links* app,
+                                Vim_Buffer_State* buffer_state, int slot) {
+    Marker marker = {};
+    if (buffer_state->marks == 0 ||
+        !managed_object_load_data(app, buffer_state->marks, slot, 1, &marker)) {
+        return -1;
+    }
+    return marker.pos;
+}
+
+static bool vim_set_mark_at(struct Application_Links* app, char c,
+                            Buffer_ID buffer_id, int pos) {
+    int slot = vim_mark_slot(c);
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer_id);
+    if (slot < 0 || buffer_state == nullptr ||
+        !vim_buffer_mark_store(app, buffer_state, slot, pos)) {
+        return false;
+    }
+    if (slot < 26) {
+        buffer_state->marks_set |= 1u << slot;
+    } else {
+        Vim_Global_Mark* mark = global_marks + (slot - 26);
+        free(mark->file_name);
+        *mark = {};
+        mark->buffer_id = buffer_id;
+    }
+    return true;
+}
+
+// Where mark c is, looked up from the current buffer. A closed buffer's
+// uppercase mark comes back with buffer_id 0 and the offset it had.
+static bool vim_get_mark(struct Application_Links* app, char c,
+                         Buffer_ID current, Buffer_ID* buffer_id, int* pos) {
+    int slot = vim_mark_slot(c);
+    if (slot < 0) { return false; }
+    if (slot < 26) {
+        Vim_Buffer_State* buffer_state = vim_table_get(&buffer_states, current);
+        if (buffer_state == nullptr || !(buffer_state->marks_set & (1u << slot))) {
+            return false;
         }
+        *buffer_id = current;
+        *pos = vim_buffer_mark_load(app, buffer_state, slot);
+        return *pos >= 0;
+    }
+    Vim_Global_Mark* mark = global_marks + (slot - 26);
+    if (mark->buffer_id == 0) {
+        *buffer_id = 0;
+        *pos = mark->pos;
+        return mark->file_name != nullptr;
     }
+    Vim_Buffer_State* buffer_state = vim_table_get(&buffer_states, mark->buffer_id);
+    if (buffer_state == nullptr) { return false; }
+    *buffer_id = mark->buffer_id;
+    *pos = vim_buffer_mark_load(app, buffer_state, slot);
+    return *pos >= 0;
+}
 
-    return pos;
+// As a buffer closes, the uppercase marks in it fall back to its file name.
+static void vim_release_buffer_marks(struct Application_Links* app,
+                                     Vim_Buffer_State* buffer_state) {
+    Buffer_Summary buffer = get_buffer(app, buffer_state->buffer_id, AccessAll);
+    for (int i = 0; i < (int)ArrayCount(global_marks); ++i) {
+        Vim_Global_Mark* mark = global_marks + i;
+        if (mark->buffer_id != buffer_state->buffer_id) { continue; }
+        mark->buffer_id = 0;
+        mark->pos = vim_buffer_mark_load(app, buffer_state, 26 + i);
+        if (!buffer.exists || buffer.file_name_len <= 0 || mark->pos < 0) {
+            *mark = {};
+            continue;
+        }
+        mark->file_name = (char*)malloc(buffer.file_name_len);
+        if (mark->file_name == nullptr) {
+            *mark = {};
+            continue;
+        }
+        memcpy(mark->file_name, buffer.file_name, buffer.file_name_len);
+        mark->file_name_size = buffer.file_name_len;
+    }
 }
 
-static int buffer_seek_nonalphanumeric_right(Application_Links* app,
-                                             Buffer_Summary* buffer, int pos) {
-    char chunk[1024];
-    int chunk_size = sizeof(chunk);
-    Stream_Chunk stream = {};
-    
-    if (init_stream_chunk(&stream, app, buffer, pos, chunk, chunk_size)) {
-        char cursorch = stream.data[pos];
-        char nextch = cursorch; 
-        int still_looping = true;
-        do {
-            for (; pos < stream.end; ++pos) {
-                nextch = stream.data[pos];
-                if (!char_is_alpha_numeric(nextch)) {
-                    return pos;
-                }
+static void vim_release_buffer_state(struct Application_Links* app,
+                                     Buffer_ID buffer_id) {
+    vim_release_view_buffer(buffer_id);
+    Vim_Buffer_State* buffer_state = vim_table_remove(&buffer_states, buffer_id);
+    if (buffer_state == nullptr) { return; }
+    vim_release_buffer_marks(app, buffer_state);
+    vim_match_cache_free(&buffer_state->matches);
+    vim_bracket_index_free(&buffer_state->brackets);
+    vim_line_index_free(&buffer_state->lines);
+    vim_array_free(&buffer_state->indent_dirty.ranges);
+    free(buffer_state);
+}
+
+static void vim_track_edit(Buffer_ID buffer_id, int start, int end,
+                           String text) {
+    int text_size = text.size;
+    vim_track_view_edit(buffer_id, start, end, text_size);
+    Vim_Buffer_State* buffer_state = vim_table_get(&buffer_states, buffer_id);
+    if (buffer_state == nullptr) { return; }
+    buffer_state->edit_version += 1;
+    vim_match_cache_on_edit(&buffer_state->matches, start, end, text_size);
+    vim_bracket_index_on_edit(&buffer_state->brackets, start, end, text_size);
+    vim_line_index_on_edit(&buffer_state->lines, start, end, text);
+    vim_indent_dirty_on_edit(&buffer_state->indent_dirty, start, end, text_size);
+
+    // An edit on the same line as the newest change replaces it, as in vim.
+    Vim_Position_Ring* changes = &buffer_state->changes;
+    vim_ring_on_edit(changes, buffer_id, start, end, text_size);
+    Vim_Position* newest = changes->count ? vim_ring_get(changes, changes->count - 1)
+                                          : nullptr;
+    Vim_Line_Index* lines = &buffer_state->lines;
+    if (newest && vim_line_index_is_complete(lines) &&
+        vim_line_index_line_of(lines, newest->pos) ==
+        vim_line_index_line_of(lines, start)) {
+        newest->pos = start;
+        changes->at = changes->count;
+    } else {
+        vim_ring_push(changes, { buffer_id, start });
+    }
+}
+
+// Carries a changed range on to the end of the brace pair around it, out to
+// the pair that also holds the partners of any braces in it. last_unpaired is
+// the position of the last brace without a partner, or -1. With one at or
+// after the range, the pairs the range sits in cannot be trusted, so it runs
+// to the end.
+static Range vim_indent_scope(Vim_Bracket_Index* brackets, Range range,
+                              int last_unpaired, int buffer_size) {
+    if (last_unpaired >= range.start) { return make_range(range.start, buffer_size); }
+    Vim_Bracket_List* list = brackets->lists + vim_bracket_brace;
+    int low = range.start;
+    int high = range.end;
+    int count = list->positions.count;
+    for (int i = vim_lower_bound(list->positions.items, count, range.start);
+         i < count && list->positions.items[i] < range.end; ++i) {
+        int partner = list->partners.items[i];
+        int partner_pos = list->positions.items[partner];
+        if (partner_pos < low) { low = partner_pos; }
+        if (partner_pos + 1 > high) { high = partner_pos + 1; }
+    }
+    int i = vim_bracket_index_enclosing(list, low);
+    while (i >= 0 && list->positions.items[list->partners.items[i]] + 1 < high) {
+        i = vim_bracket_index_outer(list, i);
+    }
+    if (i >= 0) { high = list->positions.items[list->partners.items[i]] + 1; }
+    return make_range(range.start, high);
+}
+
+// Auto-indents what changed since the last call, or the whole buffer when
+// nothing was being tracked. Returns how many ranges it indented, or -1 when
+// it indented everything.
+static int vim_indent_changes(struct Application_Links* app,
+                              Buffer_Summary* buffer, int tab_width,
+                              uint32_t flags) {
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer->buffer_id);
+    Vim_Indent_Dirty* dirty = buffer_state ? &buffer_state->indent_dirty : nullptr;
+    bool partial = dirty && dirty->tracking && dirty->buffer_size == buffer->size &&
+        vim_bracket_index_update(app, buffer, &buffer_state->brackets, INT_MAX);
+    // The indenting goes through the edit hook too. None of it is a change,
+    // and the hook must leave the ranges alone while they are read below.
+    if (dirty) { dirty->tracking = false; }
+
+    int result = -1;
+    if (partial) {
+        Vim_Bracket_List* braces = buffer_state->brackets.lists + vim_bracket_brace;
+        int last_unpaired = -1;
+        for (int i = braces->positions.count - 1; i >= 0; --i) {
+            if (braces->partners.items[i] < 0) {
+                last_unpaired = braces->positions.items[i];
+                break;
             }
-            still_looping = forward_stream_chunk(&stream);
-        } while (still_looping);
+        }
+        // Widening can make ranges overlap, so merge them, then indent from
+        // the end so the offsets still to do are not moved.
+        Vim_Array<Range>* ranges = &dirty->ranges;
+        int merged = 0;
+        for (int i = 0; i < ranges->count; ++i) {
+            Range scope = vim_indent_scope(&buffer_state->brackets,
+                                           ranges->items[i], last_unpaired,
+                                           buffer->size);
+            if (merged > 0 && scope.start <= ranges->items[merged - 1].end) {
+                Range* last = ranges->items + merged - 1;
+                if (scope.end > last->end) { last->end = scope.end; }
+            } else {
+                ranges->items[merged++] = scope;
+            }
+        }
+        ranges->count = merged;
+        result = merged;
+        for (int i = merged - 1; i >= 0; --i) {
+            Range range = dirty->ranges.items[i];
+            *buffer = get_buffer(app, buffer->buffer_id, AccessAll);
+            buffer_auto_indent(app, &global_part, buffer, range.start, range.end,
+                               tab_width, flags);
+        }
+    } else {
+        buffer_auto_indent(app, &global_part, buffer, 0, buffer->size, tab_width,
+                           flags);
+    }
+
+    *buffer = get_buffer(app, buffer->buffer_id, AccessAll);
+    if (dirty) { vim_indent_dirty_reset(dirty, buffer->size); }
+    return result;
+}
+
+//=============================================================================
+// > View tracking <                                                     @views
+// Per-view data, mostly results the render caller keeps from one frame to
+// the next.
+//=============================================================================
+
+// The search matches drawn in one view, valid while the key fields match.
+struct Vim_Search_Highlight {
+    Buffer_ID buffer_id;
+    uint32_t edit_version;
+    int buffer_size;
+    Range visible;
+    char pattern[100];
+    int pattern_size;
+    // Start and end marker of every match that overlaps visible.
+    Vim_Array<Marker> markers;
+};
+
+// Words the render caller highlights in every view, with their colors. Add
+// your own with vim_define_highlight_keyword() from your bindings.
+static Vim_Keyword_Set highlight_keywords = {};
+static int_color highlight_keyword_colors[VIM_KEYWORD_MAX];
+// Bumped when the keyword table changes, so cached hits get thrown away.
+static uint32_t highlight_keywords_version = 1;
+
+void vim_define_highlight_keyword(String word, int_color color) {
+    int index = vim_keyword_set_add(&highlight_keywords, word);
+    if (index >= 0) {
+        highlight_keyword_colors[index] = color;
+        highlight_keywords_version += 1;
+    }
+}
+
+// Marker pool:                                                   @marker_pool
+// Marker objects the render caller keeps per view and purpose, rather than
+// allocating fresh ones every frame and clearing them all after the render.
+// A slot is refilled with managed_object_store_data, and only reallocated
+// when it moves to another buffer or outgrows its capacity. Its visuals are
+// created along with the object and only have their effects updated.
+
+struct Vim_Marker_Slot {
+    Managed_Object object;
+    Buffer_ID buffer_id;
+    int capacity;
+    Marker_Visual visuals[3];
+};
+
+struct Vim_Marker_Stats {
+    uint64_t frames;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t stores;
+    // Objects the render caller allocated per frame before the pool.
+    uint64_t unpooled_allocations;
+};
+
+static Vim_Marker_Stats marker_stats = {};
+
+// Makes slot an object on buffer_id with room for count markers. Returns true
+// when the object is new and its visuals need to be created.
+static bool vim_marker_slot_reserve(struct Application_Links* app,
+                                    Managed_Scope* scope, Vim_Marker_Slot* slot,
+                                    Buffer_ID buffer_id, int count) {
+    if (count < 2) { count = 2; }
+    if (slot->object != 0 && slot->buffer_id == buffer_id &&
+        count <= slot->capacity && (slot->capacity <= 64 || count*4 > slot->capacity)) {
+        return false;
+    }
+    if (slot->object != 0) {
+        managed_object_free(app, slot->object);
+        marker_stats.frees += 1;
+    }
+    int capacity = 2;
+    while (capacity < count) { capacity *= 2; }
+    slot->object = alloc_buffer_markers_on_buffer(app, buffer_id, capacity, scope);
+    slot->buffer_id = buffer_id;
+    slot->capacity = capacity;
+    marker_stats.allocations += 1;
+    return true;
+}
+
+// Stores count markers into the slot. The unused rest of its capacity gets
+// empty ranges off the start of the buffer, which draw nothing.
+static void vim_marker_slot_store(struct Application_Links* app,
+                                  Vim_Marker_Slot* slot, Marker* markers,
+                                  int count) {
+    if (slot->object == 0) { return; }
+    if (count > slot->capacity) { count = slot->capacity; }
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Marker* padded = push_array(&global_part, Marker, slot->capacity);
+    if (padded) {
+        if (count > 0) { memcpy(padded, markers, sizeof(Marker)*count); }
+        for (int i = count; i < slot->capacity; ++i) {
+            padded[i] = {};
+            padded[i].pos = -1;
+        }
+        managed_object_store_data(app, slot->object, 0, slot->capacity, padded);
+        marker_stats.stores += 1;
+    }
+    end_temp_memory(temp);
+}
+
+// For slots whose object died with its buffer's scope.
+static void vim_marker_slot_forget(Vim_Marker_Slot* slot) {
+    slot->object = 0;
+    slot->buffer_id = 0;
+    slot->capacity = 0;
+}
+
+// Most enclosures the render caller highlights around the cursor.
+#define VIM_ENCLOSURE_MAX 64
+
+// Draws enclosures (innermost first, from the bracket index) the way the
+// default mark_enclosures does: one marker object in the render scope, and a
+// visual per color that takes every color_count-th pair, so the outermost
+// pair gets the first color.
+static void vim_mark_enclosure_ranges(struct Application_Links* app,
+                                      Managed_Scope render_scope,
+                                      Buffer_Summary* buffer, Range* ranges,
+                                      int range_count, Marker_Visual_Type type,
+                                      int_color* back_colors,
+                                      int_color* fore_colors, int color_count) {
+    if (range_count <= 0) { return; }
+    Marker markers[VIM_ENCLOSURE_MAX*2] = {};
+    for (int i = 0; i < range_count; ++i) {
+        markers[i*2].pos = ranges[i].start;
+        markers[i*2 + 1].pos = ranges[i].end - 1;
+    }
+    Managed_Object object = alloc_buffer_markers_on_buffer(
+        app, buffer->buffer_id, range_count*2, &render_scope);
+    managed_object_store_data(app, object, 0, range_count*2, markers);
+
+    Marker_Visual_Take_Rule take_rule = {};
+    take_rule.take_count_per_step = 2;
+    take_rule.step_stride_in_marker_count = color_count*2;
+    int color_index = (range_count - 1) % color_count;
+    for (int i = 0; i < color_count; ++i) {
+        Marker_Visual visual = create_marker_visual(app, object);
+        int_color back = back_colors ? back_colors[color_index] : 0;
+        int_color fore = fore_colors ? fore_colors[color_index] : 0;
+        marker_visual_set_effect(app, visual, type, back, fore, 0);
+        take_rule.first_index = i*2;
+        marker_visual_set_take_rule(app, visual, take_rule);
+        color_index = (color_index + color_count - 1) % color_count;
+    }
+}
+
+// The keyword hits drawn in one view. Edits move the hits along and mark the
+// edited bytes dirty, and scrolling only scans what came into view, so a
+// frame where nothing changed does no work at all.
+struct Vim_Keyword_Cache {
+    Buffer_ID buffer_id;
+    uint32_t keywords_version;
+    // Buffer size implied by the edits seen; a mismatch means one was missed.
+    int buffer_size;
+    Range visible;
+    // Hits that lie inside visible, sorted and disjoint.
+    Vim_Array<Vim_Keyword_Hit> hits;
+    // Edited parts of visible that still need a scan.
+    Vim_Array<Range> dirty;
+    // The markers drawing hits, one slot per color. Refilled only when hits
+    // change.
+    Vim_Array<Vim_Marker_Slot> slots;
+    int slots_in_use;
+    bool objects_stale;
+};
+
+// Render timings:                                                @render_timing
+// Each view keeps the time every render caller section took over its last
+// VIM_RENDER_SAMPLES frames. :renderstats reads percentiles off the window.
+
+enum Vim_Render_Section {
+    render_keywords,
+    render_search,
+    render_selection,
+    render_cursor_mark,
+    render_line_highlight,
+    render_brace_enclosures,
+    render_paren_enclosures,
+    render_core,
+    render_total,
+    render_section_count
+};
+
+static const char* render_section_names[render_section_count] = {
+    "keyword scan",
+    "search highlight",
+    "visual highlight",
+    "cursor and mark",
+    "line highlight",
+    "brace enclosures",
+    "paren enclosures",
+    "do_core_render",
+    "total",
+};
+
+constexpr int VIM_RENDER_SAMPLES = 512;
+
+struct Vim_Render_Timings {
+    // Nanoseconds, one ring per section; all rings share next.
+    uint32_t samples[render_section_count][VIM_RENDER_SAMPLES];
+    int next;
+    int count;
+    // The frame in progress.
+    int64_t current[render_section_count];
+};
+
+static inline void vim_render_time(Vim_Render_Timings* timings,
+                                   Vim_Render_Section section, int64_t start) {
+    timings->current[section] += vim_time_ns() - start;
+}
+
+// Moves the frame in progress into the window.
+static void vim_render_timings_commit(Vim_Render_Timings* timings) {
+    for (int i = 0; i < render_section_count; ++i) {
+        int64_t ns = timings->current[i];
+        timings->samples[i][timings->next] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+        timings->current[i] = 0;
+    }
+    timings->next = (timings->next + 1) % VIM_RENDER_SAMPLES;
+    if (timings->count < VIM_RENDER_SAMPLES) { timings->count += 1; }
+}
+
+static int vim_compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+struct Vim_Render_Percentiles {
+    uint32_t p50, p95, p99, max;
+};
+
+static Vim_Render_Percentiles vim_render_percentiles(Vim_Render_Timings* timings,
+                                                     Vim_Render_Section section) {
+    Vim_Render_Percentiles result = {};
+    int count = timings->count;
+    if (count == 0) { return result; }
+    uint32_t sorted[VIM_RENDER_SAMPLES];
+    memcpy(sorted, timings->samples[section], sizeof(uint32_t)*count);
+    qsort(sorted, count, sizeof(uint32_t), vim_compare_u32);
+    result.p50 = sorted[(count - 1)*50/100];
+    result.p95 = sorted[(count - 1)*95/100];
+    result.p99 = sorted[(count - 1)*99/100];
+    result.max = sorted[count - 1];
+    return result;
+}
+
+struct Vim_View_State {
+    View_ID view_id;
+    // Holds the marker objects this view keeps from frame to frame.
+    Managed_Scope render_scope;
+    Vim_Marker_Slot cursor_markers;
+    Vim_Marker_Slot selection_markers;
+    Vim_Marker_Slot search_markers;
+    Vim_Search_Highlight search_highlight;
+    Vim_Keyword_Cache keywords;
+    Vim_Render_Timings timings;
+    // Where jumps (G, %, searches, marks...) left from, for ^O and ^I.
+    Vim_Position_Ring jumps;
+    Vim_Modal_State modal;
+};
+
+static Vim_Id_Table<Vim_View_State> view_states = {};
+
+static Vim_View_State* vim_get_view_state(View_ID view_id) {
+    Vim_View_State* view_state = vim_table_get_or_create(&view_states, view_id);
+    if (view_state && view_state->view_id == 0) {
+        view_state->view_id = view_id;
+        view_state->modal = vim_make_modal_state();
+    }
+    return view_state;
+}
+
+// Points modal at the active view's record. Arriving in a view only looks its
+// record up and gives its buffer back the keymap the view left it with; the
+// mode, the selection and anything half typed are all still in the record.
+// An insert left behind in the old view keeps what was typed, but a block
+// insert no longer copies it to the other lines and '.' stops following it.
+// A view that shows another buffer than it did drops its selection.
+static void vim_sync_active_view(struct Application_Links* app) {
+    View_Summary view = get_active_view(app, AccessAll);
+    if (!view.exists) { return; }
+    if (view.view_id == modal_view_id && view.buffer_id == modal->buffer_id) {
+        return;
+    }
+    if (view.view_id != modal_view_id) {
+        Vim_View_State* view_state = vim_get_view_state(view.view_id);
+        if (view_state == nullptr) { return; }
+        modal = &view_state->modal;
+        modal_view_id = view.view_id;
+        state.insert_capture.active = false;
+        if (state.block_insert.active) {
+            state.block_insert.active = false;
+            free(state.block_insert.fill);
+            state.block_insert.fill = nullptr;
+        }
+    }
+    if (view.buffer_id != modal->buffer_id) {
+        if (modal->mode == mode_visual || modal->mode == mode_visual_line ||
+            modal->mode == mode_visual_block) {
+            modal->mode = mode_normal;
+            modal->keymap = mapid_normal;
+        }
+        modal->buffer_id = view.buffer_id;
+        modal->selection_cursor = make_range(-1, -1);
+        modal->selection_range = make_range(-1, -1);
+        modal->last_visual_range = make_range(-1, -1);
+    }
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+    if (buffer.exists) {
+        buffer_set_setting(app, &buffer, BufferSetting_MapID, modal->keymap);
+    }
+}
+
+// Drops every hit; the marker slots stay for the next fill.
+static void vim_keyword_cache_reset(Vim_Keyword_Cache* cache) {
+    cache->buffer_id = 0;
+    cache->hits.count = 0;
+    cache->dirty.count = 0;
+    cache->visible = make_range(0, 0);
+    cache->objects_stale = true;
+}
+
+static void vim_keyword_cache_on_edit(Vim_Keyword_Cache* cache, int start,
+                                      int end, int text_size) {
+    int shift = text_size - (end - start);
+    int kept = 0;
+    for (int i = 0; i < cache->hits.count; ++i) {
+        Vim_Keyword_Hit hit = cache->hits.items[i];
+        if (hit.end <= start) {
+            cache->hits.items[kept++] = hit;
+        } else if (hit.start >= end) {
+            hit.start += shift;
+            hit.end += shift;
+            cache->hits.items[kept++] = hit;
+        }
+    }
+    cache->hits.count = kept;
+    for (int i = 0; i < cache->dirty.count; ++i) {
+        Range* range = cache->dirty.items + i;
+        if (range->start >= end) { range->start += shift; }
+        else if (range->start > start) { range->start = start; }
+        if (range->end >= end) { range->end += shift; }
+        else if (range->end > start) { range->end = start + text_size; }
+    }
+    if (cache->visible.start >= end) { cache->visible.start += shift; }
+    else if (cache->visible.start > start) { cache->visible.start = start; }
+    if (cache->visible.end >= end) { cache->visible.end += shift; }
+    else if (cache->visible.end > start) { cache->visible.end = start + text_size; }
+    cache->buffer_size += shift;
+
+    // A long tail of scattered edits collapses into one range to scan.
+    if (cache->dirty.count >= 32) {
+        Range hull = cache->dirty.items[0];
+        for (int i = 1; i < cache->dirty.count; ++i) {
+            if (cache->dirty.items[i].start < hull.start) {
+                hull.start = cache->dirty.items[i].start;
+            }
+            if (cache->dirty.items[i].end > hull.end) {
+                hull.end = cache->dirty.items[i].end;
+            }
+        }
+        cache->dirty.items[0] = hull;
+        cache->dirty.count = 1;
+    }
+    vim_array_push(&cache->dirty, make_range(start, start + text_size));
+    cache->objects_stale = true;
+}
+
+// Moves a range held across commands past an edit, as vim_ring_on_edit does a
+// position. (-1, -1), for no range, stays as it is.
+static void vim_range_on_edit(Range* range, int start, int end, int text_size) {
+    int delta = text_size - (end - start);
+    if (range->start >= end) { range->start += delta; }
+    else if (range->start > start) { range->start = start; }
+    if (range->end >= end) { range->end += delta; }
+    else if (range->end > start) { range->end = start; }
+}
+
+static void vim_track_view_edit(Buffer_ID buffer_id, int start, int end,
+                                int text_size) {
+    for (int i = 0; i < view_states.capacity; ++i) {
+        Vim_View_State* view_state = view_states.values[i];
+        if (view_state == nullptr) { continue; }
+        if (view_state->keywords.buffer_id == buffer_id) {
+            vim_keyword_cache_on_edit(&view_state->keywords, start, end, text_size);
+        }
+        vim_ring_on_edit(&view_state->jumps, buffer_id, start, end, text_size);
+        Vim_Modal_State* view_modal = &view_state->modal;
+        if (view_modal->buffer_id == buffer_id) {
+            Range* ranges[] = {
+                &view_modal->selection_cursor,
+                &view_modal->selection_range,
+                &view_modal->last_visual_range,
+            };
+            for (int j = 0; j < (int)ArrayCount(ranges); ++j) {
+                vim_range_on_edit(ranges[j], start, end, text_size);
+            }
+        }
+    }
+}
+
+static void vim_release_view_buffer(Buffer_ID buffer_id) {
+    for (int i = 0; i < view_states.capacity; ++i) {
+        Vim_View_State* view_state = view_states.values[i];
+        if (view_state == nullptr) { continue; }
+        if (view_state->keywords.buffer_id == buffer_id) {
+            vim_keyword_cache_reset(&view_state->keywords);
+        }
+        // The buffer's scope took the marker objects on it along.
+        Vim_Marker_Slot* slots[] = {
+            &view_state->cursor_markers,
+            &view_state->selection_markers,
+            &view_state->search_markers,
+        };
+        for (int j = 0; j < (int)ArrayCount(slots); ++j) {
+            if (slots[j]->buffer_id == buffer_id) { vim_marker_slot_forget(slots[j]); }
+        }
+        for (int j = 0; j < view_state->keywords.slots.count; ++j) {
+            Vim_Marker_Slot* slot = view_state->keywords.slots.items + j;
+            if (slot->buffer_id == buffer_id) { vim_marker_slot_forget(slot); }
+        }
+        vim_ring_remove_range(&view_state->jumps, buffer_id, 0, INT_MAX);
+    }
+}
+
+// Frees the record of a view that is going away, along with the marker
+// objects in its render scope. 4coder hands a closed view's id to a later
+// split, which must start from a fresh record.
+static void vim_release_view_state(struct Application_Links* app,
+                                   View_ID view_id) {
+    Vim_View_State* view_state = vim_table_remove(&view_states, view_id);
+    if (view_state == nullptr) { return; }
+    if (view_state->render_scope != 0) {
+        destroy_user_managed_scope(app, view_state->render_scope);
+    }
+    vim_array_free(&view_state->search_highlight.markers);
+    vim_array_free(&view_state->keywords.hits);
+    vim_array_free(&view_state->keywords.dirty);
+    vim_array_free(&view_state->keywords.slots);
+    if (modal == &view_state->modal) {
+        modal = &initial_modal;
+        modal_view_id = 0;
+    }
+    free(view_state);
+}
+
+// open_view for 4vim's splits. A view closed some other way (the mouse, a
+// default command) left its record behind; the new view must not inherit it.
+static View_Summary vim_open_view(struct Application_Links* app,
+                                  View_Summary* view,
+                                  View_Split_Position position) {
+    View_Summary new_view = open_view(app, view, position);
+    if (new_view.exists) { vim_release_view_state(app, new_view.view_id); }
+    return new_view;
+}
+
+// Closes the active view, or exits if it is the only one.
+static void vim_close_active_view(struct Application_Links* app) {
+    View_Summary view = get_view_first(app, AccessAll);
+    get_view_next(app, &view, AccessAll);
+    if (!view.exists) {
+        send_exit_signal(app);
+        return;
+    }
+    View_Summary active = get_active_view(app, AccessAll);
+    vim_release_view_state(app, active.view_id);
+    close_panel(app);
+}
+
+// Jump list:                                                           @jumps
+// Adds pos in buffer_id to the view's jump list, first dropping any entry on
+// the same line as vim does. Only needs the line index if it is complete
+// already, so it costs a couple of binary searches and a pass over at most
+// VIM_RING_CAPACITY entries.
+static void vim_record_jump(View_ID view_id, Buffer_ID buffer_id, int pos) {
+    Vim_View_State* view_state = vim_get_view_state(view_id);
+    if (view_state == nullptr) { return; }
+    Vim_Buffer_State* buffer_state = vim_table_get(&buffer_states, buffer_id);
+    Vim_Line_Index* lines = buffer_state ? &buffer_state->lines : nullptr;
+    int min = pos;
+    int max = pos;
+    if (lines && vim_line_index_is_complete(lines)) {
+        int line = vim_line_index_line_of(lines, pos);
+        min = vim_line_index_start(lines, line);
+        max = vim_line_index_end(lines, line);
+    }
+    vim_ring_remove_range(&view_state->jumps, buffer_id, min, max);
+    vim_ring_push(&view_state->jumps, { buffer_id, pos });
+}
+
+// Scans region of the cached visible range again, replacing the hits there.
+// The region is widened by a keyword length on each side so that hits cut by
+// its edges are found whole.
+static void vim_keyword_cache_rescan(struct Application_Links* app,
+                                     Buffer_Summary* buffer,
+                                     Vim_Keyword_Cache* cache, Range region) {
+    int reach = VIM_KEYWORD_MAX_SIZE - 1;
+    int first = region.start - reach;
+    int last = region.end + reach;
+    if (first < cache->visible.start) { first = cache->visible.start; }
+    if (last > cache->visible.end) { last = cache->visible.end; }
+    if (first >= last) { return; }
+
+    // Hits touching [first, last) go and are found again by the scan.
+    int remove_start = 0;
+    while (remove_start < cache->hits.count &&
+           cache->hits.items[remove_start].end <= first) {
+        ++remove_start;
+    }
+    int remove_end = remove_start;
+    while (remove_end < cache->hits.count &&
+           cache->hits.items[remove_end].start < last) {
+        ++remove_end;
+    }
+    if (remove_end > remove_start) {
+        // Rescan the removed hits too, or ones straddling the edges are lost.
+        if (cache->hits.items[remove_start].start < first) {
+            first = cache->hits.items[remove_start].start;
+        }
+        if (cache->hits.items[remove_end - 1].end > last) {
+            last = cache->hits.items[remove_end - 1].end;
+        }
+        cache->objects_stale = true;
+    }
+    vim_array_remove(&cache->hits, remove_start, remove_end - remove_start);
+
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    char* text = push_array(&global_part, char, last - first);
+    if (text && buffer_read_range(app, buffer, first, last, text)) {
+        Vim_Array<Vim_Keyword_Hit> found = {};
+        vim_keyword_scan(&highlight_keywords, text, last - first, first, &found);
+        if (found.count > 0) {
+            Vim_Keyword_Hit* slot = vim_array_insert(&cache->hits, remove_start,
+                                                     found.count);
+            if (slot) {
+                memcpy(slot, found.items, sizeof(Vim_Keyword_Hit)*found.count);
+            }
+            cache->objects_stale = true;
+        }
+        vim_array_free(&found);
+    }
+    end_temp_memory(temp);
+}
+
+// Brings the view's keyword hits in line with what is on screen now.
+static void vim_update_keyword_cache(struct Application_Links* app,
+                                     Buffer_Summary* buffer,
+                                     Vim_Keyword_Cache* cache, Range visible) {
+    if (cache->buffer_id != buffer->buffer_id ||
+        cache->keywords_version != highlight_keywords_version ||
+        cache->buffer_size != buffer->size) {
+        vim_keyword_cache_reset(cache);
+        cache->buffer_id = buffer->buffer_id;
+        cache->keywords_version = highlight_keywords_version;
+        cache->buffer_size = buffer->size;
+    }
+
+    Range old_visible = cache->visible;
+    if (old_visible.start == visible.start && old_visible.end == visible.end &&
+        cache->dirty.count == 0) {
+        return;
+    }
+
+    // Forget hits that scrolled out of view.
+    int kept = 0;
+    for (int i = 0; i < cache->hits.count; ++i) {
+        Vim_Keyword_Hit hit = cache->hits.items[i];
+        if (hit.start >= visible.start && hit.end <= visible.end) {
+            cache->hits.items[kept++] = hit;
+        }
+    }
+    if (kept != cache->hits.count) { cache->objects_stale = true; }
+    cache->hits.count = kept;
+    cache->visible = visible;
+
+    if (old_visible.end <= visible.start || visible.end <= old_visible.start ||
+        old_visible.start == old_visible.end) {
+        vim_keyword_cache_rescan(app, buffer, cache, visible);
+    } else {
+        // Only what scrolled into view, plus what was edited.
+        if (visible.start < old_visible.start) {
+            vim_keyword_cache_rescan(app, buffer, cache,
+                                     make_range(visible.start, old_visible.start));
+        }
+        if (old_visible.end < visible.end) {
+            vim_keyword_cache_rescan(app, buffer, cache,
+                                     make_range(old_visible.end, visible.end));
+        }
+        for (int i = 0; i < cache->dirty.count; ++i) {
+            vim_keyword_cache_rescan(app, buffer, cache, cache->dirty.items[i]);
+        }
+    }
+    cache->dirty.count = 0;
+}
+
+// Brings highlight up to date with the matches of pattern in visible. Does
+// nothing when the buffer, its edit version, the visible range and the
+// pattern are all unchanged since the last call.
+static void vim_update_search_highlight(struct Application_Links* app,
+                                        Buffer_Summary* buffer,
+                                        Vim_Search_Highlight* highlight,
+                                        Range visible, String pattern_text) {
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer->buffer_id);
+    if (buffer_state == nullptr ||
+        pattern_text.size > (int)sizeof(highlight->pattern)) {
+        highlight->markers.count = 0;
+        return;
+    }
+    if (highlight->buffer_id == buffer->buffer_id &&
+        highlight->edit_version == buffer_state->edit_version &&
+        highlight->buffer_size == buffer->size &&
+        highlight->visible.start == visible.start &&
+        highlight->visible.end == visible.end &&
+        highlight->pattern_size == pattern_text.size &&
+        memcmp(highlight->pattern, pattern_text.str, pattern_text.size) == 0) {
+        return;
+    }
+    highlight->buffer_id = buffer->buffer_id;
+    highlight->edit_version = buffer_state->edit_version;
+    highlight->buffer_size = buffer->size;
+    highlight->visible = visible;
+    highlight->pattern_size = pattern_text.size;
+    memcpy(highlight->pattern, pattern_text.str, pattern_text.size);
+    highlight->markers.count = 0;
+
+    int m = pattern_text.size;
+    int first = visible.start - (m - 1);
+    if (first < 0) { first = 0; }
+    Vim_Match_Cache* cache = &buffer_state->matches;
+    bool cache_usable = vim_match_cache_is_complete(cache) &&
+                        cache->buffer_size == buffer->size &&
+                        cache->pattern_size == m &&
+                        memcmp(cache->pattern, pattern_text.str, m) == 0;
+    if (cache_usable) {
+        int index = vim_lower_bound(cache->matches.items, cache->matches.count,
+                                    first);
+        for (; index < cache->matches.count; ++index) {
+            int at = cache->matches.items[index];
+            if (at >= visible.end) { break; }
+            Marker* pair = vim_array_insert(&highlight->markers,
+                                            highlight->markers.count, 2);
+            if (pair == nullptr) { break; }
+            pair[0] = {};
+            pair[1] = {};
+            pair[0].pos = at;
+            pair[1].pos = at + m;
+        }
+        return;
+    }
+
+    // The match cache is still catching up: scan the visible text directly.
+    int last = visible.end + (m - 1);
+    if (last > buffer->size) { last = buffer->size; }
+    if (last - first < m) { return; }
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    char* text = push_array(&global_part, char, last - first);
+    if (text && buffer_read_range(app, buffer, first, last, text)) {
+        Vim_Search_Pattern pattern;
+        vim_search_pattern_init(&pattern, pattern_text);
+        int offset = 0;
+        for (;;) {
+            int found = vim_search_text_forward(&pattern, text + offset,
+                                                last - first - offset);
+            if (found < 0) { break; }
+            int at = first + offset + found;
+            if (at >= visible.end) { break; }
+            Marker* pair = vim_array_insert(&highlight->markers,
+                                            highlight->markers.count, 2);
+            if (pair == nullptr) { break; }
+            pair[0] = {};
+            pair[1] = {};
+            pair[0].pos = at;
+            pair[1].pos = at + m;
+            offset += found + 1;
+        }
+    }
+    end_temp_memory(temp);
+}
+
+//=============================================================================
+// > Macros <                                                          @macros
+// q{reg} records the commands the keymaps dispatch (seen through
+// vim_hook_command_caller_func) into a register as compact binary events, and
+// @{reg} calls those commands again directly, without going back through the
+// keymaps or redrawing between them.
+//
+// An event is a tag byte, then for commands a 16-bit index into
+// macro_state.commands, then the key code and character as varints. Text that
+// prompts read while recording (a / pattern, a : command) is stored as input
+// events right after the command that asked for it.
+//=============================================================================
+
+enum Vim_Macro_Event_Tag {
+    macro_event_command,
+    macro_event_input,
+    macro_event_input_abort,
+};
+
+struct Vim_Macro_Event {
+    Vim_Macro_Event_Tag tag;
+    int command;
+    Key_Code keycode;
+    Key_Code character;
+};
+
+struct Vim_Macro_Reader {
+    const uint8_t* at;
+    const uint8_t* end;
+};
+
+// Nested @ inside a macro stops this deep.
+#define VIM_MACRO_MAX_DEPTH 16
+
+struct Vim_Macro_State {
+    bool recording;
+    Register_Id recording_register;
+    Vim_Array<uint8_t> recorded;
+    // Every command seen while recording; events refer to them by index.
+    Vim_Array<Generic_Command> commands;
+    // The events being replayed (innermost @ first), or null when not
+    // replaying, and the input of the command being replayed.
+    Vim_Macro_Reader* reader;
+    int depth;
+    User_Input input;
+    Register_Id last_register;
+};
+
+static Vim_Macro_State macro_state = {};
+
+static inline bool vim_macro_replaying() {
+    return macro_state.reader != nullptr;
+}
+
+static void vim_macro_put_varint(Vim_Array<uint8_t>* out, uint32_t value) {
+    while (value >= 0x80) {
+        vim_array_push(out, (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    vim_array_push(out, (uint8_t)value);
+}
+
+static bool vim_macro_get_varint(Vim_Macro_Reader* reader, uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (reader->at >= reader->end) { return false; }
+        uint8_t byte = *reader->at++;
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int vim_macro_command_index(Generic_Command command) {
+    for (int i = 0; i < macro_state.commands.count; ++i) {
+        if (macro_state.commands.items[i].command == command.command) { return i; }
+    }
+    if (macro_state.commands.count > 0xFFFF) { return -1; }
+    if (!vim_array_push(&macro_state.commands, command)) { return -1; }
+    return macro_state.commands.count - 1;
+}
+
+static void vim_macro_put_event(Vim_Array<uint8_t>* out, Vim_Macro_Event_Tag tag,
+                                Generic_Command command, Key_Code keycode,
+                                Key_Code character) {
+    vim_array_push(out, (uint8_t)tag);
+    if (tag == macro_event_command) {
+        int index = vim_macro_command_index(command);
+        if (index < 0) {
+            out->count -= 1;
+            return;
+        }
+        vim_array_push(out, (uint8_t)(index & 0xFF));
+        vim_array_push(out, (uint8_t)(index >> 8));
+    }
+    vim_macro_put_varint(out, keycode);
+    vim_macro_put_varint(out, character);
+}
+
+static bool vim_macro_get_event(Vim_Macro_Reader* reader, Vim_Macro_Event* event) {
+    if (reader->at >= reader->end) { return false; }
+    Vim_Macro_Reader next = *reader;
+    event->tag = (Vim_Macro_Event_Tag)*next.at++;
+    event->command = -1;
+    if (event->tag == macro_event_command) {
+        if (next.end - next.at < 2) { return false; }
+        event->command = next.at[0] | (next.at[1] << 8);
+        next.at += 2;
+    }
+    uint32_t keycode, character;
+    if (!vim_macro_get_varint(&next, &keycode) ||
+        !vim_macro_get_varint(&next, &character)) {
+        return false;
+    }
+    event->keycode = (Key_Code)keycode;
+    event->character = (Key_Code)character;
+    *reader = next;
+    return true;
+}
+
+static User_Input vim_macro_make_input(Vim_Macro_Event* event) {
+    User_Input in = {};
+    in.type = UserInputKey;
+    in.abort = (event->tag == macro_event_input_abort);
+    in.key.keycode = event->keycode;
+    in.key.character = event->character;
+    in.key.character_no_caps_lock = event->character;
+    return in;
+}
+
+// What the running command was triggered by. Commands that read their key
+// should use this instead of get_command_input so that they replay.
+static User_Input vim_command_input(struct Application_Links* app) {
+    if (vim_macro_replaying()) { return macro_state.input; }
+    return get_command_input(app);
+}
+
+// get_user_input for prompts. Records the answer while a macro is being
+// recorded, and gives back the recorded one while it replays. A replay that
+// runs out of recorded answers aborts the prompt.
+static User_Input vim_get_user_input(struct Application_Links* app,
+                                     Input_Type_Flag get_type,
+                                     Input_Type_Flag abort_type) {
+    if (vim_macro_replaying()) {
+        Vim_Macro_Reader peek = *macro_state.reader;
+        Vim_Macro_Event event;
+        if (vim_macro_get_event(&peek, &event) && event.tag != macro_event_command) {
+            *macro_state.reader = peek;
+            return vim_macro_make_input(&event);
+        }
+        User_Input abort = {};
+        abort.abort = true;
+        return abort;
+    }
+    User_Input in = get_user_input(app, get_type, abort_type);
+    if (macro_state.recording) {
+        Generic_Command none = {};
+        vim_macro_put_event(&macro_state.recorded,
+                            in.abort ? macro_event_input_abort : macro_event_input,
+                            none, in.key.keycode, in.key.character);
+    }
+    return in;
+}
+
+// write_character reads its key from get_command_input, which still holds
+// the @ during a replay, so the replay types the recorded key itself.
+static void vim_macro_write_character(struct Application_Links* app,
+                                      User_Input in) {
+    uint8_t character[4];
+    uint32_t length = to_writable_character(in, character);
+    if (length != 0) {
+        write_character_parameter(app, character, length);
+    }
+}
+
+static void vim_macro_exec(struct Application_Links* app, Generic_Command command) {
+    if (command.command == write_character) {
+        vim_macro_write_character(app, macro_state.input);
+    } else {
+        exec_command(app, command);
+    }
+    // exec_command skips the command caller, which would otherwise notice a
+    // command that moved to another view.
+    vim_sync_active_view(app);
+}
+
+// Runs the events count times. Returns the number of commands run.
+static int64_t vim_macro_replay(struct Application_Links* app, Vim_Register* reg,
+                                int count) {
+    if (macro_state.depth >= VIM_MACRO_MAX_DEPTH || reg->size == 0) { return 0; }
+    // The macro may well overwrite its own register.
+    int size = reg->size;
+    uint8_t* copy = (uint8_t*)malloc(size);
+    if (copy == nullptr) { return 0; }
+    vim_register_copy_out(reg, (char*)copy);
+
+    Vim_Macro_Reader* outer = macro_state.reader;
+    User_Input outer_input = macro_state.input;
+    Vim_Macro_Reader reader;
+    macro_state.reader = &reader;
+    macro_state.depth += 1;
+
+    int64_t commands_run = 0;
+    for (int i = 0; i < count; ++i) {
+        reader.at = copy;
+        reader.end = copy + size;
+        Vim_Macro_Event event;
+        while (vim_macro_get_event(&reader, &event)) {
+            // Input nobody asked for: the prompt that recorded it must have
+            // ended early this time.
+            if (event.tag != macro_event_command) { continue; }
+            if (event.command >= macro_state.commands.count) { continue; }
+            macro_state.input = vim_macro_make_input(&event);
+            macro_state.input.command = macro_state.commands.items[event.command];
+            vim_macro_exec(app, macro_state.input.command);
+            commands_run += 1;
+        }
+    }
+
+    macro_state.depth -= 1;
+    macro_state.reader = outer;
+    macro_state.input = outer_input;
+    free(copy);
+    return commands_run;
+}
+
+CUSTOM_COMMAND_SIG(vim_search_next);
+
+namespace {
+
+// Forward declare these for ease of use since they call between each other
+static void enter_normal_mode(struct Application_Links *app, int buffer_id);
+static void enter_insert_mode(struct Application_Links *app, int buffer_id);
+static void update_visual_range(struct Application_Links* app, int end_new);
+static void update_visual_line_range(struct Application_Links* app,
+                                     int end_new);
+static void end_visual_selection(struct Application_Links* app);
+static void copy_into_register(struct Application_Links* app,
+                               Buffer_Summary* buffer, Range range,
+                               Register_Id regid, bool is_line, bool is_delete);
+static bool active_view_to_line(struct Application_Links* app, int line);
+static int vim_line_of_pos(struct Application_Links* app, Buffer_Summary* buffer,
+                           int pos);
+static int get_line_start(struct Application_Links* app, int cursor = -1);
+static int get_cursor_pos(struct Application_Links* app);
+static char get_cursor_char(struct Application_Links* app, int offset = 0);
+static void push_to_chord_bar(struct Application_Links* app, const String str);
+static void end_chord_bar(struct Application_Links* app);
+static void clear_register_selection();
+static void vim_block_finish_insert(struct Application_Links* app);
+static void vim_shift_lines(struct Application_Links* app, Buffer_Summary* buffer,
+                            int first_line, int last_line, int levels);
+static void vim_exec_action(struct Application_Links* app, Range range,
+                            bool is_line = false,
+                            Custom_Command_Function* motion = nullptr);
+
+// Counts past this stop accumulating digits.
+#define VIM_MAX_COUNT 999999
+
+static bool directory_cd_expand_user(
+    struct Application_Links* app,
+    char* dir_str,
+    int32_t* dir_len,
+    int32_t dir_capacity,
+    char* rel_path,
+    int32_t rel_len) {
+    if (rel_len > 0 && rel_path[0] == '~') {
+        int32_t home_dir_len = get_user_home_dir(nullptr, 0);
+        int32_t expanded_len = home_dir_len + (rel_len - 1);
+        if (expanded_len > dir_capacity) { return false; }
+        get_user_home_dir(dir_str, dir_capacity);
+        String dir = make_string_cap(dir_str, home_dir_len, dir_capacity);
+        append_ss(&dir, make_string(rel_path + 1, rel_len - 1));
+        *dir_len = dir.size;
+        return true;
+    } else {
+        return directory_cd(app, dir_str, dir_len, dir_capacity, rel_path, rel_len);
+    }
+}
+
+static void enter_insert_mode(struct Application_Links *app, int buffer_id) {
+    unsigned int access = AccessAll;
+    Buffer_Summary buffer;
+    
+    if (modal->mode == mode_visual ||
+        modal->mode == mode_visual_line ||
+        modal->mode == mode_visual_block) {
+        end_visual_selection(app);
+    }
+
+    modal->action = vimaction_none;
+    modal->count = modal->action_count = 0;
+    state.insert_capture.active = false;
+    modal->mode = mode_insert;
+    end_chord_bar(app);
+
+    buffer = get_buffer(app, buffer_id, access);
+    buffer_set_setting(app, &buffer, BufferSetting_MapID, mapid_insert);
+    modal->keymap = mapid_insert;
+
+    on_enter_insert_mode(app);
+}
+
+// A write into a register, between vim_register_begin_write and
+// vim_register_end_write.
+struct Vim_Register_Write {
+    Register_Id id;
+    Vim_Register* reg;
+    bool append;
+    bool is_line;
+};
+
+// Picks the register a yank or delete goes to, as vim does: the one the user
+// named, else "0 for a yank, "1 for a delete that spans lines (after rotating
+// the numbered registers) and "- for a smaller one. "" then reads the same
+// register. It is cleared for the new text unless "A to "Z asked to append.
+static Vim_Register_Write vim_register_begin_write(Register_Id regid, bool is_line,
+                                                   bool is_block, bool is_delete,
+                                                   bool spans_lines) {
+    Vim_Register_Write write = {};
+    write.append = modal->register_append && reg_a <= regid && regid <= reg_z;
+    write.is_line = is_line;
+    if (regid == reg_unnamed) {
+        if (!is_delete) {
+            regid = reg_0;
+        } else if (is_line || spans_lines) {
+            regid = reg_1;
+            state.numbered_first = (state.numbered_first + 8) % 9;
+            register_stats.rotations += 1;
+        } else {
+            regid = reg_small_delete;
+        }
+    }
+    state.unnamed_target = regid;
+    write.id = regid;
+
+    Vim_Register* reg = vim_register(regid);
+    write.reg = reg;
+    if (reg->is_macro || !write.append) {
+        write.append = false;
+        vim_register_clear(reg);
+        reg->is_macro = false;
+        reg->is_line = is_line;
+        reg->is_block = is_block;
+        register_stats.writes += 1;
+    } else {
+        // Lines and characters meet at a line break, and the result is lines
+        // if either was.
+        if ((is_line || is_block) && reg->size > 0 &&
+            vim_register_last_char(reg) != '\n') {
+            vim_register_append_text(reg, "\n", 1);
+        }
+        reg->is_block = reg->is_block && is_block;
+        register_stats.appends += 1;
+    }
+    return write;
+}
+
+static void vim_register_end_write(Vim_Register_Write* write) {
+    Vim_Register* reg = write->reg;
+    if (write->append && reg->is_line && !write->is_line &&
+        vim_register_last_char(reg) != '\n') {
+        vim_register_append_text(reg, "\n", 1);
+    }
+    reg->is_line = reg->is_line || write->is_line;
+    if (write->id == reg_system_clipboard) { vim_clipboard_changed(); }
+}
+
+// Stores range of buffer in the register vim_register_begin_write picks.
+static void copy_into_register(struct Application_Links* app,
+                               Buffer_Summary* buffer, Range range,
+                               Register_Id regid, bool is_line, bool is_delete) {
+    bool spans_lines = is_delete && !is_line &&
+        vim_line_of_pos(app, buffer, range.start) !=
+        vim_line_of_pos(app, buffer, range.end);
+    Vim_Register_Write write = vim_register_begin_write(regid, is_line, false,
+                                                        is_delete, spans_lines);
+    vim_register_append_range(app, buffer, write.reg, range.start, range.end);
+    vim_register_end_write(&write);
+}
+
+// Returns the size of the text pasted.
+static int paste_from_register(struct Application_Links* app,
+							    Buffer_Summary* buffer, int paste_pos,
+								Vim_Register* reg, int count = 1) {
+	if (reg == &state.registers[reg_system_clipboard]) {
+		vim_clipboard_fetch(app);
+	}
+    if (reg->is_macro || reg->size == 0) { return 0; }
+    if (count <= 1 && reg->chunk_count == 1) {
+        buffer_replace_range(app, buffer, paste_pos, paste_pos,
+                             reg->first->text, reg->size);
+        return reg->size;
+    }
+    // Text over several chunks, or a counted paste, goes in as a single edit.
+    if (count < 1) { count = 1; }
+    if (count > (1 << 30)/reg->size) { count = (1 << 30)/reg->size; }
+    char* text = (char*)malloc((size_t)reg->size*count);
+    if (text == nullptr) { return 0; }
+    vim_register_copy_out(reg, text);
+    for (int i = 1; i < count; ++i) {
+        memcpy(text + i*reg->size, text, reg->size);
+    }
+    buffer_replace_range(app, buffer, paste_pos, paste_pos,
+                         text, reg->size*count);
+    free(text);
+    return reg->size*count;
+}
+
+static void buffer_search(struct Application_Links* app, String word,
+                          View_Summary view, Search_Direction direction) {
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+    int start_pos = view.cursor.pos;
+
+    // Answer from the match cache once it covers the whole buffer. Until
+    // then, scan directly and let the cache catch up a step at a time.
+    int new_pos = -1;
+    int match_index = -1;
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer.buffer_id);
+    Vim_Match_Cache* cache = buffer_state ? &buffer_state->matches : nullptr;
+    if (cache && word.size <= (int)sizeof(cache->pattern) &&
+        vim_match_cache_update(app, &buffer, cache, word, VIM_MATCH_CACHE_STEP)) {
+        match_index = vim_match_cache_find(cache, start_pos, direction);
+        if (match_index >= 0) {
+            new_pos = cache->matches.items[match_index];
+        }
+    } else {
+        Vim_Search_Pattern pattern;
+        vim_search_pattern_init(&pattern, word);
+        new_pos = vim_search_buffer_wrapped(app, &buffer, &pattern, start_pos,
+                                            direction);
+    }
+    if (new_pos >= 0) {
+        view_set_cursor(app, &view, seek_pos(new_pos), true);
+        if (new_pos != start_pos) {
+            vim_record_jump(view.view_id, view.buffer_id, start_pos);
+        }
+    }
+    refresh_view(app, &view);
+    int actual_new_cursor_pos = view.cursor.pos;
+    // Update last_search
+    state.search_highlight_hidden = false;
+    state.last_search.direction = direction;
+    state.last_search.text = make_fixed_width_string(
+        state.last_search.text_buffer);
+    append_checked_ss(&state.last_search.text, word);
+    // Do the motion. '.' repeats it as n, with the pattern searched here.
+    vim_exec_action(app, make_range(start_pos, actual_new_cursor_pos), false,
+                    vim_search_next);
+    if (match_index >= 0) {
+        char count_space[32];
+        snprintf(count_space, sizeof(count_space), "[%d/%d]", match_index + 1,
+                 cache->matches.count);
+        end_chord_bar(app);
+        push_to_chord_bar(app, make_string(count_space, (int)strlen(count_space)));
+    }
+}
+
+// The buffer's line index, scanned to the end if it was not yet, or nullptr
+// if it could not be. The line-wise helpers below seek through the text
+// without it.
+static Vim_Line_Index* vim_get_line_index(struct Application_Links* app,
+                                          Buffer_Summary* buffer) {
+    if (!buffer->exists) { return nullptr; }
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer->buffer_id);
+    if (buffer_state == nullptr ||
+        !vim_line_index_update(app, buffer, &buffer_state->lines, buffer->size)) {
+        return nullptr;
+    }
+    return &buffer_state->lines;
+}
+
+static bool active_view_to_line(struct Application_Links* app, int line) {
+    View_Summary view = get_active_view(app, AccessProtected);
+    if (!view.exists) return false;
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    Vim_Line_Index* lines = vim_get_line_index(app, &buffer);
+    Buffer_Seek seek = lines ? seek_pos(vim_line_index_start(lines, line))
+                             : seek_line_char(line, 0);
+    vim_record_jump(view.view_id, view.buffer_id, view.cursor.pos);
+    if (!view_set_cursor(app, &view, seek, false)) {
+        return false;
+    }
+    return true;
+}
+
+// Line (1-based) that pos is on.
+static int vim_line_of_pos(struct Application_Links* app, Buffer_Summary* buffer,
+                           int pos) {
+    Vim_Line_Index* lines = vim_get_line_index(app, buffer);
+    if (lines) { return vim_line_index_line_of(lines, pos); }
+    Full_Cursor cursor;
+    if (!buffer_compute_cursor(app, buffer, seek_pos(pos), &cursor)) { return 1; }
+    return cursor.line;
+}
+
+// Byte range covering lines first_line through last_line, including the
+// newline that ends last_line.
+static Range vim_line_range_to_byte_range(struct Application_Links* app,
+                                          Buffer_Summary* buffer,
+                                          int first_line, int last_line) {
+    Vim_Line_Index* lines = vim_get_line_index(app, buffer);
+    if (lines) { return vim_line_index_byte_range(lines, first_line, last_line); }
+    Full_Cursor first;
+    Full_Cursor next;
+    Range result = make_range(0, buffer->size);
+    if (buffer_compute_cursor(app, buffer, seek_line_char(first_line, 1), &first)) {
+        result.start = first.pos;
+    }
+    if (last_line < buffer->line_count &&
+        buffer_compute_cursor(app, buffer, seek_line_char(last_line + 1, 1), &next)) {
+        result.end = next.pos;
+    }
+    return result;
+}
+
+static int get_current_view_buffer_id(struct Application_Links* app,
+                                      int access) {
+    View_Summary view = get_active_view(app, access);
+    return view.buffer_id;
+}
+
+static void set_current_keymap(struct Application_Links* app, int map) {
+    View_Summary view = get_active_view(app, AccessAll);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+    if (!buffer.exists) { return; }
+    buffer_set_setting(app, &buffer, BufferSetting_MapID, map);
+    modal->keymap = map;
+}
+
+static char get_cursor_char(struct Application_Links* app, int offset) {
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    char read; 
+    int res = buffer_read_range(app, &buffer, view.cursor.pos + offset,
+								view.cursor.pos + offset + 1, &read);
+    if (res) { return read; }
+    else { return 0; }
+}
+
+static int get_cursor_pos(struct Application_Links* app) {
+    View_Summary view = get_active_view(app, AccessAll);
+    return view.cursor.pos;
+}
+
+static int get_line_start(struct Application_Links* app, int cursor) {
+    unsigned int access = AccessAll;
+    View_Summary view = get_active_view(app, access);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, access);
+    if (cursor == -1) {
+        cursor = view.cursor.pos;
+    }
+    
+    Vim_Line_Index* lines = vim_get_line_index(app, &buffer);
+    if (lines) {
+        return vim_line_index_start(lines, vim_line_index_line_of(lines, cursor));
+    }
+    int new_pos = seek_line_beginning(app, &buffer, cursor);
+    return new_pos;
+}
+
+static int get_line_end(struct Application_Links* app, int cursor = -1) {
+    unsigned int access = AccessAll;
+    View_Summary view = get_active_view(app, access);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, access);
+    if (cursor == -1) {
+        cursor = view.cursor.pos;
+    }
+    
+    Vim_Line_Index* lines = vim_get_line_index(app, &buffer);
+    if (lines) {
+        return vim_line_index_end(lines, vim_line_index_line_of(lines, cursor));
+    }
+    int new_pos = seek_line_end(app, &buffer, cursor);
+    return new_pos;
+}
+
+// First non-blank on the line pos is on, or the line's end if it is blank.
+static int vim_first_nonblank(struct Application_Links* app,
+                              Buffer_Summary* buffer, int pos) {
+    Vim_Line_Index* lines = vim_get_line_index(app, buffer);
+    int start = lines ? vim_line_index_start(lines, vim_line_index_line_of(lines, pos))
+                      : seek_line_beginning(app, buffer, pos);
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    defer(end_temp_memory(temp));
+    Vim_Text_Scanner scanner;
+    if (!vim_scanner_init(&scanner, app, buffer)) { return start; }
+    return vim_word_skip(&scanner, start, 1, vim_classes_blank);
+}
+
+static void update_visual_range(struct Application_Links* app, int end_new) {
+    View_Summary view;
+    
+    unsigned int access = AccessOpen;
+    view = get_active_view(app, access);
+
+    modal->selection_cursor.end = end_new;
+    Range normalized = make_range(modal->selection_cursor.start, modal->selection_cursor.end);
+    modal->selection_range = make_range(normalized.start, normalized.end + 1);
+}
+
+static void update_visual_line_range(struct Application_Links* app, int end_new) {
+    View_Summary view;
+    
+    unsigned int access = AccessOpen;
+    view = get_active_view(app, access);
+
+    modal->selection_cursor.end = end_new;
+    Range normalized = make_range(modal->selection_cursor.start, modal->selection_cursor.end);
+    modal->selection_range = make_range(get_line_start(app, normalized.start), 
+                                       get_line_end(app, normalized.end) + 1);
+}
+
+static void end_visual_selection(struct Application_Links* app) {
+    View_Summary view;
+    
+    unsigned int access = AccessOpen;
+    view = get_active_view(app, access);
+
+    if (modal->selection_range.start >= 0) {
+        modal->last_visual_range = modal->selection_range;
+    }
+    modal->selection_range.start = modal->selection_range.end = -1;
+    modal->selection_cursor.start = modal->selection_cursor.end = -1;
+}
+
+static int push_to_string(char* str, size_t str_len, size_t str_max,
+                          char* dest, size_t dest_len) {
+    int i = 0;
+    for (i; i < dest_len && i < (str_max - str_len); ++i)
+    {
+        str[str_len + i] = dest[i];
+    }
+    return i + (int)str_len;
+}
+
+static void push_to_chord_bar(struct Application_Links* app, const String str) {
+    // Nobody sees the bar until the macro is done.
+    if (vim_macro_replaying()) { return; }
+    if (!modal->chord_bar.exists) {
+        if (start_query_bar(app, &modal->chord_bar.bar, 0) == 0) return;
+        modal->chord_bar.contents_len = 0;
+        memset(modal->chord_bar.contents, '\0',
+               ArrayCount(modal->chord_bar.contents));
+        modal->chord_bar.exists = true;
+    }
+    modal->chord_bar.contents_len = push_to_string(
+        modal->chord_bar.contents, modal->chord_bar.contents_len,
+        ArrayCount(modal->chord_bar.contents), str.str, str.size);
+    modal->chord_bar.bar.string = make_string(
+        modal->chord_bar.contents, modal->chord_bar.contents_len,
+        ArrayCount(modal->chord_bar.contents));
+}
+
+static void end_chord_bar(struct Application_Links* app) {
+    if (modal->chord_bar.exists) {
+        end_query_bar(app, &modal->chord_bar.bar, 0);
+        modal->chord_bar.contents_len = 0;
+        memset(modal->chord_bar.contents, '\0',
+               ArrayCount(modal->chord_bar.contents));
+        modal->chord_bar.exists = false;
+    }
+}
+
+static void clear_register_selection() {
+    modal->yank_register = modal->paste_register = reg_unnamed;
+    modal->register_append = false;
+}
+
+// The count for the command being run: at least 1, and 1 if none was typed,
+// in which case given is false. Consumes it.
+static int vim_take_count(struct Application_Links* app, bool* given = nullptr) {
+    int64_t count = modal->count > 0 ? modal->count : 1;
+    if (modal->action_count > 0) {
+        count *= modal->action_count;
+        if (count > VIM_MAX_COUNT) { count = VIM_MAX_COUNT; }
+    }
+    if (given) { *given = modal->count > 0 || modal->action_count > 0; }
+    modal->count_taken = (modal->count > 0 || modal->action_count > 0) ? (int)count : 0;
+    if (modal->count > 0 && modal->action == vimaction_none) {
+        // A bare motion; no operator will come along to clear the chord bar.
+        end_chord_bar(app);
+    }
+    modal->count = modal->action_count = 0;
+    return (int)count;
+}
+
+// Called as an operator chord starts.
+static void vim_hold_count_for_action() {
+    modal->action_count = modal->count;
+    modal->count = 0;
+}
+
+// The character typed after f/t/F/T, or the recorded one while '.' replays.
+static Key_Code vim_motion_character(struct Application_Links* app) {
+    if (!state.replaying) {
+        User_Input trigger = vim_command_input(app);
+        state.motion_character = trigger.key.character;
+    }
+    return state.motion_character;
+}
+
+// Keeps a command that edits by itself for '.'.
+static void vim_record_command(Custom_Command_Function* command, Register_Id reg) {
+    if (state.replaying) { return; }
+    Vim_Change* change = &state.last_change;
+    change->kind = change_command;
+    change->command = command;
+    change->count = modal->count_taken;
+    change->reg = reg;
+    change->text_size = 0;
+}
+
+// Starts following what gets typed, for change_insert and the c operator.
+static void vim_start_insert_capture(struct Application_Links* app) {
+    if (state.replaying) { return; }
+    state.insert_capture.active = true;
+    state.insert_capture.buffer_id = get_current_view_buffer_id(app, AccessAll);
+    state.insert_capture.start = -1;
+    state.last_change.text_size = 0;
+}
+
+static void vim_begin_recorded_insert(struct Application_Links* app,
+                                      Vim_Insert_Entry entry) {
+    if (state.replaying) { return; }
+    Vim_Change* change = &state.last_change;
+    change->kind = change_insert;
+    change->entry = entry;
+    change->count = 0;
+    vim_start_insert_capture(app);
+}
+
+static bool vim_change_text_reserve(Vim_Change* change, int size) {
+    if (size <= change->text_capacity) { return true; }
+    int capacity = change->text_capacity ? change->text_capacity : 64;
+    while (capacity < size) { capacity *= 2; }
+    char* text = (char*)realloc(change->text, capacity);
+    if (text == nullptr) { return false; }
+    change->text = text;
+    change->text_capacity = capacity;
+    return true;
+}
+
+// Mirrors a buffer edit into the captured insert text. Edits inside the typed
+// text (typing, backspacing, completions) are spliced in, edits before it
+// shift it, and an edit that cuts across its edge ends the capture.
+static void vim_capture_insert_edit(Buffer_ID buffer_id, int start, int end,
+                                    String text) {
+    Vim_Insert_Capture* capture = &state.insert_capture;
+    if (!capture->active || capture->buffer_id != buffer_id) { return; }
+    Vim_Change* change = &state.last_change;
+    if (capture->start < 0) {
+        if (start != end) { return; }
+        capture->start = start;
+    }
+    int region_start = capture->start;
+    int region_end = region_start + change->text_size;
+    if (end < region_start || (end == region_start && start < end)) {
+        capture->start += text.size - (end - start);
+        return;
+    }
+    if (start > region_end || (start == region_end && start < end)) {
+        return;
+    }
+    if (start < region_start || end > region_end) {
+        capture->active = false;
+        return;
+    }
+    int new_size = change->text_size - (end - start) + text.size;
+    if (!vim_change_text_reserve(change, new_size)) {
+        capture->active = false;
+        return;
+    }
+    int offset = start - region_start;
+    memmove(change->text + offset + text.size, change->text + (end - region_start),
+            region_end - end);
+    memcpy(change->text + offset, text.str, text.size);
+    change->text_size = new_size;
+}
 
-        if (pos > buffer->size) {
-            pos = buffer->size;
-        }
+static void vim_exec_action(struct Application_Links* app, Range range,
+                            bool is_line, Custom_Command_Function* motion) {
+    View_Summary view = get_active_view(app, AccessAll);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+
+    if (!state.replaying && motion && modal->mode == mode_normal &&
+        modal->action != vimaction_none && modal->action != vimaction_yank_range) {
+        Vim_Change* change = &state.last_change;
+        change->kind = change_operator;
+        change->action = modal->action;
+        change->command = motion;
+        change->character = state.motion_character;
+        change->count = modal->count_taken;
+        change->reg = modal->yank_register;
+        change->text_size = 0;
     }
 
-    return pos;
-}
+    switch (modal->action) {
+        case vimaction_delete_range: 
+        case vimaction_change_range: {
+            copy_into_register(app, &buffer, range, modal->yank_register,
+                               is_line, true);
+            clear_register_selection();
+            
+            if (modal->action == vimaction_change_range && state.replaying) {
+                // Put back what was typed the first time, in the same edit.
+                Vim_Change* change = &state.last_change;
+                buffer_replace_range(app, &buffer, range.start, range.end,
+                                     change->text, change->text_size);
+                int cursor = range.start + change->text_size - 1;
+                if (cursor < range.start) { cursor = range.start; }
+                view_set_cursor(app, &view, seek_pos(cursor), true);
+                break;
+            }
 
-static int buffer_seek_nonalphanumeric_left(Application_Links* app,
-                                            Buffer_Summary* buffer, int pos) {
-    char chunk[1024];
-    int chunk_size = sizeof(chunk);
-    Stream_Chunk stream = {};
-    
-    if (init_stream_chunk(&stream, app, buffer, pos, chunk, chunk_size)) {
-        char cursorch = stream.data[pos];
-        char nextch = cursorch; 
-        int still_looping = true;
-        do {
-            for (; pos >= stream.start; --pos) {
-                nextch = stream.data[pos];
-                if (!char_is_alpha_numeric(nextch)) {
-                    return pos;
-                }
+            buffer_replace_range(app, &buffer, range.start, range.end, "", 0);
+
+            if (modal->action == vimaction_change_range) {
+                enter_insert_mode(app, buffer.buffer_id);
+                vim_start_insert_capture(app);
             }
-            still_looping = backward_stream_chunk(&stream);
-        } while (still_looping);
+        } break;
 
-        if (pos > buffer->size) {
-            pos = buffer->size;
-        }
+        case vimaction_yank_range: {
+            copy_into_register(app, &buffer, range, modal->yank_register,
+                               is_line, false);
+            clear_register_selection();
+        } break;
+
+        case vimaction_indent_left_range:
+        case vimaction_indent_right_range: {
+            int first_line = vim_line_of_pos(app, &buffer, range.start);
+            int last_line = vim_line_of_pos(app, &buffer,
+                range.end > range.start ? range.end - 1 : range.start);
+            vim_shift_lines(app, &buffer, first_line, last_line,
+                            modal->action == vimaction_indent_right_range ? 1 : -1);
+        } break;
+
+        case vimaction_format_range: {
+            buffer_auto_indent(app, &buffer, range.start, range.end - 1,
+                               vim_tabstop, 0);
+        } break;
     }
 
-    return pos;
-}
+    switch (modal->mode) {
+        case mode_normal: {
+            enter_normal_mode(app, buffer.buffer_id);
+        } break;
 
-static Range get_word_under_cursor(struct Application_Links* app,
-                                   Buffer_Summary* buffer,
-                                   View_Summary* view) {
-    int pos = view->cursor.pos;
-    int start = buffer_seek_nonalphanumeric_left(app, buffer, pos) + 1;
-    int end = buffer_seek_nonalphanumeric_right(app, buffer, pos);
-    return make_range(start, end);
+        case mode_visual:
+        case mode_visual_block: {
+            update_visual_range(app, view.cursor.pos);
+            set_current_keymap(app, mapid_visual);
+        } break;
+
+        case mode_visual_line: {
+            update_visual_line_range(app, view.cursor.pos);
+            set_current_keymap(app, mapid_visual);
+        } break;
+    }
 }
 
 static void enter_normal_mode(struct Application_Links *app, int buffer_id) {
-    if (state.mode == mode_visual || state.mode == mode_visual_line) {
+    if (state.block_insert.active) {
+        vim_block_finish_insert(app);
+    }
+    if (modal->mode == mode_visual || modal->mode == mode_visual_line ||
+        modal->mode == mode_visual_block) {
         end_visual_selection(app);
     }
-    state.action = vimaction_none;
+    modal->action = vimaction_none;
+    modal->count = modal->action_count = 0;
+    state.insert_capture.active = false;
     end_chord_bar(app);
     Buffer_Summary buffer = get_buffer(app, buffer_id, AccessAll);
     buffer_set_setting(app, &buffer, BufferSetting_MapID, mapid_normal);
-    if (state.mode != mode_normal) {
-        state.mode = mode_normal;
+    modal->keymap = mapid_normal;
+    if (modal->mode != mode_normal) {
+        modal->mode = mode_normal;
         on_enter_normal_mode(app);
     }
 }
@@ -723,11 +2945,18 @@ static void buffer_query_search(struct Application_Links* app,
     char bar_string_space[256];
     bar.string = make_fixed_width_string(bar_string_space);
     bar.prompt = make_lit_string(direction == search_forward ? "/" : "?");
+    // Incremental search state. match_stack[n] is where the pattern's first
+    // n characters matched (or vim_incsearch_none/unknown), so backspace just
+    // pops back to an earlier answer.
+    int origin = view.cursor.pos;
+    int match_stack[sizeof(bar_string_space) + 1];
+    match_stack[0] = origin;
     // Handle the query bar
     User_Input in;
     while (true) {
-        in = get_user_input(app, EventOnAnyKey, EventOnEsc);
+        in = vim_get_user_input(app, EventOnAnyKey, EventOnEsc);
         if (in.abort) break;
+        int old_size = bar.string.size;
         if (in.key.keycode == '\n'){
             break;
         }
@@ -742,6 +2971,37 @@ static void buffer_query_search(struct Application_Links* app,
                 --bar.string.size;
             }
         }
+
+        if (!vim_incsearch || vim_macro_replaying() ||
+            bar.string.size == old_size) { continue; }
+        int size = bar.string.size;
+        if (size > old_size) {
+            int previous = match_stack[old_size];
+            if (old_size == 0 || previous == vim_incsearch_unknown) {
+                // Nothing is known yet: start right next to the cursor.
+                int last = buffer.size - 1;
+                previous = (direction == search_forward) ?
+                    (origin < last ? origin + 1 : 0) :
+                    (origin > 0 ? origin - 1 : last);
+            }
+            int found = previous;
+            if (previous != vim_incsearch_none) {
+                Vim_Search_Pattern pattern;
+                vim_search_pattern_init(&pattern, bar.string);
+                found = vim_search_incremental(app, &buffer, &pattern, origin,
+                                               previous, direction);
+            }
+            match_stack[size] = found;
+        }
+        int shown = match_stack[size];
+        if (size == 0 || shown < 0) { shown = origin; }
+        view_set_cursor(app, &view, seek_pos(shown), true);
+    }
+    if (vim_incsearch) {
+        // Put the cursor back so the search below (and any pending operator)
+        // starts where the user did.
+        view_set_cursor(app, &view, seek_pos(origin), true);
+        refresh_view(app, &view);
     }
     if (in.abort) return;
     // Do the search
@@ -749,7 +3009,7 @@ static void buffer_query_search(struct Application_Links* app,
 }
 
 void reset_keymap_for_current_mode(struct Application_Links* app) {
-    switch (state.mode) {
+    switch (modal->mode) {
         case mode_normal: {
             set_current_keymap(app, mapid_normal);
         } break;
@@ -763,12 +3023,559 @@ void reset_keymap_for_current_mode(struct Application_Links* app) {
         } break;
 
         case mode_visual_line:
+        case mode_visual_block:
         case mode_visual: {
             set_current_keymap(app, mapid_visual);
         } break;
     }
 }
 
+// Visual block:                                                        @block
+// Ctrl-V selects the columns between the selection's two corners on every
+// line between them. Columns are byte offsets into the line, so a tab is one
+// column wide. A column inside a UTF-8 character takes in the whole
+// character, so the block never splits one, and r puts one character in
+// place of each character, not each byte. d, y, r and p make all of their changes with one
+// buffer_batch_edit, which is one undo step however many lines it touches.
+// I, A and c cannot be one step: 4coder 4.0.30 has no way to group undo
+// history, and the text has to be typed into the buffer to be seen. See
+// vim_block_begin_insert for the steps they take.
+
+struct Vim_Block_Line {
+    // The line, without its newline.
+    int start;
+    int end;
+};
+
+struct Vim_Block {
+    int first_line;
+    int last_line;
+    // Columns first_col through last_col are in the block.
+    int first_col;
+    int last_col;
+    // Lines first_line to last_line, and their text, read in one go.
+    Vim_Array<Vim_Block_Line> lines;
+    char* text;
+    int text_start;
+};
+
+static void vim_block_free(Vim_Block* block) {
+    vim_array_free(&block->lines);
+    free(block->text);
+    block->text = nullptr;
+}
+
+// The line, without its newline.
+static Range vim_line_bounds(struct Application_Links* app, Buffer_Summary* buffer,
+                             int line) {
+    Range range = vim_line_range_to_byte_range(app, buffer, line, line);
+    if (line < buffer->line_count && range.end > range.start) { range.end -= 1; }
+    return range;
+}
+
+// Reads block->first_line through block->last_line.
+static bool vim_block_read_lines(struct Application_Links* app,
+                                 Buffer_Summary* buffer, Vim_Block* block) {
+    Range range = vim_line_range_to_byte_range(app, buffer, block->first_line,
+                                               block->last_line);
+    int size = range.end - range.start;
+    block->text = (char*)malloc(size > 0 ? size : 1);
+    block->text_start = range.start;
+    if (block->text == nullptr ||
+        !buffer_read_range(app, buffer, range.start, range.end, block->text)) {
+        vim_block_free(block);
+        return false;
+    }
+    int at = 0;
+    for (int line = block->first_line; line <= block->last_line && at <= size; ++line) {
+        char* newline = (char*)memchr(block->text + at, '\n', size - at);
+        int end = newline ? (int)(newline - block->text) : size;
+        Vim_Block_Line block_line = { range.start + at, range.start + end };
+        if (!vim_array_push(&block->lines, block_line)) {
+            vim_block_free(block);
+            return false;
+        }
+        at = end + 1;
+    }
+    block->last_line = block->first_line + block->lines.count - 1;
+    return block->lines.count > 0;
+}
+
+// The lines and columns between the corners of a visual selection.
+static void vim_block_from_selection(struct Application_Links* app,
+                                     Buffer_Summary* buffer, Range corners,
+                                     Vim_Block* block) {
+    *block = {};
+    int corner_a = corners.start;
+    int corner_b = corners.end;
+    int line_a = vim_line_of_pos(app, buffer, corner_a);
+    int line_b = vim_line_of_pos(app, buffer, corner_b);
+    int col_a = corner_a - vim_line_bounds(app, buffer, line_a).start;
+    int col_b = corner_b - vim_line_bounds(app, buffer, line_b).start;
+    block->first_line = line_a < line_b ? line_a : line_b;
+    block->last_line = line_a < line_b ? line_b : line_a;
+    block->first_col = col_a < col_b ? col_a : col_b;
+    block->last_col = col_a < col_b ? col_b : col_a;
+}
+
+static bool vim_block_read(struct Application_Links* app, Buffer_Summary* buffer,
+                           Vim_Block* block) {
+    vim_block_from_selection(app, buffer, modal->selection_cursor, block);
+    return vim_block_read_lines(app, buffer, block);
+}
+
+// The part of line inside the block, clipped to the line.
+static Range vim_block_clip(Vim_Block* block, Vim_Block_Line line) {
+    int start = line.start + block->first_col;
+    int end = line.start + block->last_col + 1;
+    if (start > line.end) { start = line.end; }
+    if (end > line.end) { end = line.end; }
+    return make_range(start, end);
+}
+
+static char* vim_block_text_at(Vim_Block* block, int pos) {
+    return block->text + (pos - block->text_start);
+}
+
+static bool vim_utf8_is_continuation(char c) {
+    return ((uint8_t)c & 0xC0) == 0x80;
+}
+
+// Moves pos, on line, off the middle of a UTF-8 character: back to its first
+// byte, or with forward on past its last.
+static int vim_block_snap(Vim_Block* block, Vim_Block_Line line, int pos,
+                          bool forward) {
+    while (pos > line.start && pos < line.end &&
+           vim_utf8_is_continuation(*vim_block_text_at(block, pos))) {
+        pos += forward ? 1 : -1;
+    }
+    return pos;
+}
+
+// The part of the block's line i inside it, in whole characters.
+static Range vim_block_cells(Vim_Block* block, int i) {
+    Vim_Block_Line line = block->lines.items[i];
+    Range cells = vim_block_clip(block, line);
+    cells.start = vim_block_snap(block, line, cells.start, false);
+    cells.end = vim_block_snap(block, line, cells.end, true);
+    return cells;
+}
+
+// vim_block_cells for a line of the buffer the block has not read, as when
+// the render caller draws the block.
+static Range vim_block_cells_in_buffer(struct Application_Links* app,
+                                       Buffer_Summary* buffer, Vim_Block* block,
+                                       Vim_Block_Line line) {
+    Range cells = vim_block_clip(block, line);
+    char c = 0;
+    while (cells.start > line.start && cells.start < line.end &&
+           buffer_read_range(app, buffer, cells.start, cells.start + 1, &c) &&
+           vim_utf8_is_continuation(c)) {
+        cells.start -= 1;
+    }
+    while (cells.end > line.start && cells.end < line.end &&
+           buffer_read_range(app, buffer, cells.end, cells.end + 1, &c) &&
+           vim_utf8_is_continuation(c)) {
+        cells.end += 1;
+    }
+    return cells;
+}
+
+// The characters in [start, end) of the block's text.
+static int vim_block_count_chars(Vim_Block* block, int start, int end) {
+    int count = 0;
+    for (int pos = start; pos < end; ++pos) {
+        count += !vim_utf8_is_continuation(*vim_block_text_at(block, pos));
+    }
+    return count;
+}
+
+// Queues replacing [start, end) with size bytes of text, then fill copies of
+// the character fill, for one batch edit.
+static void vim_batch_push(Vim_Array<Buffer_Edit>* edits, Vim_Array<char>* strings,
+                           int start, int end, const char* text, int size,
+                           char fill = ' ', int fill_count = 0) {
+    Buffer_Edit edit;
+    edit.str_start = strings->count;
+    edit.len = fill_count + size;
+    edit.start = start;
+    edit.end = end;
+    if (edit.len > 0) {
+        char* dest = vim_array_insert(strings, strings->count, edit.len);
+        if (dest == nullptr) { return; }
+        memset(dest, fill, fill_count);
+        memcpy(dest + fill_count, text, size);
+    }
+    vim_array_push(edits, edit);
+}
+
+static void vim_batch_apply(struct Application_Links* app, Buffer_Summary* buffer,
+                            Vim_Array<Buffer_Edit>* edits,
+                            Vim_Array<char>* strings) {
+    if (edits->count > 0) {
+        buffer_batch_edit(app, buffer, strings->items, strings->count,
+                          edits->items, edits->count, BatchEdit_Normal);
+    }
+    vim_array_free(edits);
+    vim_array_free(strings);
+}
+
+// Stores the block, a line of text per line of block, in regid.
+static void vim_block_yank(Vim_Block* block, Register_Id regid, bool is_delete) {
+    Vim_Register_Write write = vim_register_begin_write(
+        regid, false, true, is_delete, block->lines.count > 1);
+    for (int i = 0; i < block->lines.count; ++i) {
+        Range cells = vim_block_cells(block, i);
+        if (i > 0) { vim_register_append_text(write.reg, "\n", 1); }
+        vim_register_append_text(write.reg, vim_block_text_at(block, cells.start),
+                                 cells.end - cells.start);
+    }
+    vim_register_end_write(&write);
+}
+
+static void vim_block_delete(struct Application_Links* app, Buffer_Summary* buffer,
+                             Vim_Block* block) {
+    Vim_Array<Buffer_Edit> edits = {};
+    Vim_Array<char> strings = {};
+    for (int i = 0; i < block->lines.count; ++i) {
+        Range cells = vim_block_cells(block, i);
+        if (cells.end > cells.start) {
+            vim_batch_push(&edits, &strings, cells.start, cells.end, "", 0);
+        }
+    }
+    vim_batch_apply(app, buffer, &edits, &strings);
+}
+
+// Goes to insert mode at column on the block's first line, for what is typed
+// there to go onto the lines after it too. With pad, lines too short for
+// column are filled out with spaces; without, lines no longer than column
+// are left alone.
+//
+// In undo steps, that is: padding the first line out to column, if it needs
+// it; the typing on the first line, which 4coder records as it goes; and one
+// batch putting the typed text on the other lines, from
+// vim_block_finish_insert. c deletes the block with one batch before all of
+// that.
+//
+// A column inside a character inserts before it, or after it for A, the one
+// insert that pads.
+static void vim_block_begin_insert(struct Application_Links* app,
+                                   View_Summary* view, Buffer_Summary* buffer,
+                                   Vim_Block* block, int column, bool pad) {
+    Vim_Block_Insert* insert = &state.block_insert;
+    free(insert->fill);
+    insert->fill = (uint8_t*)calloc(block->lines.count, 1);
+    if (insert->fill == nullptr) { return; }
+    for (int i = 1; i < block->lines.count; ++i) {
+        Vim_Block_Line line = block->lines.items[i];
+        insert->fill[i - 1] = pad || line.end - line.start > column;
+    }
+    insert->active = true;
+    insert->buffer_id = buffer->buffer_id;
+    insert->first_line = block->first_line;
+    insert->last_line = block->last_line;
+    insert->column = column;
+    insert->pad = pad;
+
+    Vim_Block_Line first = block->lines.items[0];
+    int pos = vim_block_snap(block, first, first.start + column, pad);
+    if (pos > first.end) {
+        if (pad) {
+            Vim_Array<Buffer_Edit> edits = {};
+            Vim_Array<char> strings = {};
+            vim_batch_push(&edits, &strings, first.end, first.end, "", 0, ' ',
+                           pos - first.end);
+            vim_batch_apply(app, buffer, &edits, &strings);
+        } else {
+            pos = first.end;
+        }
+    }
+    view_set_cursor(app, view, seek_pos(pos), true);
+    enter_insert_mode(app, buffer->buffer_id);
+    // '.' does not repeat a block insert.
+    state.last_change.kind = change_none;
+    vim_start_insert_capture(app);
+}
+
+static void vim_block_finish_insert(struct Application_Links* app) {
+    Vim_Block_Insert* insert = &state.block_insert;
+    insert->active = false;
+    Vim_Insert_Capture* capture = &state.insert_capture;
+    Vim_Change* change = &state.last_change;
+    bool typed = capture->active && capture->buffer_id == insert->buffer_id &&
+        capture->start >= 0 && change->text_size > 0 &&
+        memchr(change->text, '\n', change->text_size) == nullptr;
+    capture->active = false;
+
+    Buffer_Summary buffer = get_buffer(app, insert->buffer_id, AccessOpen);
+    Vim_Block block = {};
+    block.first_line = insert->first_line + 1;
+    block.last_line = insert->last_line;
+    if (typed && buffer.exists && block.first_line <= block.last_line &&
+        vim_block_read_lines(app, &buffer, &block)) {
+        Vim_Array<Buffer_Edit> edits = {};
+        Vim_Array<char> strings = {};
+        for (int i = 0; i < block.lines.count; ++i) {
+            if (!insert->fill[i]) { continue; }
+            Vim_Block_Line line = block.lines.items[i];
+            int pos = vim_block_snap(&block, line, line.start + insert->column,
+                                     insert->pad);
+            if (pos <= line.end) {
+                vim_batch_push(&edits, &strings, pos, pos,
+                               change->text, change->text_size);
+            } else if (insert->pad) {
+                vim_batch_push(&edits, &strings, line.end, line.end,
+                               change->text, change->text_size, ' ',
+                               pos - line.end);
+            }
+        }
+        vim_batch_apply(app, &buffer, &edits, &strings);
+        vim_block_free(&block);
+    }
+    free(insert->fill);
+    insert->fill = nullptr;
+}
+
+// Splits text into the lines a block paste puts one per line. A line-wise
+// register's last newline does not start another line.
+static void vim_split_paste_lines(const char* text, int size, bool is_line,
+                                  Vim_Array<Range>* pieces) {
+    if (is_line && size > 0 && text[size - 1] == '\n') { size -= 1; }
+    int at = 0;
+    for (;;) {
+        const char* newline = (const char*)memchr(text + at, '\n', size - at);
+        int end = newline ? (int)(newline - text) : size;
+        vim_array_push(pieces, make_range(at, end));
+        if (newline == nullptr) { break; }
+        at = end + 1;
+    }
+}
+
+// Copies reg's text into a malloc'd buffer, for pastes that take it apart.
+static char* vim_register_flatten(Vim_Register* reg) {
+    char* text = (char*)malloc(reg->size > 0 ? reg->size : 1);
+    if (text) { vim_register_copy_out(reg, text); }
+    return text;
+}
+
+// p and P of a block register: its lines go into successive buffer lines at
+// pos's column, each repeated count times. Short lines are padded with spaces
+// and lines are added past the end of the buffer as needed.
+static void vim_paste_block(struct Application_Links* app, View_Summary* view,
+                            Buffer_Summary* buffer, Vim_Register* reg, int pos,
+                            int count) {
+    char* text = vim_register_flatten(reg);
+    if (text == nullptr) { return; }
+    Vim_Array<Range> pieces = {};
+    vim_split_paste_lines(text, reg->size, false, &pieces);
+
+    int line = vim_line_of_pos(app, buffer, pos);
+    int column = pos - vim_line_bounds(app, buffer, line).start;
+    Vim_Block block = {};
+    block.first_line = line;
+    block.last_line = line + pieces.count - 1;
+    if (block.last_line > buffer->line_count) { block.last_line = buffer->line_count; }
+    if (vim_block_read_lines(app, buffer, &block)) {
+        Vim_Array<Buffer_Edit> edits = {};
+        Vim_Array<char> strings = {};
+        for (int j = 0; j < pieces.count; ++j) {
+            Range piece = pieces.items[j];
+            int piece_size = piece.end - piece.start;
+            bool new_line = (j >= block.lines.count);
+            int at = buffer->size;
+            int fill = column;
+            if (!new_line) {
+                Vim_Block_Line target = block.lines.items[j];
+                at = vim_block_snap(&block, target, target.start + column, false);
+                fill = 0;
+                if (at > target.end) {
+                    fill = at - target.end;
+                    at = target.end;
+                }
+            }
+            // Pieces landing at the same spot, like the lines added at the
+            // end, join the edit already there.
+            Buffer_Edit* last = edits.count ? edits.items + edits.count - 1 : nullptr;
+            if (last == nullptr || last->start != at || last->end != at) {
+                vim_batch_push(&edits, &strings, at, at, "", 0);
+                if (edits.count == 0) { break; }
+                last = edits.items + edits.count - 1;
+            }
+            int size = new_line + fill + piece_size*count;
+            char* dest = vim_array_insert(&strings, strings.count, size);
+            if (dest == nullptr) { break; }
+            if (new_line) { *dest++ = '\n'; }
+            memset(dest, ' ', fill);
+            for (int k = 0; k < count; ++k) {
+                memcpy(dest + fill + k*piece_size, text + piece.start, piece_size);
+            }
+            last->len += size;
+        }
+        vim_batch_apply(app, buffer, &edits, &strings);
+        vim_block_free(&block);
+        view_set_cursor(app, view, seek_pos(pos), true);
+    }
+    vim_array_free(&pieces);
+    free(text);
+}
+
+// d, c, y, r and p on the visual block, then back to normal mode, or on to
+// insert mode for c. character is what r replaces with.
+static void vim_block_action(struct Application_Links* app, Pending_Action action,
+                             char character = 0, bool paste = false) {
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    Vim_Block block;
+    if (!buffer.exists || !vim_block_read(app, &buffer, &block)) {
+        clear_register_selection();
+        enter_normal_mode(app, view.buffer_id);
+        return;
+    }
+    int top_left = vim_block_cells(&block, 0).start;
+
+    if (paste) {
+        // The block becomes the register's lines, or its one line on every
+        // line, and what it held goes to "".
+        Vim_Register* reg = vim_register(modal->paste_register);
+        char* text = reg->is_macro ? nullptr : vim_register_flatten(reg);
+        if (text) {
+            Vim_Array<Range> pieces = {};
+            vim_split_paste_lines(text, reg->size, reg->is_line, &pieces);
+            clear_register_selection();
+            vim_block_yank(&block, reg_unnamed, true);
+            Vim_Array<Buffer_Edit> edits = {};
+            Vim_Array<char> strings = {};
+            for (int i = 0; i < block.lines.count; ++i) {
+                Range cells = vim_block_cells(&block, i);
+                Range piece = make_range(0, 0);
+                if (pieces.count == 1) { piece = pieces.items[0]; }
+                else if (i < pieces.count) { piece = pieces.items[i]; }
+                if (cells.end > cells.start || piece.end > piece.start) {
+                    vim_batch_push(&edits, &strings, cells.start, cells.end,
+                                   text + piece.start, piece.end - piece.start);
+                }
+            }
+            vim_batch_apply(app, &buffer, &edits, &strings);
+            vim_array_free(&pieces);
+            free(text);
+        }
+    } else if (action == vimaction_yank_range) {
+        vim_block_yank(&block, modal->yank_register, false);
+    } else if (character != 0) {
+        Vim_Array<Buffer_Edit> edits = {};
+        Vim_Array<char> strings = {};
+        for (int i = 0; i < block.lines.count; ++i) {
+            Range cells = vim_block_cells(&block, i);
+            if (cells.end > cells.start) {
+                vim_batch_push(&edits, &strings, cells.start, cells.end, "", 0,
+                               character,
+                               vim_block_count_chars(&block, cells.start, cells.end));
+            }
+        }
+        vim_batch_apply(app, &buffer, &edits, &strings);
+    } else if (action == vimaction_delete_range ||
+               action == vimaction_change_range) {
+        vim_block_yank(&block, modal->yank_register, true);
+        if (action == vimaction_change_range) {
+            // The lines to change are those with text in the block, which the
+            // delete does not alter.
+            vim_block_delete(app, &buffer, &block);
+            clear_register_selection();
+            vim_block_begin_insert(app, &view, &buffer, &block, block.first_col,
+                                   false);
+            vim_block_free(&block);
+            return;
+        }
+        vim_block_delete(app, &buffer, &block);
+    }
+    clear_register_selection();
+    vim_block_free(&block);
+    enter_normal_mode(app, buffer.buffer_id);
+    view_set_cursor(app, &view, seek_pos(top_left), true);
+}
+
+// Shifting:                                                            @shift
+// > and < move each line's indentation by vim_shiftwidth columns per level.
+// The lines are read once, every line's new indentation is worked out from
+// that copy, and the changes go in as one batch edit, so shifting a large
+// selection costs one pass over it and one undo step.
+
+// Keeps a runaway count from writing megabytes of indentation.
+#define VIM_SHIFT_MAX_WIDTH (1 << 16)
+
+// The width in columns of the indentation text[0, size).
+static int vim_indent_width(const char* text, int size) {
+    int width = 0;
+    for (int i = 0; i < size; ++i) {
+        width = (text[i] == '\t') ? (width/vim_tabstop + 1)*vim_tabstop : width + 1;
+    }
+    return width;
+}
+
+// Shifts first_line through last_line by levels shiftwidths: right when levels
+// is positive, left when it is negative. Empty lines are left alone, and a
+// line's indentation never goes below nothing. The cursor ends up on the
+// first line's text.
+static void vim_shift_lines(struct Application_Links* app, Buffer_Summary* buffer,
+                            int first_line, int last_line, int levels) {
+    if (vim_tabstop < 1) { vim_tabstop = 1; }
+    Vim_Block block = {};
+    block.first_line = first_line;
+    block.last_line = last_line;
+    if (!vim_block_read_lines(app, buffer, &block)) { return; }
+
+    int64_t shift = (int64_t)levels*vim_shiftwidth;
+    Vim_Array<Buffer_Edit> edits = {};
+    Vim_Array<char> strings = {};
+    for (int i = 0; i < block.lines.count; ++i) {
+        Vim_Block_Line line = block.lines.items[i];
+        const char* text = vim_block_text_at(&block, line.start);
+        int size = line.end - line.start;
+        if (size == 0) { continue; }
+        int indent = 0;
+        while (indent < size && (text[indent] == ' ' || text[indent] == '\t')) {
+            ++indent;
+        }
+
+        int64_t width = vim_indent_width(text, indent) + shift;
+        if (width < 0) { width = 0; }
+        if (width > VIM_SHIFT_MAX_WIDTH) { width = VIM_SHIFT_MAX_WIDTH; }
+        int tabs = vim_expandtab ? 0 : (int)width/vim_tabstop;
+        int spaces = (int)width - tabs*vim_tabstop;
+
+        // Leave whatever the old indentation shares with the new one in place,
+        // so a shift over spaces is a plain insert or delete.
+        int length = tabs + spaces;
+        int same = 0;
+        while (same < indent && same < length &&
+               text[same] == (same < tabs ? '\t' : ' ')) {
+            ++same;
+        }
+        if (same == indent && same == length) { continue; }
+        int new_tabs = same < tabs ? tabs - same : 0;
+        int new_spaces = length - same - new_tabs;
+        int pushed = edits.count;
+        vim_batch_push(&edits, &strings, line.start + same, line.start + indent,
+                       "", 0, '\t', new_tabs);
+        if (edits.count == pushed) { break; }
+        if (new_spaces > 0) {
+            char* dest = vim_array_insert(&strings, strings.count, new_spaces);
+            if (dest == nullptr) { break; }
+            memset(dest, ' ', new_spaces);
+            edits.items[edits.count - 1].len += new_spaces;
+        }
+    }
+    vim_block_free(&block);
+    vim_batch_apply(app, buffer, &edits, &strings);
+
+    View_Summary view = get_active_view(app, AccessProtected);
+    if (view.buffer_id == buffer->buffer_id) {
+        int start = vim_line_bounds(app, buffer, first_line).start;
+        view_set_cursor(app, &view, seek_pos(vim_first_nonblank(app, buffer, start)),
+                        true);
+    }
+}
+
 }  // namespace
 
 //=============================================================================
@@ -781,17 +3588,17 @@ CUSTOM_COMMAND_SIG(enter_normal_mode_on_current) {
 }
 
 CUSTOM_COMMAND_SIG(enter_replace_mode){
-    state.mode = mode_replace;
+    modal->mode = mode_replace;
     set_current_keymap(app, mapid_replace);
     clear_register_selection();
     on_enter_replace_mode(app);
 }
 
 CUSTOM_COMMAND_SIG(enter_visual_mode){
-    state.mode = mode_visual;
-    state.selection_cursor.start = get_cursor_pos(app);
-    state.selection_cursor.end = state.selection_cursor.start;
-    update_visual_range(app, state.selection_cursor.end);
+    modal->mode = mode_visual;
+    modal->selection_cursor.start = get_cursor_pos(app);
+    modal->selection_cursor.end = modal->selection_cursor.start;
+    update_visual_range(app, modal->selection_cursor.end);
 
     set_current_keymap(app, mapid_visual);
     clear_register_selection();
@@ -799,10 +3606,21 @@ CUSTOM_COMMAND_SIG(enter_visual_mode){
 }
 
 CUSTOM_COMMAND_SIG(enter_visual_line_mode){
-    state.mode = mode_visual_line;
-    state.selection_cursor.start = get_cursor_pos(app);
-    state.selection_cursor.end = state.selection_cursor.start;
-    update_visual_line_range(app, state.selection_cursor.end);
+    modal->mode = mode_visual_line;
+    modal->selection_cursor.start = get_cursor_pos(app);
+    modal->selection_cursor.end = modal->selection_cursor.start;
+    update_visual_line_range(app, modal->selection_cursor.end);
+
+    set_current_keymap(app, mapid_visual);
+    clear_register_selection();
+    on_enter_visual_mode(app);
+}
+
+CUSTOM_COMMAND_SIG(enter_visual_block_mode){
+    modal->mode = mode_visual_block;
+    modal->selection_cursor.start = get_cursor_pos(app);
+    modal->selection_cursor.end = modal->selection_cursor.start;
+    update_visual_range(app, modal->selection_cursor.end);
 
     set_current_keymap(app, mapid_visual);
     clear_register_selection();
@@ -825,7 +3643,7 @@ CUSTOM_COMMAND_SIG(replace_character) {
     if (get_cursor_char(app) != '\n') {
         delete_char(app);
     }
-    write_character(app);
+    vim_macro_write_character(app, vim_command_input(app));
 }
 
 CUSTOM_COMMAND_SIG(replace_character_then_normal) {
@@ -847,86 +3665,152 @@ CUSTOM_COMMAND_SIG(seek_bottom_of_file) {
     view_set_cursor(app, &view, seek_pos(buffer.size), true);
 }
 
-template <CUSTOM_COMMAND_SIG(command)>
+// Runs the movement count times (stopping early once it gets stuck) and then
+// applies any pending action once, over the whole distance moved. A jump
+// leaves its starting point in the jump list.
+template <CUSTOM_COMMAND_SIG(command), bool counted = true, bool jump = false>
 CUSTOM_COMMAND_SIG(compound_move_command){
     View_Summary view = get_active_view(app, AccessProtected);
     int before_pos = view.cursor.pos;
-    command(app);
+    int count = counted ? vim_take_count(app) : 1;
+    int after_pos = before_pos;
+    for (int i = 0; i < count; ++i) {
+        command(app);
+        refresh_view(app, &view);
+        if (view.cursor.pos == after_pos) { break; }
+        after_pos = view.cursor.pos;
+    }
+    if (jump && after_pos != before_pos) {
+        vim_record_jump(view.view_id, view.buffer_id, before_pos);
+    }
+    vim_exec_action(app, make_range(before_pos, after_pos), false,
+                    compound_move_command<command, counted, jump>);
+}
+
+// G and gg. With a count, both go to that line instead.
+template <CUSTOM_COMMAND_SIG(command)>
+CUSTOM_COMMAND_SIG(move_to_counted_line){
+    View_Summary view = get_active_view(app, AccessProtected);
+    int before_pos = view.cursor.pos;
+    bool given = false;
+    int line = vim_take_count(app, &given);
+    if (given) {
+        view_set_cursor(app, &view, seek_line_char(line, 1), true);
+    }
+    else {
+        command(app);
+    }
     refresh_view(app, &view);
-    int after_pos = view.cursor.pos;
-    vim_exec_action(app, make_range(before_pos, after_pos), false);
-}
-
-#define vim_move_left compound_move_command<move_left>
-#define vim_move_right compound_move_command<move_right>
-#define vim_move_end_of_line compound_move_command<seek_end_of_line>
-#define vim_move_beginning_of_line compound_move_command<seek_beginning_of_line>
-#define vim_move_whitespace_up compound_move_command<seek_whitespace_up>
-#define vim_move_whitespace_down compound_move_command<seek_whitespace_down>
-#define vim_move_to_top compound_move_command<seek_top_of_file>
-#define vim_move_to_bottom compound_move_command<seek_bottom_of_file>
-#define vim_move_click compound_move_command<click_set_cursor>
-#define vim_move_scroll compound_move_command<mouse_wheel_scroll>
-
-CUSTOM_COMMAND_SIG(move_forward_word_start){
-    View_Summary view;
-    Buffer_Summary buffer;
+    if (view.cursor.pos != before_pos) {
+        vim_record_jump(view.view_id, view.buffer_id, before_pos);
+    }
+    vim_exec_action(app, make_range(before_pos, view.cursor.pos), false,
+                    move_to_counted_line<command>);
+}
 
-    unsigned int access = AccessAll;
-    view = get_active_view(app, access);
-    buffer = get_buffer(app, view.buffer_id, access);
+#define vim_move_beginning_of_line compound_move_command<seek_beginning_of_line, false>
+#define vim_move_whitespace_up compound_move_command<seek_whitespace_up, true, true>
+#define vim_move_whitespace_down compound_move_command<seek_whitespace_down, true, true>
+#define vim_move_to_top move_to_counted_line<seek_top_of_file>
+#define vim_move_to_bottom move_to_counted_line<seek_bottom_of_file>
+#define vim_move_click compound_move_command<click_set_cursor, false>
+#define vim_move_scroll compound_move_command<mouse_wheel_scroll, false>
 
+// h and l seek straight to the counted character instead of stepping.
+CUSTOM_COMMAND_SIG(vim_move_left){
+    View_Summary view = get_active_view(app, AccessProtected);
     int pos1 = view.cursor.pos;
-    
-    int pos2 = buffer_seek_next_word(app, &buffer, pos1);
-
-    view_set_cursor(app, &view, seek_pos(pos2), true);
-    vim_exec_action(app, make_range(pos1, pos2), false);
+    int target = view.cursor.character_pos - vim_take_count(app);
+    if (target < 0) { target = 0; }
+    view_set_cursor(app, &view, seek_character_pos(target), true);
+    refresh_view(app, &view);
+    vim_exec_action(app, make_range(pos1, view.cursor.pos), false, vim_move_left);
 }
 
-CUSTOM_COMMAND_SIG(move_backward_word_start){
-    View_Summary view;
-    
-    unsigned int access = AccessAll;
-    view = get_active_view(app, access);
+CUSTOM_COMMAND_SIG(vim_move_right){
+    View_Summary view = get_active_view(app, AccessProtected);
+    int pos1 = view.cursor.pos;
+    int target = view.cursor.character_pos + vim_take_count(app);
+    view_set_cursor(app, &view, seek_character_pos(target), true);
+    refresh_view(app, &view);
+    vim_exec_action(app, make_range(pos1, view.cursor.pos), false, vim_move_right);
+}
 
+// 3$ ends on the end of the line two below.
+CUSTOM_COMMAND_SIG(vim_move_end_of_line){
+    View_Summary view = get_active_view(app, AccessProtected);
     int pos1 = view.cursor.pos;
-    
-    seek_white_or_token_left(app);
-    
+    int count = vim_take_count(app);
+    if (count > 1) {
+        move_vertical(app, (float)(count - 1));
+    }
+    seek_end_of_line(app);
     refresh_view(app, &view);
-    int pos2 = view.cursor.pos;
+    vim_exec_action(app, make_range(pos1, view.cursor.pos), false, vim_move_end_of_line);
+}
+
+CUSTOM_COMMAND_SIG(vim_count_digit){
+    User_Input trigger = vim_command_input(app);
+    int digit = (int)(trigger.key.character - '0');
+    if (digit < 0 || digit > 9) { return; }
+    if (modal->count <= (VIM_MAX_COUNT - digit)/10) {
+        modal->count = modal->count*10 + digit;
+    }
+    char str[2] = { (char)trigger.key.character, '\0' };
+    push_to_chord_bar(app, make_string(str, 1));
+}
 
-    vim_exec_action(app, make_range(pos1, pos2));
+// 0 is a count digit after 1-9 and the start of the line otherwise.
+CUSTOM_COMMAND_SIG(vim_count_digit_or_line_start){
+    if (modal->count > 0) {
+        vim_count_digit(app);
+    }
+    else {
+        vim_move_beginning_of_line(app);
+    }
 }
 
-CUSTOM_COMMAND_SIG(move_forward_word_end){
-    View_Summary view;
-    
-    unsigned int access = AccessOpen;
-    view = get_active_view(app, access);
+// w W b B e E ge gE, through the motion engine in 4coder_vim_motion.cpp. A
+// count is resolved in one scan. e and ge land on the last character of a
+// word, which an operator includes.
+template <Vim_Word_Motion motion, bool big>
+CUSTOM_COMMAND_SIG(vim_word_motion_command){
+    View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    if (!buffer.exists) { return; }
 
     int pos1 = view.cursor.pos;
-    move_right(app);
-    
-    seek_whitespace_right(app);
-    
-    refresh_view(app, &view);
-    int pos2 = view.cursor.pos;
-    move_left(app);
+    int count = vim_take_count(app);
+    int pos2 = vim_word_motion(app, &buffer, pos1, motion, big, count);
+    view_set_cursor(app, &view, seek_pos(pos2), true);
 
-    vim_exec_action(app, make_range(pos1, pos2));
+    Range range = make_range(pos1, pos2);
+    if (motion == word_motion_next_end || motion == word_motion_previous_end) {
+        if (range.end < buffer.size) { range.end += 1; }
+    }
+    vim_exec_action(app, range, false, vim_word_motion_command<motion, big>);
 }
 
+#define move_forward_word_start vim_word_motion_command<word_motion_next_start, false>
+#define move_forward_bigword_start vim_word_motion_command<word_motion_next_start, true>
+#define move_forward_word_end vim_word_motion_command<word_motion_next_end, false>
+#define move_forward_bigword_end vim_word_motion_command<word_motion_next_end, true>
+#define move_backward_word_start vim_word_motion_command<word_motion_previous_start, false>
+#define move_backward_bigword_start vim_word_motion_command<word_motion_previous_start, true>
+#define move_backward_word_end vim_word_motion_command<word_motion_previous_end, false>
+#define move_backward_bigword_end vim_word_motion_command<word_motion_previous_end, true>
+
 CUSTOM_COMMAND_SIG(newline_then_insert_before){
     seek_beginning_of_line(app);
     write_string(app, make_lit_string("\n"));
     move_left(app);
     enter_insert_mode(app, get_current_view_buffer_id(app, AccessAll));
+    vim_begin_recorded_insert(app, insert_entry_line_above);
 }
 
 CUSTOM_COMMAND_SIG(insert_at){
     enter_insert_mode(app, get_current_view_buffer_id(app, AccessAll));
+    vim_begin_recorded_insert(app, insert_entry_at_cursor);
 }
 
 CUSTOM_COMMAND_SIG(insert_after){
@@ -939,23 +3823,27 @@ CUSTOM_COMMAND_SIG(insert_after){
         move_right(app);
     }
     enter_insert_mode(app, view.buffer_id);
+    vim_begin_recorded_insert(app, insert_entry_after_cursor);
 }
 
 CUSTOM_COMMAND_SIG(seek_eol_then_insert){
     seek_end_of_line(app);
     enter_insert_mode(app, get_current_view_buffer_id(app, AccessOpen));
+    vim_begin_recorded_insert(app, insert_entry_end_of_line);
 }
 
 CUSTOM_COMMAND_SIG(newline_then_insert_after){
     seek_end_of_line(app);
     write_string(app, make_lit_string("\n"));
     enter_insert_mode(app, get_current_view_buffer_id(app, AccessOpen));
+    vim_begin_recorded_insert(app, insert_entry_line_below);
 }
 
 CUSTOM_COMMAND_SIG(enter_chord_delete){
     set_current_keymap(app, mapid_chord_delete);
 
-    state.action = vimaction_delete_range;
+    modal->action = vimaction_delete_range;
+    vim_hold_count_for_action();
 
     push_to_chord_bar(app, lit("d"));
 }
@@ -963,7 +3851,8 @@ CUSTOM_COMMAND_SIG(enter_chord_delete){
 CUSTOM_COMMAND_SIG(enter_chord_change){
     set_current_keymap(app, mapid_chord_delete);
 
-    state.action = vimaction_change_range;
+    modal->action = vimaction_change_range;
+    vim_hold_count_for_action();
 
     push_to_chord_bar(app, lit("c"));
 }
@@ -971,27 +3860,31 @@ CUSTOM_COMMAND_SIG(enter_chord_change){
 CUSTOM_COMMAND_SIG(enter_chord_yank){
     set_current_keymap(app, mapid_chord_yank);
 
-    state.action = vimaction_yank_range;
+    modal->action = vimaction_yank_range;
+    vim_hold_count_for_action();
 
     push_to_chord_bar(app, lit("y"));
 }
 
 CUSTOM_COMMAND_SIG(enter_chord_indent_left){
     set_current_keymap(app, mapid_chord_indent_left);
-    state.action = vimaction_indent_left_range;
+    modal->action = vimaction_indent_left_range;
+    vim_hold_count_for_action();
     push_to_chord_bar(app, lit("<"));
 }
 
 CUSTOM_COMMAND_SIG(enter_chord_indent_right){
     set_current_keymap(app, mapid_chord_indent_right);
-    state.action = vimaction_indent_right_range;
+    modal->action = vimaction_indent_right_range;
+    vim_hold_count_for_action();
     push_to_chord_bar(app, lit(">"));
 }
 
 CUSTOM_COMMAND_SIG(enter_chord_format){
     set_current_keymap(app, mapid_chord_format);
 
-    state.action = vimaction_format_range;
+    modal->action = vimaction_format_range;
+    vim_hold_count_for_action();
 
     push_to_chord_bar(app, lit("="));
 }
@@ -1016,9 +3909,34 @@ CUSTOM_COMMAND_SIG(enter_chord_move_rfind){
     push_to_chord_bar(app, lit("F"));
 }
 
-CUSTOM_COMMAND_SIG(enter_chord_move_rtil){
-    set_current_keymap(app, mapid_chord_move_rtil);
-    push_to_chord_bar(app, lit("T"));
+CUSTOM_COMMAND_SIG(enter_chord_move_rtil){
+    set_current_keymap(app, mapid_chord_move_rtil);
+    push_to_chord_bar(app, lit("T"));
+}
+
+CUSTOM_COMMAND_SIG(enter_chord_move_in){
+    set_current_keymap(app, mapid_chord_move_in);
+    push_to_chord_bar(app, lit("i"));
+}
+
+CUSTOM_COMMAND_SIG(enter_chord_move_around){
+    set_current_keymap(app, mapid_chord_move_around);
+    push_to_chord_bar(app, lit("a"));
+}
+
+CUSTOM_COMMAND_SIG(enter_chord_mark){
+    set_current_keymap(app, mapid_chord_mark);
+    push_to_chord_bar(app, lit("m"));
+}
+
+CUSTOM_COMMAND_SIG(enter_chord_mark_jump_line){
+    set_current_keymap(app, mapid_chord_mark_jump_line);
+    push_to_chord_bar(app, lit("'"));
+}
+
+CUSTOM_COMMAND_SIG(enter_chord_mark_jump){
+    set_current_keymap(app, mapid_chord_mark_jump);
+    push_to_chord_bar(app, lit("`"));
 }
 
 CUSTOM_COMMAND_SIG(enter_chord_g){
@@ -1026,100 +3944,409 @@ CUSTOM_COMMAND_SIG(enter_chord_g){
     push_to_chord_bar(app, lit("g"));
 }
 
+// dd, yy and friends. A count takes in that many lines, all in one action.
 CUSTOM_COMMAND_SIG(move_line_exec_action){
     View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
 	int initial = view.cursor.pos;
-    seek_beginning_of_line(app);
-    refresh_view(app, &view);
-    int line_begin = view.cursor.pos;
-    seek_end_of_line(app);
-    refresh_view(app, &view);
-    int line_end = view.cursor.pos + 1;
-    vim_exec_action(app, make_range(line_begin, line_end), true);
-    view_set_cursor(app, &view, seek_pos(initial), true);
+    int line = view.cursor.line;
+    int count = vim_take_count(app);
+    // cc leaves the cursor where the lines were, ready to type, and >> and <<
+    // leave it on the first line's text.
+    bool keep_cursor = (modal->action != vimaction_change_range &&
+                        modal->action != vimaction_indent_left_range &&
+                        modal->action != vimaction_indent_right_range);
+    Range range = vim_line_range_to_byte_range(app, &buffer, line,
+                                               line + count - 1);
+    vim_exec_action(app, range, true, move_line_exec_action);
+    if (keep_cursor) {
+        view_set_cursor(app, &view, seek_pos(initial), true);
+    }
 }
 
 CUSTOM_COMMAND_SIG(vim_delete_line){
-    state.action = vimaction_delete_range;
+    modal->action = vimaction_delete_range;
     move_line_exec_action(app);
 }
 
 CUSTOM_COMMAND_SIG(yank_line){
-    state.action = vimaction_yank_range;
+    modal->action = vimaction_yank_range;
     move_line_exec_action(app);
 }
 
-template <Search_Direction seek_forward, bool include_found>
-CUSTOM_COMMAND_SIG(seek_for_character){
-    Buffer_Summary buffer;
-    View_Summary view;
-    User_Input trigger;
-    int pos1, pos2;
-    
-    unsigned int access = AccessProtected;
-    view = get_active_view(app, access);
-    buffer = get_buffer(app, view.buffer_id, access);
-
-    trigger = get_command_input(app);
-
-    pos1 = view.cursor.pos;
-    if (seek_forward) {
-        buffer_seek_delimiter_forward(app, &buffer, pos1+1, (char)trigger.key.character, &pos2);
-    }
-    else {
-        buffer_seek_delimiter_backward(app, &buffer, pos1-1, (char)trigger.key.character, &pos2);
+// Runs a find from the cursor and applies any pending action over it. f and t
+// take in the character they stop on; F and T leave the cursor character out.
+static void vim_run_find(struct Application_Links* app, char character,
+                         Search_Direction direction, bool til, bool again,
+                         Custom_Command_Function* motion) {
+    View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    if (!buffer.exists) { return; }
+    int pos1 = view.cursor.pos;
+    int count = vim_take_count(app);
+
+    // A t right before its character would find it again; ; and , step over
+    // it, as in vim.
+    int from = pos1;
+    char next = 0;
+    if (til && again &&
+        buffer_read_range(app, &buffer, pos1 + direction, pos1 + direction + 1,
+                          &next) && next == character) {
+        from += direction;
     }
-    move_left(app);
-    if (!include_found) { 
-        pos2 += seek_forward;
+    int hit = vim_find_character(app, &buffer, from, character, direction, count,
+                                 vim_find_in_line);
+    if (hit < 0) {
+        if (modal->mode == mode_normal) {
+            enter_normal_mode(app, buffer.buffer_id);
+        } else {
+            vim_exec_action(app, make_range(pos1, pos1));
+        }
+        return;
     }
+
+    int pos2 = til ? hit - direction : hit;
     view_set_cursor(app, &view, seek_pos(pos2), true);
-    
-    if (pos2 >= 0) {
-        vim_exec_action(app, make_range(pos1, pos2));
-    }
-    else {
-        //TODO(chronister): This will not be correct for visual mode!
+    Range range = make_range(pos1, pos2);
+    if (direction == search_forward) { range.end += 1; }
+    vim_exec_action(app, range, false, motion);
+}
+
+template <Search_Direction seek_forward, bool include_found>
+CUSTOM_COMMAND_SIG(seek_for_character){
+    char character = (char)vim_motion_character(app);
+    state.find_character = character;
+    state.find_direction = seek_forward;
+    state.find_til = !include_found;
+    vim_run_find(app, character, seek_forward, !include_found, false,
+                 seek_for_character<seek_forward, include_found>);
+}
+
+// ; and , repeat the last f/t/F/T, the same way or the other way.
+template <bool reverse>
+CUSTOM_COMMAND_SIG(vim_repeat_find){
+    if (state.find_character == 0) {
         enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+        return;
     }
+    Search_Direction direction = reverse
+        ? (Search_Direction)-state.find_direction : state.find_direction;
+    vim_run_find(app, state.find_character, direction, state.find_til, true,
+                 vim_repeat_find<reverse>);
 }
 
 #define vim_seek_find_character seek_for_character<search_forward, true>
 #define vim_seek_til_character seek_for_character<search_forward, false>
 #define vim_seek_rfind_character seek_for_character<search_backward, true>
 #define vim_seek_rtil_character seek_for_character<search_backward, false>
+#define vim_repeat_find_forward vim_repeat_find<false>
+#define vim_repeat_find_backward vim_repeat_find<true>
 
-//TODO(chronister): move_up and move_down both operate on lines, which is not reflected here.
-CUSTOM_COMMAND_SIG(vim_move_up){
-    View_Summary view;
-    int pos1, pos2;
-    
-    unsigned int access = AccessProtected;
-    view = get_active_view(app, access);
+// m{a-zA-Z}
+CUSTOM_COMMAND_SIG(vim_set_mark){
+    View_Summary view = get_active_view(app, AccessProtected);
+    User_Input trigger = vim_command_input(app);
+    vim_set_mark_at(app, (char)trigger.key.character, view.buffer_id,
+                    view.cursor.pos);
+    enter_normal_mode(app, view.buffer_id);
+}
 
-    pos1 = view.cursor.pos;
+// 'x goes to the first non-blank on the line of mark x and moves by lines;
+// `x goes to the mark itself. A mark in another buffer switches the view to
+// it, opening its file again if the buffer was closed, and drops any pending
+// operator.
+template <bool exact>
+CUSTOM_COMMAND_SIG(vim_jump_to_mark){
+    View_Summary view = get_active_view(app, AccessProtected);
+    char c = (char)vim_motion_character(app);
+    Buffer_ID buffer_id = 0;
+    int pos = -1;
+    if (!vim_get_mark(app, c, view.buffer_id, &buffer_id, &pos)) {
+        enter_normal_mode(app, view.buffer_id);
+        return;
+    }
 
-    move_up(app);
-    refresh_view(app, &view);
-    pos2 = view.cursor.pos;
-    
-    vim_exec_action(app, make_range(pos1, pos2));
+    if (buffer_id != view.buffer_id) {
+        // Only a jump that lands goes in the jump list.
+        Buffer_ID from_buffer = view.buffer_id;
+        int from_pos = view.cursor.pos;
+        if (buffer_id != 0) {
+            view_set_buffer(app, &view, buffer_id, 0);
+        } else {
+            Vim_Global_Mark* mark = global_marks + (vim_mark_slot(c) - 26);
+            if (!view_open_file(app, &view, mark->file_name, mark->file_name_size,
+                                true)) {
+                enter_normal_mode(app, view.buffer_id);
+                return;
+            }
+        }
+        vim_record_jump(view.view_id, from_buffer, from_pos);
+        refresh_view(app, &view);
+        Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+        if (pos > buffer.size) { pos = buffer.size; }
+        if (buffer_id == 0) { vim_set_mark_at(app, c, buffer.buffer_id, pos); }
+        if (!exact) { pos = vim_first_nonblank(app, &buffer, pos); }
+        view_set_cursor(app, &view, seek_pos(pos), true);
+        enter_normal_mode(app, buffer.buffer_id);
+        return;
+    }
+
+    vim_record_jump(view.view_id, view.buffer_id, view.cursor.pos);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    int pos1 = view.cursor.pos;
+    if (exact) {
+        view_set_cursor(app, &view, seek_pos(pos), true);
+        vim_exec_action(app, make_range(pos1, pos), false, vim_jump_to_mark<exact>);
+        return;
+    }
+    int line1 = vim_line_of_pos(app, &buffer, pos1);
+    int line2 = vim_line_of_pos(app, &buffer, pos);
+    view_set_cursor(app, &view, seek_pos(vim_first_nonblank(app, &buffer, pos)),
+                    true);
+    Range range = (line1 <= line2)
+        ? vim_line_range_to_byte_range(app, &buffer, line1, line2)
+        : vim_line_range_to_byte_range(app, &buffer, line2, line1);
+    vim_exec_action(app, range, true, vim_jump_to_mark<exact>);
 }
 
-CUSTOM_COMMAND_SIG(vim_move_down){
-    View_Summary view;
-    int pos1, pos2;
-    
-    unsigned int access = AccessProtected;
-    view = get_active_view(app, access);
+#define vim_jump_to_mark_line vim_jump_to_mark<false>
+#define vim_jump_to_mark_exact vim_jump_to_mark<true>
+
+// Goes to a jump or change list entry, switching buffers if need be.
+static void vim_go_to_position(struct Application_Links* app, View_Summary* view,
+                               Vim_Position position) {
+    if (position.buffer_id != view->buffer_id) {
+        view_set_buffer(app, view, position.buffer_id, 0);
+        refresh_view(app, view);
+    }
+    view_set_cursor(app, view, seek_pos(position.pos), true);
+    enter_normal_mode(app, view->buffer_id);
+}
+
+// ^O and ^I: count entries back or forward through the view's jump list.
+// Going back from the newest end first adds the cursor, so ^I can return.
+template <int direction>
+CUSTOM_COMMAND_SIG(vim_jump_list_step){
+    View_Summary view = get_active_view(app, AccessProtected);
+    int count = vim_take_count(app);
+    Vim_View_State* view_state = vim_get_view_state(view.view_id);
+    if (view_state == nullptr) { return; }
+    Vim_Position_Ring* jumps = &view_state->jumps;
+    if (direction < 0 && jumps->at == jumps->count) {
+        vim_record_jump(view.view_id, view.buffer_id, view.cursor.pos);
+        jumps->at = jumps->count - 1;
+    }
+    int target = jumps->at + direction*count;
+    if (target < 0 || target >= jumps->count) {
+        enter_normal_mode(app, view.buffer_id);
+        return;
+    }
+    jumps->at = target;
+    vim_go_to_position(app, &view, *vim_ring_get(jumps, target));
+}
+
+// g; and g,: count entries back or forward through the buffer's change list,
+// stopping at either end.
+template <int direction>
+CUSTOM_COMMAND_SIG(vim_change_list_step){
+    View_Summary view = get_active_view(app, AccessProtected);
+    int count = vim_take_count(app);
+    Vim_Buffer_State* buffer_state = vim_table_get(&buffer_states, view.buffer_id);
+    if (buffer_state == nullptr) {
+        enter_normal_mode(app, view.buffer_id);
+        return;
+    }
+    Vim_Position_Ring* changes = &buffer_state->changes;
+    int target = changes->at + direction*count;
+    if (target < 0) { target = 0; }
+    if (target >= changes->count) { target = changes->count - 1; }
+    if (target < 0 || target == changes->at) {
+        enter_normal_mode(app, view.buffer_id);
+        return;
+    }
+    changes->at = target;
+    vim_go_to_position(app, &view, *vim_ring_get(changes, target));
+}
+
+#define vim_jump_back vim_jump_list_step<-1>
+#define vim_jump_forward vim_jump_list_step<1>
+#define vim_change_back vim_change_list_step<-1>
+#define vim_change_forward vim_change_list_step<1>
+
+// iw, a(, i" and the rest, after an operator or in visual mode. The object is
+// found by the engine in 4coder_vim_motion.cpp; a count selects that many
+// words or paragraphs, or that many levels of brackets or tags out.
+template <bool around>
+CUSTOM_COMMAND_SIG(select_text_object){
+    View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    if (!buffer.exists) { return; }
+
+    char key = (char)vim_motion_character(app);
+    int count = vim_take_count(app);
+    int pos = view.cursor.pos;
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer.buffer_id);
+    Vim_Bracket_Index* brackets = nullptr;
+    if (buffer_state &&
+        vim_bracket_index_update(app, &buffer, &buffer_state->brackets,
+                                 VIM_BRACKET_INDEX_FRAME_STEP)) {
+        brackets = &buffer_state->brackets;
+    }
+    Range object;
+    bool is_line;
+    if (!vim_text_object(app, &buffer, brackets, pos, key, around, count, &object,
+                         &is_line)) {
+        if (modal->mode == mode_normal) {
+            enter_normal_mode(app, buffer.buffer_id);
+        } else {
+            vim_exec_action(app, make_range(pos, pos));
+        }
+        return;
+    }
+
+    if (modal->mode == mode_visual || modal->mode == mode_visual_line ||
+        modal->mode == mode_visual_block) {
+        modal->selection_cursor.start = object.start;
+        int last = (object.end > object.start) ? object.end - 1 : object.start;
+        view_set_cursor(app, &view, seek_pos(last), true);
+    } else {
+        view_set_cursor(app, &view, seek_pos(object.start), true);
+    }
+    vim_exec_action(app, object, is_line, select_text_object<around>);
+}
+
+#define vim_select_inner_object select_text_object<false>
+#define vim_select_around_object select_text_object<true>
+
+// The buffer's bracket index, brought up to date in full.
+static Vim_Bracket_Index* vim_complete_bracket_index(struct Application_Links* app,
+                                                     Buffer_Summary* buffer) {
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer->buffer_id);
+    if (buffer_state == nullptr ||
+        !vim_bracket_index_update(app, buffer, &buffer_state->brackets,
+                                  buffer->size)) {
+        return nullptr;
+    }
+    return &buffer_state->brackets;
+}
+
+// % jumps from the first bracket at or after the cursor on its line to its
+// partner. With a count it goes that far through the file in percent, to the
+// start of the line.
+CUSTOM_COMMAND_SIG(vim_move_matching_bracket){
+    View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    if (!buffer.exists) { return; }
+    int pos1 = view.cursor.pos;
+    bool given = false;
+    int count = vim_take_count(app, &given);
+
+    if (given) {
+        if (count > 100) { count = 100; }
+        int line1 = view.cursor.line;
+        int line2 = (count*buffer.line_count + 99)/100;
+        view_set_cursor(app, &view, seek_line_char(line2, 1), true);
+        refresh_view(app, &view);
+        int pos2 = view.cursor.pos;
+        vim_record_jump(view.view_id, view.buffer_id, pos1);
+        if (modal->action == vimaction_none) {
+            vim_exec_action(app, make_range(pos1, pos2), false,
+                            vim_move_matching_bracket);
+            return;
+        }
+        // Line-wise under an operator, as j and k are.
+        Range range = (line1 < line2)
+            ? vim_line_range_to_byte_range(app, &buffer, line1, line2)
+            : vim_line_range_to_byte_range(app, &buffer, line2, line1);
+        view_set_cursor(app, &view, seek_pos(pos1 < pos2 ? pos1 : pos2), true);
+        vim_exec_action(app, range, true, vim_move_matching_bracket);
+        return;
+    }
+
+    Vim_Bracket_Index* brackets = vim_complete_bracket_index(app, &buffer);
+    int bracket = brackets ? vim_bracket_index_next(brackets, pos1, false) : -1;
+    int partner = -1;
+    if (bracket >= 0 && bracket <= get_line_end(app, pos1)) {
+        partner = vim_bracket_index_partner(brackets, bracket);
+    }
+    if (partner < 0) {
+        // Nothing to match: a pending operator is dropped, a selection kept.
+        if (modal->mode != mode_visual && modal->mode != mode_visual_line &&
+            modal->mode != mode_visual_block) {
+            enter_normal_mode(app, buffer.buffer_id);
+        }
+        return;
+    }
+    view_set_cursor(app, &view, seek_pos(partner), true);
+    vim_record_jump(view.view_id, view.buffer_id, pos1);
+    Range range = make_range(pos1, partner);
+    range.end += 1;
+    vim_exec_action(app, range, false, vim_move_matching_bracket);
+}
+
+// Offset of the first ), ], } or " at or after pos, or -1. For jump-to-closing
+// commands.
+static int vim_find_next_closing(struct Application_Links* app,
+                                 Buffer_Summary* buffer, int pos) {
+    Vim_Bracket_Index* brackets = vim_complete_bracket_index(app, buffer);
+    int limit = buffer->size;
+    if (brackets) {
+        int bracket = vim_bracket_index_next(brackets, pos, true);
+        if (bracket >= 0) { limit = bracket; }
+    }
+    // Only the bytes before the bracket can hold an earlier quote.
+    int result = (limit < buffer->size) ? limit : -1;
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner scanner;
+    if (vim_scanner_init(&scanner, app, buffer)) {
+        for (int at = pos; at < limit;) {
+            if (!vim_scanner_load(&scanner, at, 1)) { break; }
+            int end = (scanner.end < limit) ? scanner.end : limit;
+            int found = vim_find_either_forward(scanner.window, at - scanner.start,
+                                                end - scanner.start, '"', '"');
+            if (found < end - scanner.start) {
+                result = scanner.start + found;
+                break;
+            }
+            at = end;
+        }
+    }
+    end_temp_memory(temp);
+    return result;
+}
 
-    pos1 = view.cursor.pos;
+// j and k move count lines in one seek. Under an operator they take in whole
+// lines, from the line the cursor started on to the one it ends on.
+static void vim_move_lines(struct Application_Links* app, int direction,
+                           Custom_Command_Function* motion) {
+    View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+    int pos1 = view.cursor.pos;
+    int line1 = view.cursor.line;
+    int count = vim_take_count(app);
 
-    move_down(app);
+    move_vertical(app, (float)(direction*count));
     refresh_view(app, &view);
-    pos2 = view.cursor.pos;
-    
-    vim_exec_action(app, make_range(pos1, pos2));
+    int pos2 = view.cursor.pos;
+    int line2 = view.cursor.line;
+
+    if (modal->action == vimaction_none) {
+        vim_exec_action(app, make_range(pos1, pos2), false, motion);
+        return;
+    }
+    Range range = (line1 < line2)
+        ? vim_line_range_to_byte_range(app, &buffer, line1, line2)
+        : vim_line_range_to_byte_range(app, &buffer, line2, line1);
+    view_set_cursor(app, &view, seek_pos(pos1 < pos2 ? pos1 : pos2), true);
+    vim_exec_action(app, range, true, motion);
+}
+
+CUSTOM_COMMAND_SIG(vim_move_up){
+    vim_move_lines(app, -1, vim_move_up);
+}
+
+CUSTOM_COMMAND_SIG(vim_move_down){
+    vim_move_lines(app, 1, vim_move_down);
 }
 
 CUSTOM_COMMAND_SIG(cycle_window_focus){
@@ -1136,7 +4363,7 @@ CUSTOM_COMMAND_SIG(open_window_hsplit){
     end_chord_bar(app);
 
     View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Top);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Top);
     set_active_view(app, &view);
 }
 
@@ -1146,7 +4373,7 @@ CUSTOM_COMMAND_SIG(open_window_dup_hsplit){
     end_chord_bar(app);
 
     View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Top);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Top);
     view_set_buffer(app, &new_view, view.buffer_id, 0);
     set_active_view(app, &view);
 }
@@ -1157,7 +4384,7 @@ CUSTOM_COMMAND_SIG(open_window_vsplit){
     end_chord_bar(app);
 
     View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Right);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
     set_active_view(app, &view);
 }
 
@@ -1167,7 +4394,7 @@ CUSTOM_COMMAND_SIG(open_window_dup_vsplit){
     end_chord_bar(app);
 
     View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Right);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
     view_set_buffer(app, &new_view, view.buffer_id, 0);
     set_active_view(app, &view);
 }
@@ -1268,10 +4495,7 @@ CUSTOM_COMMAND_SIG(close_window) {
     set_current_keymap(app, mapid_normal);
     end_chord_bar(app);
 
-    View_Summary view = get_view_first(app, AccessAll);
-    get_view_next(app, &view, AccessAll);
-    if (!view.exists) send_exit_signal(app);
-    else close_panel(app);
+    vim_close_active_view(app);
 }
 
 CUSTOM_COMMAND_SIG(combine_with_next_line) {
@@ -1287,18 +4511,21 @@ CUSTOM_COMMAND_SIG(paste_before_cursor_char) {
     view = get_active_view(app, access);
     buffer = get_buffer(app, view.buffer_id, access);
 
-    Vim_Register* reg = state.registers + state.paste_register;
-    if (reg->is_line) {
+    Vim_Register* reg = vim_register(modal->paste_register);
+    int count = vim_take_count(app);
+    vim_record_command(paste_before_cursor_char, modal->paste_register);
+    if (reg->is_block) {
+        vim_paste_block(app, &view, &buffer, reg, view.cursor.pos, count);
+    } else if (reg->is_line) {
         seek_beginning_of_line(app);
         refresh_view(app, &view);
         int paste_pos = view.cursor.pos;
-		paste_from_register(app, &buffer, paste_pos, reg); 
+		paste_from_register(app, &buffer, paste_pos, reg, count); 
         view_set_cursor(app, &view, seek_pos(paste_pos), true);
     } else {
         int paste_pos = view.cursor.pos;
-		paste_from_register(app, &buffer, paste_pos, reg); 
-        view_set_cursor(app, &view, seek_pos(paste_pos + reg->text.size - 1),
-                        true);
+		int pasted = paste_from_register(app, &buffer, paste_pos, reg, count); 
+        view_set_cursor(app, &view, seek_pos(paste_pos + pasted - 1), true);
     }
     clear_register_selection();
 }
@@ -1311,75 +4538,235 @@ CUSTOM_COMMAND_SIG(paste_after_cursor_char) {
     view = get_active_view(app, access);
     buffer = get_buffer(app, view.buffer_id, access);
 
-    Vim_Register* reg = state.registers + state.paste_register;
-    if (reg->is_line) {
+    Vim_Register* reg = vim_register(modal->paste_register);
+    int count = vim_take_count(app);
+    vim_record_command(paste_after_cursor_char, modal->paste_register);
+    if (reg->is_block) {
+        int pos = view.cursor.pos;
+        if (pos < get_line_end(app, pos)) { pos += 1; }
+        vim_paste_block(app, &view, &buffer, reg, pos, count);
+    } else if (reg->is_line) {
         seek_end_of_line(app);
         move_right(app);
         refresh_view(app, &view);
         int paste_pos = view.cursor.pos;
-		paste_from_register(app, &buffer, paste_pos, reg); 
+		paste_from_register(app, &buffer, paste_pos, reg, count); 
         view_set_cursor(app, &view, seek_pos(paste_pos), true);
     } else {
         int paste_pos = view.cursor.pos + 1;
-		paste_from_register(app, &buffer, paste_pos, reg); 
-        view_set_cursor(app, &view, seek_pos(paste_pos + reg->text.size - 1),
-                        true);
+		int pasted = paste_from_register(app, &buffer, paste_pos, reg, count); 
+        view_set_cursor(app, &view, seek_pos(paste_pos + pasted - 1), true);
     }
     clear_register_selection();
 }
 
 CUSTOM_COMMAND_SIG(visual_delete) {
-    state.action = vimaction_delete_range;
-    vim_exec_action(app, state.selection_range, state.mode == mode_visual_line);
+    if (modal->mode == mode_visual_block) {
+        vim_block_action(app, vimaction_delete_range);
+        return;
+    }
+    modal->action = vimaction_delete_range;
+    vim_exec_action(app, modal->selection_range, modal->mode == mode_visual_line);
     enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
 }
 
 CUSTOM_COMMAND_SIG(visual_change) {
-    state.action = vimaction_change_range;
-    vim_exec_action(app, state.selection_range, state.mode == mode_visual_line);
+    if (modal->mode == mode_visual_block) {
+        vim_block_action(app, vimaction_change_range);
+        return;
+    }
+    modal->action = vimaction_change_range;
+    vim_exec_action(app, modal->selection_range, modal->mode == mode_visual_line);
     enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
 }
 
 CUSTOM_COMMAND_SIG(visual_yank) {
-    state.action = vimaction_yank_range;
-    vim_exec_action(app, state.selection_range, state.mode == mode_visual_line);
+    if (modal->mode == mode_visual_block) {
+        vim_block_action(app, vimaction_yank_range);
+        return;
+    }
+    modal->action = vimaction_yank_range;
+    vim_exec_action(app, modal->selection_range, modal->mode == mode_visual_line);
     enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
 }
 
 CUSTOM_COMMAND_SIG(visual_format) {
-    state.action = vimaction_format_range;
-    vim_exec_action(app, state.selection_range, state.mode == mode_visual_line);
+    modal->action = vimaction_format_range;
+    vim_exec_action(app, modal->selection_range, modal->mode != mode_visual);
     enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
 }
 
-CUSTOM_COMMAND_SIG(visual_indent_right) {
-    state.action = vimaction_format_range; // TODO(chr)
-    vim_exec_action(app, state.selection_range, state.mode == mode_visual_line);
-    enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+// > and < in visual mode shift every selected line, by count shiftwidths.
+template <int direction>
+CUSTOM_COMMAND_SIG(vim_visual_shift) {
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    if (!buffer.exists) { return; }
+    int levels = vim_take_count(app);
+    int first_line = vim_line_of_pos(app, &buffer, modal->selection_cursor.start);
+    int last_line = vim_line_of_pos(app, &buffer, modal->selection_cursor.end);
+    if (first_line > last_line) {
+        int swap = first_line; first_line = last_line; last_line = swap;
+    }
+    enter_normal_mode(app, buffer.buffer_id);
+    vim_shift_lines(app, &buffer, first_line, last_line, direction*levels);
 }
 
-CUSTOM_COMMAND_SIG(visual_indent_left) {
-    state.action = vimaction_format_range; // TODO(chr)
-    vim_exec_action(app, state.selection_range, state.mode == mode_visual_line);
-    enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+#define visual_indent_right vim_visual_shift<1>
+#define visual_indent_left vim_visual_shift<-1>
+
+// I and A: in a block, insert on every line of it, before it or after it.
+// Otherwise insert before or after the selection.
+template <bool append>
+CUSTOM_COMMAND_SIG(vim_visual_insert) {
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    if (!buffer.exists) { return; }
+    if (modal->mode == mode_visual_block) {
+        Vim_Block block;
+        if (vim_block_read(app, &buffer, &block)) {
+            int column = append ? block.last_col + 1 : block.first_col;
+            vim_block_begin_insert(app, &view, &buffer, &block, column, append);
+            vim_block_free(&block);
+        }
+        return;
+    }
+    int pos = append ? modal->selection_range.end : modal->selection_range.start;
+    view_set_cursor(app, &view, seek_pos(pos), true);
+    enter_insert_mode(app, buffer.buffer_id);
+}
+
+#define visual_block_insert vim_visual_insert<false>
+#define visual_block_append vim_visual_insert<true>
+
+CUSTOM_COMMAND_SIG(enter_chord_visual_replace){
+    set_current_keymap(app, mapid_chord_visual_replace);
+}
+
+// r{char} in visual mode: every selected character but line breaks becomes
+// char.
+CUSTOM_COMMAND_SIG(visual_replace_character) {
+    User_Input in = vim_command_input(app);
+    char character = (char)in.key.character;
+    if (in.key.character == 0 || in.key.character == '\n') {
+        enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+        return;
+    }
+    if (modal->mode == mode_visual_block) {
+        vim_block_action(app, vimaction_none, character);
+        return;
+    }
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    Range range = modal->selection_range;
+    if (range.end > buffer.size) { range.end = buffer.size; }
+    if (buffer.exists && range.start >= 0 && range.end > range.start) {
+        int size = range.end - range.start;
+        char* text = (char*)malloc(size);
+        if (text && buffer_read_range(app, &buffer, range.start, range.end, text)) {
+            for (int i = 0; i < size; ++i) {
+                if (text[i] != '\n') { text[i] = character; }
+            }
+            buffer_replace_range(app, &buffer, range.start, range.end, text, size);
+        }
+        free(text);
+        view_set_cursor(app, &view, seek_pos(range.start), true);
+    }
+    enter_normal_mode(app, buffer.buffer_id);
+}
+
+// p and P in visual mode: the register replaces the selection, and what the
+// selection held goes to "".
+CUSTOM_COMMAND_SIG(visual_paste) {
+    if (modal->mode == mode_visual_block) {
+        vim_block_action(app, vimaction_none, 0, true);
+        return;
+    }
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    Vim_Register* reg = vim_register(modal->paste_register);
+    Range range = modal->selection_range;
+    if (range.end > buffer.size) { range.end = buffer.size; }
+    char* text = reg->is_macro ? nullptr : vim_register_flatten(reg);
+    if (buffer.exists && text && range.start >= 0) {
+        int size = reg->size;
+        clear_register_selection();
+        copy_into_register(app, &buffer, range, reg_unnamed,
+                           modal->mode == mode_visual_line, true);
+        buffer_replace_range(app, &buffer, range.start, range.end, text, size);
+        view_set_cursor(app, &view, seek_pos(range.start), true);
+    }
+    free(text);
+    clear_register_selection();
+    enter_normal_mode(app, buffer.buffer_id);
 }
 
 CUSTOM_COMMAND_SIG(select_register) {
     User_Input trigger;
-    trigger = get_command_input(app);
+    trigger = vim_command_input(app);
 
     Register_Id regid = regid_from_char(trigger.key.character);
     if (regid == reg_unnamed) {
         enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
     }
 
-    state.yank_register = state.paste_register = regid;
+    modal->yank_register = modal->paste_register = regid;
+    modal->register_append = 'A' <= trigger.key.character && trigger.key.character <= 'Z';
     char str[2] = { (char)trigger.key.character, '\0' };
     push_to_chord_bar(app, lit(str));
 
     reset_keymap_for_current_mode(app);
 }
 
+// q: starts recording into the register named next, or stops recording.
+CUSTOM_COMMAND_SIG(vim_macro_record){
+    if (macro_state.recording) {
+        Vim_Register* reg = vim_register(macro_state.recording_register);
+        vim_register_clear(reg);
+        vim_register_append_text(reg, (char*)macro_state.recorded.items,
+                                 macro_state.recorded.count);
+        reg->is_line = false;
+        reg->is_block = false;
+        reg->is_macro = true;
+        macro_state.recording = false;
+        macro_state.recorded.count = 0;
+        return;
+    }
+    set_current_keymap(app, mapid_chord_macro_record);
+    push_to_chord_bar(app, lit("q"));
+}
+
+CUSTOM_COMMAND_SIG(vim_macro_record_register){
+    User_Input trigger = vim_command_input(app);
+    Key_Code c = trigger.key.character;
+    enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+    if (!(('a' <= c && c <= 'z') || ('0' <= c && c <= '9'))) { return; }
+    macro_state.recording = true;
+    macro_state.recording_register = regid_from_char(c);
+    macro_state.recorded.count = 0;
+}
+
+CUSTOM_COMMAND_SIG(enter_chord_macro_replay){
+    set_current_keymap(app, mapid_chord_macro_replay);
+    push_to_chord_bar(app, lit("@"));
+}
+
+// @{reg} and N@{reg}; @@ replays the last one again. 4coder gives custom code
+// no way to group undo history, so each edit the macro makes is still its own
+// undo step; the replay itself runs as one command with no redraws between.
+CUSTOM_COMMAND_SIG(vim_macro_replay_register){
+    User_Input trigger = vim_command_input(app);
+    Key_Code c = trigger.key.character;
+    int count = vim_take_count(app);
+    enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+    Register_Id regid = (c == '@') ? macro_state.last_register : regid_from_char(c);
+    if (regid == reg_unnamed || regid == reg_system_clipboard) { return; }
+    Vim_Register* reg = vim_register(regid);
+    if (!reg->is_macro) { return; }
+    macro_state.last_register = regid;
+    vim_macro_replay(app, reg, count);
+}
+
 CUSTOM_COMMAND_SIG(vim_open_file_in_quotes){
     // @COPYPASTA from 4coder_default_include.cpp
     View_Summary view;
@@ -1412,7 +4799,11 @@ CUSTOM_COMMAND_SIG(vim_open_file_in_quotes){
         remove_last_folder(&file_name);
         append(&file_name, make_string(short_file_name, size));
         
-        view_open_file(app, &view, expand_str(file_name), false);
+        // Only a file that opens is a jump.
+        Buffer_ID from_buffer = view.buffer_id;
+        if (view_open_file(app, &view, expand_str(file_name), false)) {
+            vim_record_jump(view.view_id, from_buffer, pos);
+        }
     }
 }
 
@@ -1422,7 +4813,8 @@ CUSTOM_COMMAND_SIG(search_under_cursor) {
     view = get_active_view(app, AccessAll);
     buffer = get_buffer(app, view.buffer_id, AccessAll);
     if (!buffer.exists) return;
-    Range word = get_word_under_cursor(app, &buffer, &view);
+    Range word = vim_word_at(app, &buffer, view.cursor.pos);
+    if (word.start == word.end) return;
     char* wordStr = (char*)malloc(word.end - word.start);
     defer(free(wordStr));
     buffer_read_range(app, &buffer, word.start, word.end, wordStr);
@@ -1458,16 +4850,109 @@ CUSTOM_COMMAND_SIG(vim_delete_char) {
     if (!view.exists) { return; }
     Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
     
-    char nextch[2];
+    // 4x takes up to four characters, but never the end of the line.
     int pos = view.cursor.pos;
-    buffer_read_range(app, &buffer, pos, pos + 1, nextch);
-    if (nextch[0] != '\n') {
-        if (0 < buffer.size && pos < buffer.size){
-            buffer_replace_range(app, &buffer,
-                                      pos, pos+1, 0, 0);
-            // TODO(chr): Going into register?
-        }
+    int count = vim_take_count(app);
+    vim_record_command(vim_delete_char, modal->yank_register);
+    int end = seek_line_end(app, &buffer, pos);
+    if (end > pos + count) { end = pos + count; }
+    if (end > pos && pos < buffer.size){
+        copy_into_register(app, &buffer, make_range(pos, end), modal->yank_register,
+                           false, true);
+        buffer_replace_range(app, &buffer, pos, end, 0, 0);
+    }
+    clear_register_selection();
+}
+
+// Puts the text of a recorded insert back at the place its entry command would
+// have started typing, count times over in a single edit.
+static void vim_replay_insert(struct Application_Links* app, Vim_Change* change,
+                              int count) {
+    View_Summary view = get_active_view(app, AccessOpen);
+    if (!view.exists) { return; }
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    int pos = view.cursor.pos;
+    const char* prefix = "";
+    const char* suffix = "";
+    switch (change->entry) {
+        case insert_entry_at_cursor: break;
+        case insert_entry_after_cursor: {
+            char nextch = 0;
+            buffer_read_range(app, &buffer, pos, pos + 1, &nextch);
+            if (pos < buffer.size && nextch != '\n') { pos += 1; }
+        } break;
+        case insert_entry_end_of_line: {
+            pos = seek_line_end(app, &buffer, pos);
+        } break;
+        case insert_entry_line_below: {
+            pos = seek_line_end(app, &buffer, pos);
+            prefix = "\n";
+        } break;
+        case insert_entry_line_above: {
+            pos = seek_line_beginning(app, &buffer, pos);
+            suffix = "\n";
+        } break;
+    }
+    int prefix_size = (int)strlen(prefix);
+    int suffix_size = (int)strlen(suffix);
+    int unit = prefix_size + change->text_size + suffix_size;
+    if (unit == 0) { return; }
+    if (count > (1 << 30)/unit) { count = (1 << 30)/unit; }
+    char* text = (char*)malloc((size_t)unit*count);
+    if (text == nullptr) { return; }
+    for (int i = 0; i < count; ++i) {
+        char* at = text + i*unit;
+        memcpy(at, prefix, prefix_size);
+        memcpy(at + prefix_size, change->text, change->text_size);
+        memcpy(at + prefix_size + change->text_size, suffix, suffix_size);
+    }
+    buffer_replace_range(app, &buffer, pos, pos, text, unit*count);
+    free(text);
+    // Land on the last character typed, as leaving insert mode would.
+    int cursor = pos + unit*count - suffix_size - 1;
+    if (cursor < pos) { cursor = pos; }
+    view_set_cursor(app, &view, seek_pos(cursor), true);
+}
+
+// '.': repeats the last change from its record. A count replaces the one it
+// was made with, so 3. after dw is d3w: still one edit.
+CUSTOM_COMMAND_SIG(vim_repeat_change){
+    Vim_Change* change = &state.last_change;
+    bool given = false;
+    int count = vim_take_count(app, &given);
+    if (!given && change->count > 0) {
+        count = change->count;
+        given = true;
+    }
+    end_chord_bar(app);
+
+    state.replaying = true;
+    switch (change->kind) {
+        case change_none: break;
+
+        case change_operator: {
+            modal->action = change->action;
+            modal->yank_register = change->reg;
+            state.motion_character = change->character;
+            if (given) { modal->count = count; }
+            change->command(app);
+        } break;
+
+        case change_command: {
+            modal->yank_register = modal->paste_register = change->reg;
+            if (given) { modal->count = count; }
+            change->command(app);
+        } break;
+
+        case change_insert: {
+            vim_replay_insert(app, change, count);
+        } break;
     }
+    state.replaying = false;
+    modal->action = vimaction_none;
+    modal->count = modal->action_count = 0;
+    clear_register_selection();
+    if (given) { change->count = count; }
 }
 
 // TODO(chr): Measure the lister size?
@@ -1485,18 +4970,119 @@ CUSTOM_COMMAND_SIG(lister__page_up) {
     }
 }
 
-//=============================================================================
-// > Statusbar processing and commands <                             @statusbar
-// This is where the vim statusbar feature is created.
-//
-// Define a command with VIM_COMMAND_FUNC_SIG and then add it to the statusbar
-// library with define_command().
-//=============================================================================
-
+//=============================================================================
+// > Statusbar processing and commands <                             @statusbar
+// This is where the vim statusbar feature is created.
+//
+// Define a command with VIM_COMMAND_FUNC_SIG and then add it to the statusbar
+// library with define_command().
+//=============================================================================
+
+// Parses one ex address (a line number, ., $, '< or '>, or a mark in this
+// buffer, each optionally followed by +N/-N) at str[*at]. Returns false if
+// there is none.
+static bool vim_parse_ex_address(struct Application_Links* app,
+                                 Buffer_Summary* buffer, String str, int* at,
+                                 int* line) {
+    int i = *at;
+    int cursor_line = vim_line_of_pos(app, buffer, get_cursor_pos(app));
+    bool found = true;
+    if (i < str.size && '0' <= str.str[i] && str.str[i] <= '9') {
+        *line = 0;
+        while (i < str.size && '0' <= str.str[i] && str.str[i] <= '9') {
+            *line = *line*10 + (str.str[i++] - '0');
+        }
+    } else if (i < str.size && str.str[i] == '.') {
+        *line = cursor_line;
+        ++i;
+    } else if (i < str.size && str.str[i] == '$') {
+        *line = buffer->line_count;
+        ++i;
+    } else if (i + 1 < str.size && str.str[i] == '\'' &&
+               (str.str[i + 1] == '<' || str.str[i + 1] == '>')) {
+        int pos = (str.str[i + 1] == '<') ? modal->last_visual_range.start
+                                          : modal->last_visual_range.end - 1;
+        *line = vim_line_of_pos(app, buffer, pos < 0 ? 0 : pos);
+        i += 2;
+    } else if (i + 1 < str.size && str.str[i] == '\'' &&
+               vim_mark_slot(str.str[i + 1]) >= 0) {
+        Buffer_ID mark_buffer = 0;
+        int pos = -1;
+        if (!vim_get_mark(app, str.str[i + 1], buffer->buffer_id, &mark_buffer,
+                          &pos) || mark_buffer != buffer->buffer_id) {
+            return false;
+        }
+        *line = vim_line_of_pos(app, buffer, pos);
+        i += 2;
+    } else if (i < str.size && (str.str[i] == '+' || str.str[i] == '-')) {
+        *line = cursor_line;
+    } else {
+        found = false;
+    }
+    while (found && i < str.size && (str.str[i] == '+' || str.str[i] == '-')) {
+        int sign = (str.str[i++] == '+') ? 1 : -1;
+        int offset = 0;
+        bool has_digits = false;
+        while (i < str.size && '0' <= str.str[i] && str.str[i] <= '9') {
+            offset = offset*10 + (str.str[i++] - '0');
+            has_digits = true;
+        }
+        *line += sign*(has_digits ? offset : 1);
+    }
+    if (found) {
+        if (*line > buffer->line_count) { *line = buffer->line_count; }
+        if (*line < 1) { *line = 1; }
+        *at = i;
+    }
+    return found;
+}
+
+// Parses the optional range in front of a status command: %, or one or two
+// addresses separated by a comma.
+static Vim_Ex_Range vim_parse_ex_range(struct Application_Links* app,
+                                       Buffer_Summary* buffer, String str,
+                                       int* at) {
+    Vim_Ex_Range range = {};
+    range.first_line = range.last_line =
+        vim_line_of_pos(app, buffer, get_cursor_pos(app));
+    if (*at < str.size && str.str[*at] == '%') {
+        range.given = true;
+        range.first_line = 1;
+        range.last_line = buffer->line_count;
+        ++*at;
+        return range;
+    }
+    if (vim_parse_ex_address(app, buffer, str, at, &range.first_line)) {
+        range.given = true;
+        range.last_line = range.first_line;
+    }
+    if (*at < str.size && str.str[*at] == ',') {
+        ++*at;
+        range.given = true;
+        if (!vim_parse_ex_address(app, buffer, str, at, &range.last_line)) {
+            range.last_line = vim_line_of_pos(app, buffer, get_cursor_pos(app));
+        }
+    }
+    if (range.first_line > range.last_line) {
+        int swap = range.first_line;
+        range.first_line = range.last_line;
+        range.last_line = swap;
+    }
+    return range;
+}
+
 CUSTOM_COMMAND_SIG(status_command){
     User_Input in;
     Query_Bar bar;
 
+    // Like vim, : from visual mode leaves it and works on the selected lines.
+    bool from_visual = (modal->mode == mode_visual ||
+                        modal->mode == mode_visual_line ||
+                        modal->mode == mode_visual_block);
+    if (from_visual) {
+        enter_normal_mode(app, get_current_view_buffer_id(app, AccessAll));
+    }
+
     set_current_keymap(app, mapid_normal);
 
     if (start_query_bar(app, &bar, 0) == 0) return;
@@ -1504,11 +5090,14 @@ CUSTOM_COMMAND_SIG(status_command){
 
     char bar_string_space[256];
     bar.string = make_fixed_width_string(bar_string_space);
+    if (from_visual) {
+        append(&bar.string, make_lit_string("'<,'>"));
+    }
 
     bar.prompt = make_lit_string(":");
 
     while (1){
-        in = get_user_input(app, EventOnAnyKey, EventOnEsc);
+        in = vim_get_user_input(app, EventOnAnyKey, EventOnEsc);
         if (in.abort) break;
         if (in.key.keycode == '\n'){
             break;
@@ -1551,31 +5140,31 @@ CUSTOM_COMMAND_SIG(status_command){
         ++command_offset;
     }
 
+    Buffer_Summary buffer = get_buffer(app, get_current_view_buffer_id(app, AccessAll),
+                                       AccessAll);
+    command_range = vim_parse_ex_range(app, &buffer, bar.string, &command_offset);
+
+    // Command names are a run of letters, so :s/a/b/ and :10,20d both split
+    // cleanly from their arguments.
     int command_end = command_offset;
     while (command_end < bar.string.size &&
-           !char_is_whitespace(bar.string.str[command_end])) {
+           (('a' <= bar.string.str[command_end] && bar.string.str[command_end] <= 'z') ||
+            ('A' <= bar.string.str[command_end] && bar.string.str[command_end] <= 'Z'))) {
         ++command_end;
     }
     
-    if (command_end == command_offset) { return; }
+    if (command_end == command_offset) {
+        // A bare range jumps to its last line.
+        if (command_range.given) {
+            active_view_to_line(app, command_range.last_line);
+        }
+        return;
+    }
     String command = substr(bar.string, command_offset, command_end - command_offset);
     bool command_force = false;
-    if (command.str[command.size - 1] == '!') {
-        command.size -= 1;
+    if (command_end < bar.string.size && bar.string.str[command_end] == '!') {
         command_force = true;
-    }
-
-    bool command_is_numeric = true;
-    for (int command_ch = 0; command_ch < command.size; ++command_ch) {
-        if (!('0' <= command.str[command_ch] && command.str[command_ch] <= '9')) {
-            command_is_numeric = false;
-        }
-    }
-
-    if (command_is_numeric) {
-        int line = str_to_int(command);
-        active_view_to_line(app, line);
-        return;
+        ++command_end;
     }
 
     int arg_start = command_end;
@@ -1600,116 +5189,1236 @@ void define_command(String command, Vim_Command_Func func) {
     defn->func = func;
 }
 
-VIM_COMMAND_FUNC_SIG(write_file) {
-    View_Summary view = get_active_view(app, AccessProtected);
-    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+VIM_COMMAND_FUNC_SIG(write_file) {
+    View_Summary view = get_active_view(app, AccessProtected);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessProtected);
+
+    // Only what changed since the last save is indented; see @save_indent.
+    int32_t is_virtual = 0;
+    if (global_config.automatically_indent_text_on_save && buffer_get_setting(app, &buffer, BufferSetting_VirtualWhitespace, &is_virtual)){
+        if (is_virtual){
+            vim_indent_changes(app, &buffer, DEF_TAB_WIDTH,
+                               DEFAULT_INDENT_FLAGS | AutoIndent_FullTokens);
+        }
+    }
+
+    if (argstr.str == NULL || argstr.size == 0) {
+        save_buffer(app, &buffer, buffer.file_name, buffer.file_name_len, 0);
+    } else {
+        save_buffer(app, &buffer, expand_str(argstr), 0);
+    }
+}
+
+VIM_COMMAND_FUNC_SIG(edit_file) {
+    exec_command(app, interactive_open);
+}
+
+VIM_COMMAND_FUNC_SIG(new_file) {
+    View_Summary view = get_active_view(app, AccessAll);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Top);
+    new_view_settings(app, &new_view);
+    set_active_view(app, &new_view);
+    if (compare(argstr, make_lit_string("")) == 0) {
+        exec_command(app, interactive_new);
+    } else {
+        Buffer_Summary buffer = create_buffer(app, argstr.str, argstr.size, 0);
+        if (buffer.exists){
+            view_set_buffer(app, &new_view, buffer.buffer_id, SetBuffer_KeepOriginalGUI);
+        }
+    }
+}
+
+VIM_COMMAND_FUNC_SIG(new_file_open_vertical) {
+    View_Summary view = get_active_view(app, AccessAll);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
+    new_view_settings(app, &new_view);
+    set_active_view(app, &new_view);
+    exec_command(app, interactive_new);
+}
+
+VIM_COMMAND_FUNC_SIG(colorscheme) {
+    if (argstr.str && argstr.size > 0) {
+        change_theme(app, expand_str(argstr));
+    }
+    // else set bar text (...) to current colorscheme
+    else {
+        exec_command(app, open_color_tweaker);
+    }
+}
+
+VIM_COMMAND_FUNC_SIG(close_view) {
+    vim_close_active_view(app);
+}
+
+VIM_COMMAND_FUNC_SIG(close_all) {
+    send_exit_signal(app);
+}
+
+VIM_COMMAND_FUNC_SIG(write_file_and_close_all) {
+    write_file(app, command, argstr, force);
+    close_all(app, command, argstr, force);
+}
+
+VIM_COMMAND_FUNC_SIG(write_file_and_close_view) {
+    write_file(app, command, argstr, force);
+    close_view(app, command, argstr, force);
+}
+
+VIM_COMMAND_FUNC_SIG(vertical_split) {
+    View_Summary view = get_active_view(app, AccessAll);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
+    view_set_buffer(app, &new_view, view.buffer_id, 0);
+    set_active_view(app, &view);
+}
+
+VIM_COMMAND_FUNC_SIG(horizontal_split) {
+    View_Summary view = get_active_view(app, AccessAll);
+    View_Summary new_view = vim_open_view(app, &view, ViewSplit_Right);
+    view_set_buffer(app, &new_view, view.buffer_id, 0);
+    set_active_view(app, &view);
+}
+
+// Splits the next delimiter-terminated field off a :s argument. Escaped
+// delimiters stay in the field; the regex and replacement parsers both read
+// \<delimiter> as the delimiter itself.
+static String vim_substitute_field(String args, int* at, char delimiter) {
+    int start = *at;
+    int i = start;
+    while (i < args.size && args.str[i] != delimiter) {
+        if (args.str[i] == '\\' && i + 1 < args.size) { ++i; }
+        ++i;
+    }
+    *at = (i < args.size) ? i + 1 : i;
+    return substr(args, start, i - start);
+}
+
+static char vim_apply_case(char c, int once, int always) {
+    int mode = once ? once : always;
+    if (mode == 'u' && 'a' <= c && c <= 'z') { return c - 'a' + 'A'; }
+    if (mode == 'l' && 'A' <= c && c <= 'Z') { return c - 'A' + 'a'; }
+    return c;
+}
+
+// Appends the expansion of a :s replacement for one match to out. Supports &,
+// \0-\9, \n and \r (line break), \t, \u \l \U \L \E \e, and escaped literals.
+static void vim_expand_replacement(String replacement, const char* line,
+                                   Range* groups, Vim_Array<char>* out) {
+    int once = 0;
+    int always = 0;
+    for (int i = 0; i < replacement.size; ++i) {
+        char c = replacement.str[i];
+        int group = -1;
+        if (c == '&') {
+            group = 0;
+        } else if (c == '\\' && i + 1 < replacement.size) {
+            c = replacement.str[++i];
+            if ('0' <= c && c <= '9') {
+                group = c - '0';
+            } else {
+                switch (c) {
+                    case 'n': case 'r': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'u': case 'l': once = c; continue;
+                    case 'U': always = 'u'; continue;
+                    case 'L': always = 'l'; continue;
+                    case 'E': case 'e': once = always = 0; continue;
+                }
+            }
+        }
+        if (group >= 0) {
+            Range span = groups[group];
+            for (int j = span.start; j >= 0 && j < span.end; ++j) {
+                vim_array_push(out, vim_apply_case(line[j], once, always));
+                once = 0;
+            }
+        } else {
+            vim_array_push(out, vim_apply_case(c, once, always));
+            once = 0;
+        }
+    }
+}
+
+// Asks whether to make one :s replacement. Returns y, n, a, q or l.
+static char vim_substitute_confirm(struct Application_Links* app,
+                                   View_Summary* view, Range match,
+                                   String replacement) {
+    view_set_cursor(app, view, seek_pos(match.start), true);
+    Query_Bar bar;
+    if (start_query_bar(app, &bar, 0) == 0) { return 'q'; }
+    defer(end_query_bar(app, &bar, 0));
+    char prompt_space[256];
+    bar.prompt = make_fixed_width_string(prompt_space);
+    append(&bar.prompt, make_lit_string("replace with "));
+    append(&bar.prompt, replacement);
+    append(&bar.prompt, make_lit_string(" (y/n/a/q/l)? "));
+    bar.string = make_lit_string("");
+    for (;;) {
+        User_Input in = vim_get_user_input(app, EventOnAnyKey, EventOnEsc);
+        if (in.abort) { return 'q'; }
+        switch (in.key.character) {
+            case 'y': case 'n': case 'a': case 'q': case 'l':
+                return (char)in.key.character;
+        }
+    }
+}
+
+// :[range]s/pattern/replacement/[flags]
+//
+// Replaces matches of a regex (see 4coder_vim_regex.cpp) on each line of the
+// range, the cursor line by default. Flags: g every match in a line rather
+// than the first, i/I ignore/respect case, c confirm each one. The range is
+// read a window at a time and every replacement lands in one batch edit, so a
+// whole-file substitution is a single undo step and costs one buffer rewrite.
+VIM_COMMAND_FUNC_SIG(substitute) {
+    View_Summary view = get_active_view(app, AccessOpen);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessOpen);
+    if (!buffer.exists) { return; }
+
+    char delimiter = argstr.size > 0 ? argstr.str[0] : '/';
+    if (argstr.size == 0 || char_is_alpha_numeric(delimiter) ||
+        delimiter == '\\' || delimiter == '"' || delimiter == '|') {
+        end_chord_bar(app);
+        push_to_chord_bar(app, lit("usage: s/pattern/replacement/[gicI]"));
+        return;
+    }
+    int at = 1;
+    String pattern = vim_substitute_field(argstr, &at, delimiter);
+    String replacement = vim_substitute_field(argstr, &at, delimiter);
+    bool global = false;
+    bool ignore_case = false;
+    bool confirm = false;
+    for (; at < argstr.size; ++at) {
+        switch (argstr.str[at]) {
+            case 'g': global = true; break;
+            case 'i': ignore_case = true; break;
+            case 'I': ignore_case = false; break;
+            case 'c': confirm = true; break;
+        }
+    }
+
+    // An empty pattern reuses the last search, which is a literal.
+    char last_pattern_space[2*ArrayCount(state.last_search.text_buffer)];
+    if (pattern.size == 0) {
+        pattern = make_fixed_width_string(last_pattern_space);
+        for (int i = 0; i < state.last_search.text.size; ++i) {
+            char c = state.last_search.text.str[i];
+            if (c == '\\' || c == '.' || c == '*' || c == '[' || c == '~' ||
+                c == '^' || c == '$' || c == delimiter) {
+                append(&pattern, '\\');
+            }
+            append(&pattern, c);
+        }
+    }
+
+    Vim_Regex regex;
+    if (!vim_regex_compile(&regex, pattern, ignore_case)) {
+        end_chord_bar(app);
+        push_to_chord_bar(app, make_string((char*)regex.error,
+                                           (int)strlen(regex.error)));
+        return;
+    }
+
+    bool needs_groups = false;
+    for (int i = 0; i + 1 < replacement.size; ++i) {
+        if (replacement.str[i] == '\\') {
+            needs_groups |= ('1' <= replacement.str[i + 1] &&
+                             replacement.str[i + 1] <= '9');
+            ++i;
+        }
+    }
+
+    Range range = vim_line_range_to_byte_range(app, &buffer,
+                                               command_range.first_line,
+                                               command_range.last_line);
+    Vim_Array<Buffer_Edit> edits = {};
+    Vim_Array<char> strings = {};
+    int window_size = VIM_SEARCH_WINDOW;
+    char* window = (char*)malloc(window_size);
+    bool found = false;
+    int substitutions = 0;
+    int lines_changed = 0;
+    // Where the cursor goes afterwards: the last changed line, after edits.
+    int shift = 0;
+    int last_line_start = -1;
+    bool stop = false;
+    bool replace_rest = !confirm;
+
+    int window_start = range.start;
+    while (window_start < range.end && !stop) {
+        int read_size = range.end - window_start;
+        if (read_size > window_size) { read_size = window_size; }
+        if (!buffer_read_range(app, &buffer, window_start, window_start + read_size,
+                               window)) {
+            break;
+        }
+        // Only process whole lines; a partial last line is read again as the
+        // start of the next window.
+        int usable = read_size;
+        if (window_start + read_size < range.end) {
+            while (usable > 0 && window[usable - 1] != '\n') { --usable; }
+            if (usable == 0) {
+                // One line longer than the window: grow it and retry.
+                window_size *= 2;
+                window = (char*)realloc(window, window_size);
+                continue;
+            }
+        }
+
+        for (int line_start = 0; line_start < usable && !stop;) {
+            char* newline = (char*)memchr(window + line_start, '\n',
+                                          usable - line_start);
+            int line_end = newline ? (int)(newline - window) : usable;
+            const char* line = window + line_start;
+            int line_size = line_end - line_start;
+            int line_pos = window_start + line_start;
+
+            int line_shift = shift;
+            bool line_changed = false;
+            int previous_end = -1;
+            for (int from = 0; from <= line_size;) {
+                Range match;
+                if (!vim_regex_find_in_line(&regex, line, line_size, from, &match)) {
+                    break;
+                }
+                // No empty match right where the previous one ended.
+                if (match.start == match.end && match.start == previous_end) {
+                    from = match.start + 1;
+                    continue;
+                }
+                previous_end = match.end;
+                from = (match.end > match.start) ? match.end : match.end + 1;
+                found = true;
+
+                char answer = 'y';
+                if (!replace_rest) {
+                    answer = vim_substitute_confirm(
+                        app, &view, make_range(line_pos + match.start,
+                                               line_pos + match.end),
+                        replacement);
+                    if (answer == 'a') { replace_rest = true; }
+                    if (answer == 'q') { stop = true; break; }
+                    if (answer == 'l') { stop = true; }
+                }
+                if (answer != 'n') {
+                    Range groups[VIM_REGEX_MAX_GROUPS];
+                    groups[0] = match;
+                    if (needs_groups) {
+                        vim_regex_groups(&regex, line, line_size, match, groups);
+                    }
+                    Buffer_Edit edit;
+                    edit.str_start = strings.count;
+                    vim_expand_replacement(replacement, line, groups, &strings);
+                    edit.len = strings.count - edit.str_start;
+                    edit.start = line_pos + match.start;
+                    edit.end = line_pos + match.end;
+                    vim_array_push(&edits, edit);
+                    shift += edit.len - (edit.end - edit.start);
+                    ++substitutions;
+                    line_changed = true;
+                }
+                if (!global || stop) { break; }
+            }
+            if (line_changed) {
+                ++lines_changed;
+                last_line_start = line_pos + line_shift;
+            }
+            line_start = line_end + 1;
+        }
+        window_start += usable;
+    }
+    free(window);
+    vim_regex_free(&regex);
+
+    if (edits.count > 0) {
+        buffer_batch_edit(app, &buffer, strings.items, strings.count,
+                          edits.items, edits.count, BatchEdit_Normal);
+        view_set_cursor(app, &view, seek_pos(last_line_start), true);
+    }
+    vim_array_free(&edits);
+    vim_array_free(&strings);
+
+    char report[64];
+    if (found) {
+        snprintf(report, sizeof(report), "%d substitution%s on %d line%s",
+                 substitutions, substitutions == 1 ? "" : "s",
+                 lines_changed, lines_changed == 1 ? "" : "s");
+    } else {
+        snprintf(report, sizeof(report), "Pattern not found: %.*s",
+                 pattern.size, pattern.str);
+    }
+    end_chord_bar(app);
+    push_to_chord_bar(app, make_string(report, (int)strlen(report)));
+}
+
+VIM_COMMAND_FUNC_SIG(no_highlight_search) {
+    state.search_highlight_hidden = true;
+}
+
+static Vim_Option* vim_find_option(String name) {
+    for (int i = 0; i < (int)ArrayCount(vim_options); ++i) {
+        if (match(name, (char*)vim_options[i].name) ||
+            match(name, (char*)vim_options[i].short_name)) {
+            return &vim_options[i];
+        }
+    }
+    return nullptr;
+}
+
+// Appends how option reads back in :set to report.
+static int vim_option_format(char* report, int size, int used, Vim_Option* option) {
+    if (used >= size) { return used; }
+    int written;
+    if (option->flag) {
+        written = snprintf(report + used, size - used, "%s%s  ",
+                           *option->flag ? "" : "no", option->name);
+    } else {
+        written = snprintf(report + used, size - used, "%s=%d  ", option->name,
+                           *option->number);
+    }
+    return (written > 0) ? used + written : used;
+}
+
+// :set                    shows every option
+// :set name  noname       turn a flag on or off
+// :set name=N             sets a number
+// :set name?              shows one option
+VIM_COMMAND_FUNC_SIG(set_option) {
+    char report[256];
+    int used = 0;
+    report[0] = 0;
+    if (argstr.str == nullptr || argstr.size == 0) {
+        for (int i = 0; i < (int)ArrayCount(vim_options); ++i) {
+            used = vim_option_format(report, sizeof(report), used, &vim_options[i]);
+        }
+    }
+
+    int at = 0;
+    while (at < argstr.size) {
+        while (at < argstr.size && char_is_whitespace(argstr.str[at])) { ++at; }
+        int token_start = at;
+        while (at < argstr.size && !char_is_whitespace(argstr.str[at])) { ++at; }
+        if (at == token_start) { break; }
+        String token = make_string(argstr.str + token_start, at - token_start);
+
+        int equals = find_s_char(token, 0, '=');
+        String name = substr(token, 0, equals);
+        bool query = (equals == token.size && name.size > 0 &&
+                      name.str[name.size - 1] == '?');
+        if (query) { name.size -= 1; }
+        bool negate = false;
+        Vim_Option* option = vim_find_option(name);
+        if (option == nullptr && equals == token.size && name.size > 2 &&
+            name.str[0] == 'n' && name.str[1] == 'o') {
+            option = vim_find_option(substr_tail(name, 2));
+            negate = (option != nullptr && option->flag != nullptr);
+            if (!negate) { option = nullptr; }
+        }
+
+        if (option == nullptr) {
+            snprintf(report, sizeof(report), "E518: Unknown option: %.*s",
+                     token.size, token.str);
+            break;
+        }
+        if (equals < token.size) {
+            String value = substr_tail(token, equals + 1);
+            if (option->number == nullptr || !str_is_int(value) ||
+                str_to_int(value) < 1) {
+                snprintf(report, sizeof(report), "E521: Number required after =: %.*s",
+                         token.size, token.str);
+                break;
+            }
+            *option->number = str_to_int(value);
+        } else if (option->flag && !query) {
+            *option->flag = !negate;
+        } else {
+            used = vim_option_format(report, sizeof(report), used, option);
+        }
+    }
+
+    end_chord_bar(app);
+    if (report[0]) {
+        push_to_chord_bar(app, make_string(report, (int)strlen(report)));
+    }
+}
+
+// :markerstats    reports how many marker objects the render caller made
+// :markerstats!   ...and resets the counters
+VIM_COMMAND_FUNC_SIG(marker_stats_report) {
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    Vim_Marker_Stats stats = marker_stats;
+    double frames = stats.frames ? (double)stats.frames : 1.0;
+    vim_scratch_printf(app, &out, "markerstats: %llu frames rendered\n\n",
+                       (unsigned long long)stats.frames);
+    vim_scratch_printf(app, &out, "%-28s %12s %12s\n", "", "total", "per frame");
+    vim_scratch_printf(app, &out, "%-28s %12llu %12.3f\n", "objects allocated",
+                       (unsigned long long)stats.allocations, stats.allocations/frames);
+    vim_scratch_printf(app, &out, "%-28s %12llu %12.3f\n", "objects freed",
+                       (unsigned long long)stats.frees, stats.frees/frames);
+    vim_scratch_printf(app, &out, "%-28s %12llu %12.3f\n", "marker stores",
+                       (unsigned long long)stats.stores, stats.stores/frames);
+    vim_scratch_printf(app, &out, "%-28s %12llu %12.3f\n", "allocations without pool",
+                       (unsigned long long)stats.unpooled_allocations,
+                       stats.unpooled_allocations/frames);
+    if (force) {
+        marker_stats = {};
+        vim_scratch_printf(app, &out, "\n(counters reset)\n");
+    }
+}
+
+// :bufferstats   what the per-buffer indices hold and the memory they use
+VIM_COMMAND_FUNC_SIG(buffer_stats_report) {
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out, "bufferstats: per-buffer indices\n\n");
+    vim_scratch_printf(app, &out, "%-28s %10s %10s %12s %10s %12s %10s %12s\n",
+                       "buffer", "brackets", "complete", "index KB", "matches",
+                       "matches KB", "lines", "lines KB");
+    int total = 0;
+    for (int i = 0; i < buffer_states.capacity; ++i) {
+        Vim_Buffer_State* buffer_state = buffer_states.values[i];
+        if (buffer_state == nullptr) { continue; }
+        Buffer_Summary buffer = get_buffer(app, buffer_state->buffer_id, AccessAll);
+        Vim_Bracket_Index* brackets = &buffer_state->brackets;
+        int bracket_memory = vim_bracket_index_memory(brackets);
+        int match_memory = vim_match_cache_memory(&buffer_state->matches);
+        Vim_Line_Index* lines = &buffer_state->lines;
+        int line_memory = vim_line_index_memory(lines);
+        total += bracket_memory + match_memory + line_memory;
+        vim_scratch_printf(app, &out,
+                           "%-28.*s %10d %10s %12.1f %10d %12.1f %10d %12.1f\n",
+                           buffer.exists ? buffer.buffer_name_len : 0,
+                           buffer.exists ? buffer.buffer_name : "",
+                           vim_bracket_index_count(brackets),
+                           vim_bracket_index_is_complete(brackets) ? "yes" : "no",
+                           bracket_memory/1024.0,
+                           buffer_state->matches.matches.count,
+                           match_memory/1024.0,
+                           vim_line_index_line_count(lines),
+                           line_memory/1024.0);
+    }
+    vim_scratch_printf(app, &out, "\ntotal %.1f KB\n", total/1024.0);
+}
+
+// :registers    what each register holds, the memory the register store uses
+//               and how often "* went to the system clipboard
+// :registers!   ...and resets the counters
+VIM_COMMAND_FUNC_SIG(registers_report) {
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out, "registers\n\n");
+    vim_scratch_printf(app, &out, "%-4s %-5s %10s %7s  %s\n",
+                       "name", "type", "bytes", "chunks", "content");
+    const char names[] = "\"0123456789abcdefghijklmnopqrstuvwxyz-*";
+    for (int i = 0; names[i]; ++i) {
+        Vim_Register* reg = vim_register(regid_from_char(names[i]));
+        if (reg->size == 0) { continue; }
+        // The start of the text on one line, with control characters as ^X.
+        char preview[48];
+        int preview_size = 0;
+        Vim_Register_Chunk* chunk = reg->first;
+        for (int j = 0; j < chunk->size && preview_size < 40; ++j) {
+            char c = chunk->text[j];
+            if ((unsigned char)c < ' ') {
+                preview[preview_size++] = '^';
+                c = (char)(c + '@');
+            }
+            preview[preview_size++] = c;
+        }
+        vim_scratch_printf(app, &out, "\"%-3c %-5s %10d %7d  %.*s\n", names[i],
+                           reg->is_macro ? "macro" : reg->is_line ? "lines" : "chars",
+                           reg->size, reg->chunk_count, preview_size, preview);
+    }
+    Vim_Register_Stats stats = register_stats;
+    vim_scratch_printf(app, &out, "\n%-28s %12.1f KB\n", "register memory",
+                       vim_register_memory()/1024.0);
+    vim_scratch_printf(app, &out, "%-28s %12d\n", "free chunks", register_free_count);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "chunk allocations",
+                       (unsigned long long)stats.chunk_allocations);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "chunk frees",
+                       (unsigned long long)stats.chunk_frees);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "writes",
+                       (unsigned long long)stats.writes);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "appends",
+                       (unsigned long long)stats.appends);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "numbered rotations",
+                       (unsigned long long)stats.rotations);
+    Vim_Clipboard_Stats clipboard = clipboard_stats;
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "clipboard fetches",
+                       (unsigned long long)clipboard.fetches);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "clipboard fetches skipped",
+                       (unsigned long long)clipboard.fetches_skipped);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "clipboard posts",
+                       (unsigned long long)clipboard.posts);
+    vim_scratch_printf(app, &out, "%-28s %12llu\n", "clipboard posts coalesced",
+                       (unsigned long long)clipboard.posts_coalesced);
+    if (force) {
+        register_stats = {};
+        clipboard_stats = {};
+        vim_scratch_printf(app, &out, "\n(counters reset)\n");
+    }
+}
+
+// :renderstats    per-view render caller section times over recent frames
+// :renderstats!   ...and clears the windows
+VIM_COMMAND_FUNC_SIG(render_stats_report) {
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out,
+                       "renderstats: microseconds per frame, last %d frames\n",
+                       VIM_RENDER_SAMPLES);
+    for (int i = 0; i < view_states.capacity; ++i) {
+        Vim_View_State* view_state = view_states.values[i];
+        if (view_state == nullptr || view_state->timings.count == 0) { continue; }
+        Vim_Render_Timings* timings = &view_state->timings;
+        View_Summary view = get_view(app, view_state->view_id, AccessAll);
+        Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+        vim_scratch_printf(app, &out, "\nview %d (%.*s), %d frames\n",
+                           view_state->view_id,
+                           buffer.exists ? buffer.buffer_name_len : 0,
+                           buffer.exists ? buffer.buffer_name : "",
+                           timings->count);
+        vim_scratch_printf(app, &out, "%-18s %10s %10s %10s %10s\n",
+                           "section", "p50", "p95", "p99", "max");
+        for (int section = 0; section < render_section_count; ++section) {
+            Vim_Render_Percentiles p =
+                vim_render_percentiles(timings, (Vim_Render_Section)section);
+            vim_scratch_printf(app, &out, "%-18s %10.1f %10.1f %10.1f %10.1f\n",
+                               render_section_names[section],
+                               p.p50/1000.0, p.p95/1000.0, p.p99/1000.0,
+                               p.max/1000.0);
+        }
+        if (force) {
+            timings->next = 0;
+            timings->count = 0;
+        }
+    }
+}
+
+VIM_COMMAND_FUNC_SIG(change_directory) {
+    char dir[4096];
+    String dirstr = make_fixed_width_string(dir);
+    dirstr.size = directory_get_hot(app, dirstr.str, dirstr.memory_size);
+    assert(dirstr.size < 4096);
+    if (!directory_cd_expand_user(app, dirstr.str, &dirstr.size, dirstr.memory_size,
+                                  argstr.str, argstr.size)) {
+        fprintf(stderr, "Couldn't change directory to %.*s\n", argstr.size, argstr.str);
+        return;
+    }
+    fprintf(stderr, "%.*s\n", (int)dirstr.size, dirstr.str);
+    directory_set_hot(app, dirstr.str, dirstr.size);
+}
+
+//=============================================================================
+// > Benchmarks <                                                       @bench
+// Status commands that time the 4vim engines against the stock 4coder
+// routines they replace. Results go to the *vim bench* buffer.
+//=============================================================================
+
+// Fills (or refills) a scratch buffer with size bytes of source-like text and
+// plants needle once, a quarter of the way in.
+static Buffer_Summary vim_make_benchmark_buffer(struct Application_Links* app,
+                                                String name, int size,
+                                                String needle) {
+    Buffer_Summary buffer = vim_get_scratch_buffer(app, name);
+    const int block_size = 1 << 20;
+    char* block = (char*)malloc(block_size);
+    defer(free(block));
+
+    static const char* words[] = {
+        "int", "return", "buffer", "view", "cursor", "range", "static",
+        "for", "while", "struct", "size", "pos", "app", "=", "+", "(", ")",
+        "{", "}", ";", "->", "0", "1", "NULL", "char*", "if", "else",
+    };
+    uint32_t seed = 0x12345678u;
+    int at = 0;
+    int column = 0;
+    while (at < block_size) {
+        seed = seed*1664525u + 1013904223u;
+        const char* word = words[(seed >> 16) % ArrayCount(words)];
+        int word_size = (int)strlen(word);
+        if (at + word_size + 1 >= block_size) { break; }
+        memcpy(block + at, word, word_size);
+        at += word_size;
+        column += word_size + 1;
+        block[at++] = (column > 80) ? '\n' : ' ';
+        if (column > 80) { column = 0; }
+    }
+    int fill = at;
+
+    int planted_at = size/4;
+    for (int written = 0; written < size; written += fill) {
+        int chunk = fill;
+        if (written + chunk > size) { chunk = size - written; }
+        buffer_replace_range(app, &buffer, buffer.size, buffer.size, block, chunk);
+        buffer = get_buffer(app, buffer.buffer_id, AccessAll);
+    }
+    if (needle.size > 0) {
+        buffer_replace_range(app, &buffer, planted_at, planted_at,
+                             needle.str, needle.size);
+        buffer = get_buffer(app, buffer.buffer_id, AccessAll);
+    }
+    return buffer;
+}
+
+// The n/N behaviour before the search engine: a seek from the cursor, then a
+// second seek over the whole buffer if that missed.
+static int vim_search_with_seek_functions(struct Application_Links* app,
+                                          Buffer_Summary* buffer, String word,
+                                          int pos, Search_Direction direction) {
+    int new_pos = -1;
+    if (direction == search_forward) {
+        buffer_seek_string_forward(app, buffer, pos + 1, 0, word.str, word.size,
+                                   &new_pos);
+        if (new_pos >= buffer->size || new_pos < 0) {
+            buffer_seek_string_forward(app, buffer, 0, 0, word.str, word.size,
+                                       &new_pos);
+        }
+    } else {
+        buffer_seek_string_backward(app, buffer, pos - 1, 0, word.str, word.size,
+                                    &new_pos);
+        if (new_pos >= buffer->size || new_pos < 0) {
+            buffer_seek_string_backward(app, buffer, buffer->size - 1, 0,
+                                        word.str, word.size, &new_pos);
+        }
+    }
+    if (new_pos >= buffer->size) { new_pos = -1; }
+    return new_pos;
+}
+
+// :searchbench [pattern]    times n/N on the current buffer
+// :searchbench! [pattern]   times n/N on a generated 256MB buffer
+VIM_COMMAND_FUNC_SIG(search_benchmark) {
+    char word_space[256];
+    String word = make_fixed_width_string(word_space);
+    append_checked_ss(&word, argstr.size > 0 ? argstr : state.last_search.text);
+    if (word.size == 0) {
+        append_checked_ss(&word, lit("benchmark_needle"));
+    }
+
+    View_Summary view = get_active_view(app, AccessAll);
+    Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
+    if (force) {
+        buffer = vim_make_benchmark_buffer(app, lit("*search bench data*"),
+                                           256 << 20, word);
+    }
+    if (!buffer.exists || buffer.size == 0) { return; }
+
+    Vim_Search_Pattern pattern;
+    vim_search_pattern_init(&pattern, word);
+
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out, "searchbench: \"%.*s\" in %.*s (%.1f MB)\n\n",
+                       word.size, word.str,
+                       buffer.buffer_name_len, buffer.buffer_name,
+                       buffer.size/(1024.0*1024.0));
+    vim_scratch_printf(app, &out, "%-10s %-16s %12s %12s %10s\n",
+                       "direction", "method", "avg ms", "buffer MB/s", "found");
+
+    const int runs = 5;
+    int start = buffer.size/2;
+    for (int dir_index = 0; dir_index < 2; ++dir_index) {
+        Search_Direction direction = dir_index ? search_backward : search_forward;
+        for (int method = 0; method < 2; ++method) {
+            int found = -1;
+            int64_t begin = vim_time_us();
+            for (int run = 0; run < runs; ++run) {
+                if (method == 0) {
+                    found = vim_search_with_seek_functions(app, &buffer, word,
+                                                           start, direction);
+                } else {
+                    found = vim_search_buffer_wrapped(app, &buffer, &pattern,
+                                                      start, direction);
+                }
+            }
+            double ms = (vim_time_us() - begin)/(1000.0*runs);
+            double mb_per_s = ms > 0 ? (buffer.size/(1024.0*1024.0))/(ms/1000.0) : 0;
+            vim_scratch_printf(app, &out, "%-10s %-16s %12.2f %12.0f %10d\n",
+                               dir_index ? "backward" : "forward",
+                               method ? "search engine" : "seek functions",
+                               ms, mb_per_s, found);
+        }
+    }
+}
+
+// The TODO/NOTE pass before the keyword scanner: a match_part per keyword at
+// every byte offset.
+static int vim_keyword_scan_with_match_part(Vim_Keyword_Set* set,
+                                            char* text, int size) {
+    int found = 0;
+    String tail = make_string(text, size);
+    for (int i = 0; i < size; tail.str += 1, tail.size -= 1, i += 1) {
+        for (int k = 0; k < set->count; ++k) {
+            if (match_part(tail, make_string(set->words[k], set->sizes[k]))) {
+                ++found;
+                tail.str += set->sizes[k] - 1;
+                tail.size -= set->sizes[k] - 1;
+                i += set->sizes[k] - 1;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+// :keywordbench   times the highlight keyword pass for one frame of a 4K-high
+//                 view (about 160 lines of 240 columns), with keywords dense
+//                 and absent, for the default two keywords and for eight.
+VIM_COMMAND_FUNC_SIG(keyword_benchmark) {
+    const int line_count = 160;
+    const int column_count = 240;
+    const int text_size = line_count*column_count;
+    char* dense = (char*)malloc(text_size);
+    char* plain = (char*)malloc(text_size);
+    static const char* words[] = {
+        "int", "return", "buffer", "view", "cursor", "range", "static",
+        "for", "while", "struct", "size", "pos", "app", "=", "+", "(", ")",
+        "Buffer_Summary", "// TODO(chr):", "// NOTE:", "FIXME", "HACK",
+    };
+    for (int pass = 0; pass < 2; ++pass) {
+        char* text = pass ? plain : dense;
+        // The plain text leaves out the keyword entries at the end of words.
+        int word_count = pass ? ArrayCount(words) - 4 : ArrayCount(words);
+        uint32_t seed = 0x9E3779B9u;
+        int at = 0;
+        int column = 0;
+        while (at < text_size) {
+            seed = seed*1664525u + 1013904223u;
+            const char* word = words[(seed >> 16) % word_count];
+            for (const char* c = word; *c && at < text_size; ++c) {
+                text[at++] = *c;
+            }
+            column += (int)strlen(word) + 1;
+            if (at < text_size) { text[at++] = (column > column_count) ? '\n' : ' '; }
+            if (column > column_count) { column = 0; }
+        }
+    }
+
+    Vim_Keyword_Set* sets[2];
+    static const char* extra[] = { "HACK", "FIXME", "BUG", "PERF", "XXX", "OPTIMIZE" };
+    for (int i = 0; i < 2; ++i) {
+        sets[i] = (Vim_Keyword_Set*)calloc(1, sizeof(Vim_Keyword_Set));
+        vim_keyword_set_add(sets[i], lit("NOTE"));
+        vim_keyword_set_add(sets[i], lit("TODO"));
+        for (int k = 0; i == 1 && k < (int)ArrayCount(extra); ++k) {
+            vim_keyword_set_add(sets[i], make_string((char*)extra[k],
+                                                     (int)strlen(extra[k])));
+        }
+    }
 
-    // Hopefully this will add auto indenting on save
-    int32_t is_virtual = 0;
-    if (global_config.automatically_indent_text_on_save && buffer_get_setting(app, &buffer, BufferSetting_VirtualWhitespace, &is_virtual)){
-        if (is_virtual){
-            buffer_auto_indent(app, &global_part, &buffer, 0, buffer.size,DEF_TAB_WIDTH,
-            DEFAULT_INDENT_FLAGS |
-            AutoIndent_FullTokens);
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out,
+                       "keywordbench: %d lines x %d columns per frame\n\n",
+                       line_count, column_count);
+    vim_scratch_printf(app, &out, "%-8s %-9s %-12s %14s %8s\n",
+                       "text", "keywords", "method", "us per frame", "hits");
+
+    const int frames = 200;
+    Vim_Array<Vim_Keyword_Hit> hits = {};
+    for (int pass = 0; pass < 2; ++pass) {
+        char* text = pass ? plain : dense;
+        for (int set_index = 0; set_index < 2; ++set_index) {
+            for (int method = 0; method < 2; ++method) {
+                int found = 0;
+                int64_t begin = vim_time_us();
+                for (int frame = 0; frame < frames; ++frame) {
+                    if (method == 0) {
+                        found = vim_keyword_scan_with_match_part(sets[set_index],
+                                                                 text, text_size);
+                    } else {
+                        hits.count = 0;
+                        vim_keyword_scan(sets[set_index], text, text_size, 0, &hits);
+                        found = hits.count;
+                    }
+                }
+                double us = (vim_time_us() - begin)/(double)frames;
+                vim_scratch_printf(app, &out, "%-8s %-9d %-12s %14.1f %8d\n",
+                                   pass ? "plain" : "dense",
+                                   sets[set_index]->count,
+                                   method ? "scanner" : "match_part", us, found);
+            }
         }
     }
-    //*****************************************************************
 
-    if (argstr.str == NULL || argstr.size == 0) {
-        save_buffer(app, &buffer, buffer.file_name, buffer.file_name_len, 0);
-    } else {
-        save_buffer(app, &buffer, expand_str(argstr), 0);
+    vim_array_free(&hits);
+    for (int i = 0; i < 2; ++i) {
+        vim_keyword_set_free(sets[i]);
+        free(sets[i]);
     }
+    free(dense);
+    free(plain);
 }
 
-VIM_COMMAND_FUNC_SIG(edit_file) {
-    exec_command(app, interactive_open);
-}
+// w before the motion engine: one byte at a time through 1KB stream chunks.
+static int vim_seek_next_word_by_bytes(Application_Links* app,
+                                       Buffer_Summary* buffer, int pos) {
+    char chunk[1024];
+    int chunk_size = sizeof(chunk);
+    Stream_Chunk stream = {};
+    
+    if (init_stream_chunk(&stream, app, buffer, pos, chunk, chunk_size)) {
+        char cursorch = stream.data[pos];
+        char nextch = cursorch; 
+        int still_looping = true;
+        bool inter_whitespace = false;
+        do {
+            for (; pos < stream.end; ++pos) {
+                // Three kinds of characters:
+                //  - word characters, first of a row results in a stop
+                //  - symbol characters, first of a row results in a stop
+                //  - whitespace characters, always skip
+                //  The distinction between the first two is only needed
+                //   because word and symbol characters do not form a "row"
+                //   when intermixed.
+                nextch = stream.data[pos];
+                int is_whitespace = char_is_whitespace(nextch);
+                int is_alphanum = char_is_alpha_numeric(nextch);
+                int is_symbol = !is_whitespace && !is_alphanum;
 
-VIM_COMMAND_FUNC_SIG(new_file) {
-    View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Top);
-    new_view_settings(app, &new_view);
-    set_active_view(app, &new_view);
-    if (compare(argstr, make_lit_string("")) == 0) {
-        exec_command(app, interactive_new);
-    } else {
-        Buffer_Summary buffer = create_buffer(app, argstr.str, argstr.size, 0);
-        if (buffer.exists){
-            view_set_buffer(app, &new_view, buffer.buffer_id, SetBuffer_KeepOriginalGUI);
+                if (char_is_whitespace(cursorch)) {
+                    if (!is_whitespace) {
+                        return pos;
+                    }
+                }
+                else if (char_is_alpha_numeric(cursorch)) {
+                    if (is_whitespace) {
+                        inter_whitespace = true;
+                    }
+                    else if (is_symbol ||
+                             (is_alphanum && inter_whitespace)) {
+                        return pos;
+                    }
+                }
+                else {
+                    if (is_whitespace) {
+                        inter_whitespace = true;
+                    }
+                    if (is_alphanum ||
+                        (is_symbol && inter_whitespace)) {
+                        return pos;
+                    }
+                }
+            }
+            still_looping = forward_stream_chunk(&stream);
+        } while (still_looping);
+
+        if (pos > buffer->size) {
+            pos = buffer->size;
         }
     }
-}
 
-VIM_COMMAND_FUNC_SIG(new_file_open_vertical) {
-    View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Right);
-    new_view_settings(app, &new_view);
-    set_active_view(app, &new_view);
-    exec_command(app, interactive_new);
+    return pos;
 }
 
-VIM_COMMAND_FUNC_SIG(colorscheme) {
-    if (argstr.str && argstr.size > 0) {
-        change_theme(app, expand_str(argstr));
-    }
-    // else set bar text (...) to current colorscheme
-    else {
-        exec_command(app, open_color_tweaker);
+// :wordbench [MB]   times w across a generated buffer, 64MB by default: byte
+//                   by byte, the engine one word per call, and the engine
+//                   resolving the whole walk as a single count
+VIM_COMMAND_FUNC_SIG(word_benchmark) {
+    int megabytes = (argstr.size > 0) ? str_to_int(argstr) : 64;
+    if (megabytes <= 0 || megabytes > 1024) { return; }
+    Buffer_Summary buffer = vim_make_benchmark_buffer(
+        app, lit("*word bench data*"), megabytes << 20, make_lit_string(""));
+
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out, "wordbench: w over %d MB\n\n", megabytes);
+    vim_scratch_printf(app, &out, "%-16s %10s %12s %10s\n",
+                       "method", "words", "total ms", "MB/s");
+
+    static const char* methods[] = { "bytes", "engine", "engine counted" };
+    int words = 0;
+    for (int method = 0; method < (int)ArrayCount(methods); ++method) {
+        int pos = 0;
+        int steps = 0;
+        int64_t begin = vim_time_us();
+        if (method == 2) {
+            pos = vim_word_motion(app, &buffer, 0, word_motion_next_start, false,
+                                  words);
+            steps = words;
+        } else {
+            while (pos < buffer.size) {
+                int next = (method == 0)
+                    ? vim_seek_next_word_by_bytes(app, &buffer, pos)
+                    : vim_word_motion(app, &buffer, pos, word_motion_next_start,
+                                      false, 1);
+                if (next <= pos) { break; }
+                pos = next;
+                ++steps;
+            }
+        }
+        double ms = (vim_time_us() - begin)/1000.0;
+        if (method == 1) { words = steps; }
+        vim_scratch_printf(app, &out, "%-16s %10d %12.1f %10.1f%s\n",
+                           methods[method], steps, ms,
+                           ms > 0 ? megabytes/(ms/1000.0) : 0.0,
+                           pos == buffer.size ? "" : "  (stopped early)");
     }
 }
 
-VIM_COMMAND_FUNC_SIG(close_view) {
-    View_Summary view = get_view_first(app, AccessAll);
-    get_view_next(app, &view, AccessAll);
-    if (!view.exists) send_exit_signal(app);
-    else close_panel(app);
+// :linebench [lines]   grows a V selection one line at a time down a
+//                       generated buffer of about 2M lines by default, with
+//                       line boundaries from the seek functions and from the
+//                       line index, and times scanning and patching the index
+// Runs the line index over buffers with no newline at all, where every line
+// past the last clamps to line 1, and with none at the end.
+static bool vim_line_index_check_edges() {
+    struct Edge_Case {
+        const char* text;
+        int line;
+        int start;
+        int end;
+        Range bytes;
+    };
+    static const Edge_Case cases[] = {
+        { "", 1, 0, 0, { 0, 0 } },
+        { "", 5, 0, 0, { 0, 0 } },
+        { "abc", 5, 0, 3, { 0, 3 } },
+        { "ab\ncd", 2, 3, 5, { 3, 5 } },
+        { "ab\ncd", 9, 3, 5, { 3, 5 } },
+        { "ab\ncd\n", 3, 6, 6, { 6, 6 } },
+    };
+    bool ok = true;
+    for (int i = 0; i < (int)ArrayCount(cases); ++i) {
+        const Edge_Case* edge = cases + i;
+        Vim_Line_Index index = {};
+        vim_line_index_reset(&index, 0);
+        vim_line_index_on_edit(&index, 0, 0, make_string((char*)edge->text,
+                                                         (int)strlen(edge->text)));
+        Range bytes = vim_line_index_byte_range(&index, edge->line, edge->line);
+        ok = ok && vim_line_index_is_complete(&index) &&
+            vim_line_index_start(&index, edge->line) == edge->start &&
+            vim_line_index_end(&index, edge->line) == edge->end &&
+            bytes.start == edge->bytes.start && bytes.end == edge->bytes.end;
+        vim_line_index_free(&index);
+    }
+    return ok;
 }
 
-VIM_COMMAND_FUNC_SIG(close_all) {
-    send_exit_signal(app);
-}
+VIM_COMMAND_FUNC_SIG(line_benchmark) {
+    int line_target = (argstr.size > 0) ? str_to_int(argstr) : 2000000;
+    if (line_target <= 0 || line_target > (1 << 30)/84) { return; }
+    Buffer_Summary buffer = vim_make_benchmark_buffer(
+        app, lit("*line bench data*"), line_target*84, make_lit_string(""));
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer.buffer_id);
+    if (buffer_state == nullptr) { return; }
+    Vim_Line_Index* lines = &buffer_state->lines;
+
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    if (!vim_line_index_check_edges()) {
+        vim_scratch_printf(app, &out, "linebench: line index edge cases failed\n");
+        return;
+    }
+    vim_line_index_reset(lines, buffer.size);
+    int64_t begin = vim_time_us();
+    bool complete = vim_line_index_update(app, &buffer, lines, buffer.size);
+    double scan_ms = (vim_time_us() - begin)/1000.0;
+    if (!complete) { return; }
+    int line_count = vim_line_index_line_count(lines);
+    vim_scratch_printf(app, &out, "linebench: V from line 1 to line %d (%d MB)\n\n",
+                       line_count, buffer.size >> 20);
+    vim_scratch_printf(app, &out, "%-16s %12s %14s\n", "method", "total ms",
+                       "ns per line");
+
+    // The anchor and the cursor sit mid-line, as they would after a few l.
+    int anchor = vim_line_index_start(lines, 1) + 40;
+    static const char* methods[] = { "seek", "line index" };
+    long long checksums[ArrayCount(methods)] = {};
+    for (int method = 0; method < (int)ArrayCount(methods); ++method) {
+        begin = vim_time_us();
+        for (int line = 1; line <= line_count; ++line) {
+            int pos = vim_line_index_start(lines, line) + 40;
+            int line_end = vim_line_index_end(lines, line);
+            if (pos > line_end) { pos = line_end; }
+            Range selection;
+            if (method == 0) {
+                selection = make_range(seek_line_beginning(app, &buffer, anchor),
+                                       seek_line_end(app, &buffer, pos) + 1);
+            } else {
+                selection = make_range(
+                    vim_line_index_start(lines, vim_line_index_line_of(lines, anchor)),
+                    vim_line_index_end(lines, vim_line_index_line_of(lines, pos)) + 1);
+            }
+            checksums[method] += selection.start + selection.end;
+        }
+        double ms = (vim_time_us() - begin)/1000.0;
+        vim_scratch_printf(app, &out, "%-16s %12.1f %14.1f%s\n", methods[method],
+                           ms, ms*1e6/line_count,
+                           checksums[method] == checksums[0] ? "" : "  (mismatch)");
+    }
 
-VIM_COMMAND_FUNC_SIG(write_file_and_close_all) {
-    write_file(app, command, argstr, force);
-    close_all(app, command, argstr, force);
+    // A newline typed at the top of the buffer and deleted again, the worst
+    // place for the patch since every later offset moves.
+    const int edits = 1000;
+    begin = vim_time_us();
+    for (int i = 0; i < edits; ++i) {
+        vim_line_index_on_edit(lines, 0, 0, make_lit_string("\n"));
+        vim_line_index_on_edit(lines, 0, 1, make_lit_string(""));
+    }
+    double edit_ms = (vim_time_us() - begin)/1000.0;
+    vim_scratch_printf(app, &out, "\n%-28s %12.1f ms\n", "index scan", scan_ms);
+    vim_scratch_printf(app, &out, "%-28s %12.1f us\n", "patch per edit at the top",
+                       edit_ms*1000.0/(2*edits));
+    vim_scratch_printf(app, &out, "%-28s %12.1f KB\n", "index memory",
+                       vim_line_index_memory(lines)/1024.0);
 }
 
-VIM_COMMAND_FUNC_SIG(write_file_and_close_view) {
-    write_file(app, command, argstr, force);
-    close_view(app, command, argstr, force);
+// :savebench [lines]   times the indent pass of :w on a generated buffer of
+//                       about 100000 lines of functions, after a one-line edit,
+//                       indenting everything and only what changed
+VIM_COMMAND_FUNC_SIG(save_benchmark) {
+    int line_target = (argstr.size > 0) ? str_to_int(argstr) : 100000;
+    if (line_target <= 0 || line_target > (1 << 30)/40) { return; }
+    static const char function_text[] =
+        "static int function(int a, int b) {\n"
+        "    if (a > b) {\n"
+        "        return a - b;\n"
+        "    }\n"
+        "    for (int i = 0; i < b; ++i) {\n"
+        "        a += i;\n"
+        "    }\n"
+        "    return a;\n"
+        "}\n"
+        "\n";
+    const int function_lines = 10;
+    const int function_size = sizeof(function_text) - 1;
+    int functions = (line_target + function_lines - 1)/function_lines;
+
+    Buffer_Summary buffer = vim_get_scratch_buffer(app, lit("*save bench data*"));
+    const int batch = 4096;
+    char* block = (char*)malloc(batch*function_size);
+    if (block == nullptr) { return; }
+    for (int i = 0; i < batch; ++i) {
+        memcpy(block + i*function_size, function_text, function_size);
+    }
+    for (int written = 0; written < functions; written += batch) {
+        int count = (functions - written < batch) ? functions - written : batch;
+        buffer_replace_range(app, &buffer, buffer.size, buffer.size, block,
+                             count*function_size);
+        buffer = get_buffer(app, buffer.buffer_id, AccessAll);
+    }
+    free(block);
+
+    uint32_t flags = DEFAULT_INDENT_FLAGS | AutoIndent_FullTokens;
+    Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer.buffer_id);
+    if (buffer_state == nullptr) { return; }
+    // The first pass settles the text and starts the tracking.
+    buffer_state->indent_dirty.tracking = false;
+    vim_indent_changes(app, &buffer, DEF_TAB_WIDTH, flags);
+    // The render caller keeps the bracket index current as you type, so it
+    // is not part of what a save costs.
+    buffer = get_buffer(app, buffer.buffer_id, AccessAll);
+    vim_bracket_index_update(app, &buffer, &buffer_state->brackets, INT_MAX);
+
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out,
+                       "savebench: %d lines (%d MB), one-line edit before each save\n\n",
+                       functions*function_lines, buffer.size >> 20);
+    vim_scratch_printf(app, &out, "%-16s %12s %12s %12s\n", "method",
+                       "ms per save", "ranges", "full passes");
+
+    // An unindented statement typed into a function, at a different place
+    // each time, on the line before its first return.
+    static char edit[] = "a *= 2;\n";
+    int edit_at = (int)(strstr(function_text, "        return") - function_text);
+    int edit_line = 1;
+    for (int i = 0; i < edit_at; ++i) { edit_line += (function_text[i] == '\n'); }
+    const int saves = 20;
+    // The functions edited so far, by both methods, each a line longer now.
+    int edited[2*saves];
+    int edited_count = 0;
+    Vim_Line_Index* lines = &buffer_state->lines;
+    static const char* methods[] = { "whole buffer", "changed only" };
+    for (int method = 0; method < (int)ArrayCount(methods); ++method) {
+        int64_t total_us = 0;
+        int ranges = 0;
+        int full_passes = 0;
+        for (int save = 0; save < saves; ++save) {
+            int function = (int)((save*2 + method + 1)*(int64_t)functions/(saves*2 + 1));
+            int lines_before = 0;
+            for (int i = 0; i < edited_count; ++i) {
+                lines_before += (edited[i] < function);
+            }
+            edited[edited_count++] = function;
+            if (!vim_line_index_update(app, &buffer, lines, INT_MAX)) { return; }
+            int pos = vim_line_index_start(
+                lines, function*function_lines + edit_line + lines_before);
+            buffer_replace_range(app, &buffer, pos, pos, edit, sizeof(edit) - 1);
+            buffer = get_buffer(app, buffer.buffer_id, AccessAll);
+            int64_t begin = vim_time_us();
+            if (method == 0) {
+                buffer_auto_indent(app, &global_part, &buffer, 0, buffer.size,
+                                   DEF_TAB_WIDTH, flags);
+            } else {
+                int indented = vim_indent_changes(app, &buffer, DEF_TAB_WIDTH, flags);
+                if (indented < 0) { full_passes += 1; }
+                else { ranges += indented; }
+            }
+            total_us += vim_time_us() - begin;
+            buffer = get_buffer(app, buffer.buffer_id, AccessAll);
+            vim_indent_dirty_reset(&buffer_state->indent_dirty, buffer.size);
+        }
+        if (method == 0) {
+            vim_scratch_printf(app, &out, "%-16s %12.2f %12s %12d\n",
+                               methods[method], total_us/1000.0/saves, "-", saves);
+        } else {
+            // Ranges per save that indented only what changed.
+            int partial_saves = saves - full_passes;
+            vim_scratch_printf(app, &out, "%-16s %12.2f %12.1f %12d\n",
+                               methods[method], total_us/1000.0/saves,
+                               partial_saves ? ranges/(double)partial_saves : 0.0,
+                               full_passes);
+        }
+    }
 }
 
-VIM_COMMAND_FUNC_SIG(vertical_split) {
-    View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Right);
-    view_set_buffer(app, &new_view, view.buffer_id, 0);
-    set_active_view(app, &view);
-}
+// :macrobench [runs]   replays 0xA;<esc>j over a generated buffer, 10000
+//                      times by default, and reports the replay rate
+VIM_COMMAND_FUNC_SIG(macro_benchmark) {
+    int runs = (argstr.size > 0) ? str_to_int(argstr) : 10000;
+    if (runs <= 0) { return; }
 
-VIM_COMMAND_FUNC_SIG(horizontal_split) {
     View_Summary view = get_active_view(app, AccessAll);
-    View_Summary new_view = open_view(app, &view, ViewSplit_Right);
-    view_set_buffer(app, &new_view, view.buffer_id, 0);
-    set_active_view(app, &view);
-}
-
-VIM_COMMAND_FUNC_SIG(exec_regex) {
-    fprintf(stderr, "%.*s", (int)argstr.size, argstr.str);
-}
-
-VIM_COMMAND_FUNC_SIG(change_directory) {
-    char dir[4096];
-    String dirstr = make_fixed_width_string(dir);
-    dirstr.size = directory_get_hot(app, dirstr.str, dirstr.memory_size);
-    assert(dirstr.size < 4096);
-    if (!directory_cd_expand_user(app, dirstr.str, &dirstr.size, dirstr.memory_size,
-                                  argstr.str, argstr.size)) {
-        fprintf(stderr, "Couldn't change directory to %.*s\n", argstr.size, argstr.str);
-        return;
+    if (!view.exists) { return; }
+    Buffer_ID previous_buffer = view.buffer_id;
+    Buffer_Summary buffer = vim_make_benchmark_buffer(
+        app, lit("*macro bench data*"), runs*100 + 4096, make_lit_string(""));
+    view_set_buffer(app, &view, buffer.buffer_id, 0);
+    view_set_cursor(app, &view, seek_pos(0), true);
+    enter_normal_mode(app, buffer.buffer_id);
+
+    struct { Custom_Command_Function* command; Key_Code key; } steps[] = {
+        { vim_count_digit_or_line_start, '0' },
+        { vim_delete_char, 'x' },
+        { seek_eol_then_insert, 'A' },
+        { write_character, ';' },
+        { enter_normal_mode_on_current, key_esc },
+        { vim_move_down, 'j' },
+    };
+    Vim_Array<uint8_t> events = {};
+    for (int i = 0; i < (int)ArrayCount(steps); ++i) {
+        Generic_Command command = {};
+        command.command = steps[i].command;
+        Key_Code character = (steps[i].key == key_esc) ? 0 : steps[i].key;
+        vim_macro_put_event(&events, macro_event_command, command,
+                            steps[i].key, character);
     }
-    fprintf(stderr, "%.*s\n", (int)dirstr.size, dirstr.str);
-    directory_set_hot(app, dirstr.str, dirstr.size);
+
+    Vim_Register macro = {};
+    vim_register_append_text(&macro, (char*)events.items, events.count);
+    macro.is_macro = true;
+
+    int64_t begin = vim_time_us();
+    int64_t commands = vim_macro_replay(app, &macro, runs);
+    double ms = (vim_time_us() - begin)/1000.0;
+    vim_register_clear(&macro);
+
+    Buffer_Summary out = vim_get_scratch_buffer(app, lit("*vim bench*"));
+    vim_scratch_printf(app, &out, "macrobench: 0xA;<esc>j (%d bytes of events)\n\n",
+                       events.count);
+    vim_scratch_printf(app, &out, "%10s %10s %12s %14s %12s\n",
+                       "runs", "commands", "total ms", "commands/s", "us per run");
+    vim_scratch_printf(app, &out, "%10d %10lld %12.1f %14.0f %12.2f\n",
+                       runs, (long long)commands, ms,
+                       ms > 0 ? commands/(ms/1000.0) : 0.0,
+                       ms*1000.0/runs);
+
+    vim_array_free(&events);
+    view_set_buffer(app, &view, previous_buffer, 0);
 }
 
 //=============================================================================
@@ -1756,6 +6465,38 @@ OPEN_FILE_HOOK_SIG(vim_hook_new_file_func) {
     return 0;
 }
 
+// CALL ME
+// This function should be called from your 4coder custom file edit range hook
+FILE_EDIT_RANGE_SIG(vim_hook_file_edit_range_func) {
+    vim_track_edit(buffer_id, range.first, range.one_past_last, text);
+    vim_capture_insert_edit(buffer_id, range.first, range.one_past_last, text);
+    return 0;
+}
+
+// CALL ME
+// This function should be called from your 4coder custom end file hook
+OPEN_FILE_HOOK_SIG(vim_hook_end_file_func) {
+    vim_release_buffer_state(app, buffer_id);
+    return 0;
+}
+
+// CALL ME
+// Set this as your 4coder command caller (or call it from yours in place of
+// default_command_caller) so that macros can record commands.
+COMMAND_CALLER_HOOK(vim_hook_command_caller_func) {
+    if (macro_state.recording && !vim_macro_replaying() &&
+        cmd.command != vim_macro_record) {
+        User_Input in = get_command_input(app);
+        vim_macro_put_event(&macro_state.recorded, macro_event_command, cmd,
+                            in.key.keycode, in.key.character);
+    }
+    // Views switch by mouse as well as by command, so check on both sides.
+    vim_sync_active_view(app);
+    int32_t result = default_command_caller(app, cmd);
+    vim_sync_active_view(app);
+    return result;
+}
+
 // CALL ME
 // This function should be called from your 4coder render caller to draw the
 // vim-related things on screen.
@@ -1765,6 +6506,9 @@ RENDER_CALLER_SIG(vim_render_caller) {
     Buffer_Summary buffer = get_buffer(app, view.buffer_id, AccessAll);
     View_Summary active_view = get_active_view(app, AccessAll);
     bool32 is_active_view = (active_view.view_id == view_id);
+    // A click into another view runs no command, and the next key would be
+    // looked up in its buffer's keymap before the command caller could sync.
+    if (is_active_view) { vim_sync_active_view(app); }
     
     static Managed_Scope render_scope = 0;
     if (render_scope == 0){
@@ -1773,162 +6517,275 @@ RENDER_CALLER_SIG(vim_render_caller) {
     
     Partition *scratch = &global_part;
     
+    Vim_View_State* view_state = vim_get_view_state(view_id);
+    if (view_state == 0){
+        do_core_render(app);
+        return;
+    }
+    if (view_state->render_scope == 0){
+        view_state->render_scope = create_user_managed_scope(app);
+    }
+    Managed_Scope *view_scope = &view_state->render_scope;
+    marker_stats.frames += 1;
+    vim_clipboard_flush(app);
+    
+    // NOTE(chr): Every section below is timed into the view's window; see
+    // :renderstats.
+    Vim_Render_Timings *timings = &view_state->timings;
+    int64_t frame_start = vim_time_ns();
+    int64_t section_start = frame_start;
+
+    // NOTE(chr): Let the search match cache catch up a little every frame.
+    if (is_active_view && state.last_search.text.size > 0) {
+        Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer.buffer_id);
+        if (buffer_state) {
+            vim_match_cache_update(app, &buffer, &buffer_state->matches,
+                                   state.last_search.text,
+                                   VIM_MATCH_CACHE_FRAME_STEP);
+        }
+    }
+    // NOTE(chr): Likewise the line index, so that the first line-wise command
+    // in a big buffer finds it already scanned.
+    if (is_active_view) {
+        Vim_Buffer_State* buffer_state = vim_get_buffer_state(buffer.buffer_id);
+        if (buffer_state) {
+            vim_line_index_update(app, &buffer, &buffer_state->lines,
+                                  VIM_LINE_INDEX_FRAME_STEP);
+        }
+    }
+    vim_render_time(timings, render_search, section_start);
+    
     // NOTE(allen): Scan for TODOs and NOTEs
+    // NOTE(chr): ...and every other highlight keyword, in a single pass. The
+    // hits and their marker slots carry over between frames; see
+    // Vim_Keyword_Cache.
+    section_start = vim_time_ns();
     {
-        Theme_Color colors[2];
-        colors[0].tag = Stag_Text_Cycle_2;
-        colors[1].tag = Stag_Text_Cycle_1;
-        get_theme_colors(app, colors, 2);
+        Vim_Keyword_Cache *cache = &view_state->keywords;
+        vim_update_keyword_cache(app, &buffer, cache,
+                                 make_range(on_screen_range.first, on_screen_range.one_past_last));
         
-        Temp_Memory temp = begin_temp_memory(scratch);
-        int32_t text_size = on_screen_range.one_past_last - on_screen_range.first;
-        char *text = push_array(scratch, char, text_size);
-        buffer_read_range(app, &buffer, on_screen_range.first, on_screen_range.one_past_last, text);
-        
-        Highlight_Record *records = push_array(scratch, Highlight_Record, 0);
-        String tail = make_string(text, text_size);
-        for (int32_t i = 0; i < text_size; tail.str += 1, tail.size -= 1, i += 1){
-            if (match_part(tail, make_lit_string("NOTE"))){
-                Highlight_Record *record = push_array(scratch, Highlight_Record, 1);
-                record->first = i + on_screen_range.first;
-                record->one_past_last = record->first + 4;
-                record->color = colors[0].color;
-                tail.str += 3;
-                tail.size -= 3;
-                i += 3;
+        if (cache->objects_stale){
+            cache->objects_stale = false;
+            
+            Temp_Memory temp = begin_temp_memory(scratch);
+            int32_t record_count = cache->hits.count;
+            Highlight_Record *records = push_array(scratch, Highlight_Record, record_count + 1);
+            for (int32_t i = 0; i < record_count; i += 1){
+                Vim_Keyword_Hit hit = cache->hits.items[i];
+                records[i].first = hit.start;
+                records[i].one_past_last = hit.end;
+                records[i].color = highlight_keyword_colors[hit.keyword];
+            }
+            
+            int32_t slot_index = 0;
+            if (record_count > 0){
+                sort_highlight_record(records, 0, record_count);
+                Marker *markers = push_array(scratch, Marker, record_count*2);
+                int32_t group_start = 0;
+                for (int32_t i = 1; i <= record_count; i += 1){
+                    bool32 do_emit = i == record_count || (records[i].color != records[group_start].color);
+                    if (do_emit){
+                        int32_t marker_count = 0;
+                        for (int32_t j = group_start; j < i; j += 1){
+                            markers[marker_count] = {};
+                            markers[marker_count++].pos = records[j].first;
+                            markers[marker_count] = {};
+                            markers[marker_count++].pos = records[j].one_past_last;
+                        }
+                        if (slot_index == cache->slots.count){
+                            Vim_Marker_Slot empty = {};
+                            vim_array_push(&cache->slots, empty);
+                        }
+                        Vim_Marker_Slot *slot = cache->slots.items + slot_index++;
+                        if (vim_marker_slot_reserve(app, view_scope, slot, buffer.buffer_id, marker_count)){
+                            slot->visuals[0] = create_marker_visual(app, slot->object);
+                            marker_visual_set_priority(app, slot->visuals[0], VisualPriority_Lowest);
+                            // Other views of this buffer keep their own slots.
+                            marker_visual_set_view_key(app, slot->visuals[0], view_id);
+                        }
+                        vim_marker_slot_store(app, slot, markers, marker_count);
+                        marker_visual_set_effect(app, slot->visuals[0],
+                                                 VisualType_CharacterHighlightRanges,
+                                                 SymbolicColor_Transparent, records[group_start].color, 0);
+                        group_start = i;
+                    }
+                }
             }
-            else if (match_part(tail, make_lit_string("TODO"))){
-                Highlight_Record *record = push_array(scratch, Highlight_Record, 1);
-                record->first = i + on_screen_range.first;
-                record->one_past_last = record->first + 4;
-                record->color = colors[1].color;
-                tail.str += 3;
-                tail.size -= 3;
-                i += 3;
+            // Colors that went away keep their slots, emptied.
+            cache->slots_in_use = slot_index;
+            for (; slot_index < cache->slots.count; slot_index += 1){
+                vim_marker_slot_store(app, cache->slots.items + slot_index, 0, 0);
             }
+            
+            end_temp_memory(temp);
         }
-        int32_t record_count = (int32_t)(push_array(scratch, Highlight_Record, 0) - records);
-        push_array(scratch, Highlight_Record, 1);
-        
-        if (record_count > 0){
-            sort_highlight_record(records, 0, record_count);
-            Temp_Memory marker_temp = begin_temp_memory(scratch);
-            Marker *markers = push_array(scratch, Marker, 0);
-            int_color current_color = records[0].color;
-            {
-                Marker *marker = push_array(scratch, Marker, 2);
-                marker[0].pos = records[0].first;
-                marker[1].pos = records[0].one_past_last;
-            }
-            for (int32_t i = 1; i <= record_count; i += 1){
-                bool32 do_emit = i == record_count || (records[i].color != current_color);
-                if (do_emit){
-                    int32_t marker_count = (int32_t)(push_array(scratch, Marker, 0) - markers);
-                    Managed_Object o = alloc_buffer_markers_on_buffer(app, buffer.buffer_id, marker_count, &render_scope);
-                    managed_object_store_data(app, o, 0, marker_count, markers);
-                    Marker_Visual v = create_marker_visual(app, o);
-                    marker_visual_set_effect(app, v,
-                                             VisualType_CharacterHighlightRanges,
-                                             SymbolicColor_Transparent, current_color, 0);
-                    marker_visual_set_priority(app, v, VisualPriority_Lowest);
-                    end_temp_memory(marker_temp);
-                    current_color = records[i].color;
-                }
-                
-                Marker *marker = push_array(scratch, Marker, 2);
-                marker[0].pos = records[i].first;
-                marker[1].pos = records[i].one_past_last;
+        marker_stats.unpooled_allocations += cache->slots_in_use;
+    }
+    vim_render_time(timings, render_keywords, section_start);
+
+    // NOTE(chr): Search match highlight
+    section_start = vim_time_ns();
+    {
+        Vim_Marker_Slot *slot = &view_state->search_markers;
+        int32_t marker_count = 0;
+        Marker *markers = 0;
+        if (vim_hlsearch && !state.search_highlight_hidden &&
+            state.last_search.text.size > 0){
+            Vim_Search_Highlight* highlight = &view_state->search_highlight;
+            vim_update_search_highlight(app, &buffer, highlight,
+                                        make_range(on_screen_range.first,
+                                                   on_screen_range.one_past_last),
+                                        state.last_search.text);
+            marker_count = highlight->markers.count;
+            markers = highlight->markers.items;
+        }
+        if (marker_count > 0 || slot->object != 0){
+            if (vim_marker_slot_reserve(app, view_scope, slot, buffer.buffer_id, marker_count)){
+                slot->visuals[0] = create_marker_visual(app, slot->object);
+                marker_visual_set_effect(app, slot->visuals[0],
+                                         VisualType_CharacterHighlightRanges,
+                                         SymbolicColorFromPalette(Stag_Highlight),
+                                         SymbolicColorFromPalette(Stag_At_Highlight), 0);
+                marker_visual_set_priority(app, slot->visuals[0], VisualPriority_Low);
+                marker_visual_set_view_key(app, slot->visuals[0], view_id);
             }
+            vim_marker_slot_store(app, slot, markers, marker_count);
+        }
+        if (marker_count > 0){
+            marker_stats.unpooled_allocations += 1;
         }
-        
-        end_temp_memory(temp);
     }
+    vim_render_time(timings, render_search, section_start);
     
-    // NOTE(chr): Visual range highlight
+    // NOTE(chr): Visual range highlight. A block is a range per line, for the
+    // lines on screen.
+    section_start = vim_time_ns();
     {
-        Managed_Object highlight_range = alloc_buffer_markers_on_buffer(app, buffer.buffer_id, 2, &render_scope);
+        Temp_Memory temp = begin_temp_memory(scratch);
+        Vim_Modal_State *view_modal = &view_state->modal;
         Marker cm_markers[2] = {};
-        cm_markers[0].pos = state.selection_range.start;
-        cm_markers[1].pos = state.selection_range.end;
-        managed_object_store_data(app, highlight_range, 0, 2, cm_markers);
-
-        Theme_Color color = {};
-        color.tag = Stag_Highlight;
-        get_theme_colors(app, &color, 1);
-
-        Marker_Visual visual = create_marker_visual(app, highlight_range);
-        marker_visual_set_effect(app, visual, VisualType_CharacterHighlightRanges,
-                                 color.color, 0, 0);
-        Marker_Visual_Take_Rule take_rule = {};
-        take_rule.first_index = 0;
-        take_rule.take_count_per_step = 2;
-        take_rule.step_stride_in_marker_count = 1;
-        take_rule.maximum_number_of_markers = 2;
-        marker_visual_set_take_rule(app, visual, take_rule);
-        marker_visual_set_priority(app, visual, VisualPriority_Highest);
+        cm_markers[0].pos = view_modal->selection_range.start;
+        cm_markers[1].pos = view_modal->selection_range.end;
+        Marker *markers = cm_markers;
+        int32_t marker_count = 2;
+        if (view_modal->mode == mode_visual_block){
+            marker_count = 0;
+            Vim_Block block = {};
+            vim_block_from_selection(app, &buffer, view_modal->selection_cursor, &block);
+            int32_t first = vim_line_of_pos(app, &buffer, on_screen_range.first);
+            int32_t last = vim_line_of_pos(app, &buffer, on_screen_range.one_past_last);
+            if (first < block.first_line) first = block.first_line;
+            if (last > block.last_line) last = block.last_line;
+            if (first <= last){
+                markers = push_array(scratch, Marker, (last - first + 1)*2);
+            }
+            for (int32_t line = first; markers && line <= last; line += 1){
+                Range bounds = vim_line_bounds(app, &buffer, line);
+                Range cells = vim_block_cells_in_buffer(app, &buffer, &block,
+                                                        { bounds.start, bounds.end });
+                markers[marker_count] = {};
+                markers[marker_count++].pos = cells.start;
+                markers[marker_count] = {};
+                markers[marker_count++].pos = cells.end;
+            }
+        }
+        Vim_Marker_Slot *slot = &view_state->selection_markers;
+        if (vim_marker_slot_reserve(app, view_scope, slot, buffer.buffer_id, marker_count)){
+            Marker_Visual visual = create_marker_visual(app, slot->object);
+            marker_visual_set_effect(app, visual, VisualType_CharacterHighlightRanges,
+                                     SymbolicColorFromPalette(Stag_Highlight), 0, 0);
+            Marker_Visual_Take_Rule take_rule = {};
+            take_rule.first_index = 0;
+            take_rule.take_count_per_step = 2;
+            take_rule.step_stride_in_marker_count = 2;
+            marker_visual_set_take_rule(app, visual, take_rule);
+            marker_visual_set_priority(app, visual, VisualPriority_Highest);
+            marker_visual_set_view_key(app, visual, view_id);
+            slot->visuals[0] = visual;
+        }
+        vim_marker_slot_store(app, slot, markers, marker_count);
+        marker_stats.unpooled_allocations += 1;
+        end_temp_memory(temp);
     }
+    vim_render_time(timings, render_selection, section_start);
     
 
 // NOTE(allen): Cursor and mark
-    Managed_Object cursor_and_mark = alloc_buffer_markers_on_buffer(app, buffer.buffer_id, 2, &render_scope);
-    Marker cm_markers[2] = {};
-    cm_markers[0].pos = view.cursor.pos;
-    cm_markers[1].pos = view.mark.pos;
-    managed_object_store_data(app, cursor_and_mark, 0, 2, cm_markers);
+    // NOTE(chr): One slot, with visuals for the cursor, the mark and the line
+    // highlight. Visuals that should not show this frame go invisible.
+    section_start = vim_time_ns();
+    {
+        Vim_Marker_Slot *slot = &view_state->cursor_markers;
+        if (vim_marker_slot_reserve(app, view_scope, slot, buffer.buffer_id, 2)){
+            Marker_Visual_Take_Rule take_rule = {};
+            take_rule.first_index = 0;
+            take_rule.take_count_per_step = 1;
+            take_rule.step_stride_in_marker_count = 1;
+            take_rule.maximum_number_of_markers = 1;
+            for (int32_t i = 0; i < 3; i += 1){
+                slot->visuals[i] = create_marker_visual(app, slot->object);
+                take_rule.first_index = (i == 1) ? 1 : 0;
+                marker_visual_set_take_rule(app, slot->visuals[i], take_rule);
+                marker_visual_set_priority(app, slot->visuals[i], VisualPriority_Highest);
+                marker_visual_set_view_key(app, slot->visuals[i], view_id);
+            }
+        }
+        Marker cm_markers[2] = {};
+        cm_markers[0].pos = view.cursor.pos;
+        cm_markers[1].pos = view.mark.pos;
+        vim_marker_slot_store(app, slot, cm_markers, 2);
+        marker_stats.unpooled_allocations += 1;
     
-    bool32 cursor_is_hidden_in_this_view = (cursor_is_hidden && is_active_view);
-    if (!cursor_is_hidden_in_this_view){
-        Theme_Color colors[2] = {};
-        colors[0].tag = Stag_Cursor;
-        colors[1].tag = Stag_Mark;
-        get_theme_colors(app, colors, 2);
-        int_color cursor_color = SymbolicColorFromPalette(Stag_Cursor);
-        int_color mark_color   = SymbolicColorFromPalette(Stag_Mark);
-        int_color text_color    = is_active_view?
-            SymbolicColorFromPalette(Stag_At_Cursor):SymbolicColorFromPalette(Stag_Default);
-        
-        Marker_Visual_Take_Rule take_rule = {};
-        take_rule.first_index = 0;
-        take_rule.take_count_per_step = 1;
-        take_rule.step_stride_in_marker_count = 1;
-        take_rule.maximum_number_of_markers = 1;
-        
-        Marker_Visual visual = create_marker_visual(app, cursor_and_mark);
-        Marker_Visual_Type type = is_active_view?VisualType_CharacterBlocks:VisualType_CharacterWireFrames;
-        marker_visual_set_effect(app, visual,
-                                 type, cursor_color, text_color, 0);
-        marker_visual_set_take_rule(app, visual, take_rule);
-        marker_visual_set_priority(app, visual, VisualPriority_Highest);
-        
-        visual = create_marker_visual(app, cursor_and_mark);
-        marker_visual_set_effect(app, visual,
-                                 VisualType_CharacterWireFrames, mark_color, 0, 0);
-        take_rule.first_index = 1;
-        marker_visual_set_take_rule(app, visual, take_rule);
-        marker_visual_set_priority(app, visual, VisualPriority_Highest);
-    }
+        bool32 cursor_is_hidden_in_this_view = (cursor_is_hidden && is_active_view);
+        if (!cursor_is_hidden_in_this_view){
+            int_color cursor_color = SymbolicColorFromPalette(Stag_Cursor);
+            int_color mark_color   = SymbolicColorFromPalette(Stag_Mark);
+            int_color text_color    = is_active_view?
+                SymbolicColorFromPalette(Stag_At_Cursor):SymbolicColorFromPalette(Stag_Default);
+            
+            Marker_Visual_Type type = is_active_view?VisualType_CharacterBlocks:VisualType_CharacterWireFrames;
+            marker_visual_set_effect(app, slot->visuals[0],
+                                     type, cursor_color, text_color, 0);
+            marker_visual_set_effect(app, slot->visuals[1],
+                                     VisualType_CharacterWireFrames, mark_color, 0, 0);
+        }
+        else{
+            marker_visual_set_effect(app, slot->visuals[0], VisualType_Invisible, 0, 0, 0);
+            marker_visual_set_effect(app, slot->visuals[1], VisualType_Invisible, 0, 0, 0);
+        }
+        vim_render_time(timings, render_cursor_mark, section_start);
     
-    // See if this will get me my sweet highlighted line
-    if (highlight_line_at_cursor && is_active_view){
-        Theme_Color color = {};
-        color.tag = Stag_Highlight_Cursor_Line;
-        get_theme_colors(app, &color, 1);
-        uint32_t line_color = color.color;
-        Marker_Visual visual = create_marker_visual(app, cursor_and_mark);
-        marker_visual_set_effect(app, visual, VisualType_LineHighlights,
-                                 line_color, 0, 0);
-        Marker_Visual_Take_Rule take_rule = {};
-        take_rule.first_index = 0;
-        take_rule.take_count_per_step = 1;
-        take_rule.step_stride_in_marker_count = 1;
-        take_rule.maximum_number_of_markers = 1;
-        marker_visual_set_take_rule(app, visual, take_rule);
-        marker_visual_set_priority(app, visual, VisualPriority_Highest);
+        // See if this will get me my sweet highlighted line
+        section_start = vim_time_ns();
+        if (highlight_line_at_cursor && is_active_view){
+            marker_visual_set_effect(app, slot->visuals[2], VisualType_LineHighlights,
+                                     SymbolicColorFromPalette(Stag_Highlight_Cursor_Line), 0, 0);
+        }
+        else{
+            marker_visual_set_effect(app, slot->visuals[2], VisualType_Invisible, 0, 0, 0);
+        }
+        vim_render_time(timings, render_line_highlight, section_start);
     }
     //******************************************************************
 
     // NOTE(allen): Matching enclosure highlight setup
+    // NOTE(chr): These still allocate into the per-frame render scope. The
+    // enclosures come from the buffer's bracket index, which catches up a
+    // frame's budget at a time after big edits; until it is complete they
+    // come from mark_enclosures as before.
     static const int32_t color_count = 4;
+    section_start = vim_time_ns();
+    Vim_Bracket_Index *brackets = 0;
+    if (do_matching_enclosure_highlight || do_matching_paren_highlight){
+        Vim_Buffer_State *buffer_state = vim_get_buffer_state(buffer.buffer_id);
+        if (buffer_state != 0 &&
+            vim_bracket_index_update(app, &buffer, &buffer_state->brackets,
+                                     VIM_BRACKET_INDEX_FRAME_STEP)){
+            brackets = &buffer_state->brackets;
+        }
+    }
+    Range enclosures[VIM_ENCLOSURE_MAX];
     if (do_matching_enclosure_highlight){
         Theme_Color theme_colors[color_count];
         int_color colors[color_count];
@@ -1939,11 +6796,23 @@ RENDER_CALLER_SIG(vim_render_caller) {
         for (int32_t i = 0; i < 4; i += 1){
             colors[i] = theme_colors[i].color;
         }
-        mark_enclosures(app, scratch, render_scope,
-                        &buffer, view.cursor.pos, FindScope_Brace,
-                        VisualType_LineHighlightRanges,
-                        colors, 0, color_count);
+        if (brackets != 0){
+            int32_t count = vim_bracket_index_enclosures(brackets, vim_bracket_brace,
+                                                         view.cursor.pos, enclosures,
+                                                         VIM_ENCLOSURE_MAX);
+            vim_mark_enclosure_ranges(app, render_scope, &buffer, enclosures, count,
+                                      VisualType_LineHighlightRanges,
+                                      colors, 0, color_count);
+        }
+        else{
+            mark_enclosures(app, scratch, render_scope,
+                            &buffer, view.cursor.pos, FindScope_Brace,
+                            VisualType_LineHighlightRanges,
+                            colors, 0, color_count);
+        }
     }
+    vim_render_time(timings, render_brace_enclosures, section_start);
+    section_start = vim_time_ns();
     if (do_matching_paren_highlight){
         Theme_Color theme_colors[color_count];
         int_color colors[color_count];
@@ -1963,15 +6832,32 @@ RENDER_CALLER_SIG(vim_render_caller) {
                 pos -= 1;
             }
         }
-        mark_enclosures(app, scratch, render_scope,
-                        &buffer, pos, FindScope_Paren,
-                        VisualType_CharacterBlocks,
-                        0, colors, color_count);
+        if (brackets != 0){
+            int32_t count = vim_bracket_index_enclosures(brackets, vim_bracket_paren,
+                                                         pos, enclosures,
+                                                         VIM_ENCLOSURE_MAX);
+            vim_mark_enclosure_ranges(app, render_scope, &buffer, enclosures, count,
+                                      VisualType_CharacterBlocks,
+                                      0, colors, color_count);
+        }
+        else{
+            mark_enclosures(app, scratch, render_scope,
+                            &buffer, pos, FindScope_Paren,
+                            VisualType_CharacterBlocks,
+                            0, colors, color_count);
+        }
     }
+    vim_render_time(timings, render_paren_enclosures, section_start);
     
+    section_start = vim_time_ns();
     do_core_render(app);
+    vim_render_time(timings, render_core, section_start);
     
-    managed_scope_clear_self_all_dependent_scopes(app, render_scope);
+    if (do_matching_enclosure_highlight || do_matching_paren_highlight){
+        managed_scope_clear_self_all_dependent_scopes(app, render_scope);
+    }
+    vim_render_time(timings, render_total, frame_start);
+    vim_render_timings_commit(timings);
 }
 
 // CALL ME
@@ -1980,9 +6866,15 @@ void vim_get_bindings(Bind_Helper* context) {
 
     set_scroll_rule(context, smooth_scroll_rule);
 
+    // SECTION: Highlight keywords
+
+    vim_define_highlight_keyword(lit("NOTE"), SymbolicColorFromPalette(Stag_Text_Cycle_2));
+    vim_define_highlight_keyword(lit("TODO"), SymbolicColorFromPalette(Stag_Text_Cycle_1));
+
     // SECTION: Vim commands
 
-    define_command(lit("s"), exec_regex);
+    define_command(lit("s"), substitute);
+    define_command(lit("substitute"), substitute);
     define_command(lit("write"), write_file);
     define_command(lit("quit"), close_view);
     define_command(lit("quitall"), close_all);
@@ -2003,6 +6895,22 @@ void vim_get_bindings(Bind_Helper* context) {
     define_command(lit("sp"), horizontal_split);
     define_command(lit("split"), horizontal_split);
     define_command(lit("cd"), change_directory);
+    define_command(lit("nohlsearch"), no_highlight_search);
+    define_command(lit("nohl"), no_highlight_search);
+    define_command(lit("noh"), no_highlight_search);
+    define_command(lit("set"), set_option);
+    define_command(lit("se"), set_option);
+    define_command(lit("searchbench"), search_benchmark);
+    define_command(lit("keywordbench"), keyword_benchmark);
+    define_command(lit("macrobench"), macro_benchmark);
+    define_command(lit("wordbench"), word_benchmark);
+    define_command(lit("linebench"), line_benchmark);
+    define_command(lit("savebench"), save_benchmark);
+    define_command(lit("markerstats"), marker_stats_report);
+    define_command(lit("bufferstats"), buffer_stats_report);
+    define_command(lit("registers"), registers_report);
+    define_command(lit("display"), registers_report);
+    define_command(lit("renderstats"), render_stats_report);
 
     // SECTION: Vim keybindings
 
@@ -2027,14 +6935,27 @@ void vim_get_bindings(Bind_Helper* context) {
     bind(context, 'w', MDFR_NONE, move_forward_word_start);
     bind(context, 'e', MDFR_NONE, move_forward_word_end);
     bind(context, 'b', MDFR_NONE, move_backward_word_start);
+    bind(context, 'W', MDFR_NONE, move_forward_bigword_start);
+    bind(context, 'E', MDFR_NONE, move_forward_bigword_end);
+    bind(context, 'B', MDFR_NONE, move_backward_bigword_start);
 
     bind(context, 'f', MDFR_NONE, enter_chord_move_find);
     bind(context, 't', MDFR_NONE, enter_chord_move_til);
     bind(context, 'F', MDFR_NONE, enter_chord_move_rfind);
     bind(context, 'T', MDFR_NONE, enter_chord_move_rtil);
+    bind(context, ';', MDFR_NONE, vim_repeat_find_forward);
+    bind(context, ',', MDFR_NONE, vim_repeat_find_backward);
+    bind(context, '\'', MDFR_NONE, enter_chord_mark_jump_line);
+    bind(context, '`', MDFR_NONE, enter_chord_mark_jump);
 
     bind(context, '$', MDFR_NONE, vim_move_end_of_line);
-    bind(context, '0', MDFR_NONE, vim_move_beginning_of_line);
+    bind(context, '%', MDFR_NONE, vim_move_matching_bracket);
+    bind(context, '0', MDFR_NONE, vim_count_digit_or_line_start);
+
+    // Counts, as in 5j or d3w.
+    for (char digit = '1'; digit <= '9'; ++digit) {
+        bind(context, digit, MDFR_NONE, vim_count_digit);
+    }
     bind(context, '{', MDFR_NONE, vim_move_whitespace_up);
     bind(context, '}', MDFR_NONE, vim_move_whitespace_down);
 
@@ -2074,6 +6995,12 @@ void vim_get_bindings(Bind_Helper* context) {
 
     bind(context, 'u', MDFR_NONE, cmdid_undo);
     bind(context, 'r', MDFR_CTRL, cmdid_redo);
+    bind(context, '.', MDFR_NONE, vim_repeat_change);
+    bind(context, 'o', MDFR_CTRL, vim_jump_back);
+    bind(context, 'i', MDFR_CTRL, vim_jump_forward);
+    bind(context, '\t', MDFR_NONE, vim_jump_forward);
+    bind(context, 'q', MDFR_NONE, vim_macro_record);
+    bind(context, '@', MDFR_NONE, enter_chord_macro_replay);
 
     bind(context, 'i', MDFR_NONE, insert_at);
     bind(context, 'a', MDFR_NONE, insert_after);
@@ -2084,10 +7011,9 @@ void vim_get_bindings(Bind_Helper* context) {
     bind(context, 'R', MDFR_NONE, enter_replace_mode);
     bind(context, 'v', MDFR_NONE, enter_visual_mode);
     bind(context, 'V', MDFR_NONE, enter_visual_line_mode);
+    bind(context, 'v', MDFR_CTRL, enter_visual_block_mode);
 
-    // TODO(chr): Proper alphabetic marks
-    bind(context, 'm', MDFR_NONE, set_mark);
-    bind(context, '`', MDFR_NONE, cursor_mark_swap);
+    bind(context, 'm', MDFR_NONE, enter_chord_mark);
 
     bind(context, '"', MDFR_NONE, enter_chord_switch_registers);
 
@@ -2124,6 +7050,13 @@ void vim_get_bindings(Bind_Helper* context) {
     bind(context, '=', MDFR_NONE, visual_format);
     bind(context, '>', MDFR_NONE, visual_indent_right);
     bind(context, '<', MDFR_NONE, visual_indent_left);
+    bind(context, 'i', MDFR_NONE, enter_chord_move_in);
+    bind(context, 'a', MDFR_NONE, enter_chord_move_around);
+    bind(context, 'I', MDFR_NONE, visual_block_insert);
+    bind(context, 'A', MDFR_NONE, visual_block_append);
+    bind(context, 'r', MDFR_NONE, enter_chord_visual_replace);
+    bind(context, 'p', MDFR_NONE, visual_paste);
+    bind(context, 'P', MDFR_NONE, visual_paste);
     end_map(context);
 
     // Insert mode
@@ -2169,6 +7102,12 @@ void vim_get_bindings(Bind_Helper* context) {
     bind_vanilla_keys(context, replace_character_then_normal);
     bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
     end_map(context);
+
+    begin_map(context, mapid_chord_visual_replace);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, visual_replace_character);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
     
     // Choosing register for yank/paste chords
     begin_map(context, mapid_chord_choose_register);
@@ -2177,6 +7116,19 @@ void vim_get_bindings(Bind_Helper* context) {
     bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
     end_map(context);
 
+    // Macro register chords
+    begin_map(context, mapid_chord_macro_record);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_macro_record_register);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
+    begin_map(context, mapid_chord_macro_replay);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_macro_replay_register);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
     // Move-find chords
     begin_map(context, mapid_chord_move_find);
     inherit_map(context, mapid_nomap);
@@ -2205,34 +7157,76 @@ void vim_get_bindings(Bind_Helper* context) {
     bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
     end_map(context);
 
+    // Text object chords
+    begin_map(context, mapid_chord_move_in);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_select_inner_object);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
+    begin_map(context, mapid_chord_move_around);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_select_around_object);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
+    // Mark chords
+    begin_map(context, mapid_chord_mark);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_set_mark);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
+    begin_map(context, mapid_chord_mark_jump_line);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_jump_to_mark_line);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
+    begin_map(context, mapid_chord_mark_jump);
+    inherit_map(context, mapid_nomap);
+    bind_vanilla_keys(context, vim_jump_to_mark_exact);
+    bind(context, key_esc, MDFR_NONE, enter_normal_mode_on_current);
+    end_map(context);
+
     // Delete+movement chords
     begin_map(context, mapid_chord_delete);
     inherit_map(context, mapid_movements);
     bind(context, 'd', MDFR_NONE, move_line_exec_action);
     bind(context, 'c', MDFR_NONE, move_line_exec_action);
+    bind(context, 'i', MDFR_NONE, enter_chord_move_in);
+    bind(context, 'a', MDFR_NONE, enter_chord_move_around);
     end_map(context);
 
     // yank+movement chords
     begin_map(context, mapid_chord_yank);
     inherit_map(context, mapid_movements);
     bind(context, 'y', MDFR_NONE, move_line_exec_action);
+    bind(context, 'i', MDFR_NONE, enter_chord_move_in);
+    bind(context, 'a', MDFR_NONE, enter_chord_move_around);
     end_map(context);
 
     // indent+movement chords
     begin_map(context, mapid_chord_indent_left);
     inherit_map(context, mapid_movements);
     bind(context, '<', MDFR_NONE, move_line_exec_action);
+    bind(context, 'i', MDFR_NONE, enter_chord_move_in);
+    bind(context, 'a', MDFR_NONE, enter_chord_move_around);
     end_map(context);
 
     begin_map(context, mapid_chord_indent_right);
     inherit_map(context, mapid_movements);
     bind(context, '>', MDFR_NONE, move_line_exec_action);
+    bind(context, 'i', MDFR_NONE, enter_chord_move_in);
+    bind(context, 'a', MDFR_NONE, enter_chord_move_around);
     end_map(context);
 
     // format+movement chords
     begin_map(context, mapid_chord_format);
     inherit_map(context, mapid_movements);
     bind(context, '=', MDFR_NONE, move_line_exec_action);
+    bind(context, 'i', MDFR_NONE, enter_chord_move_in);
+    bind(context, 'a', MDFR_NONE, enter_chord_move_around);
     end_map(context);
 
     // Map for chords which start with the letter g
@@ -2241,6 +7235,10 @@ void vim_get_bindings(Bind_Helper* context) {
 
     bind(context, 'g', MDFR_NONE, vim_move_to_top);
     bind(context, 'f', MDFR_NONE, vim_open_file_in_quotes);
+    bind(context, 'e', MDFR_NONE, move_backward_word_end);
+    bind(context, 'E', MDFR_NONE, move_backward_bigword_end);
+    bind(context, ';', MDFR_NONE, vim_change_back);
+    bind(context, ',', MDFR_NONE, vim_change_forward);
 
     //TODO(chronister): Folds!
 
@@ -0,0 +1,1518 @@
+//=============================================================================
+// >>> 4vim motion engine <<<
+//
+// Word motions (w W b B e E ge gE), the word under the cursor for *, and the
+// text objects for i and a (words, paragraphs, quotes, brackets, tags). Every
+// byte belongs to one of four classes: blank, newline, punctuation or word
+// (letters, digits, _ and every byte of a UTF-8 sequence). A word motion is a
+// handful of "skip the run of these classes" steps, and a skip classifies 16
+// bytes at a time with SSE2 (one table lookup per byte without it). The buffer
+// is read through a window that starts small and grows with each refill, so a
+// short hop reads a few kilobytes and a long one streams in large blocks. A
+// counted motion keeps the same scanner, and so the same window, for every
+// word it crosses. Bracket objects scan outward from the cursor in both
+// directions at once, skipping between brackets 16 bytes at a time, until the
+// buffer's bracket index (which also backs % and the enclosure highlights)
+// is complete. The buffer's line index, behind the line-wise commands, lives
+// here too, and so does the character search for f, t, F and T.
+//
+// This file is included by 4coder_vim.cpp after 4coder_vim_search.cpp and is
+// not meant to be compiled on its own.
+//=============================================================================
+
+enum Vim_Char_Class {
+    vim_class_blank,
+    vim_class_newline,
+    vim_class_punct,
+    vim_class_word,
+};
+
+// Sets of classes, for the skips below.
+enum {
+    vim_classes_blank = 1 << vim_class_blank,
+    vim_classes_newline = 1 << vim_class_newline,
+    vim_classes_punct = 1 << vim_class_punct,
+    vim_classes_word = 1 << vim_class_word,
+    vim_classes_space = vim_classes_blank | vim_classes_newline,
+    vim_classes_nonspace = vim_classes_punct | vim_classes_word,
+};
+
+static constexpr uint8_t vim_classify_byte(int c) {
+    return (c == '\n') ? vim_class_newline :
+           (c == ' ' || (c >= 9 && c <= 13)) ? vim_class_blank :
+           ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_' || c >= 0x80) ? vim_class_word :
+           vim_class_punct;
+}
+
+struct Vim_Char_Class_Table {
+    uint8_t classes[256];
+};
+
+static constexpr Vim_Char_Class_Table vim_build_char_classes() {
+    Vim_Char_Class_Table table = {};
+    for (int c = 0; c < 256; ++c) {
+        table.classes[c] = vim_classify_byte(c);
+    }
+    return table;
+}
+
+static constexpr Vim_Char_Class_Table vim_char_classes = vim_build_char_classes();
+
+static inline int vim_char_class(char c) {
+    return vim_char_classes.classes[(uint8_t)c];
+}
+
+#if VIM_SSE2
+// Bit i is set when text[i] is in one of the classes in set. Must agree with
+// vim_classify_byte.
+static inline uint32_t vim_class_mask_16(const char* text, uint32_t set) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)text);
+    __m128i newline = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+    __m128i control = _mm_sub_epi8(bytes, _mm_set1_epi8(9));
+    control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control);
+    __m128i blank = _mm_andnot_si128(
+        newline, _mm_or_si128(control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)),
+                                  _mm_set1_epi8('a'));
+    letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(25)), letter);
+    __m128i digit = _mm_sub_epi8(bytes, _mm_set1_epi8('0'));
+    digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i word = _mm_or_si128(_mm_or_si128(letter, digit),
+                                _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+
+    uint32_t newline_mask = (uint32_t)_mm_movemask_epi8(newline);
+    uint32_t blank_mask = (uint32_t)_mm_movemask_epi8(blank);
+    uint32_t word_mask = (uint32_t)_mm_movemask_epi8(word) |
+                         (uint32_t)_mm_movemask_epi8(bytes);
+    uint32_t mask = 0;
+    if (set & vim_classes_newline) { mask |= newline_mask; }
+    if (set & vim_classes_blank) { mask |= blank_mask; }
+    if (set & vim_classes_word) { mask |= word_mask; }
+    if (set & vim_classes_punct) {
+        mask |= ~(newline_mask | blank_mask | word_mask) & 0xFFFF;
+    }
+    return mask;
+}
+#endif
+
+// First offset in [from, size) whose class is not in set, or size.
+static int vim_class_find_forward(const char* text, int from, int size,
+                                  uint32_t set) {
+    int i = from;
+#if VIM_SSE2
+    for (; i + 16 <= size; i += 16) {
+        uint32_t outside = ~vim_class_mask_16(text + i, set) & 0xFFFF;
+        if (outside) { return i + vim_lowest_bit(outside); }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (!((set >> vim_char_class(text[i])) & 1)) { return i; }
+    }
+    return size;
+}
+
+// Last offset in [0, from] whose class is not in set, or -1.
+static int vim_class_find_backward(const char* text, int from, uint32_t set) {
+    int i = from;
+#if VIM_SSE2
+    for (; i - 15 >= 0; i -= 16) {
+        uint32_t outside = ~vim_class_mask_16(text + i - 15, set) & 0xFFFF;
+        if (outside) { return i - 15 + vim_highest_bit(outside); }
+    }
+#endif
+    for (; i >= 0; --i) {
+        if (!((set >> vim_char_class(text[i])) & 1)) { return i; }
+    }
+    return -1;
+}
+
+// The first read is small since most motions only go a few bytes; each refill
+// reads four times more, up to the largest window.
+constexpr int VIM_SCAN_WINDOW_FIRST = 4 << 10;
+constexpr int VIM_SCAN_WINDOW_MAX = 1 << 20;
+
+struct Vim_Text_Scanner {
+    struct Application_Links* app;
+    Buffer_Summary* buffer;
+    // VIM_SCAN_WINDOW_MAX bytes, holding buffer[start, end).
+    char* window;
+    int start;
+    int end;
+    int read_size;
+};
+
+// The window comes out of global_part; the caller holds a Temp_Memory around
+// the scanner's lifetime.
+static bool vim_scanner_init(Vim_Text_Scanner* scanner,
+                             struct Application_Links* app,
+                             Buffer_Summary* buffer) {
+    scanner->app = app;
+    scanner->buffer = buffer;
+    scanner->window = push_array(&global_part, char, VIM_SCAN_WINDOW_MAX);
+    scanner->start = scanner->end = 0;
+    scanner->read_size = VIM_SCAN_WINDOW_FIRST;
+    return scanner->window != nullptr;
+}
+
+// Makes sure pos is in the window, reading onward in the given direction.
+static bool vim_scanner_load(Vim_Text_Scanner* scanner, int pos,
+                             int direction) {
+    if (scanner->start <= pos && pos < scanner->end) { return true; }
+    int size = scanner->read_size;
+    if (scanner->read_size < VIM_SCAN_WINDOW_MAX) { scanner->read_size *= 4; }
+    int start = (direction > 0) ? pos : pos - size + 1;
+    if (start < 0) { start = 0; }
+    int end = start + size;
+    if (end > scanner->buffer->size) { end = scanner->buffer->size; }
+    if (pos < start || pos >= end) { return false; }
+    if (!buffer_read_range(scanner->app, scanner->buffer, start, end,
+                           scanner->window)) {
+        scanner->start = scanner->end = 0;
+        return false;
+    }
+    scanner->start = start;
+    scanner->end = end;
+    return true;
+}
+
+// Makes sure [pos, pos + ahead), clipped to the buffer, is in the window, and
+// fills the rest of the window with what comes before pos. For reading a
+// little forward from each stop of a scan that moves backward, so the window
+// is read again only once the scan has gone past its start.
+static bool vim_scanner_load_behind(Vim_Text_Scanner* scanner, int pos,
+                                    int ahead) {
+    int buffer_size = scanner->buffer->size;
+    int end = (pos + ahead < buffer_size) ? pos + ahead : buffer_size;
+    if (scanner->start <= pos && pos < scanner->end && end <= scanner->end) {
+        return true;
+    }
+    int size = scanner->read_size;
+    if (scanner->read_size < VIM_SCAN_WINDOW_MAX) { scanner->read_size *= 4; }
+    if (size < 2*ahead) { size = 2*ahead; }
+    if (size > VIM_SCAN_WINDOW_MAX) { size = VIM_SCAN_WINDOW_MAX; }
+    int start = end - size;
+    if (start < 0) { start = 0; }
+    if (pos < start || pos >= end) { return false; }
+    if (!buffer_read_range(scanner->app, scanner->buffer, start, end,
+                           scanner->window)) {
+        scanner->start = scanner->end = 0;
+        return false;
+    }
+    scanner->start = start;
+    scanner->end = end;
+    return true;
+}
+
+// Class of the byte at pos; newline past either end of the buffer.
+static int vim_word_class_at(Vim_Text_Scanner* scanner, int pos, int direction) {
+    if (!vim_scanner_load(scanner, pos, direction)) { return vim_class_newline; }
+    return vim_char_class(scanner->window[pos - scanner->start]);
+}
+
+// From pos (inclusive) in direction, the first position whose class is not in
+// set: the buffer size going forward, or -1 going backward, if there is none.
+static int vim_word_skip(Vim_Text_Scanner* scanner, int pos, int direction,
+                         uint32_t set) {
+    if (direction > 0) {
+        int size = scanner->buffer->size;
+        while (pos < size) {
+            if (!vim_scanner_load(scanner, pos, 1)) { return size; }
+            int found = vim_class_find_forward(scanner->window,
+                                               pos - scanner->start,
+                                               scanner->end - scanner->start, set);
+            if (found < scanner->end - scanner->start) {
+                return scanner->start + found;
+            }
+            pos = scanner->end;
+        }
+        return size;
+    }
+    while (pos >= 0) {
+        if (!vim_scanner_load(scanner, pos, -1)) { return -1; }
+        int found = vim_class_find_backward(scanner->window, pos - scanner->start,
+                                            set);
+        if (found >= 0) { return scanner->start + found; }
+        pos = scanner->start - 1;
+    }
+    return -1;
+}
+
+// The set of classes that continue the run a byte of class c starts. Big
+// words (W, B, E, gE) run on through punctuation.
+static inline uint32_t vim_word_run_set(int c, bool big) {
+    if (big) { return vim_classes_nonspace; }
+    return 1u << c;
+}
+
+// w and W: start of the next word, or an empty line.
+static int vim_word_next_start(Vim_Text_Scanner* scanner, int pos, bool big) {
+    int size = scanner->buffer->size;
+    if (pos >= size) { return size; }
+    int p = pos;
+    int c = vim_word_class_at(scanner, p, 1);
+    if (c == vim_class_punct || c == vim_class_word) {
+        p = vim_word_skip(scanner, p, 1, vim_word_run_set(c, big));
+    }
+    for (;;) {
+        p = vim_word_skip(scanner, p, 1, vim_classes_blank);
+        if (p >= size) { return size; }
+        if (vim_word_class_at(scanner, p, 1) != vim_class_newline) { return p; }
+        p += 1;
+        if (p < size && vim_word_class_at(scanner, p, 1) == vim_class_newline) {
+            // p starts an empty line, which counts as a word.
+            return p;
+        }
+    }
+}
+
+// e and E: last character of the word ending after pos.
+static int vim_word_next_end(Vim_Text_Scanner* scanner, int pos, bool big) {
+    int size = scanner->buffer->size;
+    if (pos + 1 >= size) { return size > 0 ? size - 1 : 0; }
+    int p = vim_word_skip(scanner, pos + 1, 1, vim_classes_space);
+    if (p >= size) { return size - 1; }
+    int c = vim_word_class_at(scanner, p, 1);
+    return vim_word_skip(scanner, p, 1, vim_word_run_set(c, big)) - 1;
+}
+
+// b and B: start of the word beginning before pos, or an empty line.
+static int vim_word_previous_start(Vim_Text_Scanner* scanner, int pos, bool big) {
+    int p = pos - 1;
+    for (;;) {
+        p = vim_word_skip(scanner, p, -1, vim_classes_blank);
+        if (p < 0) { return 0; }
+        if (vim_word_class_at(scanner, p, -1) != vim_class_newline) { break; }
+        if (p == 0 || vim_word_class_at(scanner, p - 1, -1) == vim_class_newline) {
+            // p starts an empty line, which counts as a word.
+            return p;
+        }
+        p -= 1;
+    }
+    int c = vim_word_class_at(scanner, p, -1);
+    return vim_word_skip(scanner, p, -1, vim_word_run_set(c, big)) + 1;
+}
+
+// ge and gE: last character of the word ending before pos.
+static int vim_word_previous_end(Vim_Text_Scanner* scanner, int pos, bool big) {
+    if (pos <= 0) { return 0; }
+    int p = pos;
+    if (pos < scanner->buffer->size) {
+        int c = vim_word_class_at(scanner, pos, -1);
+        if (c == vim_class_punct || c == vim_class_word) {
+            p = vim_word_skip(scanner, pos, -1, vim_word_run_set(c, big));
+        }
+    } else {
+        p = pos - 1;
+    }
+    p = vim_word_skip(scanner, p, -1, vim_classes_space);
+    return p < 0 ? 0 : p;
+}
+
+enum Vim_Word_Motion {
+    word_motion_next_start,
+    word_motion_next_end,
+    word_motion_previous_start,
+    word_motion_previous_end,
+};
+
+// Where count repetitions of the motion land, starting from pos.
+static int vim_word_motion(struct Application_Links* app, Buffer_Summary* buffer,
+                           int pos, Vim_Word_Motion motion, bool big, int count) {
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner scanner;
+    if (vim_scanner_init(&scanner, app, buffer)) {
+        for (int i = 0; i < count; ++i) {
+            int next = pos;
+            switch (motion) {
+                case word_motion_next_start: {
+                    next = vim_word_next_start(&scanner, pos, big);
+                } break;
+                case word_motion_next_end: {
+                    next = vim_word_next_end(&scanner, pos, big);
+                } break;
+                case word_motion_previous_start: {
+                    next = vim_word_previous_start(&scanner, pos, big);
+                } break;
+                case word_motion_previous_end: {
+                    next = vim_word_previous_end(&scanner, pos, big);
+                } break;
+            }
+            if (next == pos) { break; }
+            pos = next;
+        }
+    }
+    end_temp_memory(temp);
+    return pos;
+}
+
+// The run of word characters at pos, or the next one after it on the line if
+// pos is not on one. Empty if there is none.
+static Range vim_word_at(struct Application_Links* app, Buffer_Summary* buffer,
+                         int pos) {
+    Range result = make_range(pos, pos);
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner scanner;
+    if (pos < buffer->size && vim_scanner_init(&scanner, app, buffer)) {
+        int start = pos;
+        if (vim_word_class_at(&scanner, pos, 1) != vim_class_word) {
+            start = vim_word_skip(&scanner, pos, 1,
+                                  vim_classes_blank | vim_classes_punct);
+        } else {
+            start = vim_word_skip(&scanner, pos, -1, vim_classes_word) + 1;
+        }
+        if (start < buffer->size &&
+            vim_word_class_at(&scanner, start, 1) == vim_class_word) {
+            int end = vim_word_skip(&scanner, start, 1, vim_classes_word);
+            result = make_range(start, end);
+        }
+    }
+    end_temp_memory(temp);
+    return result;
+}
+
+//=============================================================================
+// Bracket index
+// Each buffer keeps the sorted offsets of its (), [] and {} brackets, one
+// list per kind, with every bracket's partner and the open bracket around its
+// pair. That makes %, the enclosure highlights and text objects binary
+// searches. Edits splice the lists and only rescan the inserted bytes; the
+// partners are worked out again, from the lists rather than the text, only
+// when an edit added or removed a bracket. A large paste is scanned a frame's
+// budget at a time, and until the index is complete its users fall back to
+// scanning the text.
+//
+// Brackets are counted wherever they are, in strings and comments too, as %
+// in vim does.
+//=============================================================================
+
+enum Vim_Bracket_Kind {
+    vim_bracket_paren,
+    vim_bracket_square,
+    vim_bracket_brace,
+    vim_bracket_kind_count,
+};
+
+struct Vim_Bracket_List {
+    // Sorted offsets of the brackets of this kind below scanned_to, and
+    // whether each one is a closing bracket.
+    Vim_Array<int> positions;
+    Vim_Array<uint8_t> closes;
+    // From the pairing pass, by list index: each bracket's partner, and the
+    // innermost open bracket around its pair. -1 for none.
+    Vim_Array<int> partners;
+    Vim_Array<int> parents;
+};
+
+struct Vim_Bracket_Index {
+    Vim_Bracket_List lists[vim_bracket_kind_count];
+    int scanned_to;
+    // Inserted text below scanned_to that has not been scanned yet. Sorted
+    // and disjoint.
+    Vim_Array<Range> dirty;
+    // Brackets came or went since the last pairing pass.
+    bool unpaired;
+    // Buffer size the index was last reconciled against, as in the match
+    // cache.
+    int buffer_size;
+};
+
+// Bytes of unscanned text the index takes on per frame from the render
+// caller.
+constexpr int VIM_BRACKET_INDEX_FRAME_STEP = 4 << 20;
+
+// Kind of bracket c is, or -1.
+static int vim_bracket_kind(char c, bool* closes) {
+    switch (c) {
+        case '(': { *closes = false; return vim_bracket_paren; }
+        case ')': { *closes = true; return vim_bracket_paren; }
+        case '[': { *closes = false; return vim_bracket_square; }
+        case ']': { *closes = true; return vim_bracket_square; }
+        case '{': { *closes = false; return vim_bracket_brace; }
+        case '}': { *closes = true; return vim_bracket_brace; }
+    }
+    return -1;
+}
+
+static void vim_bracket_index_free(Vim_Bracket_Index* index) {
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        vim_array_free(&list->positions);
+        vim_array_free(&list->closes);
+        vim_array_free(&list->partners);
+        vim_array_free(&list->parents);
+    }
+    vim_array_free(&index->dirty);
+    index->scanned_to = 0;
+    index->unpaired = true;
+}
+
+static void vim_bracket_index_reset(Vim_Bracket_Index* index, int buffer_size) {
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        index->lists[kind].positions.count = 0;
+        index->lists[kind].closes.count = 0;
+    }
+    index->dirty.count = 0;
+    index->scanned_to = 0;
+    index->unpaired = true;
+    index->buffer_size = buffer_size;
+}
+
+static bool vim_bracket_index_is_complete(Vim_Bracket_Index* index) {
+    return index->dirty.count == 0 && index->scanned_to >= index->buffer_size &&
+           !index->unpaired;
+}
+
+// Keeps the index consistent with an edit that replaced [start, end) with
+// text_size bytes: drops the brackets that were in the replaced bytes, moves
+// the later ones and leaves the inserted bytes to be scanned.
+static void vim_bracket_index_on_edit(Vim_Bracket_Index* index, int start,
+                                      int end, int text_size) {
+    int delta = text_size - (end - start);
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        int count = list->positions.count;
+        int lo = vim_lower_bound(list->positions.items, count, start);
+        int hi = vim_lower_bound(list->positions.items, count, end);
+        if (hi > lo) {
+            vim_array_remove(&list->positions, lo, hi - lo);
+            vim_array_remove(&list->closes, lo, hi - lo);
+            index->unpaired = true;
+        }
+        for (int i = lo; i < list->positions.count; ++i) {
+            list->positions.items[i] += delta;
+        }
+    }
+
+    if (index->scanned_to >= end) {
+        index->scanned_to += delta;
+    } else if (index->scanned_to > start) {
+        index->scanned_to = start;
+    }
+
+    // The same bookkeeping as the match cache's dirty ranges.
+    Vim_Array<Range>* dirty = &index->dirty;
+    for (int i = 0; i < dirty->count; ++i) {
+        Range* range = dirty->items + i;
+        range->start = range->start < start ? range->start :
+                       range->start >= end ? range->start + delta : start;
+        range->end = range->end <= start ? range->end :
+                     range->end >= end ? range->end + delta : start + text_size;
+    }
+    if (text_size > 0) {
+        int at = 0;
+        while (at < dirty->count && dirty->items[at].start < start) { ++at; }
+        Range* added = vim_array_insert(dirty, at, 1);
+        if (added) { *added = make_range(start, start + text_size); }
+    }
+    int kept = 0;
+    for (int i = 0; i < dirty->count; ++i) {
+        Range range = dirty->items[i];
+        if (range.end > index->scanned_to) { range.end = index->scanned_to; }
+        if (range.start >= range.end) { continue; }
+        if (kept > 0 && dirty->items[kept - 1].end >= range.start) {
+            if (range.end > dirty->items[kept - 1].end) {
+                dirty->items[kept - 1].end = range.end;
+            }
+        } else {
+            dirty->items[kept++] = range;
+        }
+    }
+    dirty->count = kept;
+    index->buffer_size += delta;
+}
+
+// First offset in [from, size) holding a bracket, or size.
+static int vim_find_bracket_forward(const char* text, int from, int size) {
+    int i = from;
+#if VIM_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('(')),
+                         _mm_cmpeq_epi8(bytes, _mm_set1_epi8(')'))),
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('[')),
+                         _mm_cmpeq_epi8(bytes, _mm_set1_epi8(']'))));
+        hits = _mm_or_si128(
+            hits, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('{')),
+                               _mm_cmpeq_epi8(bytes, _mm_set1_epi8('}'))));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(hits);
+        if (mask) { return i + vim_lowest_bit(mask); }
+    }
+#endif
+    bool closes;
+    for (; i < size; ++i) {
+        if (vim_bracket_kind(text[i], &closes) >= 0) { return i; }
+    }
+    return size;
+}
+
+// Adds the brackets in [min, max) to the lists. The caller guarantees that
+// the lists hold nothing in that range yet.
+static bool vim_bracket_index_scan(struct Application_Links* app,
+                                   Buffer_Summary* buffer,
+                                   Vim_Bracket_Index* index, int min, int max) {
+    if (max > buffer->size) { max = buffer->size; }
+    if (min >= max) { return true; }
+    bool result = true;
+    Vim_Array<int> found[vim_bracket_kind_count] = {};
+    Vim_Array<uint8_t> found_closes[vim_bracket_kind_count] = {};
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner scanner;
+    if (!vim_scanner_init(&scanner, app, buffer)) {
+        end_temp_memory(temp);
+        return false;
+    }
+    for (int pos = min; pos < max && result;) {
+        if (!vim_scanner_load(&scanner, pos, 1)) { result = false; break; }
+        int end = (scanner.end < max) ? scanner.end : max;
+        int at = pos - scanner.start;
+        for (;;) {
+            at = vim_find_bracket_forward(scanner.window, at, end - scanner.start);
+            if (at >= end - scanner.start) { break; }
+            bool closes = false;
+            int kind = vim_bracket_kind(scanner.window[at], &closes);
+            if (!vim_array_push(found + kind, scanner.start + at) ||
+                !vim_array_push(found_closes + kind, (uint8_t)closes)) {
+                result = false;
+                break;
+            }
+            ++at;
+        }
+        pos = end;
+    }
+    end_temp_memory(temp);
+
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        int count = found[kind].count;
+        if (result && count > 0) {
+            int at = vim_lower_bound(list->positions.items, list->positions.count,
+                                     min);
+            int* positions = vim_array_insert(&list->positions, at, count);
+            uint8_t* closes = positions ? vim_array_insert(&list->closes, at, count)
+                                        : nullptr;
+            if (closes) {
+                memcpy(positions, found[kind].items, sizeof(int)*count);
+                memcpy(closes, found_closes[kind].items, count);
+                index->unpaired = true;
+            } else {
+                result = false;
+            }
+        }
+        vim_array_free(found + kind);
+        vim_array_free(found_closes + kind);
+    }
+    return result;
+}
+
+// Pairs every list off with a stack, as % would going through the buffer.
+static bool vim_bracket_index_pair(Vim_Bracket_Index* index) {
+    Vim_Array<int> stack = {};
+    bool result = true;
+    for (int kind = 0; kind < vim_bracket_kind_count && result; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        int count = list->positions.count;
+        if (!vim_array_reserve(&list->partners, count) ||
+            !vim_array_reserve(&list->parents, count)) {
+            result = false;
+            break;
+        }
+        list->partners.count = list->parents.count = count;
+        stack.count = 0;
+        for (int i = 0; i < count; ++i) {
+            int top = stack.count ? stack.items[stack.count - 1] : -1;
+            if (!list->closes.items[i]) {
+                list->partners.items[i] = -1;
+                list->parents.items[i] = top;
+                if (!vim_array_push(&stack, i)) { result = false; break; }
+            } else if (top >= 0) {
+                stack.count -= 1;
+                list->partners.items[top] = i;
+                list->partners.items[i] = top;
+                list->parents.items[i] = list->parents.items[top];
+            } else {
+                list->partners.items[i] = -1;
+                list->parents.items[i] = -1;
+            }
+        }
+    }
+    vim_array_free(&stack);
+    return result;
+}
+
+// Scans up to budget bytes of text the index has not seen, the bytes edits
+// inserted first, and pairs the brackets off once nothing is left. Returns
+// whether the index now covers the whole buffer.
+static bool vim_bracket_index_update(struct Application_Links* app,
+                                     Buffer_Summary* buffer,
+                                     Vim_Bracket_Index* index, int budget) {
+    if (index->buffer_size != buffer->size) {
+        vim_bracket_index_reset(index, buffer->size);
+    }
+    Vim_Array<Range>* dirty = &index->dirty;
+    while (dirty->count > 0 && budget > 0) {
+        Range* range = dirty->items;
+        int end = range->start + budget;
+        if (end > range->end || end < range->start) { end = range->end; }
+        if (!vim_bracket_index_scan(app, buffer, index, range->start, end)) {
+            return false;
+        }
+        budget -= end - range->start;
+        range->start = end;
+        if (range->start >= range->end) { vim_array_remove(dirty, 0, 1); }
+    }
+    if (budget > 0 && index->scanned_to < buffer->size) {
+        int scan_end = index->scanned_to + budget;
+        if (scan_end > buffer->size || scan_end < index->scanned_to) {
+            scan_end = buffer->size;
+        }
+        if (!vim_bracket_index_scan(app, buffer, index, index->scanned_to,
+                                    scan_end)) {
+            return false;
+        }
+        index->scanned_to = scan_end;
+    }
+    if (dirty->count == 0 && index->scanned_to >= buffer->size &&
+        index->unpaired) {
+        index->unpaired = !vim_bracket_index_pair(index);
+    }
+    return vim_bracket_index_is_complete(index);
+}
+
+// The rest need a complete index.
+
+// List index of the bracket of this kind at pos, or -1.
+static int vim_bracket_index_at(Vim_Bracket_List* list, int pos) {
+    int i = vim_lower_bound(list->positions.items, list->positions.count, pos);
+    return (i < list->positions.count && list->positions.items[i] == pos) ? i : -1;
+}
+
+// The open bracket around the pair of list index i that has a partner, or -1.
+static int vim_bracket_index_outer(Vim_Bracket_List* list, int i) {
+    i = list->parents.items[i];
+    while (i >= 0 && list->partners.items[i] < 0) { i = list->parents.items[i]; }
+    return i;
+}
+
+// List index of the open bracket of the innermost pair with open < pos and
+// pos <= close, or -1.
+static int vim_bracket_index_enclosing(Vim_Bracket_List* list, int pos) {
+    int i = vim_lower_bound(list->positions.items, list->positions.count, pos) - 1;
+    if (i < 0) { return -1; }
+    if (list->closes.items[i] || list->partners.items[i] < 0) {
+        return vim_bracket_index_outer(list, i);
+    }
+    return i;
+}
+
+// The pairs of this kind around pos, innermost first, as ranges from the open
+// bracket to one past the close. Returns how many were stored.
+static int vim_bracket_index_enclosures(Vim_Bracket_Index* index, int kind,
+                                        int pos, Range* ranges, int max) {
+    Vim_Bracket_List* list = index->lists + kind;
+    int count = 0;
+    for (int i = vim_bracket_index_enclosing(list, pos); i >= 0 && count < max;
+         i = vim_bracket_index_outer(list, i)) {
+        ranges[count++] = make_range(list->positions.items[i],
+                                     list->positions.items[list->partners.items[i]] + 1);
+    }
+    return count;
+}
+
+// Offset of the partner of the bracket at pos, or -1.
+static int vim_bracket_index_partner(Vim_Bracket_Index* index, int pos) {
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        int i = vim_bracket_index_at(list, pos);
+        if (i >= 0) {
+            int partner = list->partners.items[i];
+            return (partner >= 0) ? list->positions.items[partner] : -1;
+        }
+    }
+    return -1;
+}
+
+// Offset of the first bracket at or after pos, or -1. Only closing brackets
+// if closing_only.
+static int vim_bracket_index_next(Vim_Bracket_Index* index, int pos,
+                                  bool closing_only) {
+    int result = -1;
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        int count = list->positions.count;
+        int i = vim_lower_bound(list->positions.items, count, pos);
+        while (closing_only && i < count && !list->closes.items[i]) { ++i; }
+        if (i < count && (result < 0 || list->positions.items[i] < result)) {
+            result = list->positions.items[i];
+        }
+    }
+    return result;
+}
+
+static int vim_bracket_index_memory(Vim_Bracket_Index* index) {
+    int bytes = index->dirty.capacity*(int)sizeof(Range);
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        Vim_Bracket_List* list = index->lists + kind;
+        bytes += list->positions.capacity*(int)sizeof(int) +
+                 list->closes.capacity*(int)sizeof(uint8_t) +
+                 list->partners.capacity*(int)sizeof(int) +
+                 list->parents.capacity*(int)sizeof(int);
+    }
+    return bytes;
+}
+
+static int vim_bracket_index_count(Vim_Bracket_Index* index) {
+    int count = 0;
+    for (int kind = 0; kind < vim_bracket_kind_count; ++kind) {
+        count += index->lists[kind].positions.count;
+    }
+    return count;
+}
+
+// i( and friends from a complete index: the count-th pair around pos, an open
+// bracket under the cursor counting as inside its pair.
+static bool vim_bracket_index_object(Vim_Bracket_Index* index, int kind,
+                                     int pos, int count, Range* brackets) {
+    Vim_Bracket_List* list = index->lists + kind;
+    int under = vim_bracket_index_at(list, pos);
+    if (under >= 0 && !list->closes.items[under]) { pos += 1; }
+    int i = vim_bracket_index_enclosing(list, pos);
+    for (int level = 1; level < count && i >= 0; ++level) {
+        i = vim_bracket_index_outer(list, i);
+    }
+    if (i < 0) { return false; }
+    *brackets = make_range(list->positions.items[i],
+                           list->positions.items[list->partners.items[i]] + 1);
+    return true;
+}
+
+//=============================================================================
+// Line index
+// Each buffer keeps the sorted offsets of its newlines, so finding where a
+// line starts or ends, or which line holds an offset, is a binary search
+// instead of a seek through the text. The edit hook hands over the inserted
+// text, so an edit is patched in place: the newlines in the replaced bytes go,
+// the later ones move and the inserted ones are added. Only the first scan of
+// a buffer reads the text, and the render caller does that a frame's budget
+// at a time.
+//=============================================================================
+
+struct Vim_Line_Index {
+    // Sorted offsets of the newlines below scanned_to.
+    Vim_Array<int> newlines;
+    int scanned_to;
+    // Buffer size the index was last reconciled against, as in the match
+    // cache.
+    int buffer_size;
+};
+
+// Bytes of unscanned text the index takes on per frame from the render
+// caller.
+constexpr int VIM_LINE_INDEX_FRAME_STEP = 16 << 20;
+
+static void vim_line_index_free(Vim_Line_Index* index) {
+    vim_array_free(&index->newlines);
+    index->scanned_to = 0;
+}
+
+static void vim_line_index_reset(Vim_Line_Index* index, int buffer_size) {
+    index->newlines.count = 0;
+    index->scanned_to = 0;
+    index->buffer_size = buffer_size;
+}
+
+static bool vim_line_index_is_complete(Vim_Line_Index* index) {
+    return index->scanned_to >= index->buffer_size;
+}
+
+// Appends base + i for every newline text[i] in [0, size).
+static bool vim_line_index_collect(const char* text, int size, int base,
+                                   Vim_Array<int>* out) {
+    int i = 0;
+#if VIM_SSE2
+    __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        for (; mask; mask &= mask - 1) {
+            if (!vim_array_push(out, base + i + vim_lowest_bit(mask))) {
+                return false;
+            }
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (text[i] == '\n' && !vim_array_push(out, base + i)) { return false; }
+    }
+    return true;
+}
+
+// Keeps the index consistent with an edit that replaced [start, end) with
+// text. Past scanned_to there is nothing to patch; the scan gets there later.
+static void vim_line_index_on_edit(Vim_Line_Index* index, int start, int end,
+                                   String text) {
+    int delta = text.size - (end - start);
+    index->buffer_size += delta;
+    if (index->scanned_to < end) {
+        if (index->scanned_to > start) { index->scanned_to = start; }
+        int count = vim_lower_bound(index->newlines.items,
+                                    index->newlines.count, index->scanned_to);
+        index->newlines.count = count;
+        return;
+    }
+    index->scanned_to += delta;
+
+    Vim_Array<int>* newlines = &index->newlines;
+    int lo = vim_lower_bound(newlines->items, newlines->count, start);
+    int hi = vim_lower_bound(newlines->items, newlines->count, end);
+    for (int i = hi; i < newlines->count; ++i) {
+        newlines->items[i] += delta;
+    }
+    Vim_Array<int> added = {};
+    if (!vim_line_index_collect(text.str, text.size, start, &added)) {
+        vim_array_free(&added);
+        vim_line_index_reset(index, index->buffer_size);
+        return;
+    }
+    int removed = hi - lo;
+    if (added.count > removed) {
+        if (!vim_array_insert(newlines, hi, added.count - removed)) {
+            vim_array_free(&added);
+            vim_line_index_reset(index, index->buffer_size);
+            return;
+        }
+    } else if (added.count < removed) {
+        vim_array_remove(newlines, lo + added.count, removed - added.count);
+    }
+    if (added.count > 0) {
+        memcpy(newlines->items + lo, added.items, sizeof(int)*added.count);
+    }
+    vim_array_free(&added);
+}
+
+// Scans up to budget bytes past scanned_to. Returns whether the index now
+// covers the whole buffer.
+static bool vim_line_index_update(struct Application_Links* app,
+                                  Buffer_Summary* buffer, Vim_Line_Index* index,
+                                  int budget) {
+    if (index->buffer_size != buffer->size) {
+        vim_line_index_reset(index, buffer->size);
+    }
+    if (budget <= 0 || index->scanned_to >= buffer->size) {
+        return vim_line_index_is_complete(index);
+    }
+    int scan_end = index->scanned_to + budget;
+    if (scan_end > buffer->size || scan_end < index->scanned_to) {
+        scan_end = buffer->size;
+    }
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    defer(end_temp_memory(temp));
+    char* window = push_array(&global_part, char, VIM_SCAN_WINDOW_MAX);
+    if (window == nullptr) { return false; }
+    for (int pos = index->scanned_to; pos < scan_end;) {
+        int end = pos + VIM_SCAN_WINDOW_MAX;
+        if (end > scan_end) { end = scan_end; }
+        if (!buffer_read_range(app, buffer, pos, end, window) ||
+            !vim_line_index_collect(window, end - pos, pos, &index->newlines)) {
+            index->newlines.count = vim_lower_bound(
+                index->newlines.items, index->newlines.count, index->scanned_to);
+            return false;
+        }
+        index->scanned_to = pos = end;
+    }
+    return vim_line_index_is_complete(index);
+}
+
+// The rest need a complete index. Lines are 1-based, as in 4coder.
+
+static int vim_line_index_line_count(Vim_Line_Index* index) {
+    return index->newlines.count + 1;
+}
+
+// Line that pos is on; a newline is on the line it ends.
+static int vim_line_index_line_of(Vim_Line_Index* index, int pos) {
+    return vim_lower_bound(index->newlines.items, index->newlines.count, pos) + 1;
+}
+
+// Offset of the first byte of line, clamped to the buffer's lines.
+static int vim_line_index_start(Vim_Line_Index* index, int line) {
+    if (line > index->newlines.count) { line = index->newlines.count + 1; }
+    if (line <= 1) { return 0; }
+    return index->newlines.items[line - 2] + 1;
+}
+
+// Offset of the newline that ends line, or the buffer size for the last line.
+static int vim_line_index_end(Vim_Line_Index* index, int line) {
+    if (line < 1) { line = 1; }
+    if (line > index->newlines.count) { return index->buffer_size; }
+    return index->newlines.items[line - 1];
+}
+
+// Byte range covering lines first_line through last_line, including the
+// newline that ends last_line.
+static Range vim_line_index_byte_range(Vim_Line_Index* index, int first_line,
+                                       int last_line) {
+    Range result = make_range(vim_line_index_start(index, first_line),
+                              index->buffer_size);
+    if (last_line < vim_line_index_line_count(index)) {
+        result.end = vim_line_index_start(index, last_line + 1);
+    }
+    return result;
+}
+
+static int vim_line_index_memory(Vim_Line_Index* index) {
+    return index->newlines.capacity*(int)sizeof(int);
+}
+
+//=============================================================================
+// Text objects
+// What i and a select after an operator or in visual mode. Brackets come
+// from the bracket index when it is complete; otherwise they, like the rest,
+// are found by scanning outward from the cursor.
+//=============================================================================
+
+// The byte at pos, or 0 outside the buffer.
+static char vim_scanner_char(Vim_Text_Scanner* scanner, int pos, int direction) {
+    if (!vim_scanner_load(scanner, pos, direction)) { return 0; }
+    return scanner->window[pos - scanner->start];
+}
+
+// First offset in [from, size) holding a or b, or size.
+static int vim_find_either_forward(const char* text, int from, int size,
+                                   char a, char b) {
+    int i = from;
+#if VIM_SSE2
+    __m128i first = _mm_set1_epi8(a);
+    __m128i second = _mm_set1_epi8(b);
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        uint32_t hits = (uint32_t)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(bytes, second)));
+        if (hits) { return i + vim_lowest_bit(hits); }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (text[i] == a || text[i] == b) { return i; }
+    }
+    return size;
+}
+
+// Last offset in [0, from] holding a or b, or -1.
+static int vim_find_either_backward(const char* text, int from, char a, char b) {
+    int i = from;
+#if VIM_SSE2
+    __m128i first = _mm_set1_epi8(a);
+    __m128i second = _mm_set1_epi8(b);
+    for (; i - 15 >= 0; i -= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i - 15));
+        uint32_t hits = (uint32_t)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(bytes, second)));
+        if (hits) { return i - 15 + vim_highest_bit(hits); }
+    }
+#endif
+    for (; i >= 0; --i) {
+        if (text[i] == a || text[i] == b) { return i; }
+    }
+    return -1;
+}
+
+// One side of the outward bracket scan. Going backward it looks for an open
+// bracket nobody closed, going forward for a close bracket nobody opened.
+struct Vim_Bracket_Side {
+    Vim_Text_Scanner scanner;
+    int direction;
+    int pos;
+    int depth;
+    int levels;
+    // Where the side stopped: the bracket, or -1 if it ran off the buffer.
+    int found;
+    bool done;
+};
+
+// Scans the rest of one window.
+static void vim_bracket_side_step(Vim_Bracket_Side* side, char open, char close,
+                                  int count) {
+    Vim_Text_Scanner* scanner = &side->scanner;
+    if (side->pos < 0 || side->pos >= scanner->buffer->size ||
+        !vim_scanner_load(scanner, side->pos, side->direction)) {
+        side->found = -1;
+        side->done = true;
+        return;
+    }
+    char inner = (side->direction > 0) ? open : close;
+    char outer = (side->direction > 0) ? close : open;
+    int at = side->pos - scanner->start;
+    int size = scanner->end - scanner->start;
+    for (;;) {
+        at = (side->direction > 0)
+            ? vim_find_either_forward(scanner->window, at, size, open, close)
+            : vim_find_either_backward(scanner->window, at, open, close);
+        if (at < 0 || at >= size) { break; }
+        char c = scanner->window[at];
+        if (c == inner) {
+            ++side->depth;
+        } else if (side->depth > 0) {
+            --side->depth;
+        } else if (c == outer && ++side->levels == count) {
+            side->found = scanner->start + at;
+            side->done = true;
+            return;
+        }
+        at += side->direction;
+    }
+    side->pos = (side->direction > 0) ? scanner->end : scanner->start - 1;
+}
+
+// The count-th pair of open/close around pos, counting a bracket under the
+// cursor as part of the innermost pair. Both sides advance a window at a time
+// in turn, so a cursor outside any pair fails as soon as either side runs off
+// the buffer instead of after reading all of it.
+static bool vim_find_enclosing_brackets(struct Application_Links* app,
+                                        Buffer_Summary* buffer, int pos,
+                                        char open, char close, int count,
+                                        Range* brackets) {
+    bool result = false;
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Bracket_Side sides[2] = {};
+    if (vim_scanner_init(&sides[0].scanner, app, buffer) &&
+        vim_scanner_init(&sides[1].scanner, app, buffer)) {
+        Vim_Bracket_Side* left = &sides[0];
+        Vim_Bracket_Side* right = &sides[1];
+        left->direction = -1;
+        right->direction = 1;
+        char under = vim_scanner_char(&left->scanner, pos, -1);
+        left->pos = (under == open) ? pos : pos - 1;
+        right->pos = (under == open) ? pos + 1 : pos;
+        while (!(left->done && right->done)) {
+            if (!left->done) { vim_bracket_side_step(left, open, close, count); }
+            if (left->done && left->found < 0) { break; }
+            if (!right->done) { vim_bracket_side_step(right, open, close, count); }
+            if (right->done && right->found < 0) { break; }
+        }
+        if (left->done && right->done && left->found >= 0 && right->found >= 0) {
+            *brackets = make_range(left->found, right->found + 1);
+            result = true;
+        }
+    }
+    end_temp_memory(temp);
+    return result;
+}
+
+// i( and friends leave out a newline right after the open bracket and the
+// indentation before a close bracket on its own line, so ci{ on a block keeps
+// the braces on their lines.
+static Range vim_brackets_inner(struct Application_Links* app,
+                                Buffer_Summary* buffer, Range brackets) {
+    Range inner = make_range(brackets.start + 1, brackets.end - 1);
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner scanner;
+    if (inner.start < inner.end && vim_scanner_init(&scanner, app, buffer)) {
+        if (vim_scanner_char(&scanner, inner.start, 1) == '\n') {
+            int line_start = vim_word_skip(&scanner, inner.end - 1, -1,
+                                           vim_classes_blank) + 1;
+            if (line_start > inner.start &&
+                vim_scanner_char(&scanner, line_start - 1, -1) == '\n') {
+                inner = make_range(inner.start + 1, line_start);
+            }
+        }
+    }
+    end_temp_memory(temp);
+    return inner;
+}
+
+// Start of the line holding pos.
+static int vim_scanner_line_start(Vim_Text_Scanner* scanner, int pos) {
+    return vim_word_skip(scanner, pos - 1, -1, vim_classes_blank |
+                         vim_classes_punct | vim_classes_word) + 1;
+}
+
+// A quote that a backslash does not escape.
+static bool vim_is_quote_at(Vim_Text_Scanner* scanner, int pos, char quote) {
+    return vim_scanner_char(scanner, pos, 1) == quote &&
+           (pos == 0 || vim_scanner_char(scanner, pos - 1, -1) != '\\');
+}
+
+// First quote at or after pos on the line, or -1.
+static int vim_next_quote(Vim_Text_Scanner* scanner, int pos, char quote) {
+    int size = scanner->buffer->size;
+    for (; pos < size; ++pos) {
+        char c = vim_scanner_char(scanner, pos, 1);
+        if (c == '\n') { break; }
+        if (c == quote && vim_is_quote_at(scanner, pos, quote)) { return pos; }
+    }
+    return -1;
+}
+
+// Quotes pair up from the start of the line, as in vim. The cursor between a
+// pair (or on one of its quotes) selects it; anywhere else selects the next
+// pair on the line.
+static bool vim_find_quotes(Vim_Text_Scanner* scanner, int pos, char quote,
+                            Range* quotes) {
+    for (int at = vim_scanner_line_start(scanner, pos);;) {
+        int first = vim_next_quote(scanner, at, quote);
+        if (first < 0) { return false; }
+        int second = vim_next_quote(scanner, first + 1, quote);
+        if (second < 0) { return false; }
+        if (second >= pos) {
+            *quotes = make_range(first, second + 1);
+            return true;
+        }
+        at = second + 1;
+    }
+}
+
+// aw and a" take the blanks after the object, or the ones before it when
+// there are none after.
+static Range vim_object_with_blanks(Vim_Text_Scanner* scanner, Range object) {
+    int after = vim_word_skip(scanner, object.end, 1, vim_classes_blank);
+    if (after > object.end) {
+        object.end = after;
+    } else if (object.start > 0) {
+        object.start = vim_word_skip(scanner, object.start - 1, -1,
+                                     vim_classes_blank) + 1;
+    }
+    return object;
+}
+
+// iw, aw, iW and aW. Counted, iw takes that many runs, blanks counting as
+// runs, and aw that many words with their blanks. Neither crosses a line.
+static bool vim_find_word_object(Vim_Text_Scanner* scanner, int pos, bool around,
+                                 bool big, int count, Range* object) {
+    int size = scanner->buffer->size;
+    if (pos >= size) { return false; }
+    int c = vim_word_class_at(scanner, pos, 1);
+    if (c == vim_class_newline) { return false; }
+    uint32_t run = (c == vim_class_blank) ? (uint32_t)vim_classes_blank
+                                          : vim_word_run_set(c, big);
+    int start = vim_word_skip(scanner, pos, -1, run) + 1;
+    int end = vim_word_skip(scanner, pos, 1, run);
+    if (!around) {
+        for (int i = 1; i < count; ++i) {
+            int next = vim_word_class_at(scanner, end, 1);
+            if (end >= size || next == vim_class_newline) { break; }
+            end = vim_word_skip(scanner, end, 1, (next == vim_class_blank)
+                                ? (uint32_t)vim_classes_blank : vim_word_run_set(next, big));
+        }
+        *object = make_range(start, end);
+        return true;
+    }
+    if (c == vim_class_blank) {
+        // Leading blanks and the words after them.
+        for (int i = 0; i < count; ++i) {
+            if (i > 0) { end = vim_word_skip(scanner, end, 1, vim_classes_blank); }
+            int next = vim_word_class_at(scanner, end, 1);
+            if (end >= size || next == vim_class_newline) { break; }
+            end = vim_word_skip(scanner, end, 1, vim_word_run_set(next, big));
+        }
+        *object = make_range(start, end);
+        return true;
+    }
+    for (int i = 1; i < count; ++i) {
+        int word = vim_word_skip(scanner, end, 1, vim_classes_blank);
+        int next = vim_word_class_at(scanner, word, 1);
+        if (word >= size || next == vim_class_newline) { break; }
+        end = vim_word_skip(scanner, word, 1, vim_word_run_set(next, big));
+    }
+    *object = vim_object_with_blanks(scanner, make_range(start, end));
+    return true;
+}
+
+// Whether the line starting at line_start has only blanks on it.
+static bool vim_scanner_line_is_blank(Vim_Text_Scanner* scanner, int line_start) {
+    int first = vim_word_skip(scanner, line_start, 1, vim_classes_blank);
+    return first >= scanner->buffer->size ||
+           vim_word_class_at(scanner, first, 1) == vim_class_newline;
+}
+
+// Past the newline of the last line in the run of lines, from line_start down,
+// that are blank or not as blank says.
+static int vim_scanner_line_run_end(Vim_Text_Scanner* scanner, int line_start,
+                                    bool blank) {
+    int size = scanner->buffer->size;
+    int at = line_start;
+    while (at < size && vim_scanner_line_is_blank(scanner, at) == blank) {
+        at = vim_word_skip(scanner, at, 1, vim_classes_blank |
+                           vim_classes_punct | vim_classes_word) + 1;
+    }
+    return (at > size) ? size : at;
+}
+
+// ip and ap, always whole lines. A paragraph is a run of lines that are all
+// blank or all not. ap adds the blank lines after the paragraph, or before it
+// when there are none after.
+static bool vim_find_paragraph_object(Vim_Text_Scanner* scanner, int pos,
+                                      bool around, int count, Range* object) {
+    int size = scanner->buffer->size;
+    if (size == 0) { return false; }
+    if (pos >= size) { pos = size - 1; }
+    int line = vim_scanner_line_start(scanner, pos);
+    bool blank = vim_scanner_line_is_blank(scanner, line);
+
+    int start = line;
+    while (start > 0) {
+        int previous = vim_scanner_line_start(scanner, start - 1);
+        if (vim_scanner_line_is_blank(scanner, previous) != blank) { break; }
+        start = previous;
+    }
+    int end = vim_scanner_line_run_end(scanner, line, blank);
+    int runs = around ? 2*count : count;
+    int taken = 1;
+    bool next_blank = !blank;
+    for (; taken < runs && end < size; ++taken) {
+        end = vim_scanner_line_run_end(scanner, end, next_blank);
+        next_blank = !next_blank;
+    }
+    if (around && !blank && taken < runs) {
+        // No blank lines after: take the ones before instead.
+        while (start > 0) {
+            int previous = vim_scanner_line_start(scanner, start - 1);
+            if (!vim_scanner_line_is_blank(scanner, previous)) { break; }
+            start = previous;
+        }
+    }
+    *object = make_range(start, end);
+    return true;
+}
+
+constexpr int VIM_TAG_MAX_NAME = 64;
+constexpr int VIM_TAG_MAX_SIZE = 4096;
+
+struct Vim_Tag {
+    int start;
+    int end;
+    bool closing;
+    bool self_closing;
+    int name_size;
+    char name[VIM_TAG_MAX_NAME];
+};
+
+// Reads the tag starting with the < at pos: <name ...>, </name> or
+// <name .../>. Comments, doctypes and stray <s are not tags.
+static bool vim_parse_tag(Vim_Text_Scanner* scanner, int pos, Vim_Tag* tag) {
+    int size = scanner->buffer->size;
+    if (vim_scanner_char(scanner, pos, 1) != '<') { return false; }
+    tag->start = pos;
+    tag->name_size = 0;
+    int at = pos + 1;
+    tag->closing = (at < size && vim_scanner_char(scanner, at, 1) == '/');
+    if (tag->closing) { ++at; }
+    for (; at < size; ++at) {
+        char c = vim_scanner_char(scanner, at, 1);
+        if (vim_char_class(c) != vim_class_word && c != '-' && c != ':' &&
+            c != '.') {
+            break;
+        }
+        if (tag->name_size == VIM_TAG_MAX_NAME) { return false; }
+        tag->name[tag->name_size++] = c;
+    }
+    if (tag->name_size == 0) { return false; }
+    char previous = 0;
+    for (; at < size && at - pos < VIM_TAG_MAX_SIZE; ++at) {
+        char c = vim_scanner_char(scanner, at, 1);
+        if (c == '<') { return false; }
+        if (c == '>') {
+            tag->end = at + 1;
+            tag->self_closing = (previous == '/');
+            return !(tag->closing && tag->self_closing);
+        }
+        previous = c;
+    }
+    return false;
+}
+
+// The count-th element around pos, from the start of its opening tag to the
+// end of its closing one. The two tags are given back for it and at.
+static bool vim_find_tag_object(struct Application_Links* app,
+                                Buffer_Summary* buffer, int pos, int count,
+                                Vim_Tag* open_tag, Vim_Tag* close_tag) {
+    bool result = false;
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner left;
+    Vim_Text_Scanner reader;
+    if (!vim_scanner_init(&left, app, buffer) ||
+        !vim_scanner_init(&reader, app, buffer)) {
+        end_temp_memory(temp);
+        return false;
+    }
+
+    // A cursor inside a tag belongs to that tag's element.
+    int left_from = pos - 1;
+    int right_from = pos;
+    Vim_Tag tag;
+    int lt = -1;
+    for (int at = pos; at >= 0 && pos - at < VIM_TAG_MAX_SIZE; --at) {
+        char c = vim_scanner_char(&left, at, -1);
+        if (c == '<') { lt = at; break; }
+        if (c == '>' && at != pos) { break; }
+    }
+    if (lt >= 0 && vim_parse_tag(&reader, lt, &tag) && tag.end > pos) {
+        if (tag.closing) {
+            left_from = lt - 1;
+            right_from = lt;
+        } else if (!tag.self_closing) {
+            left_from = lt;
+            right_from = tag.end;
+        }
+    }
+
+    int depth = 0;
+    int levels = 0;
+    bool found_open = false;
+    for (int at = left_from; at >= 0 && !found_open; --at) {
+        if (!vim_scanner_load(&left, at, -1)) { break; }
+        at = left.start + vim_find_either_backward(left.window, at - left.start,
+                                                   '<', '<');
+        if (at < left.start) { at = left.start; continue; }
+        // Every tag this far is read from one window, not one per tag.
+        if (!vim_scanner_load_behind(&reader, at, VIM_TAG_MAX_SIZE)) { break; }
+        if (!vim_parse_tag(&reader, at, &tag) || tag.self_closing) { continue; }
+        if (tag.closing) {
+            ++depth;
+        } else if (depth > 0) {
+            --depth;
+        } else if (++levels == count) {
+            *open_tag = tag;
+            found_open = true;
+        }
+    }
+
+    depth = 0;
+    levels = 0;
+    int size = buffer->size;
+    for (int at = right_from; found_open && at < size; ++at) {
+        if (!vim_scanner_load(&left, at, 1)) { break; }
+        int found = vim_find_either_forward(left.window, at - left.start,
+                                            left.end - left.start, '<', '<');
+        at = left.start + found;
+        if (at >= left.end) { at = left.end - 1; continue; }
+        if (!vim_parse_tag(&reader, at, &tag) || tag.self_closing) { continue; }
+        if (!tag.closing) {
+            ++depth;
+        } else if (depth > 0) {
+            --depth;
+        } else if (++levels == count) {
+            if (tag.name_size == open_tag->name_size &&
+                memcmp(tag.name, open_tag->name, tag.name_size) == 0) {
+                *close_tag = tag;
+                result = true;
+            }
+            break;
+        }
+    }
+    end_temp_memory(temp);
+    return result;
+}
+
+// Resolves the text object named by key (the character after i or a) around
+// pos. is_line is set for objects made of whole lines. brackets is the
+// buffer's bracket index when it is complete, or null to scan the text.
+static bool vim_text_object(struct Application_Links* app, Buffer_Summary* buffer,
+                            Vim_Bracket_Index* brackets_index, int pos, char key,
+                            bool around, int count, Range* object,
+                            bool* is_line) {
+    *is_line = false;
+    char open = 0;
+    char close = 0;
+    switch (key) {
+        case '(': case ')': case 'b': { open = '('; close = ')'; } break;
+        case '{': case '}': case 'B': { open = '{'; close = '}'; } break;
+        case '[': case ']': { open = '['; close = ']'; } break;
+        case '<': case '>': { open = '<'; close = '>'; } break;
+    }
+    if (open) {
+        Range brackets;
+        bool closes;
+        int kind = vim_bracket_kind(open, &closes);
+        bool found = (brackets_index && kind >= 0)
+            ? vim_bracket_index_object(brackets_index, kind, pos, count, &brackets)
+            : vim_find_enclosing_brackets(app, buffer, pos, open, close, count,
+                                          &brackets);
+        if (!found) { return false; }
+        *object = around ? brackets : vim_brackets_inner(app, buffer, brackets);
+        return true;
+    }
+    if (key == 't') {
+        Vim_Tag open_tag, close_tag;
+        if (!vim_find_tag_object(app, buffer, pos, count, &open_tag, &close_tag)) {
+            return false;
+        }
+        *object = around ? make_range(open_tag.start, close_tag.end)
+                         : make_range(open_tag.end, close_tag.start);
+        return true;
+    }
+
+    bool result = false;
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    Vim_Text_Scanner scanner;
+    if (vim_scanner_init(&scanner, app, buffer)) {
+        switch (key) {
+            case 'w': case 'W': {
+                result = vim_find_word_object(&scanner, pos, around, key == 'W',
+                                              count, object);
+            } break;
+
+            case 'p': {
+                result = vim_find_paragraph_object(&scanner, pos, around, count,
+                                                   object);
+                *is_line = true;
+            } break;
+
+            case '"': case '\'': case '`': {
+                Range quotes;
+                result = vim_find_quotes(&scanner, pos, key, &quotes);
+                if (result) {
+                    *object = around ? vim_object_with_blanks(&scanner, quotes)
+                                     : make_range(quotes.start + 1, quotes.end - 1);
+                }
+            } break;
+        }
+    }
+    end_temp_memory(temp);
+    return result;
+}
+
+//=============================================================================
+// Character find
+// f, t, F and T. The scanner's window is searched 16 bytes at a time for the
+// character and, when the find stays on the cursor line as in vim, for the
+// newline that ends it. A count carries on from each hit in the same window.
+//=============================================================================
+
+// Offset of the count-th c after pos (direction > 0) or before it, or -1 if
+// the buffer (or the line, with in_line) runs out first.
+static int vim_find_character(struct Application_Links* app,
+                              Buffer_Summary* buffer, int pos, char c,
+                              int direction, int count, bool in_line) {
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    defer(end_temp_memory(temp));
+    Vim_Text_Scanner scanner;
+    if (!vim_scanner_init(&scanner, app, buffer)) { return -1; }
+    char stop = in_line ? '\n' : c;
+    int at = pos;
+    for (int found = 0; found < count;) {
+        at += direction;
+        if (!vim_scanner_load(&scanner, at, direction)) { return -1; }
+        int hit;
+        if (direction > 0) {
+            int size = scanner.end - scanner.start;
+            hit = vim_find_either_forward(scanner.window, at - scanner.start, size,
+                                          c, stop);
+            if (hit >= size) {
+                at = scanner.end - 1;
+                continue;
+            }
+        } else {
+            hit = vim_find_either_backward(scanner.window, at - scanner.start,
+                                           c, stop);
+            if (hit < 0) {
+                at = scanner.start;
+                continue;
+            }
+        }
+        at = scanner.start + hit;
+        if (scanner.window[hit] != c) { return -1; }
+        ++found;
+    }
+    return at;
+}
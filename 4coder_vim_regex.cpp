@@ -0,0 +1,871 @@
+//=============================================================================
+// >>> 4vim regex engine <<<
+//
+// Regular expressions for :s. Patterns use vim's "magic" syntax:
+//
+//   .  [abc]  [^a-z]  \s \S \d \D \w \W \a \l \u  ^  $
+//   *  \+  \=  \?  \{n,m}  \(group\)  \%(group\)  a\|b  \c \C
+//
+// A pattern compiles to a Thompson NFA program once. Matching runs a lazily
+// built DFA over that program, so each line costs one table lookup per byte
+// no matter how complex the pattern is. Lines are matched one at a time (^ and
+// $ anchor to the line), and a match is the leftmost-longest one. Capture
+// groups are only recovered when the replacement asks for them, by running a
+// Pike VM over the already-matched span.
+//
+// This file is included by 4coder_vim.cpp and is not meant to be compiled on
+// its own.
+//=============================================================================
+
+constexpr int VIM_REGEX_MAX_GROUPS = 10;
+// The lazy DFA is thrown away and rebuilt when it grows past this many states.
+constexpr int VIM_REGEX_MAX_DFA_STATES = 4096;
+
+struct Vim_Regex_Set {
+    uint32_t bits[8];
+};
+
+static inline bool vim_regex_set_has(const Vim_Regex_Set* set, uint8_t c) {
+    return (set->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+static inline void vim_regex_set_add(Vim_Regex_Set* set, uint8_t c) {
+    set->bits[c >> 5] |= 1u << (c & 31);
+}
+
+static void vim_regex_set_add_range(Vim_Regex_Set* set, int first, int last) {
+    for (int c = first; c <= last; ++c) { vim_regex_set_add(set, (uint8_t)c); }
+}
+
+enum Vim_Regex_Op {
+    re_set,    // consume a byte in sets[set], continue at pc + 1
+    re_split,  // continue at x (preferred) and y
+    re_jmp,    // continue at x
+    re_bol,    // assert start of line, continue at pc + 1
+    re_eol,    // assert end of line, continue at pc + 1
+    re_save,   // record the position in capture slot x, continue at pc + 1
+    re_match,
+};
+
+struct Vim_Regex_Inst {
+    Vim_Regex_Op op;
+    int x;
+    int y;
+};
+
+struct Vim_Regex_Dfa_State {
+    // Index of the next state for each byte, or -1 if not computed yet.
+    int next[256];
+    int pcs_offset;
+    int pcs_count;
+    bool accept;
+    // Accepts if the line ends right here (the pattern ends in $).
+    bool accept_at_eol;
+};
+
+struct Vim_Regex_Dfa {
+    // An unanchored DFA restarts the pattern at every byte. It answers "does
+    // this line match at all, and where does the first match end".
+    bool unanchored;
+    Vim_Array<Vim_Regex_Dfa_State> states;
+    Vim_Array<int> pcs;
+    Vim_Array<int> table;  // open-addressed state lookup, state index + 1
+    // Start state with and without the start-of-line assertion holding.
+    int start[2];
+};
+
+enum Vim_Regex_Node_Type {
+    re_node_empty,
+    re_node_set,
+    re_node_concat,
+    re_node_alt,
+    re_node_repeat,
+    re_node_group,
+    re_node_bol,
+    re_node_eol,
+};
+
+struct Vim_Regex_Node {
+    Vim_Regex_Node_Type type;
+    int a;
+    int b;
+    int set;
+    int min;
+    int max;  // -1 for unbounded
+    int group;
+};
+
+struct Vim_Regex {
+    Vim_Array<Vim_Regex_Set> sets;
+    Vim_Array<Vim_Regex_Inst> program;
+    int group_count;
+    bool ignore_case;
+    Vim_Regex_Dfa anchored;
+    Vim_Regex_Dfa unanchored;
+    // Bytes that can begin a match, for skipping hopeless start positions.
+    bool first_bytes[256];
+    bool matches_empty;
+    const char* error;
+
+    // Parser scratch.
+    Vim_Array<Vim_Regex_Node> nodes;
+    const char* at;
+    const char* end;
+};
+
+//- Parsing
+
+static int vim_regex_node(Vim_Regex* regex, Vim_Regex_Node_Type type,
+                          int a = -1, int b = -1) {
+    Vim_Regex_Node node = {};
+    node.type = type;
+    node.a = a;
+    node.b = b;
+    vim_array_push(&regex->nodes, node);
+    return regex->nodes.count - 1;
+}
+
+static int vim_regex_set_node(Vim_Regex* regex, Vim_Regex_Set set) {
+    if (regex->ignore_case) {
+        for (int c = 'a'; c <= 'z'; ++c) {
+            if (vim_regex_set_has(&set, (uint8_t)c) ||
+                vim_regex_set_has(&set, (uint8_t)(c - 'a' + 'A'))) {
+                vim_regex_set_add(&set, (uint8_t)c);
+                vim_regex_set_add(&set, (uint8_t)(c - 'a' + 'A'));
+            }
+        }
+    }
+    vim_array_push(&regex->sets, set);
+    int node = vim_regex_node(regex, re_node_set);
+    regex->nodes.items[node].set = regex->sets.count - 1;
+    return node;
+}
+
+// Fills set for a backslash class letter (\s, \d, ...). Returns false if the
+// letter is not a class.
+static bool vim_regex_class_escape(char c, Vim_Regex_Set* set) {
+    Vim_Regex_Set result = {};
+    bool negate = false;
+    switch (c) {
+        case 'S': negate = true; // fallthrough
+        case 's': {
+            vim_regex_set_add(&result, ' ');
+            vim_regex_set_add(&result, '\t');
+        } break;
+        case 'D': negate = true; // fallthrough
+        case 'd': vim_regex_set_add_range(&result, '0', '9'); break;
+        case 'W': negate = true; // fallthrough
+        case 'w': {
+            vim_regex_set_add_range(&result, '0', '9');
+            vim_regex_set_add_range(&result, 'a', 'z');
+            vim_regex_set_add_range(&result, 'A', 'Z');
+            vim_regex_set_add(&result, '_');
+        } break;
+        case 'A': negate = true; // fallthrough
+        case 'a': {
+            vim_regex_set_add_range(&result, 'a', 'z');
+            vim_regex_set_add_range(&result, 'A', 'Z');
+        } break;
+        case 'l': vim_regex_set_add_range(&result, 'a', 'z'); break;
+        case 'u': vim_regex_set_add_range(&result, 'A', 'Z'); break;
+        case 'x': {
+            vim_regex_set_add_range(&result, '0', '9');
+            vim_regex_set_add_range(&result, 'a', 'f');
+            vim_regex_set_add_range(&result, 'A', 'F');
+        } break;
+        default: return false;
+    }
+    if (negate) {
+        for (int i = 0; i < 8; ++i) { result.bits[i] = ~result.bits[i]; }
+        // Lines never contain newlines; keep them out so sets stay honest.
+        result.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+    }
+    *set = result;
+    return true;
+}
+
+static char vim_regex_literal_escape(char c) {
+    switch (c) {
+        case 't': return '\t';
+        case 'e': return 27;
+        case 'r': return '\r';
+        case 'n': return '\n';
+        default: return c;
+    }
+}
+
+static int vim_regex_parse_alt(Vim_Regex* regex);
+
+static int vim_regex_parse_class(Vim_Regex* regex) {
+    // regex->at is just past the '['.
+    Vim_Regex_Set set = {};
+    bool negate = false;
+    if (regex->at < regex->end && *regex->at == '^') {
+        negate = true;
+        ++regex->at;
+    }
+    bool first = true;
+    while (regex->at < regex->end && (*regex->at != ']' || first)) {
+        first = false;
+        int c = (uint8_t)*regex->at++;
+        if (c == '\\' && regex->at < regex->end) {
+            Vim_Regex_Set class_set;
+            if (vim_regex_class_escape(*regex->at, &class_set)) {
+                for (int i = 0; i < 8; ++i) { set.bits[i] |= class_set.bits[i]; }
+                ++regex->at;
+                continue;
+            }
+            c = (uint8_t)vim_regex_literal_escape(*regex->at++);
+        }
+        if (regex->at + 1 < regex->end && regex->at[0] == '-' &&
+            regex->at[1] != ']') {
+            ++regex->at;
+            int last = (uint8_t)*regex->at++;
+            if (last == '\\' && regex->at < regex->end) {
+                last = (uint8_t)vim_regex_literal_escape(*regex->at++);
+            }
+            if (last < c) {
+                regex->error = "reverse range in character class";
+                return -1;
+            }
+            vim_regex_set_add_range(&set, c, last);
+        } else {
+            vim_regex_set_add(&set, (uint8_t)c);
+        }
+    }
+    if (regex->at >= regex->end) {
+        regex->error = "missing ]";
+        return -1;
+    }
+    ++regex->at;
+    if (negate) {
+        for (int i = 0; i < 8; ++i) { set.bits[i] = ~set.bits[i]; }
+        set.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+    }
+    return vim_regex_set_node(regex, set);
+}
+
+static bool vim_regex_parse_int(Vim_Regex* regex, int* out) {
+    if (regex->at >= regex->end || !('0' <= *regex->at && *regex->at <= '9')) {
+        return false;
+    }
+    int value = 0;
+    while (regex->at < regex->end && '0' <= *regex->at && *regex->at <= '9') {
+        value = value*10 + (*regex->at++ - '0');
+        if (value > 1000) { value = 1000; }
+    }
+    *out = value;
+    return true;
+}
+
+// True when the parser sits at the end of a branch: end of pattern, \| or \).
+static bool vim_regex_at_branch_end(Vim_Regex* regex) {
+    if (regex->at >= regex->end) { return true; }
+    return regex->at + 1 < regex->end && regex->at[0] == '\\' &&
+           (regex->at[1] == '|' || regex->at[1] == ')');
+}
+
+static int vim_regex_parse_atom(Vim_Regex* regex, bool branch_start) {
+    char c = *regex->at++;
+    switch (c) {
+        case '.': {
+            Vim_Regex_Set set;
+            memset(&set, 0xFF, sizeof(set));
+            set.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+            return vim_regex_set_node(regex, set);
+        }
+        case '[': return vim_regex_parse_class(regex);
+        case '^': {
+            if (branch_start) { return vim_regex_node(regex, re_node_bol); }
+        } break;
+        case '$': {
+            if (vim_regex_at_branch_end(regex)) {
+                return vim_regex_node(regex, re_node_eol);
+            }
+        } break;
+        case '\\': {
+            if (regex->at >= regex->end) {
+                regex->error = "trailing \\";
+                return -1;
+            }
+            char e = *regex->at++;
+            bool capture = (e == '(');
+            if (e == '%' && regex->at < regex->end && *regex->at == '(') {
+                ++regex->at;
+            } else if (!capture) {
+                Vim_Regex_Set set;
+                if (vim_regex_class_escape(e, &set)) {
+                    return vim_regex_set_node(regex, set);
+                }
+                c = vim_regex_literal_escape(e);
+                break;
+            }
+            int group = -1;
+            if (capture) {
+                group = ++regex->group_count;
+            }
+            int inner = vim_regex_parse_alt(regex);
+            if (inner < 0) { return -1; }
+            if (!(regex->at + 1 < regex->end && regex->at[0] == '\\' &&
+                  regex->at[1] == ')')) {
+                regex->error = "missing \\)";
+                return -1;
+            }
+            regex->at += 2;
+            if (group < 0 || group >= VIM_REGEX_MAX_GROUPS) { return inner; }
+            int node = vim_regex_node(regex, re_node_group, inner);
+            regex->nodes.items[node].group = group;
+            return node;
+        }
+    }
+    Vim_Regex_Set set = {};
+    vim_regex_set_add(&set, (uint8_t)c);
+    return vim_regex_set_node(regex, set);
+}
+
+static int vim_regex_parse_piece(Vim_Regex* regex, bool branch_start) {
+    int atom = vim_regex_parse_atom(regex, branch_start);
+    while (atom >= 0 && regex->at < regex->end) {
+        int min = 0;
+        int max = -1;
+        if (*regex->at == '*') {
+            regex->at += 1;
+        } else if (regex->at + 1 < regex->end && regex->at[0] == '\\' &&
+                   (regex->at[1] == '+' || regex->at[1] == '=' ||
+                    regex->at[1] == '?')) {
+            min = (regex->at[1] == '+') ? 1 : 0;
+            max = (regex->at[1] == '+') ? -1 : 1;
+            regex->at += 2;
+        } else if (regex->at + 1 < regex->end && regex->at[0] == '\\' &&
+                   regex->at[1] == '{') {
+            regex->at += 2;
+            bool has_min = vim_regex_parse_int(regex, &min);
+            if (regex->at < regex->end && *regex->at == ',') {
+                ++regex->at;
+                if (!vim_regex_parse_int(regex, &max)) { max = -1; }
+            } else {
+                max = has_min ? min : -1;
+            }
+            if (regex->at < regex->end && *regex->at == '\\') { ++regex->at; }
+            if (regex->at >= regex->end || *regex->at != '}') {
+                regex->error = "missing } in \\{";
+                return -1;
+            }
+            ++regex->at;
+            if (max >= 0 && max < min) {
+                int swap = min;
+                min = max;
+                max = swap;
+            }
+        } else {
+            break;
+        }
+        int node = vim_regex_node(regex, re_node_repeat, atom);
+        regex->nodes.items[node].min = min;
+        regex->nodes.items[node].max = max;
+        atom = node;
+    }
+    return atom;
+}
+
+static int vim_regex_parse_concat(Vim_Regex* regex) {
+    int result = vim_regex_node(regex, re_node_empty);
+    bool branch_start = true;
+    while (!vim_regex_at_branch_end(regex)) {
+        int piece = vim_regex_parse_piece(regex, branch_start);
+        if (piece < 0) { return -1; }
+        result = vim_regex_node(regex, re_node_concat, result, piece);
+        branch_start = false;
+    }
+    return result;
+}
+
+static int vim_regex_parse_alt(Vim_Regex* regex) {
+    int result = vim_regex_parse_concat(regex);
+    while (result >= 0 && regex->at + 1 < regex->end &&
+           regex->at[0] == '\\' && regex->at[1] == '|') {
+        regex->at += 2;
+        int branch = vim_regex_parse_concat(regex);
+        if (branch < 0) { return -1; }
+        result = vim_regex_node(regex, re_node_alt, result, branch);
+    }
+    return result;
+}
+
+//- Compiling to an NFA program
+
+static int vim_regex_emit(Vim_Regex* regex, Vim_Regex_Op op, int x = 0, int y = 0) {
+    Vim_Regex_Inst inst = { op, x, y };
+    vim_array_push(&regex->program, inst);
+    return regex->program.count - 1;
+}
+
+static void vim_regex_compile_node(Vim_Regex* regex, int index) {
+    // Copy: compiling children may grow (and move) the node array.
+    Vim_Regex_Node node = regex->nodes.items[index];
+    switch (node.type) {
+        case re_node_empty: break;
+        case re_node_set: vim_regex_emit(regex, re_set, node.set); break;
+        case re_node_bol: vim_regex_emit(regex, re_bol); break;
+        case re_node_eol: vim_regex_emit(regex, re_eol); break;
+        case re_node_concat: {
+            vim_regex_compile_node(regex, node.a);
+            vim_regex_compile_node(regex, node.b);
+        } break;
+        case re_node_alt: {
+            int split = vim_regex_emit(regex, re_split);
+            regex->program.items[split].x = regex->program.count;
+            vim_regex_compile_node(regex, node.a);
+            int jump = vim_regex_emit(regex, re_jmp);
+            regex->program.items[split].y = regex->program.count;
+            vim_regex_compile_node(regex, node.b);
+            regex->program.items[jump].x = regex->program.count;
+        } break;
+        case re_node_group: {
+            vim_regex_emit(regex, re_save, node.group*2);
+            vim_regex_compile_node(regex, node.a);
+            vim_regex_emit(regex, re_save, node.group*2 + 1);
+        } break;
+        case re_node_repeat: {
+            for (int i = 0; i < node.min; ++i) {
+                vim_regex_compile_node(regex, node.a);
+            }
+            if (node.max < 0) {
+                int split = vim_regex_emit(regex, re_split);
+                regex->program.items[split].x = regex->program.count;
+                vim_regex_compile_node(regex, node.a);
+                vim_regex_emit(regex, re_jmp, split);
+                regex->program.items[split].y = regex->program.count;
+            } else {
+                Vim_Array<int> splits = {};
+                for (int i = node.min; i < node.max; ++i) {
+                    int split = vim_regex_emit(regex, re_split);
+                    regex->program.items[split].x = regex->program.count;
+                    vim_array_push(&splits, split);
+                    vim_regex_compile_node(regex, node.a);
+                }
+                for (int i = 0; i < splits.count; ++i) {
+                    regex->program.items[splits.items[i]].y = regex->program.count;
+                }
+                vim_array_free(&splits);
+            }
+        } break;
+    }
+}
+
+//- Lazy DFA
+
+static void vim_regex_dfa_clear(Vim_Regex_Dfa* dfa) {
+    dfa->states.count = 0;
+    dfa->pcs.count = 0;
+    for (int i = 0; i < dfa->table.count; ++i) { dfa->table.items[i] = 0; }
+    dfa->start[0] = dfa->start[1] = -1;
+}
+
+static void vim_regex_dfa_free(Vim_Regex_Dfa* dfa) {
+    vim_array_free(&dfa->states);
+    vim_array_free(&dfa->pcs);
+    vim_array_free(&dfa->table);
+}
+
+// Follows epsilon edges from pc, collecting byte-consuming and match
+// instructions into out. Returns whether an end-of-line assertion was hit on
+// the way to a match.
+static bool vim_regex_closure(Vim_Regex* regex, int pc, bool at_bol, bool at_eol,
+                              Vim_Array<int>* out, uint8_t* seen) {
+    bool eol_accept = false;
+    while (!seen[pc]) {
+        seen[pc] = 1;
+        Vim_Regex_Inst inst = regex->program.items[pc];
+        switch (inst.op) {
+            case re_set: vim_array_push(out, pc); return eol_accept;
+            case re_match: {
+                if (at_eol) { return true; }
+                vim_array_push(out, pc);
+                return false;
+            }
+            case re_jmp: pc = inst.x; break;
+            case re_split: {
+                eol_accept |= vim_regex_closure(regex, inst.x, at_bol, at_eol,
+                                                out, seen);
+                pc = inst.y;
+            } break;
+            case re_bol: {
+                if (!at_bol) { return eol_accept; }
+                pc += 1;
+            } break;
+            case re_eol: {
+                if (at_eol) {
+                    pc += 1;
+                } else {
+                    // Only a line ending here can get past this; see whether
+                    // that would reach a match.
+                    Vim_Array<int> ignored = {};
+                    uint8_t* eol_seen = (uint8_t*)calloc(regex->program.count, 1);
+                    eol_accept |= vim_regex_closure(regex, pc + 1, at_bol, true,
+                                                    &ignored, eol_seen);
+                    free(eol_seen);
+                    vim_array_free(&ignored);
+                    return eol_accept;
+                }
+            } break;
+            case re_save: pc += 1; break;
+        }
+    }
+    return eol_accept;
+}
+
+static int vim_regex_dfa_intern(Vim_Regex* regex, Vim_Regex_Dfa* dfa,
+                                int* seeds, int seed_count, bool at_bol) {
+    Vim_Array<int> pcs = {};
+    uint8_t* seen = (uint8_t*)calloc(regex->program.count, 1);
+    bool eol_accept = false;
+    for (int i = 0; i < seed_count; ++i) {
+        eol_accept |= vim_regex_closure(regex, seeds[i], at_bol, false, &pcs, seen);
+    }
+    free(seen);
+    // Canonical order so equal sets intern to the same state.
+    for (int i = 1; i < pcs.count; ++i) {
+        int value = pcs.items[i];
+        int j = i - 1;
+        while (j >= 0 && pcs.items[j] > value) {
+            pcs.items[j + 1] = pcs.items[j];
+            --j;
+        }
+        pcs.items[j + 1] = value;
+    }
+    bool accept = false;
+    for (int i = 0; i < pcs.count; ++i) {
+        if (regex->program.items[pcs.items[i]].op == re_match) { accept = true; }
+    }
+    eol_accept |= accept;
+
+    uint32_t hash = eol_accept ? 0x9E3779B9u : 17u;
+    for (int i = 0; i < pcs.count; ++i) {
+        hash = (hash ^ (uint32_t)pcs.items[i])*16777619u;
+    }
+    if (dfa->table.count < 2*(dfa->states.count + 1)) {
+        // Grow and rehash.
+        int capacity = dfa->table.count ? dfa->table.count*2 : 64;
+        vim_array_free(&dfa->table);
+        vim_array_reserve(&dfa->table, capacity);
+        dfa->table.count = capacity;
+        for (int i = 0; i < capacity; ++i) { dfa->table.items[i] = 0; }
+        for (int s = 0; s < dfa->states.count; ++s) {
+            Vim_Regex_Dfa_State* state = dfa->states.items + s;
+            uint32_t h = state->accept_at_eol ? 0x9E3779B9u : 17u;
+            for (int i = 0; i < state->pcs_count; ++i) {
+                h = (h ^ (uint32_t)dfa->pcs.items[state->pcs_offset + i])*16777619u;
+            }
+            uint32_t slot = h & (capacity - 1);
+            while (dfa->table.items[slot]) { slot = (slot + 1) & (capacity - 1); }
+            dfa->table.items[slot] = s + 1;
+        }
+    }
+    uint32_t mask = (uint32_t)dfa->table.count - 1;
+    uint32_t slot = hash & mask;
+    while (dfa->table.items[slot]) {
+        Vim_Regex_Dfa_State* state = dfa->states.items + dfa->table.items[slot] - 1;
+        if (state->pcs_count == pcs.count && state->accept_at_eol == eol_accept &&
+            (pcs.count == 0 ||
+             memcmp(dfa->pcs.items + state->pcs_offset, pcs.items,
+                    sizeof(int)*pcs.count) == 0)) {
+            vim_array_free(&pcs);
+            return dfa->table.items[slot] - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    Vim_Regex_Dfa_State state;
+    for (int i = 0; i < 256; ++i) { state.next[i] = -1; }
+    state.pcs_offset = dfa->pcs.count;
+    state.pcs_count = pcs.count;
+    state.accept = accept;
+    state.accept_at_eol = eol_accept;
+    int* stored = vim_array_insert(&dfa->pcs, dfa->pcs.count, pcs.count);
+    if (pcs.count > 0) { memcpy(stored, pcs.items, sizeof(int)*pcs.count); }
+    vim_array_free(&pcs);
+    vim_array_push(&dfa->states, state);
+    dfa->table.items[slot] = dfa->states.count;
+    return dfa->states.count - 1;
+}
+
+static int vim_regex_dfa_start(Vim_Regex* regex, Vim_Regex_Dfa* dfa, bool at_bol) {
+    if (dfa->start[at_bol] < 0) {
+        int seed = 0;
+        dfa->start[at_bol] = vim_regex_dfa_intern(regex, dfa, &seed, 1, at_bol);
+    }
+    return dfa->start[at_bol];
+}
+
+static int vim_regex_dfa_step(Vim_Regex* regex, Vim_Regex_Dfa* dfa, int index,
+                              uint8_t c) {
+    int next = dfa->states.items[index].next[c];
+    if (next >= 0) { return next; }
+
+    Vim_Array<int> seeds = {};
+    Vim_Regex_Dfa_State* state = dfa->states.items + index;
+    for (int i = 0; i < state->pcs_count; ++i) {
+        int pc = dfa->pcs.items[state->pcs_offset + i];
+        Vim_Regex_Inst inst = regex->program.items[pc];
+        if (inst.op == re_set &&
+            vim_regex_set_has(regex->sets.items + inst.x, c)) {
+            vim_array_push(&seeds, pc + 1);
+        }
+    }
+    if (dfa->unanchored) {
+        vim_array_push(&seeds, 0);
+    }
+    next = vim_regex_dfa_intern(regex, dfa, seeds.items, seeds.count, false);
+    vim_array_free(&seeds);
+    // Interning may have moved the state array.
+    dfa->states.items[index].next[c] = next;
+    return next;
+}
+
+static inline bool vim_regex_dfa_is_dead(Vim_Regex_Dfa* dfa, int index) {
+    Vim_Regex_Dfa_State* state = dfa->states.items + index;
+    return state->pcs_count == 0 && !state->accept_at_eol && !dfa->unanchored;
+}
+
+//- Public interface
+
+static void vim_regex_free(Vim_Regex* regex) {
+    vim_array_free(&regex->sets);
+    vim_array_free(&regex->program);
+    vim_array_free(&regex->nodes);
+    vim_regex_dfa_free(&regex->anchored);
+    vim_regex_dfa_free(&regex->unanchored);
+}
+
+// Compiles pattern. On failure returns false and regex->error says why.
+static bool vim_regex_compile(Vim_Regex* regex, String pattern, bool ignore_case) {
+    *regex = {};
+    regex->ignore_case = ignore_case;
+    // \c and \C anywhere in the pattern override the flag, as in vim.
+    for (int i = 0; i + 1 < pattern.size; ++i) {
+        if (pattern.str[i] == '\\') {
+            if (pattern.str[i + 1] == 'c') { regex->ignore_case = true; }
+            if (pattern.str[i + 1] == 'C') { regex->ignore_case = false; }
+            ++i;
+        }
+    }
+    char* stripped = (char*)malloc(pattern.size + 1);
+    int stripped_size = 0;
+    for (int i = 0; i < pattern.size; ++i) {
+        if (pattern.str[i] == '\\' && i + 1 < pattern.size) {
+            if (pattern.str[i + 1] == 'c' || pattern.str[i + 1] == 'C') {
+                ++i;
+                continue;
+            }
+            stripped[stripped_size++] = pattern.str[i++];
+        }
+        stripped[stripped_size++] = pattern.str[i];
+    }
+    regex->at = stripped;
+    regex->end = stripped + stripped_size;
+
+    int root = vim_regex_parse_alt(regex);
+    if (root >= 0 && regex->at < regex->end) {
+        regex->error = "unmatched \\)";
+    }
+    if (regex->error == nullptr) {
+        vim_regex_emit(regex, re_save, 0);
+        vim_regex_compile_node(regex, root);
+        vim_regex_emit(regex, re_save, 1);
+        vim_regex_emit(regex, re_match);
+    }
+    free(stripped);
+    regex->at = regex->end = nullptr;
+    vim_array_free(&regex->nodes);
+    if (regex->error) {
+        vim_regex_free(regex);
+        return false;
+    }
+
+    regex->unanchored.unanchored = true;
+    vim_regex_dfa_clear(&regex->anchored);
+    vim_regex_dfa_clear(&regex->unanchored);
+    int start = vim_regex_dfa_start(regex, &regex->anchored, false);
+    int start_bol = vim_regex_dfa_start(regex, &regex->anchored, true);
+    regex->matches_empty =
+        regex->anchored.states.items[start].accept_at_eol ||
+        regex->anchored.states.items[start_bol].accept_at_eol;
+    for (int c = 0; c < 256; ++c) {
+        int next = vim_regex_dfa_step(regex, &regex->anchored, start, (uint8_t)c);
+        int next_bol = vim_regex_dfa_step(regex, &regex->anchored, start_bol,
+                                          (uint8_t)c);
+        regex->first_bytes[c] = !vim_regex_dfa_is_dead(&regex->anchored, next) ||
+                                !vim_regex_dfa_is_dead(&regex->anchored, next_bol);
+    }
+    return true;
+}
+
+// Longest match of the pattern anchored at line[start]. Returns its end, or
+// -1 if there is none.
+static int vim_regex_match_at(Vim_Regex* regex, const char* line, int size,
+                              int start) {
+    Vim_Regex_Dfa* dfa = &regex->anchored;
+    int state = vim_regex_dfa_start(regex, dfa, start == 0);
+    int last = dfa->states.items[state].accept ? start : -1;
+    int i = start;
+    for (; i < size; ++i) {
+        state = vim_regex_dfa_step(regex, dfa, state, (uint8_t)line[i]);
+        if (vim_regex_dfa_is_dead(dfa, state)) { return last; }
+        if (dfa->states.items[state].accept) { last = i + 1; }
+    }
+    if (dfa->states.items[state].accept_at_eol) { last = size; }
+    return last;
+}
+
+// Finds the leftmost-longest match in line[from, size), where line is one line
+// of text without its newline. Returns false if there is none.
+static bool vim_regex_find_in_line(Vim_Regex* regex, const char* line, int size,
+                                   int from, Range* match) {
+    if (regex->anchored.states.count > VIM_REGEX_MAX_DFA_STATES) {
+        vim_regex_dfa_clear(&regex->anchored);
+    }
+    if (regex->unanchored.states.count > VIM_REGEX_MAX_DFA_STATES) {
+        vim_regex_dfa_clear(&regex->unanchored);
+    }
+
+    // One pass of the unanchored DFA rejects non-matching lines and tells
+    // where the earliest match ends; the leftmost match starts no later.
+    Vim_Regex_Dfa* dfa = &regex->unanchored;
+    int state = vim_regex_dfa_start(regex, dfa, from == 0);
+    int first_end = dfa->states.items[state].accept ? from : -1;
+    for (int i = from; first_end < 0 && i < size; ++i) {
+        state = vim_regex_dfa_step(regex, dfa, state, (uint8_t)line[i]);
+        if (dfa->states.items[state].accept) { first_end = i + 1; }
+    }
+    if (first_end < 0) {
+        if (!dfa->states.items[state].accept_at_eol) { return false; }
+        first_end = size;
+    }
+
+    for (int start = from; start <= first_end; ++start) {
+        if (!regex->matches_empty && start < size &&
+            !regex->first_bytes[(uint8_t)line[start]]) {
+            continue;
+        }
+        int end = vim_regex_match_at(regex, line, size, start);
+        if (end >= 0) {
+            *match = make_range(start, end);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Recovers capture groups for a match found by vim_regex_find_in_line.
+// groups[0] is the whole match; unmatched groups are empty ranges at -1.
+static void vim_regex_groups(Vim_Regex* regex, const char* line, int size,
+                             Range match, Range* groups) {
+    const int slot_count = VIM_REGEX_MAX_GROUPS*2;
+    int program_count = regex->program.count;
+    struct Thread {
+        int pc;
+        int slots[VIM_REGEX_MAX_GROUPS*2];
+    };
+    Thread* current = (Thread*)malloc(sizeof(Thread)*program_count);
+    Thread* next = (Thread*)malloc(sizeof(Thread)*program_count);
+    int* on_list = (int*)malloc(sizeof(int)*program_count);
+    // Every pc is expanded at most once per list and pushes at most two
+    // frames of three ints each.
+    int* stack = (int*)malloc(sizeof(int)*3*(program_count*2 + 2));
+    int current_count = 0;
+    int next_count = 0;
+    for (int i = 0; i < program_count; ++i) { on_list[i] = -1; }
+
+    for (int g = 0; g < VIM_REGEX_MAX_GROUPS; ++g) {
+        groups[g] = make_range(-1, -1);
+    }
+    groups[0] = match;
+
+    // Adds pc and everything reachable through epsilon edges to list, in
+    // priority order. gen tags the list so on_list needs no clearing.
+    auto add_thread = [&](Thread* list, int* count, int gen, int pc,
+                          const int* slots, int pos) {
+        struct Frame { int pc; int slot; int value; };
+        Frame* frames = (Frame*)stack;
+        int top = 0;
+        int local[VIM_REGEX_MAX_GROUPS*2];
+        memcpy(local, slots, sizeof(local));
+        frames[top++] = { pc, -1, 0 };
+        while (top > 0) {
+            Frame frame = frames[--top];
+            if (frame.slot >= 0) {
+                // Undo a save on the way back out.
+                local[frame.slot] = frame.value;
+                continue;
+            }
+            int at = frame.pc;
+            if (on_list[at] == gen) { continue; }
+            on_list[at] = gen;
+            Vim_Regex_Inst inst = regex->program.items[at];
+            switch (inst.op) {
+                case re_jmp: frames[top++] = { inst.x, -1, 0 }; break;
+                case re_split: {
+                    frames[top++] = { inst.y, -1, 0 };
+                    frames[top++] = { inst.x, -1, 0 };
+                } break;
+                case re_bol: {
+                    if (pos == 0) { frames[top++] = { at + 1, -1, 0 }; }
+                } break;
+                case re_eol: {
+                    if (pos == size) { frames[top++] = { at + 1, -1, 0 }; }
+                } break;
+                case re_save: {
+                    frames[top++] = { 0, inst.x, local[inst.x] };
+                    local[inst.x] = pos;
+                    frames[top++] = { at + 1, -1, 0 };
+                } break;
+                default: {
+                    Thread* thread = list + (*count)++;
+                    thread->pc = at;
+                    memcpy(thread->slots, local, sizeof(local));
+                } break;
+            }
+        }
+    };
+
+    int initial[VIM_REGEX_MAX_GROUPS*2];
+    for (int i = 0; i < slot_count; ++i) { initial[i] = -1; }
+    int gen = 0;
+    add_thread(current, &current_count, gen++, 0, initial, match.start);
+    for (int pos = match.start; pos <= match.end && current_count > 0; ++pos) {
+        next_count = 0;
+        int list_gen = gen++;
+        for (int t = 0; t < current_count; ++t) {
+            Thread* thread = current + t;
+            Vim_Regex_Inst inst = regex->program.items[thread->pc];
+            if (inst.op == re_match) {
+                if (pos == match.end) {
+                    for (int g = 1; g < VIM_REGEX_MAX_GROUPS; ++g) {
+                        if (thread->slots[g*2] >= 0 && thread->slots[g*2 + 1] >= 0) {
+                            groups[g] = make_range(thread->slots[g*2],
+                                                   thread->slots[g*2 + 1]);
+                        }
+                    }
+                    current_count = 0;
+                    break;
+                }
+            } else if (pos < match.end &&
+                       vim_regex_set_has(regex->sets.items + inst.x,
+                                         (uint8_t)line[pos])) {
+                add_thread(next, &next_count, list_gen, thread->pc + 1,
+                           thread->slots, pos + 1);
+            }
+        }
+        if (pos == match.end) { break; }
+        Thread* swap = current;
+        current = next;
+        next = swap;
+        current_count = next_count;
+    }
+
+    free(current);
+    free(next);
+    free(on_list);
+    free(stack);
+}
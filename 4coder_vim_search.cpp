@@ -0,0 +1,687 @@
+//=============================================================================
+// >>> 4vim search engine <<<
+//
+// Substring search used by /, ?, n, N and *. The buffer is walked in large
+// windows that overlap by (pattern length - 1) bytes so that no match is lost
+// on a window seam. Inside a window, candidates are found 16 bytes at a time by
+// comparing the first and last byte of the pattern in parallel (SSE2), and only
+// positions where both agree get a full compare. Without SSE2, a Horspool skip
+// loop is used instead.
+//
+// This file is included by 4coder_vim.cpp and is not meant to be compiled on
+// its own.
+//=============================================================================
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VIM_SSE2 1
+#include <emmintrin.h>
+#else
+#define VIM_SSE2 0
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline int vim_lowest_bit(uint32_t mask) {
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+}
+static inline int vim_highest_bit(uint32_t mask) {
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return (int)index;
+}
+#else
+static inline int vim_lowest_bit(uint32_t mask) { return __builtin_ctz(mask); }
+static inline int vim_highest_bit(uint32_t mask) { return 31 - __builtin_clz(mask); }
+#endif
+
+// Size of a single buffer read while searching. Large enough that the read
+// overhead disappears, small enough to live in global_part.
+constexpr int VIM_SEARCH_WINDOW = 1 << 20;
+
+struct Vim_Search_Pattern {
+    char* str;
+    int size;
+    // Horspool shift for each byte value, used by the scalar paths.
+    int skip_forward[256];
+    int skip_backward[256];
+};
+
+static void vim_search_pattern_init(Vim_Search_Pattern* pattern, String needle) {
+    pattern->str = needle.str;
+    pattern->size = needle.size;
+    int m = needle.size;
+    for (int i = 0; i < 256; ++i) {
+        pattern->skip_forward[i] = m;
+        pattern->skip_backward[i] = m;
+    }
+    for (int i = 0; i + 1 < m; ++i) {
+        pattern->skip_forward[(uint8_t)needle.str[i]] = m - 1 - i;
+    }
+    for (int i = m - 1; i > 0; --i) {
+        pattern->skip_backward[(uint8_t)needle.str[i]] = i;
+    }
+}
+
+static inline bool vim_search_verify(const Vim_Search_Pattern* pattern,
+                                     const char* at) {
+    // First and last bytes are already known to match.
+    return pattern->size <= 2 ||
+           memcmp(at + 1, pattern->str + 1, pattern->size - 2) == 0;
+}
+
+// Returns the offset of the first match that lies entirely in text[0, size),
+// or -1.
+static int vim_search_text_forward(const Vim_Search_Pattern* pattern,
+                                   const char* text, int size) {
+    int m = pattern->size;
+    if (m <= 0 || m > size) { return -1; }
+    if (m == 1) {
+        const char* found = (const char*)memchr(text, pattern->str[0], size);
+        return found ? (int)(found - text) : -1;
+    }
+
+    int last_start = size - m;
+    int i = 0;
+#if VIM_SSE2
+    const __m128i first = _mm_set1_epi8(pattern->str[0]);
+    const __m128i last = _mm_set1_epi8(pattern->str[m - 1]);
+    for (; i + 15 <= last_start; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text + i + m - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                          _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            int bit = vim_lowest_bit(mask);
+            if (vim_search_verify(pattern, text + i + bit)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    // Horspool for whatever the vector loop could not cover.
+    while (i <= last_start) {
+        char tail = text[i + m - 1];
+        if (tail == pattern->str[m - 1] && text[i] == pattern->str[0] &&
+            vim_search_verify(pattern, text + i)) {
+            return i;
+        }
+        i += pattern->skip_forward[(uint8_t)tail];
+    }
+    return -1;
+}
+
+// Returns the offset of the last match that lies entirely in text[0, size),
+// or -1.
+static int vim_search_text_backward(const Vim_Search_Pattern* pattern,
+                                    const char* text, int size) {
+    int m = pattern->size;
+    if (m <= 0 || m > size) { return -1; }
+
+    int i = size - m;
+#if VIM_SSE2
+    const __m128i first = _mm_set1_epi8(pattern->str[0]);
+    const __m128i last = _mm_set1_epi8(pattern->str[m - 1]);
+    for (; i >= 15; i -= 16) {
+        int block = i - 15;
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text + block));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text + block + m - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                          _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            int bit = vim_highest_bit(mask);
+            if (vim_search_verify(pattern, text + block + bit)) {
+                return block + bit;
+            }
+            mask &= ~(1u << bit);
+        }
+    }
+#endif
+    while (i >= 0) {
+        char head = text[i];
+        if (head == pattern->str[0] && text[i + m - 1] == pattern->str[m - 1] &&
+            vim_search_verify(pattern, text + i)) {
+            return i;
+        }
+        i -= pattern->skip_backward[(uint8_t)head];
+    }
+    return -1;
+}
+
+// Finds the first (search_forward) or last (search_backward) match that lies
+// entirely inside [min, max) of the buffer. Returns the buffer offset or -1.
+static int vim_search_buffer_range(struct Application_Links* app,
+                                   Buffer_Summary* buffer,
+                                   const Vim_Search_Pattern* pattern,
+                                   int min, int max,
+                                   Search_Direction direction) {
+    int m = pattern->size;
+    if (min < 0) { min = 0; }
+    if (max > buffer->size) { max = buffer->size; }
+    if (m <= 0 || max - min < m) { return -1; }
+
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    defer(end_temp_memory(temp));
+    int window_size = VIM_SEARCH_WINDOW;
+    if (window_size < 2*m) { window_size = 2*m; }
+    char* window = push_array(&global_part, char, window_size);
+    if (window == nullptr) { return -1; }
+
+    // Consecutive windows share m - 1 bytes so a match straddling the seam is
+    // fully contained in one of them.
+    int advance = window_size - (m - 1);
+    if (direction == search_forward) {
+        for (int start = min; start + m <= max; start += advance) {
+            int end = start + window_size;
+            if (end > max) { end = max; }
+            buffer_read_range(app, buffer, start, end, window);
+            int found = vim_search_text_forward(pattern, window, end - start);
+            if (found >= 0) { return start + found; }
+        }
+    } else {
+        for (int end = max; end - m >= min; end -= advance) {
+            int start = end - window_size;
+            if (start < min) { start = min; }
+            buffer_read_range(app, buffer, start, end, window);
+            int found = vim_search_text_backward(pattern, window, end - start);
+            if (found >= 0) { return start + found; }
+        }
+    }
+    return -1;
+}
+
+// Finds the next match strictly after (or strictly before) pos, wrapping
+// around the end of the buffer. The two halves of the scan cover the buffer
+// exactly once, so a miss costs one pass rather than one and a half. A match
+// at pos itself is only found after wrapping, as in vim. Returns -1 if the
+// pattern does not occur.
+static int vim_search_buffer_wrapped(struct Application_Links* app,
+                                     Buffer_Summary* buffer,
+                                     const Vim_Search_Pattern* pattern,
+                                     int pos, Search_Direction direction) {
+    int m = pattern->size;
+    int found = -1;
+    if (direction == search_forward) {
+        found = vim_search_buffer_range(app, buffer, pattern, pos + 1,
+                                        buffer->size, search_forward);
+        if (found < 0) {
+            found = vim_search_buffer_range(app, buffer, pattern, 0, pos + m,
+                                            search_forward);
+        }
+    } else {
+        found = vim_search_buffer_range(app, buffer, pattern, 0, pos - 1 + m,
+                                        search_backward);
+        if (found < 0) {
+            found = vim_search_buffer_range(app, buffer, pattern, pos,
+                                            buffer->size, search_backward);
+        }
+    }
+    return found;
+}
+
+//=============================================================================
+// Match cache
+// Each buffer keeps a sorted array of every match offset for the current
+// search pattern, so n and N become a binary search and the query bar can say
+// which match you are on. The array is filled front to back in bounded steps
+// (from n/N and from the render caller), and edits only drop and rescan the
+// matches around the edited bytes.
+//=============================================================================
+
+struct Vim_Match_Cache {
+    char pattern[100];
+    int pattern_size;
+    // Sorted start offsets of every match that begins below scanned_to.
+    Vim_Array<int> matches;
+    int scanned_to;
+    // Parts of [0, scanned_to) whose matches were dropped by an edit and have
+    // not been searched again yet. Sorted and disjoint.
+    Vim_Array<Range> dirty;
+    // Buffer size the cache was last reconciled against. A mismatch means an
+    // edit never reached the edit hook, and the cache starts over.
+    int buffer_size;
+};
+
+// Bytes of not-yet-scanned buffer text the cache takes on per n/N, and per
+// frame from the render caller.
+constexpr int VIM_MATCH_CACHE_STEP = 16 << 20;
+constexpr int VIM_MATCH_CACHE_FRAME_STEP = 4 << 20;
+
+static void vim_match_cache_free(Vim_Match_Cache* cache) {
+    vim_array_free(&cache->matches);
+    vim_array_free(&cache->dirty);
+    cache->pattern_size = 0;
+    cache->scanned_to = 0;
+}
+
+static void vim_match_cache_reset(Vim_Match_Cache* cache, String pattern,
+                                  int buffer_size) {
+    int size = pattern.size;
+    if (size > (int)sizeof(cache->pattern)) { size = sizeof(cache->pattern); }
+    memcpy(cache->pattern, pattern.str, size);
+    cache->pattern_size = size;
+    cache->matches.count = 0;
+    cache->dirty.count = 0;
+    cache->scanned_to = 0;
+    cache->buffer_size = buffer_size;
+}
+
+static bool vim_match_cache_is_complete(Vim_Match_Cache* cache) {
+    return cache->pattern_size > 0 && cache->dirty.count == 0 &&
+           cache->scanned_to >= cache->buffer_size;
+}
+
+// Keeps the cache consistent with an edit that replaced [start, end) with
+// text_size bytes. Only bookkeeping happens here; rescanning the bytes around
+// the edit waits until the cache is next used.
+static void vim_match_cache_on_edit(Vim_Match_Cache* cache, int start, int end,
+                                    int text_size) {
+    if (cache->pattern_size == 0) { return; }
+    int m = cache->pattern_size;
+    int delta = text_size - (end - start);
+    // Matches overlapping the replaced bytes are gone; later ones move.
+    int touched_min = start - m + 1;
+    if (touched_min < 0) { touched_min = 0; }
+
+    Vim_Array<int>* matches = &cache->matches;
+    int lo = vim_lower_bound(matches->items, matches->count, touched_min);
+    int hi = vim_lower_bound(matches->items, matches->count, end);
+    vim_array_remove(matches, lo, hi - lo);
+    for (int i = lo; i < matches->count; ++i) {
+        matches->items[i] += delta;
+    }
+
+    if (cache->scanned_to >= end) {
+        cache->scanned_to += delta;
+    } else if (cache->scanned_to > touched_min) {
+        cache->scanned_to = touched_min;
+    }
+
+    // Move the dirty ranges along with the text (a monotonic mapping, so
+    // they stay sorted), fold in the bytes around the edit, then merge.
+    Vim_Array<Range>* dirty = &cache->dirty;
+    for (int i = 0; i < dirty->count; ++i) {
+        Range* range = dirty->items + i;
+        range->start = range->start < start ? range->start :
+                       range->start >= end ? range->start + delta : start;
+        range->end = range->end <= start ? range->end :
+                     range->end >= end ? range->end + delta : start + text_size;
+    }
+    int index = 0;
+    while (index < dirty->count && dirty->items[index].start < touched_min) {
+        ++index;
+    }
+    Range* added = vim_array_insert(dirty, index, 1);
+    if (added) { *added = make_range(touched_min, start + text_size); }
+
+    int kept = 0;
+    for (int i = 0; i < dirty->count; ++i) {
+        Range range = dirty->items[i];
+        if (range.end > cache->scanned_to) { range.end = cache->scanned_to; }
+        if (range.start >= range.end) { continue; }
+        if (kept > 0 && dirty->items[kept - 1].end >= range.start) {
+            if (range.end > dirty->items[kept - 1].end) {
+                dirty->items[kept - 1].end = range.end;
+            }
+        } else {
+            dirty->items[kept++] = range;
+        }
+    }
+    dirty->count = kept;
+    cache->buffer_size += delta;
+}
+
+// Collects the start offset of every match beginning in [min, max_start) and
+// splices them into the sorted array. The caller guarantees that the array
+// holds nothing in that range yet.
+static void vim_match_cache_scan(struct Application_Links* app,
+                                 Buffer_Summary* buffer, Vim_Match_Cache* cache,
+                                 const Vim_Search_Pattern* pattern,
+                                 int min, int max_start) {
+    int m = pattern->size;
+    if (min < 0) { min = 0; }
+    int max = max_start + m - 1;
+    if (max > buffer->size) { max = buffer->size; }
+    if (max - min < m) { return; }
+
+    Temp_Memory temp = begin_temp_memory(&global_part);
+    defer(end_temp_memory(temp));
+    int window_size = VIM_SEARCH_WINDOW;
+    if (window_size < 2*m) { window_size = 2*m; }
+    char* window = push_array(&global_part, char, window_size);
+    if (window == nullptr) { return; }
+
+    int insert_at = vim_lower_bound(cache->matches.items, cache->matches.count, min);
+    int advance = window_size - (m - 1);
+    for (int start = min; start + m <= max; start += advance) {
+        int end = start + window_size;
+        if (end > max) { end = max; }
+        buffer_read_range(app, buffer, start, end, window);
+        int offset = 0;
+        for (;;) {
+            int found = vim_search_text_forward(pattern, window + offset,
+                                                end - start - offset);
+            if (found < 0) { break; }
+            int at = start + offset + found;
+            // The overlap belongs to the next window.
+            if (at >= start + advance || at >= max_start) { break; }
+            int* slot = vim_array_insert(&cache->matches, insert_at, 1);
+            if (slot == nullptr) { return; }
+            *slot = at;
+            ++insert_at;
+            offset += found + 1;
+        }
+    }
+}
+
+// Brings the cache in line with pattern and the buffer: rescans the dirty
+// ranges left by edits, then extends the scanned prefix by up to budget
+// bytes. Returns whether the cache now covers the whole buffer.
+static bool vim_match_cache_update(struct Application_Links* app,
+                                   Buffer_Summary* buffer, Vim_Match_Cache* cache,
+                                   String pattern_text, int budget) {
+    if (pattern_text.size == 0) { return false; }
+    if (cache->pattern_size != pattern_text.size ||
+        memcmp(cache->pattern, pattern_text.str, pattern_text.size) != 0 ||
+        cache->buffer_size != buffer->size) {
+        vim_match_cache_reset(cache, pattern_text, buffer->size);
+    }
+
+    Vim_Search_Pattern pattern;
+    vim_search_pattern_init(&pattern, make_string(cache->pattern,
+                                                  cache->pattern_size));
+    for (int i = 0; i < cache->dirty.count; ++i) {
+        Range range = cache->dirty.items[i];
+        vim_match_cache_scan(app, buffer, cache, &pattern, range.start, range.end);
+    }
+    cache->dirty.count = 0;
+
+    if (cache->scanned_to < buffer->size) {
+        int scan_end = cache->scanned_to + budget;
+        if (scan_end > buffer->size || scan_end < 0) { scan_end = buffer->size; }
+        vim_match_cache_scan(app, buffer, cache, &pattern, cache->scanned_to,
+                             scan_end);
+        cache->scanned_to = scan_end;
+    }
+    return vim_match_cache_is_complete(cache);
+}
+
+// Index of the match after (or before) pos, wrapping around. The cache must
+// be complete. Returns -1 if there are no matches.
+static int vim_match_cache_find(Vim_Match_Cache* cache, int pos,
+                                Search_Direction direction) {
+    int count = cache->matches.count;
+    if (count == 0) { return -1; }
+    if (direction == search_forward) {
+        int index = vim_lower_bound(cache->matches.items, count, pos + 1);
+        return index < count ? index : 0;
+    } else {
+        int index = vim_lower_bound(cache->matches.items, count, pos) - 1;
+        return index >= 0 ? index : count - 1;
+    }
+}
+
+static int vim_match_cache_memory(Vim_Match_Cache* cache) {
+    return cache->matches.capacity*(int)sizeof(int) +
+           cache->dirty.capacity*(int)sizeof(Range);
+}
+
+//=============================================================================
+// Incremental search
+// While a / or ? pattern is typed, each keystroke only has to look onward
+// from the previous match: every match of the longer pattern is also a match
+// of the shorter one, so nothing before it can qualify. The scan for a single
+// keystroke is capped to keep typing under a frame on huge buffers. A capped
+// miss is reported as unknown and settled by the full search on Enter.
+//=============================================================================
+
+// Bytes scanned per keystroke at most (roughly 10ms of SSE2 scanning).
+constexpr int VIM_INCSEARCH_BUDGET = 64 << 20;
+
+enum {
+    vim_incsearch_none = -1,
+    vim_incsearch_unknown = -2,
+};
+
+// Searches match starts in [first, last] of the buffer, spending at most
+// *budget start positions. Returns the match, vim_incsearch_none, or
+// vim_incsearch_unknown if the budget ran out first.
+static int vim_search_start_range(struct Application_Links* app,
+                                  Buffer_Summary* buffer,
+                                  const Vim_Search_Pattern* pattern,
+                                  int first, int last,
+                                  Search_Direction direction, int* budget) {
+    if (first > last) { return vim_incsearch_none; }
+    bool exhausted = false;
+    if (last - first + 1 > *budget) {
+        exhausted = true;
+        if (direction == search_forward) {
+            last = first + *budget - 1;
+        } else {
+            first = last - *budget + 1;
+        }
+    }
+    *budget -= last - first + 1;
+    int found = vim_search_buffer_range(app, buffer, pattern, first,
+                                        last + pattern->size, direction);
+    if (found >= 0) { return found; }
+    return exhausted ? vim_incsearch_unknown : vim_incsearch_none;
+}
+
+// Finds the first match a search from origin would reach, given that nothing
+// is to be found before from in that visiting order (from is inclusive).
+static int vim_search_incremental(struct Application_Links* app,
+                                  Buffer_Summary* buffer,
+                                  const Vim_Search_Pattern* pattern,
+                                  int origin, int from,
+                                  Search_Direction direction) {
+    int budget = VIM_INCSEARCH_BUDGET;
+    int last = buffer->size - 1;
+    int found = vim_incsearch_none;
+    if (direction == search_forward) {
+        // Visiting order: origin + 1 ... end, then 0 ... origin.
+        if (from > origin) {
+            found = vim_search_start_range(app, buffer, pattern, from, last,
+                                           direction, &budget);
+            from = 0;
+        }
+        if (found == vim_incsearch_none) {
+            found = vim_search_start_range(app, buffer, pattern, from, origin,
+                                           direction, &budget);
+        }
+    } else {
+        // Visiting order: origin - 1 ... 0, then end ... origin.
+        if (from < origin) {
+            found = vim_search_start_range(app, buffer, pattern, 0, from,
+                                           direction, &budget);
+            from = last;
+        }
+        if (found == vim_incsearch_none) {
+            found = vim_search_start_range(app, buffer, pattern, origin, from,
+                                           direction, &budget);
+        }
+    }
+    return found;
+}
+
+//=============================================================================
+// Keyword scanner
+// Finds every occurrence of a small set of keywords (TODO, NOTE, ...) in one
+// pass. The keywords form an Aho-Corasick automaton with a full 256-way
+// transition table, so each byte costs one lookup however many keywords
+// there are. While the automaton sits at its root, text is skipped 16 bytes
+// at a time unless some byte falls in the range of keyword first bytes.
+// Keywords are ASCII words, so ordinary lowercase code skips at SIMD speed.
+//=============================================================================
+
+constexpr int VIM_KEYWORD_MAX = 64;
+constexpr int VIM_KEYWORD_MAX_SIZE = 32;
+
+struct Vim_Keyword_Set {
+    char words[VIM_KEYWORD_MAX][VIM_KEYWORD_MAX_SIZE];
+    int sizes[VIM_KEYWORD_MAX];
+    int count;
+
+    // Automaton, rebuilt lazily after the keyword list changes.
+    bool built;
+    Vim_Array<int> next;    // state*256 + byte -> state
+    Vim_Array<int> output;  // state -> longest keyword ending here, or -1
+    uint8_t first_min;
+    uint8_t first_max;
+};
+
+struct Vim_Keyword_Hit {
+    int start;
+    int end;
+    int keyword;
+};
+
+// Adds a keyword (or replaces nothing if it is already there). Returns its
+// index, or -1 if the set is full or the word is unusable.
+static int vim_keyword_set_add(Vim_Keyword_Set* set, String word) {
+    if (word.size <= 0 || word.size > VIM_KEYWORD_MAX_SIZE) { return -1; }
+    for (int i = 0; i < set->count; ++i) {
+        if (set->sizes[i] == word.size &&
+            memcmp(set->words[i], word.str, word.size) == 0) {
+            return i;
+        }
+    }
+    if (set->count >= VIM_KEYWORD_MAX) { return -1; }
+    int index = set->count++;
+    memcpy(set->words[index], word.str, word.size);
+    set->sizes[index] = word.size;
+    set->built = false;
+    return index;
+}
+
+static void vim_keyword_set_free(Vim_Keyword_Set* set) {
+    vim_array_free(&set->next);
+    vim_array_free(&set->output);
+    set->built = false;
+}
+
+static void vim_keyword_set_build(Vim_Keyword_Set* set) {
+    set->next.count = 0;
+    set->output.count = 0;
+    Vim_Array<int> fail = {};
+    int* root = vim_array_insert(&set->next, 0, 256);
+    for (int c = 0; c < 256; ++c) { root[c] = -1; }
+    vim_array_push(&set->output, -1);
+    vim_array_push(&fail, 0);
+    set->first_min = 255;
+    set->first_max = 0;
+
+    // Trie.
+    for (int k = 0; k < set->count; ++k) {
+        int state = 0;
+        uint8_t first = (uint8_t)set->words[k][0];
+        if (first < set->first_min) { set->first_min = first; }
+        if (first > set->first_max) { set->first_max = first; }
+        for (int i = 0; i < set->sizes[k]; ++i) {
+            uint8_t c = (uint8_t)set->words[k][i];
+            if (set->next.items[state*256 + c] < 0) {
+                int added = set->output.count;
+                int* row = vim_array_insert(&set->next, set->next.count, 256);
+                for (int j = 0; j < 256; ++j) { row[j] = -1; }
+                vim_array_push(&set->output, -1);
+                vim_array_push(&fail, 0);
+                set->next.items[state*256 + c] = added;
+            }
+            state = set->next.items[state*256 + c];
+        }
+        int current = set->output.items[state];
+        if (current < 0 || set->sizes[current] < set->sizes[k]) {
+            set->output.items[state] = k;
+        }
+    }
+
+    // Breadth-first: fill in failure transitions so every state has all 256
+    // edges, and inherit the longest output along the failure chain.
+    Vim_Array<int> queue = {};
+    for (int c = 0; c < 256; ++c) {
+        int child = set->next.items[c];
+        if (child < 0) {
+            set->next.items[c] = 0;
+        } else {
+            fail.items[child] = 0;
+            vim_array_push(&queue, child);
+        }
+    }
+    for (int head = 0; head < queue.count; ++head) {
+        int state = queue.items[head];
+        int fallback = fail.items[state];
+        if (set->output.items[state] < 0) {
+            set->output.items[state] = set->output.items[fallback];
+        }
+        for (int c = 0; c < 256; ++c) {
+            int child = set->next.items[state*256 + c];
+            int via_fail = set->next.items[fallback*256 + c];
+            if (child < 0) {
+                set->next.items[state*256 + c] = via_fail;
+            } else {
+                fail.items[child] = via_fail;
+                vim_array_push(&queue, child);
+            }
+        }
+    }
+    vim_array_free(&queue);
+    vim_array_free(&fail);
+    set->built = true;
+}
+
+// Appends every keyword occurrence in text to hits, offset by base. Hits do
+// not overlap; scanning resumes after each one.
+static void vim_keyword_scan(Vim_Keyword_Set* set, const char* text, int size,
+                             int base, Vim_Array<Vim_Keyword_Hit>* hits) {
+    if (set->count == 0) { return; }
+    if (!set->built) { vim_keyword_set_build(set); }
+    const int* next = set->next.items;
+    const int* output = set->output.items;
+    int state = 0;
+    int i = 0;
+#if VIM_SSE2
+    const __m128i low = _mm_set1_epi8((char)set->first_min);
+    const __m128i span = _mm_set1_epi8((char)(set->first_max - set->first_min));
+#endif
+    while (i < size) {
+        if (state == 0) {
+#if VIM_SSE2
+            // Skip blocks without a possible keyword start: a byte can only
+            // start one if (byte - first_min) <= (first_max - first_min).
+            while (i + 16 <= size) {
+                __m128i block = _mm_loadu_si128((const __m128i*)(text + i));
+                __m128i offset = _mm_sub_epi8(block, low);
+                __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset);
+                uint32_t mask = (uint32_t)_mm_movemask_epi8(in_range);
+                if (mask) {
+                    i += vim_lowest_bit(mask);
+                    break;
+                }
+                i += 16;
+            }
+            if (i >= size) { break; }
+#else
+            while (i < size && (uint8_t)((uint8_t)text[i] - set->first_min) >
+                               (uint8_t)(set->first_max - set->first_min)) {
+                ++i;
+            }
+            if (i >= size) { break; }
+#endif
+        }
+        state = next[state*256 + (uint8_t)text[i]];
+        ++i;
+        int keyword = output[state];
+        if (keyword >= 0) {
+            Vim_Keyword_Hit hit;
+            hit.start = base + i - set->sizes[keyword];
+            hit.end = base + i;
+            hit.keyword = keyword;
+            vim_array_push(hits, hit);
+            state = 0;
+        }
+    }
+}